@@ -9,11 +9,13 @@
 #define FUSE_USE_VERSION 26
 #include <fuse/fuse_lowlevel.h>
 
+#include <cstdlib>
 #include <iostream>
 #include <string>
 #include <unistd.h>
 
 #include "./consts.h"
+#include "block/stats_manager.h"
 #include "filesystem/directory_op.h"
 
 #include "argparse/argparse.hpp"
@@ -433,7 +435,9 @@ void chfs_statfs(fuse_req_t req, fuse_ino_t ino) { UNIMPLEMENTED(); }
  */
 // this is a no-op in BBFS.  It just logs the call and returns success
 void chfs_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
-  UNIMPLEMENTED();
+  // writes reach the block manager before chfs_write replies,
+  // so nothing is buffered per file descriptor
+  fuse_reply_err(req, 0);
 }
 
 /** Release an open file
@@ -463,7 +467,21 @@ void chfs_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
  */
 void chfs_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
                 struct fuse_file_info *fi) {
-  UNIMPLEMENTED();
+  FileOperation *fs = reinterpret_cast<FileOperation *>(fuse_req_userdata(req));
+
+  // the metadata locating the data is always synced, so datasync is ignored
+  auto res = fs->sync_file(ino);
+  if (res.is_err()) {
+    switch (res.unwrap_error()) {
+    case ErrorType::INVALID_ARG:
+      fuse_reply_err(req, ENOENT);
+      break;
+    default:
+      fuse_reply_err(req, EIO);
+    }
+    return;
+  }
+  fuse_reply_err(req, 0);
 }
 
 /** Open directory
@@ -549,8 +567,15 @@ auto bootstrap_fuse(int argc, char **argv) -> int {
   }
 
   // 2. prepare the filesystem handler
-  auto bm = std::shared_ptr<BlockManager>(
-      new BlockManager(kDiskSize / KBlockSize, KBlockSize));
+  auto bm = std::shared_ptr<BlockManager>(new BlockManager(
+      kDiskSize / KBlockSize, KBlockSize, HugePageMode::Transparent));
+  // counting the block I/O disables the direct mapping of the blocks,
+  // so it is only enabled on request
+  std::shared_ptr<StatsBlockManager> stats_bm = nullptr;
+  if (getenv("CHFS_BLOCK_STATS") != nullptr) {
+    stats_bm = std::make_shared<StatsBlockManager>(bm);
+    bm = stats_bm;
+  }
   auto fs = new FileOperation(bm, KMaxInodeNum);
   {
     // pre-initialize
@@ -575,6 +600,19 @@ auto bootstrap_fuse(int argc, char **argv) -> int {
   fuse_session_destroy(se);
   fuse_unmount(argv[1], ch);
 
+  // the block I/O of the whole mount
+  if (stats_bm != nullptr) {
+    auto stats = stats_bm->get_stats();
+    for (usize op = 0; op < KBlockOpCnt; ++op) {
+      const auto &op_stats = stats.ops[op];
+      std::cerr << block_op_name(static_cast<BlockOp>(op)) << ": "
+                << op_stats.calls << " calls, " << op_stats.blocks
+                << " blocks, " << op_stats.bytes << " bytes, mean "
+                << op_stats.mean_ns() << " ns, p99 < "
+                << op_stats.percentile_ns(99) << " ns" << std::endl;
+    }
+  }
+
   delete fs;
   return err;
 }
@@ -656,9 +694,9 @@ auto main(int argc, char **argv) -> int {
   fuseserver_oper.write = chfs_write;
   fuseserver_oper.setattr = chfs_setattr;
   fuseserver_oper.statfs = chfs_statfs;
-  // fuseserver_oper.flush = chfs_flush;
+  fuseserver_oper.flush = chfs_flush;
   // fuseserver_oper.release = chfs_release;
-  // fuseserver_oper.fsync = chfs_fsync;
+  fuseserver_oper.fsync = chfs_fsync;
   // fuseserver_oper.opendir = chfs_opendir;
   // fuseserver_oper.releasedir = chfs_releasedir;
   // fuseserver_oper.fsyncdir = chfs_fsyncdir;
@@ -7,180 +7,519 @@ namespace chfs
   BlockAllocator::BlockAllocator(std::shared_ptr<BlockManager> block_manager)
       : BlockAllocator(std::move(block_manager), 0, true) {}
 
-  // Your implementation
   BlockAllocator::BlockAllocator(std::shared_ptr<BlockManager> block_manager,
-                                 usize bitmap_block_id, bool will_initialize)
-      : bm(std::move(block_manager)), bitmap_block_id(bitmap_block_id)
+                                 usize bitmap_block_id, usize block_cnt,
+                                 std::vector<BitmapExtent> grown_extents)
+      : bm(std::move(block_manager)), bitmap_block_id(bitmap_block_id),
+        block_cnt(block_cnt), grown_extents(std::move(grown_extents))
+  {
+    this->locate_bitmap_blocks();
+    this->load_bitmap().unwrap();
+  }
+
+  auto BlockAllocator::locate_bitmap_blocks() -> void
   {
+    CHFS_VERIFY(this->block_cnt <= this->bm->total_blocks(),
+                "The bitmap covers more blocks than the manager");
+    this->update_bounds();
+
+    usize grown_cnt = 0;
+    for (const auto &extent : this->grown_extents)
+    {
+      grown_cnt += extent.cnt;
+    }
+    CHFS_VERIFY(grown_cnt < this->bitmap_block_cnt, "Need blocks in the manager!");
+
     // calculate the total blocks required
-    const auto total_bits_per_block = this->bm->block_size() * KBitsPerByte;
-    auto total_bitmap_block = this->bm->total_blocks() / total_bits_per_block;
-    if (this->bm->total_blocks() % total_bits_per_block != 0)
+    const auto initial_cnt = this->bitmap_block_cnt - grown_cnt;
+    CHFS_VERIFY(initial_cnt + this->bitmap_block_id <= this->block_cnt,
+                "not available blocks to store the bitmap");
+
+    for (usize i = 0; i < initial_cnt; ++i)
     {
-      total_bitmap_block += 1;
+      this->bitmap_blocks.push_back(this->bitmap_block_id + i);
+    }
+    for (const auto &extent : this->grown_extents)
+    {
+      for (usize i = 0; i < extent.cnt; ++i)
+      {
+        this->bitmap_blocks.push_back(extent.start + i);
+      }
+    }
+  }
+
+  auto BlockAllocator::bits_per_block() const -> usize
+  {
+    return this->bm->block_size() * KBitsPerByte;
+  }
+
+  static const usize KBitsPerWord = KBytesPerWord * KBitsPerByte;
+
+  auto BlockAllocator::free_bits_of(usize word) const -> u64
+  {
+    u64 bits;
+    memcpy(&bits, this->bitmap.data() + word * KBytesPerWord, KBytesPerWord);
+
+    auto free = ~bits;
+    const auto first = static_cast<u64>(word) * KBitsPerWord;
+    if (first + KBitsPerWord > this->block_cnt)
+    {
+      // the last word is partially valid
+      free &= (u64(1) << (this->block_cnt - first)) - 1;
+    }
+    return free;
+  }
+
+  auto BlockAllocator::load_bitmap() -> ChfsNullResult
+  {
+    this->bitmap.resize(this->bitmap_block_cnt * this->bm->block_size());
+    auto res = this->bm->read_blocks(this->bitmap_blocks, this->bitmap.data());
+    if (res.is_err())
+    {
+      return res;
+    }
+    this->dirty_blocks.clear();
+    this->pending_updates = 0;
+    this->rebuild_summary();
+    return KNullOk;
+  }
+
+  auto BlockAllocator::rebuild_summary() -> void
+  {
+    const auto word_cnt = (this->block_cnt + KBitsPerWord - 1) / KBitsPerWord;
+
+    this->summary.clear();
+    this->summary.emplace_back((word_cnt + KBitsPerWord - 1) / KBitsPerWord);
+    for (usize w = 0; w < word_cnt; ++w)
+    {
+      if (this->free_bits_of(w) != 0)
+      {
+        this->summary[0][w / KBitsPerWord] |= u64(1) << (w % KBitsPerWord);
+      }
+    }
+
+    // each level summarizes the words of the one below
+    while (this->summary.back().size() > 1)
+    {
+      const auto &below = this->summary.back();
+      std::vector<u64> level((below.size() + KBitsPerWord - 1) / KBitsPerWord);
+      for (usize w = 0; w < below.size(); ++w)
+      {
+        if (below[w] != 0)
+        {
+          level[w / KBitsPerWord] |= u64(1) << (w % KBitsPerWord);
+        }
+      }
+      this->summary.push_back(std::move(level));
     }
+  }
 
+  auto BlockAllocator::update_summary(usize word, bool has_free) -> void
+  {
+    auto idx = word;
+    for (auto &level : this->summary)
+    {
+      auto &bits = level[idx / KBitsPerWord];
+      const auto mask = u64(1) << (idx % KBitsPerWord);
+      if (has_free)
+      {
+        // the levels above already know if the bit was set
+        if ((bits & mask) != 0)
+        {
+          return;
+        }
+        bits |= mask;
+      }
+      else
+      {
+        bits &= ~mask;
+        // the word still has free bits for the levels above
+        if (bits != 0)
+        {
+          return;
+        }
+      }
+      idx /= KBitsPerWord;
+    }
+  }
+
+  auto BlockAllocator::find_free_word() const -> std::optional<usize>
+  {
+    const auto &top = this->summary.back();
+    if (top[0] == 0)
+    {
+      return std::nullopt;
+    }
+
+    // a set bit always leads to a word with a set bit one level down
+    usize idx = __builtin_ctzll(top[0]);
+    for (usize k = this->summary.size() - 1; k > 0; --k)
+    {
+      idx = idx * KBitsPerWord + __builtin_ctzll(this->summary[k - 1][idx]);
+    }
+    return idx;
+  }
+
+  auto BlockAllocator::find_free_word_from(usize word) const
+      -> std::optional<usize>
+  {
+    // climb until a level has a set bit at or after the position, then take
+    // the lowest set bits down to the bitmap word
+    auto idx = word;
+    for (usize k = 0; k < this->summary.size(); ++k)
+    {
+      const auto &level = this->summary[k];
+      if (idx / KBitsPerWord >= level.size())
+      {
+        break;
+      }
+      auto bits = level[idx / KBitsPerWord] & (~u64(0) << (idx % KBitsPerWord));
+      if (bits != 0)
+      {
+        idx = idx / KBitsPerWord * KBitsPerWord + __builtin_ctzll(bits);
+        for (; k > 0; --k)
+        {
+          idx = idx * KBitsPerWord + __builtin_ctzll(this->summary[k - 1][idx]);
+        }
+        return idx;
+      }
+      idx = idx / KBitsPerWord + 1;
+    }
+    return this->find_free_word();
+  }
+
+  auto BlockAllocator::update_bounds() -> void
+  {
+    const auto total_bits_per_block = this->bits_per_block();
+    auto total_bitmap_block = this->block_cnt / total_bits_per_block;
+    if (this->block_cnt % total_bits_per_block != 0)
+    {
+      total_bitmap_block += 1;
+    }
     CHFS_VERIFY(total_bitmap_block > 0, "Need blocks in the manager!");
-    CHFS_VERIFY(total_bitmap_block + this->bitmap_block_id <= bm->total_blocks(),
-                "not available blocks to store the bitmap");
 
     this->bitmap_block_cnt = total_bitmap_block;
-    if (this->bitmap_block_cnt * total_bits_per_block ==
-        this->bm->total_blocks())
+    if (this->bitmap_block_cnt * total_bits_per_block == this->block_cnt)
     {
       this->last_block_num = total_bits_per_block;
     }
     else
     {
-      this->last_block_num = this->bm->total_blocks() % total_bits_per_block;
+      this->last_block_num = this->block_cnt % total_bits_per_block;
     }
     CHFS_VERIFY(this->last_block_num <= total_bits_per_block,
                 "last block num should be less than total bits per block");
+  }
 
+  // Your implementation
+  BlockAllocator::BlockAllocator(std::shared_ptr<BlockManager> block_manager,
+                                 usize bitmap_block_id, bool will_initialize)
+      : bm(block_manager), bitmap_block_id(bitmap_block_id),
+        block_cnt(block_manager->total_blocks())
+  {
+    this->locate_bitmap_blocks();
     if (!will_initialize)
     {
+      this->load_bitmap().unwrap();
       return;
     }
 
-    // zeroing
-    for (block_id_t i = 0; i < this->bitmap_block_cnt; i++)
+    // the bitmap on the device is overwritten, so it is not read first.
+    // The blocks before the bitmap and the bitmap itself are in use.
+    this->bitmap.assign(this->bitmap_block_cnt * this->bm->block_size(), 0);
+    auto bitmap = Bitmap(this->bitmap.data(), this->bitmap.size());
+    for (block_id_t i = 0; i < this->bitmap_block_cnt + this->bitmap_block_id;
+         i++)
     {
-      this->bm->zero_block(i + this->bitmap_block_id);
+      bitmap.set(i);
     }
 
-    block_id_t cur_block_id = this->bitmap_block_id;
-    std::vector<u8> buffer(bm->block_size());
-    auto bitmap = Bitmap(buffer.data(), bm->block_size());
-    bitmap.zeroed();
+    // all the bitmap blocks are written at once
+    for (usize i = 0; i < this->bitmap_block_cnt; ++i)
+    {
+      this->dirty_blocks.insert(i);
+    }
+    this->flush().unwrap();
+    this->rebuild_summary();
+  }
 
-    // set the blocks of the bitmap block to 1
-    for (block_id_t i = 0; i < this->bitmap_block_cnt + this->bitmap_block_id;
-         i++)
+  BlockAllocator::~BlockAllocator()
+  {
+    // there is no one to report to, a lost flush leaves the bitmap on the
+    // device as of the last successful one
+    [[maybe_unused]] auto res = this->flush();
+    // the freed blocks stay allocated on the host, which is harmless
+    [[maybe_unused]] auto discard_res = this->flush_discards();
+  }
+
+  auto BlockAllocator::set_flush_batch(usize batch) -> ChfsNullResult
+  {
+    this->flush_batch = batch;
+    if (batch > 0 && this->pending_updates >= batch)
     {
-      // + bitmap_block_id is necessary, since the bitmap block starts with an
-      // offset
-      auto block_id = i / total_bits_per_block + this->bitmap_block_id;
-      auto block_idx = i % total_bits_per_block;
+      return this->flush();
+    }
+    return KNullOk;
+  }
 
-      if (block_id != cur_block_id)
+  auto BlockAllocator::flush() -> ChfsNullResult
+  {
+    // runs of consecutive dirty blocks are contiguous in memory, each run is
+    // written as a batch
+    for (auto it = this->dirty_blocks.begin(); it != this->dirty_blocks.end();)
+    {
+      const auto first = *it;
+      std::vector<block_id_t> block_ids;
+      for (; it != this->dirty_blocks.end() && *it == first + block_ids.size();
+           ++it)
       {
-        bm->write_block(cur_block_id, buffer.data());
+        block_ids.push_back(this->bitmap_blocks[*it]);
+      }
 
-        cur_block_id = block_id;
-        bitmap.zeroed();
+      auto res = this->bm->write_blocks(
+          block_ids, this->bitmap.data() + first * this->bm->block_size());
+      if (res.is_err())
+      {
+        // the blocks from this run on stay dirty
+        this->dirty_blocks.erase(this->dirty_blocks.begin(),
+                                 this->dirty_blocks.find(first));
+        return res;
       }
+    }
+    this->dirty_blocks.clear();
+    this->pending_updates = 0;
+    return KNullOk;
+  }
 
-      bitmap.set(block_idx);
+  auto BlockAllocator::mark_dirty(block_id_t block_id) -> ChfsNullResult
+  {
+    this->dirty_blocks.insert(block_id / this->bits_per_block());
+    this->pending_updates += 1;
+    if (this->flush_batch > 0 && this->pending_updates >= this->flush_batch)
+    {
+      return this->flush();
     }
+    return KNullOk;
+  }
 
-    bm->write_block(cur_block_id, buffer.data());
+  auto BlockAllocator::set_discard_batch(usize batch) -> ChfsNullResult
+  {
+    this->discard_batch = batch;
+    if (this->pending_discards.size() >= batch)
+    {
+      return this->flush_discards();
+    }
+    return KNullOk;
   }
 
-  // Fixme: currently we don't consider errors in this implementation
-  auto BlockAllocator::free_block_cnt() const -> usize
+  auto BlockAllocator::flush_discards() -> ChfsNullResult
   {
-    usize total_free_blocks = 0;
-    std::vector<u8> buffer(bm->block_size());
+    if (this->pending_discards.empty())
+    {
+      return KNullOk;
+    }
+
+    std::vector<block_id_t> block_ids(this->pending_discards.begin(),
+                                      this->pending_discards.end());
+    this->pending_discards.clear();
+    return this->bm->discard_blocks(block_ids);
+  }
+
+  auto BlockAllocator::grow(usize new_block_cnt) -> ChfsResult<BitmapExtent>
+  {
+    if (new_block_cnt < this->block_cnt ||
+        new_block_cnt > this->bm->total_blocks())
+    {
+      return ChfsResult<BitmapExtent>(ErrorType::INVALID_ARG);
+    }
+
+    const auto old_block_cnt = this->block_cnt;
+    const auto old_bitmap_cnt = this->bitmap_block_cnt;
+    this->block_cnt = new_block_cnt;
+    this->update_bounds();
+
+    // 1. put the extra bitmap blocks at the start of the new region
+    BitmapExtent extent = {old_block_cnt, this->bitmap_block_cnt - old_bitmap_cnt};
+    if (extent.cnt > new_block_cnt - old_block_cnt)
+    {
+      // the new region cannot hold its own bitmap
+      this->block_cnt = old_block_cnt;
+      this->update_bounds();
+      return ChfsResult<BitmapExtent>(ErrorType::INVALID_ARG);
+    }
+    for (usize i = 0; i < extent.cnt; ++i)
+    {
+      this->bitmap_blocks.push_back(extent.start + i);
+    }
+    if (extent.cnt > 0)
+    {
+      this->grown_extents.push_back(extent);
+    }
 
-    for (block_id_t i = 0; i < this->bitmap_block_cnt; i++)
+    // 2. the bitmap blocks themselves are in use
+    this->bitmap.resize(this->bitmap_block_cnt * this->bm->block_size(), 0);
+    auto bitmap = Bitmap(this->bitmap.data(), this->bitmap.size());
+    for (usize i = 0; i < extent.cnt; ++i)
     {
-      bm->read_block(i + this->bitmap_block_id, buffer.data()).unwrap();
+      bitmap.set(extent.start + i);
+      this->dirty_blocks.insert((extent.start + i) / this->bits_per_block());
+    }
 
-      usize n_free_blocks = 0;
-      if (i == this->bitmap_block_cnt - 1)
+    // 3. the new bitmap blocks are written as a whole
+    for (auto i = old_bitmap_cnt; i < this->bitmap_block_cnt; ++i)
+    {
+      this->dirty_blocks.insert(i);
+    }
+    auto res = this->flush();
+    if (res.is_err())
+    {
+      // back to the old size. The extent may start in the last old bitmap
+      // block, whose bits are cleared and written again on the next flush.
+      for (usize i = 0; i < extent.cnt; ++i)
       {
-        // last one
-        // std::cerr <<"last block num: " << this->last_block_num << std::endl;
-        n_free_blocks = Bitmap(buffer.data(), bm->block_size())
-                            .count_zeros_to_bound(this->last_block_num);
+        bitmap.clear(extent.start + i);
+        const auto index = (extent.start + i) / this->bits_per_block();
+        if (index < old_bitmap_cnt)
+        {
+          this->dirty_blocks.insert(index);
+        }
       }
-      else
+      this->dirty_blocks.erase(this->dirty_blocks.lower_bound(old_bitmap_cnt),
+                               this->dirty_blocks.end());
+      if (extent.cnt > 0)
       {
-        n_free_blocks = Bitmap(buffer.data(), bm->block_size()).count_zeros();
+        this->grown_extents.pop_back();
       }
-      // std::cerr << "check free block: " << i << " : " << n_free_blocks
-      //           << std::endl;
-      total_free_blocks += n_free_blocks;
+      this->bitmap_blocks.resize(old_bitmap_cnt);
+      this->bitmap.resize(old_bitmap_cnt * this->bm->block_size());
+      this->block_cnt = old_block_cnt;
+      this->update_bounds();
+      this->rebuild_summary();
+      return ChfsResult<BitmapExtent>(res.unwrap_error());
     }
-    return total_free_blocks;
+    this->rebuild_summary();
+    return ChfsResult<BitmapExtent>(extent);
+  }
+
+  auto BlockAllocator::grow_bitmap_block_cnt(usize new_block_cnt) const
+      -> usize
+  {
+    if (new_block_cnt <= this->block_cnt)
+    {
+      return 0;
+    }
+    const auto total_bits_per_block = this->bits_per_block();
+    const usize needed =
+        (new_block_cnt + total_bits_per_block - 1) / total_bits_per_block;
+    return needed - this->bitmap_block_cnt;
+  }
+
+  auto BlockAllocator::free_block_cnt() const -> usize
+  {
+    // the bit of a block is at its id in the resident bitmap
+    auto bitmap = Bitmap(const_cast<u8 *>(this->bitmap.data()),
+                         this->bitmap.size());
+    return bitmap.count_zeros_to_bound(this->block_cnt);
   }
 
   // Your implementation
   auto BlockAllocator::allocate() -> ChfsResult<block_id_t>
   {
-    std::vector<u8> buffer(bm->block_size());
+    return this->allocate_from(0);
+  }
 
-    for (uint i = 0; i < this->bitmap_block_cnt; i++)
-    {
-      bm->read_block(i + this->bitmap_block_id, buffer.data());
+  auto BlockAllocator::allocate(std::optional<block_id_t> hint)
+      -> ChfsResult<block_id_t>
+  {
+    return this->allocate_from(hint.value_or(this->next_fit_cursor));
+  }
 
-      // The index of the allocated bit inside current bitmap block.
-      std::optional<block_id_t> res = std::nullopt;
+  auto BlockAllocator::allocate_from(block_id_t goal) -> ChfsResult<block_id_t>
+  {
+    if (goal >= this->block_cnt)
+    {
+      goal = 0;
+    }
 
-      if (i == this->bitmap_block_cnt - 1)
+    while (true)
+    {
+      // the summary leads to a word with a free bit in a constant number of
+      // steps, however full the bitmap is
+      auto word_res = this->find_free_word_from(goal / KBitsPerWord);
+      if (!word_res.has_value())
       {
-        // If current block is the last block of the bitmap.
-        // std::cout << "bitmap last_block_numer:" << last_block_num << std::endl;
-        Bitmap originBitmap(buffer.data(), this->last_block_num / KBitsPerByte);
-        res = originBitmap.find_first_free();
-        // TODO: Find the first free bit of current bitmap block
-        // and store it in `res`.
-        // UNIMPLEMENTED();
+        return ChfsResult<block_id_t>(ErrorType::OUT_OF_RESOURCE);
       }
-      else
+      const auto word = word_res.value();
+      const auto free = this->free_bits_of(word);
+      CHFS_ASSERT(free != 0, "The summary is out of sync with the bitmap");
+
+      auto candidates = free;
+      if (word == goal / KBitsPerWord)
       {
-        Bitmap originBitmap(buffer.data(), bm->block_size());
-        res = originBitmap.find_first_free();
-        // UNIMPLEMENTED();
+        // only the bits from the goal on
+        candidates &= ~u64(0) << (goal % KBitsPerWord);
+        if (candidates == 0)
+        {
+          // the free bits are before the goal, they are found after the
+          // search wraps around
+          goal = (word + 1) * KBitsPerWord;
+          goal = goal < this->block_cnt ? goal : 0;
+          continue;
+        }
       }
 
-      // If we find one free bit inside current bitmap block.
-      if (res.has_value())
+      // The block id of the allocated block.
+      const block_id_t retval = static_cast<block_id_t>(word) * KBitsPerWord +
+                                __builtin_ctzll(candidates);
+      CHFS_ASSERT(retval < this->block_cnt, "allocate fault");
+      Bitmap(this->bitmap.data(), this->bitmap.size()).set(retval);
+
+      // the word is full if the allocated bit was its last free one
+      this->update_summary(word, (free & (free - 1)) != 0);
+      this->next_fit_cursor = retval + 1;
+      // the block is in use again, it must not be discarded later
+      this->pending_discards.erase(retval);
+
+      // The bitmap block reaches the device with the next flush.
+      auto flush_res = this->mark_dirty(retval);
+      if (flush_res.is_err())
       {
-        // The block id of the allocated block.
-        block_id_t retval = static_cast<block_id_t>(0);
-
-        Bitmap modifiedBitmap(buffer.data(), i == this->bitmap_block_cnt - 1 ? this->last_block_num / KBitsPerByte : bm->block_size());
-        modifiedBitmap.set(res.value());
-
-        bm->write_block(i + this->bitmap_block_id, buffer.data());
-
-        const auto total_bits_per_block = static_cast<block_id_t>(this->bm->block_size() * KBitsPerByte);
-        retval = res.value() + i * total_bits_per_block;
-        // TODO:
-        // 1. Set the free bit we found to 1 in the bitmap.
-        // 2. Flush the changed bitmap block back to the block manager.
-        // 3. Calculate the value of `retval`.
-        // UNIMPLEMENTED();
-        // std::cout << "allocate: " << retval << std::endl;
-        CHFS_ASSERT(retval < this->bm->total_blocks(), "allocate fault");
-        return ChfsResult<block_id_t>(retval);
+        return ChfsResult<block_id_t>(flush_res.unwrap_error());
       }
+      return ChfsResult<block_id_t>(retval);
     }
-    return ChfsResult<block_id_t>(ErrorType::OUT_OF_RESOURCE);
   }
 
   // Your implementation
   auto BlockAllocator::deallocate(block_id_t block_id) -> ChfsNullResult
   {
-    if (block_id >= this->bm->total_blocks())
+    if (block_id >= this->block_cnt)
     {
       return ChfsNullResult(ErrorType::INVALID_ARG);
     }
 
-    std::vector<u8> buffer(bm->block_size());
-    const auto total_bits_per_block = static_cast<block_id_t>(this->bm->block_size() * KBitsPerByte);
-    const auto target_bitmap_block_id = block_id / total_bits_per_block;
-    const auto target_bitmap_index = block_id % total_bits_per_block;
-
-    bm->read_block(this->bitmap_block_id + target_bitmap_block_id, buffer.data());
-    Bitmap modifiedBitmap(buffer.data(), bm->block_size());
-
-    if (!modifiedBitmap.check(target_bitmap_index))
+    Bitmap modifiedBitmap(this->bitmap.data(), this->bitmap.size());
+    if (!modifiedBitmap.check(block_id))
       return ChfsNullResult(ErrorType::INVALID_ARG);
-    modifiedBitmap.clear(target_bitmap_index);
+    modifiedBitmap.clear(block_id);
+    this->update_summary(block_id / KBitsPerWord, true);
+
+    // The bitmap block reaches the device with the next flush.
+    auto flush_res = this->mark_dirty(block_id);
+    if (flush_res.is_err())
+    {
+      return flush_res;
+    }
 
-    bm->write_block(this->bitmap_block_id + target_bitmap_block_id, buffer.data());
+    if (this->discard_batch > 0)
+    {
+      this->pending_discards.insert(block_id);
+      if (this->pending_discards.size() >= this->discard_batch)
+      {
+        return this->flush_discards();
+      }
+    }
     // TODO: Implement this function.
     // 1. According to `block_id`, zero the bit in the bitmap.
     // 2. Flush the changed bitmap block back to the block manager.
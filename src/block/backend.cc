@@ -0,0 +1,80 @@
+#include <algorithm>
+
+#include "block/backend.h"
+#include "block/pread_manager.h"
+#include "block/uring_manager.h"
+
+namespace chfs
+{
+
+  auto create_block_manager(const std::string &file, usize block_cnt,
+                            BlockBackend backend, bool direct_io,
+                            usize block_size)
+      -> std::shared_ptr<BlockManager>
+  {
+    switch (backend)
+    {
+    case BlockBackend::Mmap:
+      return std::make_shared<BlockManager>(file, block_cnt, block_size);
+    case BlockBackend::Pread:
+      return std::make_shared<PreadBlockManager>(file, block_cnt, direct_io,
+                                                 block_size);
+    case BlockBackend::IoUring:
+    {
+      UringOptions options;
+      options.direct_io = direct_io;
+      return std::make_shared<UringBlockManager>(file, block_cnt, options,
+                                                 block_size);
+    }
+    }
+    CHFS_VERIFY(false, "Unknown block backend");
+    return nullptr;
+  }
+
+  auto open_devices(const std::vector<std::string> &files, usize block_cnt,
+                    BlockBackend backend)
+      -> std::vector<std::shared_ptr<BlockManager>>
+  {
+    std::vector<std::shared_ptr<BlockManager>> devices;
+    devices.reserve(files.size());
+    for (const auto &file : files)
+    {
+      devices.push_back(create_block_manager(file, block_cnt, backend));
+    }
+    return devices;
+  }
+
+  auto min_device_block_cnt(
+      const std::vector<std::shared_ptr<BlockManager>> &devices) -> usize
+  {
+    CHFS_VERIFY(!devices.empty(), "Need at least one device");
+
+    usize min_cnt = devices[0]->total_blocks();
+    for (const auto &device : devices)
+    {
+      CHFS_VERIFY(device->block_size() == devices[0]->block_size(),
+                  "The devices must share a block size");
+      min_cnt = std::min(min_cnt, device->total_blocks());
+    }
+    return min_cnt;
+  }
+
+  auto parse_block_backend(const std::string &name)
+      -> std::optional<BlockBackend>
+  {
+    if (name == "mmap")
+    {
+      return BlockBackend::Mmap;
+    }
+    if (name == "pread")
+    {
+      return BlockBackend::Pread;
+    }
+    if (name == "uring")
+    {
+      return BlockBackend::IoUring;
+    }
+    return std::nullopt;
+  }
+
+} // namespace chfs
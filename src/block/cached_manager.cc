@@ -0,0 +1,491 @@
+#include <algorithm>
+#include <cstring>
+
+#include "block/cached_manager.h"
+
+namespace chfs
+{
+
+  CachedBlockManager::CachedBlockManager(const std::string &file,
+                                         usize block_cnt,
+                                         usize cache_block_cnt,
+                                         WritebackOptions writeback,
+                                         usize block_size)
+      : BlockManager(file, block_cnt, block_size),
+        cache_block_cnt(cache_block_cnt),
+        writeback_options(writeback)
+  {
+    this->init_frames();
+  }
+
+  CachedBlockManager::CachedBlockManager(usize block_count, usize block_size,
+                                         usize cache_block_cnt,
+                                         WritebackOptions writeback)
+      : BlockManager(block_count, block_size),
+        cache_block_cnt(cache_block_cnt), writeback_options(writeback)
+  {
+    this->init_frames();
+  }
+
+  CachedBlockManager::~CachedBlockManager()
+  {
+    if (this->writeback_thread.joinable())
+    {
+      {
+        std::lock_guard<std::recursive_mutex> lock(this->mtx);
+        this->writeback_stop = true;
+      }
+      this->writeback_cv.notify_one();
+      this->writeback_thread.join();
+    }
+    auto res = this->flush();
+    CHFS_VERIFY(res.is_ok(), "Failed to flush the block cache");
+  }
+
+  auto CachedBlockManager::init_frames() -> void
+  {
+    CHFS_VERIFY(this->cache_block_cnt > 0, "The cache needs at least a block");
+    // a cache larger than the device is useless
+    this->cache_block_cnt = std::min(this->cache_block_cnt, this->block_cnt);
+
+    this->frame_data.resize(static_cast<u64>(this->cache_block_cnt) *
+                            this->block_sz);
+    this->frames.resize(this->cache_block_cnt);
+    this->frame_table.reserve(this->cache_block_cnt);
+
+    if (this->writeback_options.enabled)
+    {
+      this->writeback_thread = std::thread([this]()
+                                           { this->writeback_loop(); });
+    }
+  }
+
+  auto CachedBlockManager::write_back(usize idx) -> ChfsNullResult
+  {
+    auto &frame = this->frames[idx];
+    if (!frame.valid || !frame.dirty)
+    {
+      return KNullOk;
+    }
+
+    auto res = BlockManager::write_block(frame.block_id, this->frame_ptr(idx));
+    if (res.is_err())
+    {
+      return res;
+    }
+    frame.dirty = false;
+    this->dirty_cnt -= 1;
+    this->stats.writebacks += 1;
+    return KNullOk;
+  }
+
+  auto CachedBlockManager::mark_dirty(usize idx) -> void
+  {
+    auto &frame = this->frames[idx];
+    if (frame.dirty)
+    {
+      return;
+    }
+    frame.dirty = true;
+    frame.dirtied_at = std::chrono::steady_clock::now();
+    this->dirty_cnt += 1;
+
+    if (this->writeback_thread.joinable() &&
+        this->dirty_cnt * this->block_sz >
+            this->writeback_options.dirty_bytes_threshold)
+    {
+      this->writeback_cv.notify_one();
+    }
+  }
+
+  auto CachedBlockManager::writeback_loop() -> void
+  {
+    std::unique_lock<std::recursive_mutex> lock(this->mtx);
+    while (!this->writeback_stop)
+    {
+      this->writeback_cv.wait_for(
+          lock, this->writeback_options.interval, [this]()
+          { return this->writeback_stop ||
+                   this->dirty_cnt * this->block_sz >
+                       this->writeback_options.dirty_bytes_threshold; });
+      if (this->writeback_stop)
+      {
+        break;
+      }
+      this->writeback_once();
+    }
+  }
+
+  auto CachedBlockManager::writeback_once() -> void
+  {
+    auto all = this->dirty_cnt * this->block_sz >
+               this->writeback_options.dirty_bytes_threshold;
+    auto expire = std::chrono::steady_clock::now() -
+                  this->writeback_options.dirty_expire;
+
+    for (usize i = 0; i < this->cache_block_cnt && this->dirty_cnt > 0; ++i)
+    {
+      auto &frame = this->frames[i];
+      // a pinned frame may be modified through a view at the same time
+      if (!frame.valid || !frame.dirty || frame.pin_cnt > 0)
+      {
+        continue;
+      }
+      if (!all && frame.dirtied_at > expire)
+      {
+        continue;
+      }
+
+      auto res = this->write_back(i);
+      if (res.is_err())
+      {
+        if (this->writeback_error == ErrorType::DONE)
+        {
+          this->writeback_error = res.unwrap_error();
+        }
+        return;
+      }
+      this->stats.background_writebacks += 1;
+    }
+  }
+
+  auto CachedBlockManager::take_writeback_error() -> ChfsNullResult
+  {
+    auto error_code = this->writeback_error;
+    this->writeback_error = ErrorType::DONE;
+    if (error_code != ErrorType::DONE)
+    {
+      return ChfsNullResult(error_code);
+    }
+    return KNullOk;
+  }
+
+  auto CachedBlockManager::evict() -> ChfsResult<usize>
+  {
+    // At most two rounds: the first round clears the reference bits
+    for (usize i = 0; i < 2 * this->cache_block_cnt; ++i)
+    {
+      auto idx = this->clock_hand;
+      this->clock_hand = (this->clock_hand + 1) % this->cache_block_cnt;
+
+      auto &frame = this->frames[idx];
+      if (!frame.valid)
+      {
+        return ChfsResult<usize>(idx);
+      }
+      if (frame.pin_cnt > 0)
+      {
+        continue;
+      }
+      if (frame.referenced)
+      {
+        frame.referenced = false;
+        continue;
+      }
+
+      auto res = this->write_back(idx);
+      if (res.is_err())
+      {
+        return ChfsResult<usize>(res.unwrap_error());
+      }
+      this->frame_table.erase(frame.block_id);
+      frame.valid = false;
+      this->stats.evictions += 1;
+      return ChfsResult<usize>(idx);
+    }
+    return ChfsResult<usize>(ErrorType::OUT_OF_RESOURCE);
+  }
+
+  auto CachedBlockManager::lookup(block_id_t block_id, bool fill)
+      -> ChfsResult<usize>
+  {
+    if (block_id >= this->block_cnt)
+    {
+      return ChfsResult<usize>(ErrorType::INVALID_ARG);
+    }
+
+    auto it = this->frame_table.find(block_id);
+    if (it != this->frame_table.end())
+    {
+      this->stats.hits += 1;
+      this->frames[it->second].referenced = true;
+      return ChfsResult<usize>(it->second);
+    }
+    this->stats.misses += 1;
+
+    auto evict_res = this->evict();
+    if (evict_res.is_err())
+    {
+      return evict_res;
+    }
+    auto idx = evict_res.unwrap();
+
+    if (fill)
+    {
+      auto res = BlockManager::read_block(block_id, this->frame_ptr(idx));
+      if (res.is_err())
+      {
+        return ChfsResult<usize>(res.unwrap_error());
+      }
+    }
+
+    auto &frame = this->frames[idx];
+    frame.block_id = block_id;
+    frame.valid = true;
+    frame.dirty = false;
+    frame.referenced = true;
+    this->frame_table[block_id] = idx;
+    return ChfsResult<usize>(idx);
+  }
+
+  auto CachedBlockManager::write_block(block_id_t block_id, const u8 *data)
+      -> ChfsNullResult
+  {
+    std::lock_guard<std::recursive_mutex> lock(this->mtx);
+    // the whole block is overwritten, so there is no need to fill the frame
+    auto res = this->lookup(block_id, false);
+    if (res.is_err())
+    {
+      return ChfsNullResult(res.unwrap_error());
+    }
+    auto idx = res.unwrap();
+    memcpy(this->frame_ptr(idx), data, this->block_sz);
+    this->mark_dirty(idx);
+    return KNullOk;
+  }
+
+  auto CachedBlockManager::write_partial_block(block_id_t block_id,
+                                               const u8 *data, usize offset,
+                                               usize len) -> ChfsNullResult
+  {
+    std::lock_guard<std::recursive_mutex> lock(this->mtx);
+    if (offset + len > this->block_sz)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    auto res = this->lookup(block_id, true);
+    if (res.is_err())
+    {
+      return ChfsNullResult(res.unwrap_error());
+    }
+    auto idx = res.unwrap();
+    memcpy(this->frame_ptr(idx) + offset, data, len);
+    this->mark_dirty(idx);
+    return KNullOk;
+  }
+
+  auto CachedBlockManager::read_block(block_id_t block_id, u8 *data)
+      -> ChfsNullResult
+  {
+    std::lock_guard<std::recursive_mutex> lock(this->mtx);
+    auto res = this->lookup(block_id, true);
+    if (res.is_err())
+    {
+      return ChfsNullResult(res.unwrap_error());
+    }
+    memcpy(data, this->frame_ptr(res.unwrap()), this->block_sz);
+    return KNullOk;
+  }
+
+  auto CachedBlockManager::zero_block(block_id_t block_id) -> ChfsNullResult
+  {
+    std::lock_guard<std::recursive_mutex> lock(this->mtx);
+    auto res = this->lookup(block_id, false);
+    if (res.is_err())
+    {
+      return ChfsNullResult(res.unwrap_error());
+    }
+    auto idx = res.unwrap();
+    memset(this->frame_ptr(idx), 0, this->block_sz);
+    this->mark_dirty(idx);
+    return KNullOk;
+  }
+
+  auto CachedBlockManager::zero_blocks(block_id_t start, usize cnt)
+      -> ChfsNullResult
+  {
+    std::lock_guard<std::recursive_mutex> lock(this->mtx);
+    if (start > this->block_cnt || cnt > this->block_cnt - start)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    for (usize i = 0; i < cnt; ++i)
+    {
+      auto res = this->zero_block(start + i);
+      if (res.is_err())
+      {
+        return res;
+      }
+    }
+    return KNullOk;
+  }
+
+  auto CachedBlockManager::read_blocks(const std::vector<block_id_t> &block_ids,
+                                       u8 *data) -> ChfsNullResult
+  {
+    std::lock_guard<std::recursive_mutex> lock(this->mtx);
+    if (!this->check_batch(block_ids))
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    for (usize i = 0; i < block_ids.size(); ++i)
+    {
+      auto res = this->read_block(block_ids[i],
+                                  data + static_cast<u64>(i) * this->block_sz);
+      if (res.is_err())
+      {
+        return res;
+      }
+    }
+    return KNullOk;
+  }
+
+  auto CachedBlockManager::write_blocks(const std::vector<block_id_t> &block_ids,
+                                        const u8 *data) -> ChfsNullResult
+  {
+    std::lock_guard<std::recursive_mutex> lock(this->mtx);
+    if (!this->check_batch(block_ids))
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    for (usize i = 0; i < block_ids.size(); ++i)
+    {
+      auto res = this->write_block(block_ids[i],
+                                   data + static_cast<u64>(i) * this->block_sz);
+      if (res.is_err())
+      {
+        return res;
+      }
+    }
+    return KNullOk;
+  }
+
+  auto CachedBlockManager::map_block(block_id_t block_id) -> u8 *
+  {
+    std::lock_guard<std::recursive_mutex> lock(this->mtx);
+    auto res = this->lookup(block_id, true);
+    if (res.is_err())
+    {
+      // the view falls back to read_block/write_block
+      return nullptr;
+    }
+    auto idx = res.unwrap();
+    this->frames[idx].pin_cnt += 1;
+    return this->frame_ptr(idx);
+  }
+
+  auto CachedBlockManager::unmap_block(block_id_t block_id, bool dirty) -> void
+  {
+    std::lock_guard<std::recursive_mutex> lock(this->mtx);
+    auto it = this->frame_table.find(block_id);
+    CHFS_ASSERT(it != this->frame_table.end(), "unmap an uncached block");
+
+    auto &frame = this->frames[it->second];
+    CHFS_ASSERT(frame.pin_cnt > 0, "unmap an unpinned block");
+    frame.pin_cnt -= 1;
+    if (dirty)
+    {
+      this->mark_dirty(it->second);
+    }
+  }
+
+  auto CachedBlockManager::flush() -> ChfsNullResult
+  {
+    std::lock_guard<std::recursive_mutex> lock(this->mtx);
+    for (usize i = 0; i < this->cache_block_cnt; ++i)
+    {
+      auto res = this->write_back(i);
+      if (res.is_err())
+      {
+        return res;
+      }
+    }
+    return KNullOk;
+  }
+
+  auto CachedBlockManager::discard_blocks(
+      const std::vector<block_id_t> &block_ids) -> ChfsNullResult
+  {
+    std::lock_guard<std::recursive_mutex> lock(this->mtx);
+    if (!this->check_batch(block_ids))
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    for (auto block_id : block_ids)
+    {
+      auto it = this->frame_table.find(block_id);
+      if (it == this->frame_table.end())
+      {
+        continue;
+      }
+      auto &frame = this->frames[it->second];
+      memset(this->frame_ptr(it->second), 0, this->block_sz);
+      if (frame.dirty)
+      {
+        frame.dirty = false;
+        this->dirty_cnt -= 1;
+      }
+    }
+    return BlockManager::discard_blocks(block_ids);
+  }
+
+  auto CachedBlockManager::grow(usize new_block_cnt) -> ChfsNullResult
+  {
+    // the writeback thread must not write while the device is remapped
+    std::lock_guard<std::recursive_mutex> lock(this->mtx);
+    return BlockManager::grow(new_block_cnt);
+  }
+
+  auto CachedBlockManager::sync_range(block_id_t start, usize cnt)
+      -> ChfsNullResult
+  {
+    std::lock_guard<std::recursive_mutex> lock(this->mtx);
+    if (start > this->block_cnt || cnt > this->block_cnt - start)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    for (usize i = 0; i < this->cache_block_cnt && this->dirty_cnt > 0; ++i)
+    {
+      auto &frame = this->frames[i];
+      if (frame.valid && frame.block_id >= start &&
+          frame.block_id < start + cnt)
+      {
+        auto res = this->write_back(i);
+        if (res.is_err())
+        {
+          return res;
+        }
+      }
+    }
+
+    auto res = this->take_writeback_error();
+    if (res.is_err())
+    {
+      return res;
+    }
+    return BlockManager::sync_range(start, cnt);
+  }
+
+  auto CachedBlockManager::sync_all() -> ChfsNullResult
+  {
+    std::lock_guard<std::recursive_mutex> lock(this->mtx);
+    auto res = this->flush();
+    if (res.is_err())
+    {
+      return res;
+    }
+    res = this->take_writeback_error();
+    if (res.is_err())
+    {
+      return res;
+    }
+    return BlockManager::sync_range(0, this->block_cnt);
+  }
+
+} // namespace chfs
@@ -0,0 +1,285 @@
+#include <algorithm>
+#include <cstring>
+
+#include "block/checksum_manager.h"
+#include "common/crc32c.h"
+
+namespace chfs
+{
+
+  // number of blocks read at once when the checksums are initialized
+  static const usize KInitBatchBlocks = 256;
+
+  auto ChecksumBlockManager::csum_block_cnt(usize block_cnt, usize block_size)
+      -> usize
+  {
+    // Each checksum block covers `per` blocks and itself is not covered,
+    // so c blocks suffice as long as c * (per + 1) >= block_cnt.
+    const usize per = block_size / sizeof(u32);
+    return (block_cnt + per) / (per + 1);
+  }
+
+  ChecksumBlockManager::ChecksumBlockManager(
+      std::shared_ptr<BlockManager> inner, bool will_initialize)
+      : BlockManager("checksum", -1,
+                     inner->total_blocks() -
+                         csum_block_cnt(inner->total_blocks(),
+                                        inner->block_size()),
+                     inner->block_size()),
+        inner(inner), csum_block_id(this->block_cnt),
+        csums(this->block_cnt)
+  {
+    CHFS_VERIFY(this->block_cnt > 0, "The device is too small");
+
+    std::vector<u8> buffer(this->block_sz);
+    this->zero_csum = crc32c(buffer.data(), this->block_sz);
+
+    const auto region_cnt = this->inner->total_blocks() - this->csum_block_id;
+    const auto per = this->entries_per_block();
+
+    if (will_initialize)
+    {
+      // checksum the current content of the device
+      buffer.resize(KInitBatchBlocks * this->block_sz);
+      for (block_id_t start = 0; start < this->block_cnt;
+           start += KInitBatchBlocks)
+      {
+        auto n = std::min<usize>(KInitBatchBlocks, this->block_cnt - start);
+        std::vector<block_id_t> block_ids(n);
+        for (usize i = 0; i < n; ++i)
+        {
+          block_ids[i] = start + i;
+        }
+        this->inner->read_blocks(block_ids, buffer.data()).unwrap();
+        for (usize i = 0; i < n; ++i)
+        {
+          this->csums[start + i] =
+              crc32c(buffer.data() + i * this->block_sz, this->block_sz);
+        }
+      }
+
+      buffer.assign(this->block_sz, 0);
+      for (usize i = 0; i < region_cnt; ++i)
+      {
+        auto cnt = std::min(per, this->block_cnt - i * per);
+        memcpy(buffer.data(), this->csums.data() + i * per,
+               cnt * sizeof(u32));
+        this->inner->write_block(this->csum_block_id + i, buffer.data())
+            .unwrap();
+      }
+      return;
+    }
+
+    // load the checksums from the region
+    for (usize i = 0; i < region_cnt; ++i)
+    {
+      this->inner->read_block(this->csum_block_id + i, buffer.data()).unwrap();
+      auto cnt = std::min(per, this->block_cnt - i * per);
+      memcpy(this->csums.data() + i * per, buffer.data(), cnt * sizeof(u32));
+    }
+  }
+
+  auto ChecksumBlockManager::verify(block_id_t block_id,
+                                    const u8 *data) const -> ChfsNullResult
+  {
+    if (crc32c(data, this->block_sz) != this->csums[block_id])
+    {
+      return ChfsNullResult(ErrorType::Corrupted);
+    }
+    return KNullOk;
+  }
+
+  auto ChecksumBlockManager::store_csums(
+      const std::vector<block_id_t> &block_ids) -> ChfsNullResult
+  {
+    const auto per = this->entries_per_block();
+
+    std::vector<usize> regions;
+    regions.reserve(block_ids.size());
+    for (auto block_id : block_ids)
+    {
+      regions.push_back(block_id / per);
+    }
+    std::sort(regions.begin(), regions.end());
+    regions.erase(std::unique(regions.begin(), regions.end()), regions.end());
+
+    // a single checksum is written in place
+    if (block_ids.size() == 1)
+    {
+      auto block_id = block_ids[0];
+      return this->inner->write_partial_block(
+          this->csum_block_id + regions[0],
+          reinterpret_cast<const u8 *>(&this->csums[block_id]),
+          (block_id % per) * sizeof(u32), sizeof(u32));
+    }
+
+    std::vector<u8> buffer(this->block_sz, 0);
+    for (auto region : regions)
+    {
+      auto cnt = std::min(per, this->block_cnt - region * per);
+      memcpy(buffer.data(), this->csums.data() + region * per,
+             cnt * sizeof(u32));
+      auto res = this->inner->write_block(this->csum_block_id + region,
+                                          buffer.data());
+      if (res.is_err())
+      {
+        return res;
+      }
+    }
+    return KNullOk;
+  }
+
+  auto ChecksumBlockManager::write_block(block_id_t block_id, const u8 *data)
+      -> ChfsNullResult
+  {
+    return this->write_blocks({block_id}, data);
+  }
+
+  auto ChecksumBlockManager::write_partial_block(block_id_t block_id,
+                                                 const u8 *data, usize offset,
+                                                 usize len) -> ChfsNullResult
+  {
+    if (offset + len > this->block_sz)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    std::vector<u8> buffer(this->block_sz);
+    auto res = this->read_block(block_id, buffer.data());
+    if (res.is_err())
+    {
+      return res;
+    }
+    memcpy(buffer.data() + offset, data, len);
+    return this->write_block(block_id, buffer.data());
+  }
+
+  auto ChecksumBlockManager::read_block(block_id_t block_id, u8 *data)
+      -> ChfsNullResult
+  {
+    return this->read_blocks({block_id}, data);
+  }
+
+  auto ChecksumBlockManager::zero_block(block_id_t block_id) -> ChfsNullResult
+  {
+    if (block_id >= this->block_cnt)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    auto res = this->inner->zero_block(block_id);
+    if (res.is_err())
+    {
+      return res;
+    }
+    this->csums[block_id] = this->zero_csum;
+    return this->store_csums({block_id});
+  }
+
+  auto ChecksumBlockManager::read_blocks(
+      const std::vector<block_id_t> &block_ids, u8 *data) -> ChfsNullResult
+  {
+    if (!this->check_batch(block_ids))
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    auto res = this->inner->read_blocks(block_ids, data);
+    if (res.is_err())
+    {
+      return res;
+    }
+    for (usize i = 0; i < block_ids.size(); ++i)
+    {
+      res = this->verify(block_ids[i],
+                         data + static_cast<u64>(i) * this->block_sz);
+      if (res.is_err())
+      {
+        return res;
+      }
+    }
+    return KNullOk;
+  }
+
+  auto ChecksumBlockManager::write_blocks(
+      const std::vector<block_id_t> &block_ids, const u8 *data)
+      -> ChfsNullResult
+  {
+    if (!this->check_batch(block_ids))
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    if (block_ids.empty())
+    {
+      return KNullOk;
+    }
+
+    auto res = this->inner->write_blocks(block_ids, data);
+    if (res.is_err())
+    {
+      return res;
+    }
+    for (usize i = 0; i < block_ids.size(); ++i)
+    {
+      this->csums[block_ids[i]] =
+          crc32c(data + static_cast<u64>(i) * this->block_sz, this->block_sz);
+    }
+    return this->store_csums(block_ids);
+  }
+
+  auto ChecksumBlockManager::discard_blocks(
+      const std::vector<block_id_t> &block_ids) -> ChfsNullResult
+  {
+    if (!this->check_batch(block_ids))
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    if (block_ids.empty())
+    {
+      return KNullOk;
+    }
+
+    auto res = this->inner->discard_blocks(block_ids);
+    if (res.is_err())
+    {
+      return res;
+    }
+    // a discarded block reads as zeros
+    for (auto block_id : block_ids)
+    {
+      this->csums[block_id] = this->zero_csum;
+    }
+    return this->store_csums(block_ids);
+  }
+
+  auto ChecksumBlockManager::sync_range(block_id_t start, usize cnt)
+      -> ChfsNullResult
+  {
+    if (start > this->block_cnt || cnt > this->block_cnt - start)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    if (cnt == 0)
+    {
+      return KNullOk;
+    }
+
+    auto res = this->inner->sync_range(start, cnt);
+    if (res.is_err())
+    {
+      return res;
+    }
+    // the checksums of the range
+    const auto per = this->entries_per_block();
+    auto first = start / per;
+    auto last = (start + cnt - 1) / per;
+    return this->inner->sync_range(this->csum_block_id + first,
+                                   last - first + 1);
+  }
+
+  auto ChecksumBlockManager::sync_all() -> ChfsNullResult
+  {
+    return this->inner->sync_all();
+  }
+
+} // namespace chfs
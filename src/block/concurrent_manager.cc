@@ -0,0 +1,215 @@
+#include <algorithm>
+#include <mutex>
+#include <numeric>
+
+#include "block/concurrent_manager.h"
+
+namespace chfs
+{
+
+  ConcurrentBlockManager::ConcurrentBlockManager(
+      std::shared_ptr<BlockManager> inner, usize stripe_cnt)
+      : BlockManager("concurrent", -1, inner->total_blocks(),
+                     inner->block_size()),
+        inner(std::move(inner)), stripes(stripe_cnt)
+  {
+    CHFS_VERIFY(stripe_cnt > 0, "Need at least one lock");
+  }
+
+  ConcurrentBlockManager::BatchLock::BatchLock(ConcurrentBlockManager *bm,
+                                               std::vector<usize> stripes,
+                                               bool exclusive)
+      : bm(bm), stripes(std::move(stripes)), exclusive(exclusive)
+  {
+    // always in the ascending order, so two batches cannot deadlock
+    for (auto stripe : this->stripes)
+    {
+      if (this->exclusive)
+      {
+        this->bm->stripes[stripe].mtx.lock();
+      }
+      else
+      {
+        this->bm->stripes[stripe].mtx.lock_shared();
+      }
+    }
+  }
+
+  ConcurrentBlockManager::BatchLock::~BatchLock()
+  {
+    for (auto stripe : this->stripes)
+    {
+      if (this->exclusive)
+      {
+        this->bm->stripes[stripe].mtx.unlock();
+      }
+      else
+      {
+        this->bm->stripes[stripe].mtx.unlock_shared();
+      }
+    }
+  }
+
+  auto ConcurrentBlockManager::stripe_of(block_id_t block_id) const -> usize
+  {
+    // Fibonacci hashing, so that strided accesses spread over the stripes
+    return static_cast<usize>((block_id * 0x9e3779b97f4a7c15ULL) >> 32) %
+           this->stripes.size();
+  }
+
+  auto ConcurrentBlockManager::stripes_of(
+      const std::vector<block_id_t> &block_ids) const -> std::vector<usize>
+  {
+    std::vector<usize> res;
+    res.reserve(block_ids.size());
+    for (auto block_id : block_ids)
+    {
+      res.push_back(this->stripe_of(block_id));
+    }
+    std::sort(res.begin(), res.end());
+    res.erase(std::unique(res.begin(), res.end()), res.end());
+    return res;
+  }
+
+  auto ConcurrentBlockManager::write_block(block_id_t block_id, const u8 *data)
+      -> ChfsNullResult
+  {
+    std::unique_lock<std::shared_mutex> lock(
+        this->stripes[this->stripe_of(block_id)].mtx);
+    if (block_id >= this->block_cnt)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    return this->inner->write_block(block_id, data);
+  }
+
+  auto ConcurrentBlockManager::write_partial_block(block_id_t block_id,
+                                                   const u8 *data,
+                                                   usize offset, usize len)
+      -> ChfsNullResult
+  {
+    std::unique_lock<std::shared_mutex> lock(
+        this->stripes[this->stripe_of(block_id)].mtx);
+    if (block_id >= this->block_cnt)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    return this->inner->write_partial_block(block_id, data, offset, len);
+  }
+
+  auto ConcurrentBlockManager::read_block(block_id_t block_id, u8 *data)
+      -> ChfsNullResult
+  {
+    std::shared_lock<std::shared_mutex> lock(
+        this->stripes[this->stripe_of(block_id)].mtx);
+    if (block_id >= this->block_cnt)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    return this->inner->read_block(block_id, data);
+  }
+
+  auto ConcurrentBlockManager::zero_block(block_id_t block_id) -> ChfsNullResult
+  {
+    std::unique_lock<std::shared_mutex> lock(
+        this->stripes[this->stripe_of(block_id)].mtx);
+    if (block_id >= this->block_cnt)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    return this->inner->zero_block(block_id);
+  }
+
+  auto ConcurrentBlockManager::update_block(
+      block_id_t block_id, const std::function<void(u8 *)> &update)
+      -> ChfsNullResult
+  {
+    std::unique_lock<std::shared_mutex> lock(
+        this->stripes[this->stripe_of(block_id)].mtx);
+    if (block_id >= this->block_cnt)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    std::vector<u8> buffer(this->block_sz);
+    auto res = this->inner->read_block(block_id, buffer.data());
+    if (res.is_err())
+    {
+      return res;
+    }
+    update(buffer.data());
+    return this->inner->write_block(block_id, buffer.data());
+  }
+
+  auto ConcurrentBlockManager::read_blocks(
+      const std::vector<block_id_t> &block_ids, u8 *data) -> ChfsNullResult
+  {
+    BatchLock lock(this, this->stripes_of(block_ids), false);
+    if (!this->check_batch(block_ids))
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    return this->inner->read_blocks(block_ids, data);
+  }
+
+  auto ConcurrentBlockManager::write_blocks(
+      const std::vector<block_id_t> &block_ids, const u8 *data)
+      -> ChfsNullResult
+  {
+    BatchLock lock(this, this->stripes_of(block_ids), true);
+    if (!this->check_batch(block_ids))
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    return this->inner->write_blocks(block_ids, data);
+  }
+
+  auto ConcurrentBlockManager::discard_blocks(
+      const std::vector<block_id_t> &block_ids) -> ChfsNullResult
+  {
+    BatchLock lock(this, this->stripes_of(block_ids), true);
+    if (!this->check_batch(block_ids))
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    return this->inner->discard_blocks(block_ids);
+  }
+
+  auto ConcurrentBlockManager::sync_range(block_id_t start, usize cnt)
+      -> ChfsNullResult
+  {
+    // a sync does not change any block, the locks only keep `grow` away
+    BatchLock lock(this, {this->stripe_of(start)}, false);
+    if (start > this->block_cnt || cnt > this->block_cnt - start)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    return this->inner->sync_range(start, cnt);
+  }
+
+  auto ConcurrentBlockManager::sync_all() -> ChfsNullResult
+  {
+    BatchLock lock(this, {this->stripe_of(0)}, false);
+    return this->inner->sync_all();
+  }
+
+  auto ConcurrentBlockManager::grow(usize new_block_cnt) -> ChfsNullResult
+  {
+    std::vector<usize> all(this->stripes.size());
+    std::iota(all.begin(), all.end(), 0);
+    BatchLock lock(this, std::move(all), true);
+
+    if (new_block_cnt < this->block_cnt)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    auto res = this->inner->grow(new_block_cnt);
+    if (res.is_err())
+    {
+      return res;
+    }
+    this->block_cnt = this->inner->total_blocks();
+    return KNullOk;
+  }
+
+} // namespace chfs
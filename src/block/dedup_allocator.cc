@@ -0,0 +1,339 @@
+#include <algorithm>
+#include <cstring>
+
+#include "block/dedup_allocator.h"
+#include "common/hash.h"
+
+namespace chfs
+{
+
+  // number of table blocks read at once when the table is loaded
+  static const usize KLoadBatchBlocks = 256;
+
+  // no old block, the same as `KInvalidBlockID` of the inodes
+  static const block_id_t KNoBlock = 0;
+
+  auto DedupAllocator::table_block_cnt_for(usize block_cnt, usize block_size)
+      -> usize
+  {
+    const usize per = block_size / sizeof(DedupEntry);
+    return (block_cnt + per - 1) / per;
+  }
+
+  auto DedupAllocator::create(std::shared_ptr<BlockManager> bm,
+                              std::shared_ptr<BlockAllocator> allocator)
+      -> ChfsResult<std::shared_ptr<DedupAllocator>>
+  {
+    const auto cnt =
+        table_block_cnt_for(allocator->total_blocks(), bm->block_size());
+
+    // a fresh allocator hands out contiguous blocks
+    std::vector<block_id_t> block_ids;
+    for (usize i = 0; i < cnt; ++i)
+    {
+      auto res = allocator->allocate();
+      if (res.is_err() ||
+          (i > 0 && res.unwrap() != block_ids.front() + i))
+      {
+        if (res.is_ok())
+        {
+          block_ids.push_back(res.unwrap());
+        }
+        for (auto block_id : block_ids)
+        {
+          allocator->deallocate(block_id);
+        }
+        return ChfsResult<std::shared_ptr<DedupAllocator>>(
+            ErrorType::OUT_OF_RESOURCE);
+      }
+      block_ids.push_back(res.unwrap());
+    }
+
+    auto res = bm->zero_blocks(block_ids.front(), cnt);
+    if (res.is_err())
+    {
+      return ChfsResult<std::shared_ptr<DedupAllocator>>(res.unwrap_error());
+    }
+    return ChfsResult<std::shared_ptr<DedupAllocator>>(
+        std::make_shared<DedupAllocator>(bm, allocator, block_ids.front(),
+                                         cnt));
+  }
+
+  DedupAllocator::DedupAllocator(std::shared_ptr<BlockManager> bm,
+                                 std::shared_ptr<BlockAllocator> allocator,
+                                 block_id_t table_block_id,
+                                 usize table_block_cnt)
+      : bm(std::move(bm)), allocator(std::move(allocator)),
+        table_block_id(table_block_id), table_block_cnt(table_block_cnt)
+  {
+    const auto per = this->entries_per_block();
+    const auto block_size = this->bm->block_size();
+    this->entries.resize(std::min<usize>(table_block_cnt * per,
+                                         this->allocator->total_blocks()));
+
+    // load the table and index the deduplicated blocks
+    std::vector<u8> buffer(KLoadBatchBlocks * block_size);
+    for (usize start = 0; start < table_block_cnt; start += KLoadBatchBlocks)
+    {
+      auto n = std::min<usize>(KLoadBatchBlocks, table_block_cnt - start);
+      std::vector<block_id_t> block_ids(n);
+      for (usize i = 0; i < n; ++i)
+      {
+        block_ids[i] = table_block_id + start + i;
+      }
+      this->bm->read_blocks(block_ids, buffer.data()).unwrap();
+
+      auto first = start * per;
+      auto cnt = std::min<usize>(n * per, this->entries.size() - first);
+      memcpy(this->entries.data() + first, buffer.data(),
+             cnt * sizeof(DedupEntry));
+    }
+    for (block_id_t i = 0; i < this->entries.size(); ++i)
+    {
+      if (this->entries[i].ref_cnt > 0)
+      {
+        this->index.emplace(this->entries[i].fingerprint, i);
+      }
+    }
+  }
+
+  auto DedupAllocator::entries_per_block() const -> usize
+  {
+    return this->bm->block_size() / sizeof(DedupEntry);
+  }
+
+  auto DedupAllocator::ref_cnt(block_id_t block_id) const -> u32
+  {
+    return this->covered(block_id) ? this->entries[block_id].ref_cnt : 0;
+  }
+
+  auto DedupAllocator::store_entries(std::vector<block_id_t> &block_ids)
+      -> ChfsNullResult
+  {
+    const auto per = this->entries_per_block();
+
+    // a single entry is written in place
+    if (block_ids.size() == 1)
+    {
+      auto block_id = block_ids[0];
+      return this->bm->write_partial_block(
+          this->table_block_id + block_id / per,
+          reinterpret_cast<const u8 *>(&this->entries[block_id]),
+          (block_id % per) * sizeof(DedupEntry), sizeof(DedupEntry));
+    }
+
+    std::vector<usize> regions;
+    regions.reserve(block_ids.size());
+    for (auto block_id : block_ids)
+    {
+      regions.push_back(block_id / per);
+    }
+    std::sort(regions.begin(), regions.end());
+    regions.erase(std::unique(regions.begin(), regions.end()), regions.end());
+
+    std::vector<u8> buffer(this->bm->block_size(), 0);
+    for (auto region : regions)
+    {
+      auto cnt = std::min<usize>(per, this->entries.size() - region * per);
+      memcpy(buffer.data(), this->entries.data() + region * per,
+             cnt * sizeof(DedupEntry));
+      auto res =
+          this->bm->write_block(this->table_block_id + region, buffer.data());
+      if (res.is_err())
+      {
+        return res;
+      }
+    }
+    return KNullOk;
+  }
+
+  auto DedupAllocator::release(block_id_t block_id,
+                               std::vector<block_id_t> &dirty)
+      -> ChfsNullResult
+  {
+    if (this->ref_cnt(block_id) == 0)
+    {
+      return this->allocator->deallocate(block_id);
+    }
+
+    auto &entry = this->entries[block_id];
+    entry.ref_cnt -= 1;
+    dirty.push_back(block_id);
+    if (entry.ref_cnt > 0)
+    {
+      return KNullOk;
+    }
+
+    auto it = this->index.find(entry.fingerprint);
+    if (it != this->index.end() && it->second == block_id)
+    {
+      this->index.erase(it);
+    }
+    entry.fingerprint = 0;
+    return this->allocator->deallocate(block_id);
+  }
+
+  auto DedupAllocator::deallocate(block_id_t block_id) -> ChfsNullResult
+  {
+    std::vector<block_id_t> dirty;
+    auto res = this->release(block_id, dirty);
+    if (res.is_err() || dirty.empty())
+    {
+      return res;
+    }
+    return this->store_entries(dirty);
+  }
+
+  auto DedupAllocator::store(std::vector<block_id_t> &block_ids,
+                             const u8 *data) -> ChfsNullResult
+  {
+    const auto block_size = this->bm->block_size();
+    const auto n = block_ids.size();
+
+    std::vector<u64> fingerprints(n);
+    for (usize i = 0; i < n; ++i)
+    {
+      fingerprints[i] = hash64(data + static_cast<u64>(i) * block_size,
+                               block_size);
+    }
+
+    // 1. read the stored blocks with the same fingerprints in one batch
+    std::vector<block_id_t> candidates;
+    for (auto fingerprint : fingerprints)
+    {
+      auto it = this->index.find(fingerprint);
+      if (it != this->index.end())
+      {
+        candidates.push_back(it->second);
+      }
+    }
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()),
+                     candidates.end());
+    std::vector<u8> candidate_data(candidates.size() * block_size);
+    auto res = this->bm->read_blocks(candidates, candidate_data.data());
+    if (res.is_err())
+    {
+      return res;
+    }
+
+    // the blocks to write, whose content is newer than the candidates
+    std::unordered_map<block_id_t, const u8 *> pending;
+    auto content_of = [&](block_id_t block_id) -> const u8 *
+    {
+      auto it = pending.find(block_id);
+      if (it != pending.end())
+      {
+        return it->second;
+      }
+      auto pos = std::lower_bound(candidates.begin(), candidates.end(),
+                                  block_id);
+      if (pos == candidates.end() || *pos != block_id)
+      {
+        return nullptr;
+      }
+      return candidate_data.data() + (pos - candidates.begin()) * block_size;
+    };
+
+    // 2. decide where each block goes
+    std::vector<block_id_t> dirty;
+    for (usize i = 0; i < n && res.is_ok(); ++i)
+    {
+      const u8 *block = data + static_cast<u64>(i) * block_size;
+      const auto fingerprint = fingerprints[i];
+      const auto old_id = block_ids[i];
+
+      auto it = this->index.find(fingerprint);
+      if (it != this->index.end())
+      {
+        auto stored = content_of(it->second);
+        if (stored != nullptr && memcmp(stored, block, block_size) == 0)
+        {
+          this->dedup_hit_cnt += 1;
+          if (it->second == old_id)
+          {
+            continue;
+          }
+          block_ids[i] = it->second;
+          this->entries[it->second].ref_cnt += 1;
+          dirty.push_back(it->second);
+          if (old_id != KNoBlock)
+          {
+            res = this->release(old_id, dirty);
+          }
+          continue;
+        }
+      }
+
+      // a block only this file refers to is overwritten in place
+      if (old_id != KNoBlock && this->ref_cnt(old_id) <= 1)
+      {
+        if (this->covered(old_id))
+        {
+          auto &entry = this->entries[old_id];
+          auto old_it = this->index.find(entry.fingerprint);
+          if (entry.ref_cnt > 0 && old_it != this->index.end() &&
+              old_it->second == old_id)
+          {
+            this->index.erase(old_it);
+          }
+          entry = {fingerprint, 1, 0};
+          this->index.emplace(fingerprint, old_id);
+          dirty.push_back(old_id);
+        }
+        pending[old_id] = block;
+        continue;
+      }
+
+      auto alloc_res = this->allocator->allocate();
+      if (alloc_res.is_err())
+      {
+        res = ChfsNullResult(alloc_res.unwrap_error());
+        break;
+      }
+      auto block_id = alloc_res.unwrap();
+      if (this->covered(block_id))
+      {
+        this->entries[block_id] = {fingerprint, 1, 0};
+        this->index.emplace(fingerprint, block_id);
+        dirty.push_back(block_id);
+      }
+      pending[block_id] = block;
+      block_ids[i] = block_id;
+      if (old_id != KNoBlock)
+      {
+        res = this->release(old_id, dirty);
+      }
+    }
+
+    // 3. write the new contents in one batch, then their entries
+    std::vector<block_id_t> write_ids;
+    write_ids.reserve(pending.size());
+    for (const auto &[block_id, _] : pending)
+    {
+      write_ids.push_back(block_id);
+    }
+    std::sort(write_ids.begin(), write_ids.end());
+    std::vector<u8> buffer(write_ids.size() * block_size);
+    for (usize i = 0; i < write_ids.size(); ++i)
+    {
+      memcpy(buffer.data() + i * block_size, pending[write_ids[i]],
+             block_size);
+    }
+    auto write_res = this->bm->write_blocks(write_ids, buffer.data());
+    if (write_res.is_err())
+    {
+      return write_res;
+    }
+    if (!dirty.empty())
+    {
+      write_res = this->store_entries(dirty);
+      if (write_res.is_err())
+      {
+        return write_res;
+      }
+    }
+    return res;
+  }
+
+} // namespace chfs
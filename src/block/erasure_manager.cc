@@ -0,0 +1,503 @@
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+#include "block/erasure_manager.h"
+
+namespace chfs
+{
+
+  static auto erasure_block_cnt(
+      const std::vector<std::shared_ptr<BlockManager>> &devices,
+      usize data_cnt) -> usize
+  {
+    CHFS_VERIFY(data_cnt > 0 && data_cnt <= devices.size(),
+                "Need k data devices");
+    return min_device_block_cnt(devices) * data_cnt;
+  }
+
+  ErasureBlockManager::ErasureBlockManager(
+      std::vector<std::shared_ptr<BlockManager>> devices, usize data_cnt)
+      : BlockManager("erasure", -1, erasure_block_cnt(devices, data_cnt),
+                     devices[0]->block_size()),
+        devices(std::move(devices)), failed(this->devices.size(), false),
+        codec(data_cnt, this->devices.size() - data_cnt),
+        workers(this->devices.size())
+  {
+    CHFS_VERIFY(this->block_cnt > 0, "The devices are too small");
+  }
+
+  ErasureBlockManager::ErasureBlockManager(const std::vector<std::string> &files,
+                                           usize block_cnt, usize data_cnt,
+                                           BlockBackend backend)
+      : ErasureBlockManager(open_devices(files, block_cnt, backend), data_cnt)
+  {
+  }
+
+  auto ErasureBlockManager::failed_cnt() const -> usize
+  {
+    return std::count(this->failed.begin(), this->failed.end(), true);
+  }
+
+  auto ErasureBlockManager::fail_device(usize idx) -> ChfsNullResult
+  {
+    if (idx >= this->devices.size())
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    if (!this->failed[idx] && this->failed_cnt() == this->codec.parity_cnt())
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    this->failed[idx] = true;
+    return KNullOk;
+  }
+
+  auto ErasureBlockManager::for_each_device(
+      const std::function<ChfsNullResult(usize)> &op) -> ChfsNullResult
+  {
+    const auto n = this->devices.size();
+    std::vector<ChfsNullResult> results(n, KNullOk);
+    std::vector<std::function<void()>> tasks(n);
+    for (usize d = 0; d < n; ++d)
+    {
+      if (!this->failed[d])
+      {
+        tasks[d] = [d, &op, &results]() { results[d] = op(d); };
+      }
+    }
+    this->workers.run(tasks);
+
+    for (usize d = 0; d < n; ++d)
+    {
+      if (results[d].is_err())
+      {
+        this->failed[d] = true;
+      }
+    }
+    if (this->failed_cnt() > this->codec.parity_cnt())
+    {
+      return ChfsNullResult(ErrorType::IOError);
+    }
+    return KNullOk;
+  }
+
+  auto ErasureBlockManager::read_shards(const std::vector<ShardIo> &shards)
+      -> ChfsNullResult
+  {
+    const auto n = this->devices.size();
+    const auto block_sz = this->block_sz;
+
+    // 1. read the shards of each device at once, through a staging buffer
+    std::vector<std::vector<usize>> per_device(n);
+    for (usize i = 0; i < shards.size(); ++i)
+    {
+      per_device[this->device_of(shards[i].row, shards[i].shard)].push_back(i);
+    }
+    auto res = this->for_each_device(
+        [this, &shards, &per_device, block_sz](usize d) -> ChfsNullResult
+        {
+          const auto &idx = per_device[d];
+          if (idx.empty())
+          {
+            return KNullOk;
+          }
+          std::vector<block_id_t> rows(idx.size());
+          for (usize j = 0; j < idx.size(); ++j)
+          {
+            rows[j] = shards[idx[j]].row;
+          }
+          if (idx.size() == 1)
+          {
+            return this->devices[d]->read_block(rows[0], shards[idx[0]].data);
+          }
+
+          std::vector<u8> staging(idx.size() * block_sz);
+          auto res = this->devices[d]->read_blocks(rows, staging.data());
+          if (res.is_err())
+          {
+            return res;
+          }
+          for (usize j = 0; j < idx.size(); ++j)
+          {
+            memcpy(shards[idx[j]].data, staging.data() + j * block_sz,
+                   block_sz);
+          }
+          return KNullOk;
+        });
+    if (res.is_err())
+    {
+      return res;
+    }
+
+    // 2. reconstruct the shards of the failed devices
+    std::map<block_id_t, std::vector<usize>> lost;
+    for (usize d = 0; d < n; ++d)
+    {
+      if (!this->failed[d])
+      {
+        continue;
+      }
+      for (auto i : per_device[d])
+      {
+        lost[shards[i].row].push_back(i);
+      }
+    }
+    if (lost.empty())
+    {
+      return KNullOk;
+    }
+
+    std::vector<u8> row_data(n * block_sz);
+    for (const auto &[row, idx] : lost)
+    {
+      auto res = this->reconstruct_row(row, row_data.data());
+      if (res.is_err())
+      {
+        return res;
+      }
+      for (auto i : idx)
+      {
+        memcpy(shards[i].data, row_data.data() + shards[i].shard * block_sz,
+               block_sz);
+      }
+    }
+    return KNullOk;
+  }
+
+  auto ErasureBlockManager::reconstruct_row(block_id_t row, u8 *row_data)
+      -> ChfsNullResult
+  {
+    const auto n = this->devices.size();
+    const auto k = this->codec.data_cnt();
+
+    // any k shards will do
+    std::vector<bool> present(n, false);
+    usize present_cnt = 0;
+    for (usize shard = 0; shard < n && present_cnt < k; ++shard)
+    {
+      auto d = this->device_of(row, shard);
+      if (this->failed[d])
+      {
+        continue;
+      }
+      auto res = this->devices[d]->read_block(
+          row, row_data + static_cast<u64>(shard) * this->block_sz);
+      if (res.is_err())
+      {
+        this->failed[d] = true;
+        continue;
+      }
+      present[shard] = true;
+      present_cnt += 1;
+    }
+
+    std::vector<u8 *> ptrs(n);
+    for (usize shard = 0; shard < n; ++shard)
+    {
+      ptrs[shard] = row_data + static_cast<u64>(shard) * this->block_sz;
+    }
+    if (!this->codec.reconstruct(ptrs.data(), present, this->block_sz))
+    {
+      return ChfsNullResult(ErrorType::IOError);
+    }
+    return KNullOk;
+  }
+
+  auto ErasureBlockManager::write_shards(const std::vector<ShardIo> &shards)
+      -> ChfsNullResult
+  {
+    const auto block_sz = this->block_sz;
+
+    std::vector<std::vector<usize>> per_device(this->devices.size());
+    for (usize i = 0; i < shards.size(); ++i)
+    {
+      per_device[this->device_of(shards[i].row, shards[i].shard)].push_back(i);
+    }
+    return this->for_each_device(
+        [this, &shards, &per_device, block_sz](usize d) -> ChfsNullResult
+        {
+          const auto &idx = per_device[d];
+          if (idx.empty())
+          {
+            return KNullOk;
+          }
+          std::vector<block_id_t> rows(idx.size());
+          for (usize j = 0; j < idx.size(); ++j)
+          {
+            rows[j] = shards[idx[j]].row;
+          }
+          if (idx.size() == 1)
+          {
+            return this->devices[d]->write_block(rows[0], shards[idx[0]].data);
+          }
+
+          std::vector<u8> staging(idx.size() * block_sz);
+          for (usize j = 0; j < idx.size(); ++j)
+          {
+            memcpy(staging.data() + j * block_sz, shards[idx[j]].data,
+                   block_sz);
+          }
+          return this->devices[d]->write_blocks(rows, staging.data());
+        });
+  }
+
+  auto ErasureBlockManager::read_blocks(const std::vector<block_id_t> &block_ids,
+                                        u8 *data) -> ChfsNullResult
+  {
+    if (!this->check_batch(block_ids))
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    const auto k = this->codec.data_cnt();
+    std::vector<ShardIo> shards;
+    shards.reserve(block_ids.size());
+    for (usize i = 0; i < block_ids.size(); ++i)
+    {
+      shards.push_back({block_ids[i] / k,
+                        static_cast<usize>(block_ids[i] % k),
+                        data + static_cast<u64>(i) * this->block_sz});
+    }
+    return this->read_shards(shards);
+  }
+
+  auto ErasureBlockManager::write_blocks(
+      const std::vector<block_id_t> &block_ids, const u8 *data)
+      -> ChfsNullResult
+  {
+    if (!this->check_batch(block_ids))
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    if (block_ids.empty())
+    {
+      return KNullOk;
+    }
+
+    const auto n = this->devices.size();
+    const auto k = this->codec.data_cnt();
+    const auto m = this->codec.parity_cnt();
+    const auto block_sz = this->block_sz;
+
+    // 1. the new data of each row, the last write of a block wins
+    std::map<block_id_t, std::vector<const u8 *>> rows;
+    for (usize i = 0; i < block_ids.size(); ++i)
+    {
+      auto &row = rows[block_ids[i] / k];
+      row.resize(k, nullptr);
+      row[block_ids[i] % k] = data + static_cast<u64>(i) * block_sz;
+    }
+
+    // 2. read what the parity is computed from: the old data and parity for
+    // a delta update, or the unchanged data for a full encode
+    std::vector<u8> row_data(rows.size() * n * block_sz);
+    std::vector<bool> use_delta(rows.size());
+    std::vector<ShardIo> reads;
+    usize r = 0;
+    for (const auto &[row, new_data] : rows)
+    {
+      auto row_buf = row_data.data() + r * n * block_sz;
+      const auto changed = static_cast<usize>(
+          std::count_if(new_data.begin(), new_data.end(),
+                        [](const u8 *p) { return p != nullptr; }));
+      use_delta[r] = this->failed_cnt() == 0 && changed + m < k - changed;
+
+      for (usize shard = 0; shard < k; ++shard)
+      {
+        auto shard_buf = row_buf + shard * block_sz;
+        if ((new_data[shard] != nullptr) == use_delta[r])
+        {
+          reads.push_back({row, shard, shard_buf});
+        }
+        else if (new_data[shard] != nullptr)
+        {
+          memcpy(shard_buf, new_data[shard], block_sz);
+        }
+      }
+      if (use_delta[r])
+      {
+        for (usize i = 0; i < m; ++i)
+        {
+          reads.push_back({row, k + i, row_buf + (k + i) * block_sz});
+        }
+      }
+      r += 1;
+    }
+    auto res = this->read_shards(reads);
+    if (res.is_err())
+    {
+      return res;
+    }
+
+    // 3. compute the parity
+    std::vector<ShardIo> writes;
+    std::vector<u8 *> ptrs(n);
+    r = 0;
+    for (const auto &[row, new_data] : rows)
+    {
+      auto row_buf = row_data.data() + r * n * block_sz;
+      for (usize shard = 0; shard < n; ++shard)
+      {
+        ptrs[shard] = row_buf + shard * block_sz;
+      }
+
+      if (use_delta[r])
+      {
+        for (usize shard = 0; shard < k; ++shard)
+        {
+          if (new_data[shard] == nullptr)
+          {
+            continue;
+          }
+          // old ^ new
+          gf_mul_add_region(this->codec.get_kernel(), 1, new_data[shard],
+                            ptrs[shard], block_sz);
+          for (usize i = 0; i < m; ++i)
+          {
+            this->codec.update(i, shard, ptrs[shard], ptrs[k + i], block_sz);
+          }
+        }
+      }
+      else
+      {
+        this->codec.encode(ptrs.data(), ptrs.data() + k, block_sz);
+      }
+
+      for (usize shard = 0; shard < k; ++shard)
+      {
+        if (new_data[shard] != nullptr)
+        {
+          writes.push_back({row, shard, const_cast<u8 *>(new_data[shard])});
+        }
+      }
+      for (usize i = 0; i < m; ++i)
+      {
+        writes.push_back({row, k + i, ptrs[k + i]});
+      }
+      r += 1;
+    }
+
+    // 4. write the new data and the parity
+    return this->write_shards(writes);
+  }
+
+  auto ErasureBlockManager::write_block(block_id_t block_id, const u8 *data)
+      -> ChfsNullResult
+  {
+    return this->write_blocks({block_id}, data);
+  }
+
+  auto ErasureBlockManager::write_partial_block(block_id_t block_id,
+                                                const u8 *data, usize offset,
+                                                usize len) -> ChfsNullResult
+  {
+    if (offset + len > this->block_sz)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    std::vector<u8> buffer(this->block_sz);
+    auto res = this->read_block(block_id, buffer.data());
+    if (res.is_err())
+    {
+      return res;
+    }
+    memcpy(buffer.data() + offset, data, len);
+    return this->write_block(block_id, buffer.data());
+  }
+
+  auto ErasureBlockManager::read_block(block_id_t block_id, u8 *data)
+      -> ChfsNullResult
+  {
+    return this->read_blocks({block_id}, data);
+  }
+
+  auto ErasureBlockManager::zero_block(block_id_t block_id) -> ChfsNullResult
+  {
+    std::vector<u8> buffer(this->block_sz, 0);
+    return this->write_block(block_id, buffer.data());
+  }
+
+  auto ErasureBlockManager::discard_blocks(
+      const std::vector<block_id_t> &block_ids) -> ChfsNullResult
+  {
+    if (!this->check_batch(block_ids))
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    const auto k = this->codec.data_cnt();
+    std::vector<block_id_t> sorted = block_ids;
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+    // The parity of a zero row is zero, so a whole row can be discarded on
+    // every device. The other blocks are zeroed with their parity.
+    std::vector<block_id_t> whole_rows;
+    std::vector<block_id_t> partial;
+    for (usize i = 0; i < sorted.size();)
+    {
+      auto row = sorted[i] / k;
+      usize j = i;
+      while (j < sorted.size() && sorted[j] / k == row)
+      {
+        j += 1;
+      }
+      if (j - i == k)
+      {
+        whole_rows.push_back(row);
+      }
+      else
+      {
+        partial.insert(partial.end(), sorted.begin() + i, sorted.begin() + j);
+      }
+      i = j;
+    }
+
+    if (!whole_rows.empty())
+    {
+      auto res = this->for_each_device(
+          [this, &whole_rows](usize d)
+          { return this->devices[d]->discard_blocks(whole_rows); });
+      if (res.is_err())
+      {
+        return res;
+      }
+    }
+    if (!partial.empty())
+    {
+      std::vector<u8> zeros(partial.size() * this->block_sz, 0);
+      return this->write_blocks(partial, zeros.data());
+    }
+    return KNullOk;
+  }
+
+  auto ErasureBlockManager::sync_range(block_id_t start, usize cnt)
+      -> ChfsNullResult
+  {
+    if (start > this->block_cnt || cnt > this->block_cnt - start)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    if (cnt == 0)
+    {
+      return KNullOk;
+    }
+
+    // the rows of the range, including their parity
+    const auto k = this->codec.data_cnt();
+    const auto first = start / k;
+    const auto last = (start + cnt - 1) / k;
+    return this->for_each_device(
+        [this, first, last](usize d)
+        { return this->devices[d]->sync_range(first, last - first + 1); });
+  }
+
+  auto ErasureBlockManager::sync_all() -> ChfsNullResult
+  {
+    return this->for_each_device([this](usize d)
+                                 { return this->devices[d]->sync_all(); });
+  }
+
+} // namespace chfs
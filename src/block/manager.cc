@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cerrno>
 #include <cstring>
 #include <fcntl.h>
 #include <filesystem>
@@ -6,10 +8,14 @@
 #include <unistd.h>
 
 #include "block/manager.h"
+#include "common/stream.h"
 
 namespace chfs
 {
 
+  // the size of a huge page on x86-64, which MAP_HUGETLB uses by default
+  static const u64 KHugePageSize = 2 * 1024 * 1024;
+
   auto get_file_sz(std::string &file_name) -> usize
   {
     std::filesystem::path path = file_name;
@@ -42,24 +48,52 @@ namespace chfs
    * device's blocks are more or less than it, the manager should adjust the
    * actual block cnt.
    */
-  BlockManager::BlockManager(usize block_cnt, usize block_size)
+  BlockManager::BlockManager(usize block_cnt, usize block_size,
+                             HugePageMode huge_page)
       : block_sz(block_size), file_name_("in-memory"), fd(-1),
         block_cnt(block_cnt), in_memory(true)
   {
     // An important step to prevent overflow
     u64 buf_sz = static_cast<u64>(block_cnt) * static_cast<u64>(block_size);
     CHFS_VERIFY(buf_sz > 0, "Santiy check buffer size fails");
-    this->block_data = new u8[buf_sz];
-    CHFS_VERIFY(this->block_data != nullptr, "Failed to allocate memory");
+
+    // Map the device lazily, the pages are zero-filled on the first touch,
+    // so the start-up cost does not depend on the device size.
+    const int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+    void *data = MAP_FAILED;
+    if (huge_page == HugePageMode::Explicit)
+    {
+      this->map_sz = (buf_sz + KHugePageSize - 1) / KHugePageSize * KHugePageSize;
+      // hugetlb pages are reserved up front (no MAP_NORESERVE), otherwise an
+      // exhausted pool would raise SIGBUS on the first touch
+      data = mmap(nullptr, this->map_sz, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      this->hugetlb = data != MAP_FAILED;
+    }
+    if (data == MAP_FAILED)
+    {
+      this->map_sz = buf_sz;
+      data = mmap(nullptr, this->map_sz, PROT_READ | PROT_WRITE, flags, -1, 0);
+      CHFS_VERIFY(data != MAP_FAILED, "Failed to allocate memory");
+      if (huge_page != HugePageMode::None)
+      {
+        // only a hint, the kernel may have transparent huge pages disabled
+        madvise(data, this->map_sz, MADV_HUGEPAGE);
+      }
+    }
+    this->block_data = static_cast<u8 *>(data);
   }
 
   /**
    * Core constructor: open/create a single database file & log file
    * @input db_file: database file name
    */
-  BlockManager::BlockManager(const std::string &file, usize block_cnt)
-      : file_name_(file), block_cnt(block_cnt), in_memory(false)
+  BlockManager::BlockManager(const std::string &file, usize block_cnt,
+                             usize block_size)
+      : block_sz(block_size), file_name_(file), block_cnt(block_cnt),
+        in_memory(false)
   {
+    CHFS_VERIFY(is_valid_block_size(block_size), "Unsupported block size");
     this->fd = open(file.c_str(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
     CHFS_ASSERT(this->fd != -1, "Failed to open the block manager file");
 
@@ -70,9 +104,9 @@ namespace chfs
     }
     else
     {
+      // the device may have been grown, so trust the file size
       this->block_cnt = file_sz / this->block_sz;
-      CHFS_ASSERT(this->total_storage_sz() == KDefaultBlockCnt * this->block_sz,
-                  "The file size mismatches");
+      CHFS_ASSERT(this->block_cnt > 0, "The file is smaller than a block");
     }
 
     this->block_data =
@@ -81,6 +115,40 @@ namespace chfs
     CHFS_ASSERT(this->block_data != MAP_FAILED, "Failed to mmap the data");
   }
 
+  BlockManager::BlockManager(const std::string &file, int fd, usize block_cnt,
+                             usize block_size)
+      : block_sz(block_size), file_name_(file), fd(fd), block_data(nullptr),
+        block_cnt(block_cnt), in_memory(false) {}
+
+  auto BlockManager::open_block_file(const std::string &file, int flags,
+                                     usize block_cnt, usize block_size)
+      -> std::pair<int, usize>
+  {
+    auto fd = open(file.c_str(), O_RDWR | O_CREAT | flags, S_IRUSR | S_IWUSR);
+    if (fd == -1)
+    {
+      return {-1, 0};
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+      close(fd);
+      return {-1, 0};
+    }
+
+    if (st.st_size == 0)
+    {
+      if (ftruncate(fd, static_cast<u64>(block_cnt) * block_size) == -1)
+      {
+        close(fd);
+        return {-1, 0};
+      }
+      return {fd, block_cnt};
+    }
+    return {fd, static_cast<usize>(st.st_size / block_size)};
+  }
+
   auto BlockManager::write_block(block_id_t block_id, const u8 *data)
       -> ChfsNullResult
   {
@@ -127,64 +195,426 @@ namespace chfs
     return KNullOk;
   }
 
+  auto BlockManager::zero_blocks(block_id_t start, usize cnt) -> ChfsNullResult
+  {
+    if (start > this->block_cnt || cnt > this->block_cnt - start)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    if (block_data == nullptr)
+    {
+      // the device cannot be addressed directly, go block by block
+      for (usize i = 0; i < cnt; ++i)
+      {
+        auto res = this->zero_block(start + i);
+        if (res.is_err())
+        {
+          return res;
+        }
+      }
+      return KNullOk;
+    }
+
+    bulk_zero(block_data + start * block_sz, static_cast<u64>(cnt) * block_sz);
+    return KNullOk;
+  }
+
+  auto BlockManager::contiguous_run_len(const std::vector<block_id_t> &block_ids,
+                                        usize from) -> usize
+  {
+    usize len = 1;
+    while (from + len < block_ids.size() &&
+           block_ids[from + len] == block_ids[from] + len)
+    {
+      len += 1;
+    }
+    return len;
+  }
+
+  auto BlockManager::check_batch(const std::vector<block_id_t> &block_ids) const
+      -> bool
+  {
+    for (auto block_id : block_ids)
+    {
+      if (block_id >= this->block_cnt)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  auto BlockManager::read_blocks(const std::vector<block_id_t> &block_ids,
+                                 u8 *data) -> ChfsNullResult
+  {
+    if (!this->check_batch(block_ids))
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    if (block_data == nullptr)
+    {
+      // the device cannot be addressed directly, go block by block
+      for (usize i = 0; i < block_ids.size(); ++i)
+      {
+        auto res = this->read_block(block_ids[i], data + static_cast<u64>(i) * block_sz);
+        if (res.is_err())
+        {
+          return res;
+        }
+      }
+      return KNullOk;
+    }
+
+    for (usize i = 0; i < block_ids.size();)
+    {
+      auto len = contiguous_run_len(block_ids, i);
+      memcpy(data + static_cast<u64>(i) * block_sz,
+             block_data + block_ids[i] * block_sz,
+             static_cast<u64>(len) * block_sz);
+      i += len;
+    }
+    return KNullOk;
+  }
+
+  auto BlockManager::write_blocks(const std::vector<block_id_t> &block_ids,
+                                  const u8 *data) -> ChfsNullResult
+  {
+    if (!this->check_batch(block_ids))
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    if (block_data == nullptr)
+    {
+      // the device cannot be addressed directly, go block by block
+      for (usize i = 0; i < block_ids.size(); ++i)
+      {
+        auto res = this->write_block(block_ids[i], data + static_cast<u64>(i) * block_sz);
+        if (res.is_err())
+        {
+          return res;
+        }
+      }
+      return KNullOk;
+    }
+
+    for (usize i = 0; i < block_ids.size();)
+    {
+      auto len = contiguous_run_len(block_ids, i);
+      bulk_copy(block_data + block_ids[i] * block_sz,
+                data + static_cast<u64>(i) * block_sz,
+                static_cast<u64>(len) * block_sz);
+      i += len;
+    }
+    return KNullOk;
+  }
+
+  auto BlockManager::discard_blocks(const std::vector<block_id_t> &block_ids)
+      -> ChfsNullResult
+  {
+    if (!this->check_batch(block_ids))
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    std::vector<block_id_t> sorted_ids = block_ids;
+    std::sort(sorted_ids.begin(), sorted_ids.end());
+    sorted_ids.erase(std::unique(sorted_ids.begin(), sorted_ids.end()),
+                     sorted_ids.end());
+
+    static const u64 page_sz = sysconf(_SC_PAGESIZE);
+    for (usize i = 0; i < sorted_ids.size();)
+    {
+      auto len = contiguous_run_len(sorted_ids, i);
+      u64 begin = sorted_ids[i] * this->block_sz;
+      u64 end = begin + static_cast<u64>(len) * this->block_sz;
+      i += len;
+
+      if (this->in_memory)
+      {
+        // only whole pages can be dropped, zero the partial ones
+        u64 page_begin = (begin + page_sz - 1) / page_sz * page_sz;
+        u64 page_end = end / page_sz * page_sz;
+        if (page_begin >= page_end)
+        {
+          memset(this->block_data + begin, 0, end - begin);
+          continue;
+        }
+        memset(this->block_data + begin, 0, page_begin - begin);
+        memset(this->block_data + page_end, 0, end - page_end);
+        if (madvise(this->block_data + page_begin, page_end - page_begin,
+                    MADV_DONTNEED) == -1)
+        {
+          memset(this->block_data + page_begin, 0, page_end - page_begin);
+        }
+        continue;
+      }
+
+      if (this->fd != -1 &&
+          fallocate(this->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                    begin, end - begin) == 0)
+      {
+        continue;
+      }
+      if (this->fd != -1 && errno != EOPNOTSUPP)
+      {
+        return ChfsNullResult(ErrorType::IOError);
+      }
+
+      // the device cannot punch holes, zero the blocks instead
+      for (usize j = 0; j < len; ++j)
+      {
+        auto res = this->zero_block(begin / this->block_sz + j);
+        if (res.is_err())
+        {
+          return res;
+        }
+      }
+    }
+    return KNullOk;
+  }
+
+  auto BlockManager::sync_range(block_id_t start, usize cnt) -> ChfsNullResult
+  {
+    if (start > this->block_cnt || cnt > this->block_cnt - start)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    if (this->in_memory || cnt == 0)
+    {
+      return KNullOk;
+    }
+
+    if (this->block_data != nullptr)
+    {
+      // msync requires a page-aligned address
+      static const u64 page_sz = sysconf(_SC_PAGESIZE);
+      u64 begin = start * this->block_sz / page_sz * page_sz;
+      u64 end = (start + cnt) * this->block_sz;
+      if (msync(this->block_data + begin, end - begin, MS_SYNC) == -1)
+      {
+        return ChfsNullResult(ErrorType::IOError);
+      }
+      return KNullOk;
+    }
+
+    // the data was written with write(2), the page cache only knows how to
+    // sync the whole file
+    if (fdatasync(this->fd) == -1)
+    {
+      return ChfsNullResult(ErrorType::IOError);
+    }
+    return KNullOk;
+  }
+
+  auto BlockManager::sync_all() -> ChfsNullResult
+  {
+    return this->sync_range(0, this->block_cnt);
+  }
+
+  auto BlockManager::grow(usize new_block_cnt) -> ChfsNullResult
+  {
+    if (new_block_cnt < this->block_cnt)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    if (new_block_cnt == this->block_cnt)
+    {
+      return KNullOk;
+    }
+    if (!this->in_memory && this->fd == -1)
+    {
+      // the device has no storage of its own
+      return ChfsNullResult(ErrorType::INVALID);
+    }
+
+    const u64 old_sz = this->total_storage_sz();
+    const u64 new_sz = static_cast<u64>(new_block_cnt) * this->block_sz;
+
+    if (this->in_memory)
+    {
+      u64 new_map_sz = new_sz;
+      if (this->hugetlb)
+      {
+        new_map_sz = (new_sz + KHugePageSize - 1) / KHugePageSize * KHugePageSize;
+      }
+      if (new_map_sz > this->map_sz)
+      {
+        auto data = mremap(this->block_data, this->map_sz, new_map_sz,
+                           MREMAP_MAYMOVE);
+        if (data == MAP_FAILED)
+        {
+          return ChfsNullResult(ErrorType::OUT_OF_RESOURCE);
+        }
+        this->block_data = static_cast<u8 *>(data);
+        this->map_sz = new_map_sz;
+      }
+      this->block_cnt = new_block_cnt;
+      return KNullOk;
+    }
+
+    if (ftruncate(this->fd, new_sz) == -1)
+    {
+      return ChfsNullResult(ErrorType::IOError);
+    }
+    if (this->block_data != nullptr)
+    {
+      auto data = mremap(this->block_data, old_sz, new_sz, MREMAP_MAYMOVE);
+      if (data == MAP_FAILED)
+      {
+        // keep the old size, the file is only truncated back
+        [[maybe_unused]] auto ret = ftruncate(this->fd, old_sz);
+        return ChfsNullResult(ErrorType::OUT_OF_RESOURCE);
+      }
+      this->block_data = static_cast<u8 *>(data);
+    }
+    this->block_cnt = new_block_cnt;
+    return KNullOk;
+  }
+
+  auto BlockManager::map_blocks(block_id_t start, usize cnt) -> u8 *
+  {
+    // the run is contiguous in the mapping
+    return BlockManager::map_block(start);
+  }
+
+  auto BlockManager::readahead(block_id_t start, usize cnt) -> void
+  {
+    if (this->in_memory || start >= this->block_cnt)
+    {
+      return;
+    }
+    cnt = std::min<usize>(cnt, this->block_cnt - start);
+    const u64 begin = static_cast<u64>(start) * this->block_sz;
+    const u64 len = static_cast<u64>(cnt) * this->block_sz;
+
+    // it is only a hint, the errors do not matter
+    if (this->block_data != nullptr)
+    {
+      static const u64 page_sz = sysconf(_SC_PAGESIZE);
+      const u64 aligned = begin / page_sz * page_sz;
+      madvise(this->block_data + aligned, begin + len - aligned,
+              MADV_WILLNEED);
+    }
+    else if (this->fd != -1)
+    {
+      posix_fadvise(this->fd, begin, len, POSIX_FADV_WILLNEED);
+    }
+  }
+
+  auto BlockManager::map_block(block_id_t block_id) -> u8 *
+  {
+    if (this->block_data == nullptr)
+    {
+      return nullptr;
+    }
+    return this->block_data + block_id * this->block_sz;
+  }
+
   BlockManager::~BlockManager()
   {
     if (!this->in_memory)
     {
-      munmap(this->block_data, this->total_storage_sz());
-      close(this->fd);
+      if (this->block_data != nullptr)
+      {
+        munmap(this->block_data, this->total_storage_sz());
+      }
+      if (this->fd != -1)
+      {
+        close(this->fd);
+      }
     }
     else
     {
-      delete[] this->block_data;
+      munmap(this->block_data, this->map_sz);
     }
   }
 
   // BlockIterator
   auto BlockIterator::create(BlockManager *bm, block_id_t start_block_id,
-                             block_id_t end_block_id)
+                             block_id_t end_block_id, usize window)
       -> ChfsResult<BlockIterator>
   {
+    CHFS_ASSERT(window > 0, "The window must not be empty");
+
     BlockIterator iter;
     iter.bm = bm;
     iter.cur_block_off = 0;
     iter.start_block_id = start_block_id;
     iter.end_block_id = end_block_id;
+    iter.window = window;
 
-    std::vector<u8> buffer(bm->block_sz);
+    if (start_block_id < end_block_id)
+    {
+      auto res = iter.load_window(0);
+      if (res.is_err())
+      {
+        return ChfsResult<BlockIterator>(res.unwrap_error());
+      }
+    }
+    return ChfsResult<BlockIterator>(std::move(iter));
+  }
 
-    auto res = bm->read_block(iter.cur_block_off / bm->block_sz + start_block_id,
-                              buffer.data());
-    if (res.is_ok())
+  auto BlockIterator::load_window(block_id_t from) -> ChfsNullResult
+  {
+    const auto total = this->end_block_id - this->start_block_id;
+    const auto len = static_cast<usize>(
+        std::min<block_id_t>(this->window, total - from));
+    const auto first = this->start_block_id + from;
+
+    this->mapped = this->bm->map_blocks(first, len);
+    if (this->mapped == nullptr)
     {
-      iter.buffer = std::move(buffer);
-      return ChfsResult<BlockIterator>(iter);
+      std::vector<block_id_t> block_ids(len);
+      for (usize i = 0; i < len; ++i)
+      {
+        block_ids[i] = first + i;
+      }
+      this->buffer.resize(static_cast<u64>(len) * this->bm->block_sz);
+      auto res = this->bm->read_blocks(block_ids, this->buffer.data());
+      if (res.is_err())
+      {
+        this->win_len = 0;
+        return res;
+      }
     }
-    return ChfsResult<BlockIterator>(res.unwrap_error());
+    this->win_start = from;
+    this->win_len = len;
+
+    // fetch the next window while this one is scanned
+    if (from + len < total)
+    {
+      this->bm->readahead(
+          first + len,
+          static_cast<usize>(std::min<block_id_t>(this->window,
+                                                  total - from - len)));
+    }
+    return KNullOk;
   }
 
   // assumption: a previous call of has_next() returns true
   auto BlockIterator::next(usize offset) -> ChfsNullResult
   {
-    auto prev_block_id = this->cur_block_off / bm->block_size();
     this->cur_block_off += offset;
 
     auto new_block_id = this->cur_block_off / bm->block_size();
-    // move forward
-    if (new_block_id != prev_block_id)
+    if (this->start_block_id + new_block_id > this->end_block_id)
     {
-      if (this->start_block_id + new_block_id > this->end_block_id)
-      {
-        return ChfsNullResult(ErrorType::DONE);
-      }
+      return ChfsNullResult(ErrorType::DONE);
+    }
+    if (this->start_block_id + new_block_id == this->end_block_id)
+    {
+      // just reached the end, has_next() tells
+      return KNullOk;
+    }
 
-      // else: we need to refresh the buffer
-      auto res = bm->read_block(this->start_block_id + new_block_id,
-                                this->buffer.data());
-      if (res.is_err())
-      {
-        return ChfsNullResult(res.unwrap_error());
-      }
+    // move forward out of the window
+    if (new_block_id < this->win_start ||
+        new_block_id >= this->win_start + this->win_len)
+    {
+      return this->load_window(new_block_id);
     }
     return KNullOk;
   }
@@ -0,0 +1,498 @@
+#include <algorithm>
+
+#include "block/backend.h"
+#include "block/mirrored_manager.h"
+
+namespace chfs
+{
+
+  // a batched read of at least this many blocks is split among the replicas
+  static const usize KSplitReadBlocks = 32;
+  // number of blocks copied at once by the rebuild
+  static const usize KRebuildBatchBlocks = 256;
+
+  MirroredBlockManager::MirroredBlockManager(
+      std::vector<std::shared_ptr<BlockManager>> replicas,
+      ReadPolicy read_policy)
+      : BlockManager("mirrored", -1, min_device_block_cnt(replicas),
+                     replicas[0]->block_size()),
+        read_policy(read_policy), workers(replicas.size())
+  {
+    for (auto &replica : replicas)
+    {
+      this->replicas.push_back(std::make_unique<Replica>());
+      this->replicas.back()->bm = std::move(replica);
+    }
+  }
+
+  MirroredBlockManager::~MirroredBlockManager()
+  {
+    this->rebuild_stop = true;
+    if (this->rebuild_thread.joinable())
+    {
+      this->rebuild_thread.join();
+    }
+  }
+
+  auto MirroredBlockManager::get_replica(usize idx) const
+      -> std::shared_ptr<BlockManager>
+  {
+    std::shared_lock<std::shared_mutex> lock(this->mtx);
+    return this->replicas[idx]->bm;
+  }
+
+  auto MirroredBlockManager::replica_state(usize idx) const -> ReplicaState
+  {
+    return this->replicas[idx]->state;
+  }
+
+  auto MirroredBlockManager::healthy_cnt() const -> usize
+  {
+    usize cnt = 0;
+    for (const auto &replica : this->replicas)
+    {
+      if (replica->state == ReplicaState::Healthy)
+      {
+        cnt += 1;
+      }
+    }
+    return cnt;
+  }
+
+  auto MirroredBlockManager::pick_replica() -> usize
+  {
+    const auto n = this->replicas.size();
+    // start from a different replica every time, which breaks the ties
+    const auto first = this->next_replica.fetch_add(1) % n;
+
+    auto best = n;
+    for (usize i = 0; i < n; ++i)
+    {
+      auto idx = (first + i) % n;
+      if (this->replicas[idx]->state != ReplicaState::Healthy)
+      {
+        continue;
+      }
+      if (this->read_policy == ReadPolicy::RoundRobin)
+      {
+        return idx;
+      }
+      if (best == n ||
+          this->replicas[idx]->inflight < this->replicas[best]->inflight)
+      {
+        best = idx;
+      }
+    }
+    return best;
+  }
+
+  auto MirroredBlockManager::read_from_any(
+      const std::vector<block_id_t> &block_ids, u8 *data) -> ChfsNullResult
+  {
+    while (true)
+    {
+      auto idx = this->pick_replica();
+      if (idx == this->replicas.size())
+      {
+        return ChfsNullResult(ErrorType::IOError);
+      }
+
+      auto &replica = *this->replicas[idx];
+      replica.inflight += block_ids.size();
+      auto res = block_ids.size() == 1
+                     ? replica.bm->read_block(block_ids[0], data)
+                     : replica.bm->read_blocks(block_ids, data);
+      replica.inflight -= block_ids.size();
+      if (res.is_ok())
+      {
+        return res;
+      }
+
+      // the last healthy replica keeps serving, and its error is reported
+      if (this->healthy_cnt() == 1)
+      {
+        return res;
+      }
+      auto expected = ReplicaState::Healthy;
+      replica.state.compare_exchange_strong(expected, ReplicaState::Failed);
+    }
+  }
+
+  auto MirroredBlockManager::write_all(
+      const std::function<ChfsNullResult(BlockManager &)> &op, bool parallel)
+      -> ChfsNullResult
+  {
+    const auto n = this->replicas.size();
+    std::vector<ChfsNullResult> results(n, KNullOk);
+    std::vector<std::function<void()>> tasks(n);
+    for (usize i = 0; i < n; ++i)
+    {
+      if (this->replicas[i]->state == ReplicaState::Failed)
+      {
+        continue;
+      }
+      tasks[i] = [this, i, &op, &results]()
+      { results[i] = op(*this->replicas[i]->bm); };
+    }
+
+    if (parallel)
+    {
+      this->workers.run(tasks);
+    }
+    else
+    {
+      for (auto &task : tasks)
+      {
+        if (task)
+        {
+          task();
+        }
+      }
+    }
+
+    // the write only fails if no healthy replica has it
+    auto first_error = ErrorType::DONE;
+    usize written = 0;
+    for (usize i = 0; i < n; ++i)
+    {
+      if (!tasks[i])
+      {
+        continue;
+      }
+      if (results[i].is_err())
+      {
+        if (first_error == ErrorType::DONE)
+        {
+          first_error = results[i].unwrap_error();
+        }
+        continue;
+      }
+      if (this->replicas[i]->state == ReplicaState::Healthy)
+      {
+        written += 1;
+      }
+    }
+    if (written == 0)
+    {
+      return ChfsNullResult(first_error == ErrorType::DONE ? ErrorType::IOError
+                                                           : first_error);
+    }
+    for (usize i = 0; i < n; ++i)
+    {
+      if (tasks[i] && results[i].is_err())
+      {
+        this->replicas[i]->state = ReplicaState::Failed;
+      }
+    }
+    return KNullOk;
+  }
+
+  auto MirroredBlockManager::write_block(block_id_t block_id, const u8 *data)
+      -> ChfsNullResult
+  {
+    if (block_id >= this->block_cnt)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    std::unique_lock<std::shared_mutex> lock(this->mtx);
+    return this->write_all([block_id, data](BlockManager &bm)
+                           { return bm.write_block(block_id, data); },
+                           false);
+  }
+
+  auto MirroredBlockManager::write_partial_block(block_id_t block_id,
+                                                 const u8 *data, usize offset,
+                                                 usize len) -> ChfsNullResult
+  {
+    if (block_id >= this->block_cnt || offset + len > this->block_sz)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    std::unique_lock<std::shared_mutex> lock(this->mtx);
+    return this->write_all(
+        [block_id, data, offset, len](BlockManager &bm)
+        { return bm.write_partial_block(block_id, data, offset, len); },
+        false);
+  }
+
+  auto MirroredBlockManager::zero_block(block_id_t block_id) -> ChfsNullResult
+  {
+    if (block_id >= this->block_cnt)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    std::unique_lock<std::shared_mutex> lock(this->mtx);
+    return this->write_all([block_id](BlockManager &bm)
+                           { return bm.zero_block(block_id); },
+                           false);
+  }
+
+  auto MirroredBlockManager::write_blocks(
+      const std::vector<block_id_t> &block_ids, const u8 *data)
+      -> ChfsNullResult
+  {
+    if (!this->check_batch(block_ids))
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    if (block_ids.empty())
+    {
+      return KNullOk;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(this->mtx);
+    return this->write_all([&block_ids, data](BlockManager &bm)
+                           { return bm.write_blocks(block_ids, data); },
+                           block_ids.size() > 1);
+  }
+
+  auto MirroredBlockManager::discard_blocks(
+      const std::vector<block_id_t> &block_ids) -> ChfsNullResult
+  {
+    if (!this->check_batch(block_ids))
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    if (block_ids.empty())
+    {
+      return KNullOk;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(this->mtx);
+    return this->write_all([&block_ids](BlockManager &bm)
+                           { return bm.discard_blocks(block_ids); },
+                           false);
+  }
+
+  auto MirroredBlockManager::read_block(block_id_t block_id, u8 *data)
+      -> ChfsNullResult
+  {
+    if (block_id >= this->block_cnt)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    std::shared_lock<std::shared_mutex> lock(this->mtx);
+    return this->read_from_any({block_id}, data);
+  }
+
+  auto MirroredBlockManager::read_blocks(
+      const std::vector<block_id_t> &block_ids, u8 *data) -> ChfsNullResult
+  {
+    if (!this->check_batch(block_ids))
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    if (block_ids.empty())
+    {
+      return KNullOk;
+    }
+
+    std::shared_lock<std::shared_mutex> lock(this->mtx);
+    const auto healthy = this->healthy_cnt();
+    if (block_ids.size() < KSplitReadBlocks || healthy < 2)
+    {
+      return this->read_from_any(block_ids, data);
+    }
+
+    // Cut the batch into a contiguous part per healthy replica. Each part
+    // still goes through `read_from_any`, so a failed part moves on to
+    // another replica.
+    const auto n = this->replicas.size();
+    const auto part_len = (block_ids.size() + healthy - 1) / healthy;
+    std::vector<ChfsNullResult> results(n, KNullOk);
+    std::vector<std::function<void()>> tasks(n);
+    usize from = 0;
+    for (usize i = 0; i < n && from < block_ids.size(); ++i)
+    {
+      if (this->replicas[i]->state != ReplicaState::Healthy)
+      {
+        continue;
+      }
+      auto len = std::min(part_len, block_ids.size() - from);
+      tasks[i] = [this, i, from, len, &block_ids, data, &results]()
+      {
+        std::vector<block_id_t> part(block_ids.begin() + from,
+                                     block_ids.begin() + from + len);
+        auto part_data = data + static_cast<u64>(from) * this->block_sz;
+
+        auto &replica = *this->replicas[i];
+        replica.inflight += len;
+        auto res = replica.bm->read_blocks(part, part_data);
+        replica.inflight -= len;
+        if (res.is_err() && this->healthy_cnt() > 1)
+        {
+          auto expected = ReplicaState::Healthy;
+          replica.state.compare_exchange_strong(expected,
+                                                ReplicaState::Failed);
+          res = this->read_from_any(part, part_data);
+        }
+        results[i] = res;
+      };
+      from += len;
+    }
+    this->workers.run(tasks);
+
+    for (const auto &res : results)
+    {
+      if (res.is_err())
+      {
+        return res;
+      }
+    }
+    return KNullOk;
+  }
+
+  auto MirroredBlockManager::sync_range(block_id_t start, usize cnt)
+      -> ChfsNullResult
+  {
+    if (start > this->block_cnt || cnt > this->block_cnt - start)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    if (cnt == 0)
+    {
+      return KNullOk;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(this->mtx);
+    return this->write_all([start, cnt](BlockManager &bm)
+                           { return bm.sync_range(start, cnt); },
+                           true);
+  }
+
+  auto MirroredBlockManager::sync_all() -> ChfsNullResult
+  {
+    std::unique_lock<std::shared_mutex> lock(this->mtx);
+    return this->write_all([](BlockManager &bm) { return bm.sync_all(); },
+                           true);
+  }
+
+  auto MirroredBlockManager::fail_replica(usize idx) -> ChfsNullResult
+  {
+    if (idx >= this->replicas.size())
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    std::unique_lock<std::shared_mutex> lock(this->mtx);
+    auto &replica = *this->replicas[idx];
+    if (replica.state == ReplicaState::Healthy && this->healthy_cnt() == 1)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    if (replica.state == ReplicaState::Rebuilding)
+    {
+      // let the rebuild stop first
+      lock.unlock();
+      this->rebuild_stop = true;
+      this->wait_rebuild();
+      lock.lock();
+    }
+    replica.state = ReplicaState::Failed;
+    return KNullOk;
+  }
+
+  auto MirroredBlockManager::rebuild_replica(
+      usize idx, std::shared_ptr<BlockManager> replacement) -> ChfsNullResult
+  {
+    if (idx >= this->replicas.size())
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    if (replacement != nullptr &&
+        (replacement->block_size() != this->block_sz ||
+         replacement->total_blocks() < this->block_cnt))
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    std::unique_lock<std::shared_mutex> lock(this->mtx);
+    auto &replica = *this->replicas[idx];
+    if (replica.state != ReplicaState::Failed)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    for (const auto &other : this->replicas)
+    {
+      if (other->state == ReplicaState::Rebuilding)
+      {
+        return ChfsNullResult(ErrorType::INVALID_ARG);
+      }
+    }
+    if (this->rebuild_thread.joinable())
+    {
+      // the last rebuild has ended
+      this->rebuild_thread.join();
+    }
+
+    if (replacement != nullptr)
+    {
+      replica.bm = std::move(replacement);
+    }
+    replica.state = ReplicaState::Rebuilding;
+    this->rebuild_stop = false;
+    this->rebuild_done = 0;
+    this->rebuild_thread = std::thread(&MirroredBlockManager::rebuild, this, idx);
+    return KNullOk;
+  }
+
+  auto MirroredBlockManager::wait_rebuild() -> bool
+  {
+    if (this->rebuild_thread.joinable())
+    {
+      this->rebuild_thread.join();
+    }
+    return this->healthy_cnt() == this->replicas.size();
+  }
+
+  auto MirroredBlockManager::rebuild(usize idx) -> void
+  {
+    auto &target = *this->replicas[idx];
+    std::vector<u8> buffer(KRebuildBatchBlocks * this->block_sz);
+    std::vector<block_id_t> block_ids;
+
+    block_id_t start = 0;
+    while (start < this->block_cnt)
+    {
+      if (this->rebuild_stop)
+      {
+        target.state = ReplicaState::Failed;
+        return;
+      }
+
+      // The writes wait for the batch, so the batch cannot overwrite a
+      // newer block, and the blocks written later reach the target anyway.
+      std::unique_lock<std::shared_mutex> lock(this->mtx);
+      if (target.state != ReplicaState::Rebuilding)
+      {
+        // a write to the target has failed
+        return;
+      }
+      auto n = std::min<usize>(KRebuildBatchBlocks, this->block_cnt - start);
+      block_ids.resize(n);
+      for (usize i = 0; i < n; ++i)
+      {
+        block_ids[i] = start + i;
+      }
+
+      auto res = this->read_from_any(block_ids, buffer.data());
+      if (res.is_ok())
+      {
+        res = target.bm->write_blocks(block_ids, buffer.data());
+      }
+      if (res.is_err())
+      {
+        target.state = ReplicaState::Failed;
+        return;
+      }
+      start += n;
+      this->rebuild_done = start;
+    }
+    target.state = ReplicaState::Healthy;
+  }
+
+} // namespace chfs
@@ -0,0 +1,213 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "block/pread_manager.h"
+
+namespace chfs
+{
+
+  PreadBlockManager::PreadBlockManager(const std::string &file,
+                                       usize block_cnt, bool direct_io,
+                                       usize block_size)
+      : PreadBlockManager(file,
+                          open_block_file(file, direct_io ? O_DIRECT : 0,
+                                          block_cnt, block_size),
+                          direct_io, block_size) {}
+
+  PreadBlockManager::PreadBlockManager(const std::string &file,
+                                       std::pair<int, usize> opened,
+                                       bool direct_io, usize block_size)
+      : BlockManager(file, opened.first, opened.second, block_size),
+        direct_io(direct_io)
+  {
+    CHFS_VERIFY(this->fd != -1, "Failed to open the block manager file");
+    CHFS_VERIFY(is_valid_block_size(block_size), "Unsupported block size");
+
+    auto res = posix_memalign(reinterpret_cast<void **>(&this->scratch),
+                              KDirectIOAlign, this->block_sz);
+    CHFS_VERIFY(res == 0, "Failed to allocate memory");
+  }
+
+  PreadBlockManager::~PreadBlockManager() { free(this->scratch); }
+
+  auto PreadBlockManager::is_aligned(const void *ptr) const -> bool
+  {
+    return !this->direct_io ||
+           reinterpret_cast<uintptr_t>(ptr) % KDirectIOAlign == 0;
+  }
+
+  auto PreadBlockManager::read_range(u8 *buf, u64 offset, u64 len)
+      -> ChfsNullResult
+  {
+    while (len > 0)
+    {
+      auto ret = pread(this->fd, buf, len, offset);
+      if (ret < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      if (ret <= 0)
+      {
+        return ChfsNullResult(ErrorType::IOError);
+      }
+      buf += ret;
+      offset += ret;
+      len -= ret;
+    }
+    return KNullOk;
+  }
+
+  auto PreadBlockManager::write_range(const u8 *buf, u64 offset, u64 len)
+      -> ChfsNullResult
+  {
+    while (len > 0)
+    {
+      auto ret = pwrite(this->fd, buf, len, offset);
+      if (ret < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      if (ret <= 0)
+      {
+        return ChfsNullResult(ErrorType::IOError);
+      }
+      buf += ret;
+      offset += ret;
+      len -= ret;
+    }
+    return KNullOk;
+  }
+
+  auto PreadBlockManager::read_blocks(const std::vector<block_id_t> &block_ids,
+                                      u8 *data) -> ChfsNullResult
+  {
+    if (!this->check_batch(block_ids))
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    for (usize i = 0; i < block_ids.size();)
+    {
+      auto len = contiguous_run_len(block_ids, i);
+      auto dst = data + static_cast<u64>(i) * this->block_sz;
+
+      if (this->is_aligned(dst))
+      {
+        auto res = this->read_range(dst, block_ids[i] * this->block_sz,
+                                    static_cast<u64>(len) * this->block_sz);
+        if (res.is_err())
+        {
+          return res;
+        }
+        i += len;
+        continue;
+      }
+
+      // stage the unaligned run block by block
+      for (usize j = 0; j < len; ++j)
+      {
+        auto res = this->read_range(this->scratch,
+                                    (block_ids[i] + j) * this->block_sz,
+                                    this->block_sz);
+        if (res.is_err())
+        {
+          return res;
+        }
+        memcpy(dst + static_cast<u64>(j) * this->block_sz, this->scratch,
+               this->block_sz);
+      }
+      i += len;
+    }
+    return KNullOk;
+  }
+
+  auto PreadBlockManager::write_blocks(const std::vector<block_id_t> &block_ids,
+                                       const u8 *data) -> ChfsNullResult
+  {
+    if (!this->check_batch(block_ids))
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    for (usize i = 0; i < block_ids.size();)
+    {
+      auto len = contiguous_run_len(block_ids, i);
+      auto src = data + static_cast<u64>(i) * this->block_sz;
+
+      if (this->is_aligned(src))
+      {
+        auto res = this->write_range(src, block_ids[i] * this->block_sz,
+                                     static_cast<u64>(len) * this->block_sz);
+        if (res.is_err())
+        {
+          return res;
+        }
+        i += len;
+        continue;
+      }
+
+      // stage the unaligned run block by block
+      for (usize j = 0; j < len; ++j)
+      {
+        memcpy(this->scratch, src + static_cast<u64>(j) * this->block_sz,
+               this->block_sz);
+        auto res = this->write_range(this->scratch,
+                                     (block_ids[i] + j) * this->block_sz,
+                                     this->block_sz);
+        if (res.is_err())
+        {
+          return res;
+        }
+      }
+      i += len;
+    }
+    return KNullOk;
+  }
+
+  auto PreadBlockManager::read_block(block_id_t block_id, u8 *data)
+      -> ChfsNullResult
+  {
+    return this->read_blocks({block_id}, data);
+  }
+
+  auto PreadBlockManager::write_block(block_id_t block_id, const u8 *data)
+      -> ChfsNullResult
+  {
+    return this->write_blocks({block_id}, data);
+  }
+
+  auto PreadBlockManager::write_partial_block(block_id_t block_id,
+                                              const u8 *data, usize offset,
+                                              usize len) -> ChfsNullResult
+  {
+    if (block_id >= this->block_cnt || offset + len > this->block_sz)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    if (!this->direct_io)
+    {
+      return this->write_range(data, block_id * this->block_sz + offset, len);
+    }
+
+    // O_DIRECT cannot write a partial block, so read-modify-write it
+    auto res = this->read_range(this->scratch, block_id * this->block_sz,
+                                this->block_sz);
+    if (res.is_err())
+    {
+      return res;
+    }
+    memcpy(this->scratch + offset, data, len);
+    return this->write_range(this->scratch, block_id * this->block_sz,
+                             this->block_sz);
+  }
+
+  auto PreadBlockManager::zero_block(block_id_t block_id) -> ChfsNullResult
+  {
+    memset(this->scratch, 0, this->block_sz);
+    return this->write_blocks({block_id}, this->scratch);
+  }
+
+} // namespace chfs
@@ -0,0 +1,597 @@
+#include <algorithm>
+#include <cstring>
+
+#include "block/snapshot_manager.h"
+
+namespace chfs
+{
+
+  static const u64 KSnapshotMagic = 0x70616e73'73666863; // "chfssnap"
+
+  struct SnapshotHeader
+  {
+    u64 magic;
+    u32 next_id;
+    u32 snapshot_cnt;
+    u32 ids[KMaxSnapshots];
+  };
+
+  // an entry of the remap log, `snapshot_id` 0 ends the log
+  struct RemapEntry
+  {
+    u64 block_id;
+    u32 snapshot_id;
+    // relative to the start of the store
+    u32 store_idx;
+  };
+
+  static auto log_block_cnt(usize store_block_cnt, usize block_size) -> usize
+  {
+    const usize per = block_size / sizeof(RemapEntry);
+    return (store_block_cnt + per - 1) / per;
+  }
+
+  auto SnapshotBlockManager::reserved_block_cnt(usize store_block_cnt,
+                                                usize block_size) -> usize
+  {
+    return 1 + log_block_cnt(store_block_cnt, block_size) + store_block_cnt;
+  }
+
+  SnapshotBlockManager::SnapshotBlockManager(
+      std::shared_ptr<BlockManager> inner, usize store_block_cnt,
+      bool will_initialize)
+      : BlockManager("snapshot", -1,
+                     inner->total_blocks() -
+                         reserved_block_cnt(store_block_cnt,
+                                            inner->block_size()),
+                     inner->block_size()),
+        inner(inner), header_block_id(this->block_cnt),
+        log_block_id(this->header_block_id + 1),
+        store_block_id(this->log_block_id +
+                       log_block_cnt(store_block_cnt, inner->block_size())),
+        store_block_cnt(store_block_cnt)
+  {
+    CHFS_VERIFY(this->inner->total_blocks() >
+                    reserved_block_cnt(store_block_cnt, this->block_sz),
+                "The device is too small");
+    CHFS_VERIFY(this->block_sz >= sizeof(SnapshotHeader),
+                "The block is too small for the snapshot header");
+
+    if (!will_initialize)
+    {
+      this->load();
+      return;
+    }
+
+    // an empty log and no snapshots
+    this->inner
+        ->zero_blocks(this->log_block_id,
+                      this->store_block_id - this->log_block_id)
+        .unwrap();
+    this->store_header().unwrap();
+  }
+
+  auto SnapshotBlockManager::entries_per_block() const -> usize
+  {
+    return this->block_sz / sizeof(RemapEntry);
+  }
+
+  auto SnapshotBlockManager::find_snapshot(u32 id) -> Snapshot *
+  {
+    auto it = std::lower_bound(
+        this->snapshots.begin(), this->snapshots.end(), id,
+        [](const Snapshot &snapshot, u32 id)
+        { return snapshot.id < id; });
+    if (it == this->snapshots.end() || it->id != id)
+    {
+      return nullptr;
+    }
+    return &*it;
+  }
+
+  auto SnapshotBlockManager::load() -> void
+  {
+    std::vector<u8> buffer(this->block_sz);
+    this->inner->read_block(this->header_block_id, buffer.data()).unwrap();
+    auto header = reinterpret_cast<SnapshotHeader *>(buffer.data());
+    CHFS_VERIFY(header->magic == KSnapshotMagic, "No snapshots on the device");
+    CHFS_VERIFY(header->snapshot_cnt <= KMaxSnapshots, "Corrupted snapshots");
+
+    this->next_id = header->next_id;
+    for (u32 i = 0; i < header->snapshot_cnt; ++i)
+    {
+      this->snapshots.push_back({header->ids[i], {}});
+    }
+
+    // replay the log, entries of deleted snapshots are dropped
+    std::vector<bool> used(this->store_block_cnt, false);
+    const auto per = this->entries_per_block();
+    bool end = false;
+    for (block_id_t i = this->log_block_id; i < this->store_block_id && !end;
+         ++i)
+    {
+      this->inner->read_block(i, buffer.data()).unwrap();
+      auto entries = reinterpret_cast<RemapEntry *>(buffer.data());
+      for (usize j = 0; j < per; ++j)
+      {
+        if (entries[j].snapshot_id == 0)
+        {
+          end = true;
+          break;
+        }
+        this->log_entry_cnt += 1;
+        auto snapshot = this->find_snapshot(entries[j].snapshot_id);
+        if (snapshot == nullptr ||
+            entries[j].store_idx >= this->store_block_cnt)
+        {
+          continue;
+        }
+        snapshot->remap[entries[j].block_id] =
+            this->store_block_id + entries[j].store_idx;
+        used[entries[j].store_idx] = true;
+        this->store_cursor =
+            std::max<usize>(this->store_cursor, entries[j].store_idx + 1);
+      }
+    }
+
+    for (usize i = 0; i < this->store_cursor; ++i)
+    {
+      if (!used[i])
+      {
+        this->free_store_blocks.push_back(this->store_block_id + i);
+      }
+    }
+  }
+
+  auto SnapshotBlockManager::store_header() -> ChfsNullResult
+  {
+    std::vector<u8> buffer(this->block_sz, 0);
+    auto header = reinterpret_cast<SnapshotHeader *>(buffer.data());
+    header->magic = KSnapshotMagic;
+    header->next_id = this->next_id;
+    header->snapshot_cnt = static_cast<u32>(this->snapshots.size());
+    for (usize i = 0; i < this->snapshots.size(); ++i)
+    {
+      header->ids[i] = this->snapshots[i].id;
+    }
+    return this->inner->write_block(this->header_block_id, buffer.data());
+  }
+
+  auto SnapshotBlockManager::append_log(u32 id, block_id_t block_id,
+                                        block_id_t store_id) -> ChfsNullResult
+  {
+    const auto per = this->entries_per_block();
+    RemapEntry entry = {block_id, id,
+                        static_cast<u32>(store_id - this->store_block_id)};
+    auto res = this->inner->write_partial_block(
+        this->log_block_id + this->log_entry_cnt / per,
+        reinterpret_cast<const u8 *>(&entry),
+        (this->log_entry_cnt % per) * sizeof(RemapEntry), sizeof(RemapEntry));
+    if (res.is_err())
+    {
+      return res;
+    }
+    this->log_entry_cnt += 1;
+    return KNullOk;
+  }
+
+  auto SnapshotBlockManager::rewrite_log() -> ChfsNullResult
+  {
+    const auto per = this->entries_per_block();
+    std::vector<u8> buffer(this->block_sz, 0);
+    auto entries = reinterpret_cast<RemapEntry *>(buffer.data());
+    usize cnt = 0;
+    block_id_t log_block = this->log_block_id;
+
+    auto flush = [&]() -> ChfsNullResult
+    {
+      auto res = this->inner->write_block(log_block, buffer.data());
+      log_block += 1;
+      std::fill(buffer.begin(), buffer.end(), 0);
+      return res;
+    };
+
+    for (const auto &snapshot : this->snapshots)
+    {
+      for (const auto &[block_id, store_id] : snapshot.remap)
+      {
+        entries[cnt % per] = {
+            block_id, snapshot.id,
+            static_cast<u32>(store_id - this->store_block_id)};
+        cnt += 1;
+        if (cnt % per == 0)
+        {
+          auto res = flush();
+          if (res.is_err())
+          {
+            return res;
+          }
+        }
+      }
+    }
+
+    // the rest of the old log is cleared
+    const auto old_end =
+        this->log_block_id + (this->log_entry_cnt + per - 1) / per;
+    while (log_block < std::max(old_end, this->log_block_id + cnt / per + 1) &&
+           log_block < this->store_block_id)
+    {
+      auto res = flush();
+      if (res.is_err())
+      {
+        return res;
+      }
+    }
+    this->log_entry_cnt = cnt;
+    return KNullOk;
+  }
+
+  auto SnapshotBlockManager::alloc_store_block() -> ChfsResult<block_id_t>
+  {
+    if (!this->free_store_blocks.empty())
+    {
+      auto store_id = this->free_store_blocks.back();
+      this->free_store_blocks.pop_back();
+      return ChfsResult<block_id_t>(store_id);
+    }
+    if (this->store_cursor < this->store_block_cnt)
+    {
+      return ChfsResult<block_id_t>(this->store_block_id +
+                                    this->store_cursor++);
+    }
+    return ChfsResult<block_id_t>(ErrorType::OUT_OF_RESOURCE);
+  }
+
+  auto SnapshotBlockManager::preserve(const std::vector<block_id_t> &block_ids)
+      -> ChfsNullResult
+  {
+    if (this->snapshots.empty())
+    {
+      return KNullOk;
+    }
+
+    auto &latest = this->snapshots.back();
+    std::vector<block_id_t> todo;
+    for (auto block_id : block_ids)
+    {
+      if (latest.remap.count(block_id) == 0)
+      {
+        todo.push_back(block_id);
+      }
+    }
+    if (todo.empty())
+    {
+      return KNullOk;
+    }
+    std::sort(todo.begin(), todo.end());
+    todo.erase(std::unique(todo.begin(), todo.end()), todo.end());
+    if (todo.size() > this->free_store_block_cnt())
+    {
+      return ChfsNullResult(ErrorType::OUT_OF_RESOURCE);
+    }
+
+    // 1. copy the old content to the store
+    std::vector<u8> buffer(todo.size() * this->block_sz);
+    auto res = this->inner->read_blocks(todo, buffer.data());
+    if (res.is_err())
+    {
+      return res;
+    }
+    std::vector<block_id_t> store_ids;
+    store_ids.reserve(todo.size());
+    for (usize i = 0; i < todo.size(); ++i)
+    {
+      store_ids.push_back(this->alloc_store_block().unwrap());
+    }
+    res = this->inner->write_blocks(store_ids, buffer.data());
+    if (res.is_err())
+    {
+      this->free_store_blocks.insert(this->free_store_blocks.end(),
+                                     store_ids.begin(), store_ids.end());
+      return res;
+    }
+
+    // 2. record the copies before the live blocks are overwritten
+    for (usize i = 0; i < todo.size(); ++i)
+    {
+      res = this->append_log(latest.id, todo[i], store_ids[i]);
+      if (res.is_err())
+      {
+        this->free_store_blocks.insert(this->free_store_blocks.end(),
+                                       store_ids.begin() + i, store_ids.end());
+        return res;
+      }
+      latest.remap[todo[i]] = store_ids[i];
+    }
+    return KNullOk;
+  }
+
+  auto SnapshotBlockManager::write_block(block_id_t block_id, const u8 *data)
+      -> ChfsNullResult
+  {
+    return this->write_blocks({block_id}, data);
+  }
+
+  auto SnapshotBlockManager::write_partial_block(block_id_t block_id,
+                                                 const u8 *data, usize offset,
+                                                 usize len) -> ChfsNullResult
+  {
+    if (block_id >= this->block_cnt || offset + len > this->block_sz)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    auto res = this->preserve({block_id});
+    if (res.is_err())
+    {
+      return res;
+    }
+    return this->inner->write_partial_block(block_id, data, offset, len);
+  }
+
+  auto SnapshotBlockManager::read_block(block_id_t block_id, u8 *data)
+      -> ChfsNullResult
+  {
+    if (block_id >= this->block_cnt)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    return this->inner->read_block(block_id, data);
+  }
+
+  auto SnapshotBlockManager::zero_block(block_id_t block_id) -> ChfsNullResult
+  {
+    if (block_id >= this->block_cnt)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    auto res = this->preserve({block_id});
+    if (res.is_err())
+    {
+      return res;
+    }
+    return this->inner->zero_block(block_id);
+  }
+
+  auto SnapshotBlockManager::read_blocks(
+      const std::vector<block_id_t> &block_ids, u8 *data) -> ChfsNullResult
+  {
+    if (!this->check_batch(block_ids))
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    return this->inner->read_blocks(block_ids, data);
+  }
+
+  auto SnapshotBlockManager::write_blocks(
+      const std::vector<block_id_t> &block_ids, const u8 *data)
+      -> ChfsNullResult
+  {
+    if (!this->check_batch(block_ids))
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    auto res = this->preserve(block_ids);
+    if (res.is_err())
+    {
+      return res;
+    }
+    return this->inner->write_blocks(block_ids, data);
+  }
+
+  auto SnapshotBlockManager::discard_blocks(
+      const std::vector<block_id_t> &block_ids) -> ChfsNullResult
+  {
+    if (!this->check_batch(block_ids))
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    auto res = this->preserve(block_ids);
+    if (res.is_err())
+    {
+      return res;
+    }
+    return this->inner->discard_blocks(block_ids);
+  }
+
+  auto SnapshotBlockManager::sync_range(block_id_t start, usize cnt)
+      -> ChfsNullResult
+  {
+    if (start > this->block_cnt || cnt > this->block_cnt - start)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    if (cnt == 0)
+    {
+      return KNullOk;
+    }
+
+    auto res = this->inner->sync_range(start, cnt);
+    if (res.is_err())
+    {
+      return res;
+    }
+    // the preserved copies and their remap entries
+    return this->inner->sync_range(
+        this->header_block_id,
+        this->inner->total_blocks() - this->header_block_id);
+  }
+
+  auto SnapshotBlockManager::sync_all() -> ChfsNullResult
+  {
+    return this->inner->sync_all();
+  }
+
+  auto SnapshotBlockManager::create_snapshot() -> ChfsResult<u32>
+  {
+    if (this->snapshots.size() >= KMaxSnapshots)
+    {
+      return ChfsResult<u32>(ErrorType::OUT_OF_RESOURCE);
+    }
+
+    auto id = this->next_id;
+    this->snapshots.push_back({id, {}});
+    this->next_id += 1;
+    auto res = this->store_header();
+    if (res.is_err())
+    {
+      this->snapshots.pop_back();
+      this->next_id -= 1;
+      return ChfsResult<u32>(res.unwrap_error());
+    }
+    return ChfsResult<u32>(id);
+  }
+
+  auto SnapshotBlockManager::delete_snapshot(u32 id) -> ChfsNullResult
+  {
+    auto snapshot = this->find_snapshot(id);
+    if (snapshot == nullptr)
+    {
+      return ChfsNullResult(ErrorType::NotExist);
+    }
+
+    // the previous snapshot reads through the copies it has not made itself
+    auto idx = snapshot - this->snapshots.data();
+    for (const auto &[block_id, store_id] : snapshot->remap)
+    {
+      if (idx > 0 && this->snapshots[idx - 1].remap.count(block_id) == 0)
+      {
+        this->snapshots[idx - 1].remap[block_id] = store_id;
+      }
+      else
+      {
+        this->free_store_blocks.push_back(store_id);
+      }
+    }
+    this->snapshots.erase(this->snapshots.begin() + idx);
+
+    // the handed over copies are logged before the snapshot is dropped
+    auto res = this->rewrite_log();
+    if (res.is_err())
+    {
+      return res;
+    }
+    return this->store_header();
+  }
+
+  auto SnapshotBlockManager::list_snapshots() const -> std::vector<u32>
+  {
+    std::vector<u32> ids;
+    for (const auto &snapshot : this->snapshots)
+    {
+      ids.push_back(snapshot.id);
+    }
+    return ids;
+  }
+
+  auto SnapshotBlockManager::open_snapshot(u32 id)
+      -> ChfsResult<std::shared_ptr<BlockManager>>
+  {
+    if (this->find_snapshot(id) == nullptr)
+    {
+      return ChfsResult<std::shared_ptr<BlockManager>>(ErrorType::NotExist);
+    }
+    return ChfsResult<std::shared_ptr<BlockManager>>(
+        std::make_shared<SnapshotView>(this, id));
+  }
+
+  auto SnapshotBlockManager::read_snapshot_block(u32 id, block_id_t block_id,
+                                                 u8 *data) -> ChfsNullResult
+  {
+    auto snapshot = this->find_snapshot(id);
+    if (snapshot == nullptr)
+    {
+      return ChfsNullResult(ErrorType::NotExist);
+    }
+    if (block_id >= this->block_cnt)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    // the first copy made since the snapshot was taken
+    for (auto it = this->snapshots.begin() + (snapshot - this->snapshots.data());
+         it != this->snapshots.end(); ++it)
+    {
+      auto entry = it->remap.find(block_id);
+      if (entry != it->remap.end())
+      {
+        return this->inner->read_block(entry->second, data);
+      }
+    }
+    return this->inner->read_block(block_id, data);
+  }
+
+  SnapshotView::SnapshotView(SnapshotBlockManager *origin, u32 id)
+      : BlockManager("snapshot-view", -1, origin->total_blocks(),
+                     origin->block_size()),
+        origin(origin), id(id) {}
+
+  auto SnapshotView::write_block(block_id_t, const u8 *) -> ChfsNullResult
+  {
+    return ChfsNullResult(ErrorType::INVALID);
+  }
+
+  auto SnapshotView::write_partial_block(block_id_t, const u8 *, usize, usize)
+      -> ChfsNullResult
+  {
+    return ChfsNullResult(ErrorType::INVALID);
+  }
+
+  auto SnapshotView::read_block(block_id_t block_id, u8 *data)
+      -> ChfsNullResult
+  {
+    return this->origin->read_snapshot_block(this->id, block_id, data);
+  }
+
+  auto SnapshotView::zero_block(block_id_t) -> ChfsNullResult
+  {
+    return ChfsNullResult(ErrorType::INVALID);
+  }
+
+  auto SnapshotView::read_blocks(const std::vector<block_id_t> &block_ids,
+                                 u8 *data) -> ChfsNullResult
+  {
+    if (!this->check_batch(block_ids))
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    for (usize i = 0; i < block_ids.size(); ++i)
+    {
+      auto res = this->read_block(block_ids[i],
+                                  data + static_cast<u64>(i) * this->block_sz);
+      if (res.is_err())
+      {
+        return res;
+      }
+    }
+    return KNullOk;
+  }
+
+  auto SnapshotView::write_blocks(const std::vector<block_id_t> &,
+                                  const u8 *) -> ChfsNullResult
+  {
+    return ChfsNullResult(ErrorType::INVALID);
+  }
+
+  auto SnapshotView::discard_blocks(const std::vector<block_id_t> &)
+      -> ChfsNullResult
+  {
+    return ChfsNullResult(ErrorType::INVALID);
+  }
+
+  auto SnapshotView::sync_range(block_id_t start, usize cnt) -> ChfsNullResult
+  {
+    if (start > this->block_cnt || cnt > this->block_cnt - start)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    // nothing is written through the view
+    return KNullOk;
+  }
+
+  auto SnapshotView::sync_all() -> ChfsNullResult { return KNullOk; }
+
+} // namespace chfs
@@ -0,0 +1,297 @@
+#include <algorithm>
+#include <chrono>
+#include <unordered_map>
+
+#include "block/stats_manager.h"
+
+namespace chfs
+{
+
+  static std::atomic<u64> next_instance_id{1};
+
+  // The counters of the managers a thread has used. A small direct-mapped
+  // cache serves the common case of a thread using a few managers, the map
+  // serves the rest.
+  static const usize KLocalCacheSize = 4;
+
+  struct LocalStatsCache
+  {
+    u64 instance_ids[KLocalCacheSize] = {};
+    StatsBlockManager::ThreadStats *stats[KLocalCacheSize] = {};
+    std::unordered_map<u64, StatsBlockManager::ThreadStats *> others;
+  };
+
+  static thread_local LocalStatsCache local_cache;
+
+  /**
+   * Add to a counter that only the calling thread writes
+   */
+  static inline auto bump(std::atomic<u64> &counter, u64 delta) -> void
+  {
+    counter.store(counter.load(std::memory_order_relaxed) + delta,
+                  std::memory_order_relaxed);
+  }
+
+  auto BlockOpStats::percentile_ns(double p) const -> u64
+  {
+    u64 total = 0;
+    for (auto cnt : this->latency)
+    {
+      total += cnt;
+    }
+    if (total == 0)
+    {
+      return 0;
+    }
+
+    // the rank of the percentile, at least the first sample
+    auto rank = static_cast<u64>(p / 100 * static_cast<double>(total));
+    rank = std::max<u64>(std::min(rank, total), 1);
+    u64 seen = 0;
+    for (usize i = 0; i < KLatencyBuckets; ++i)
+    {
+      seen += this->latency[i];
+      if (seen >= rank)
+      {
+        return static_cast<u64>(1) << (i + 1);
+      }
+    }
+    return static_cast<u64>(1) << KLatencyBuckets;
+  }
+
+  StatsBlockManager::StatsBlockManager(std::shared_ptr<BlockManager> inner,
+                                       bool track_latency)
+      : BlockManager("stats", -1, inner->total_blocks(), inner->block_size()),
+        inner(std::move(inner)), track_latency(track_latency),
+        instance_id(next_instance_id.fetch_add(1)) {}
+
+  auto StatsBlockManager::local_stats() -> ThreadStats &
+  {
+    const auto slot = this->instance_id % KLocalCacheSize;
+    if (local_cache.instance_ids[slot] == this->instance_id)
+    {
+      return *local_cache.stats[slot];
+    }
+
+    ThreadStats *stats = nullptr;
+    auto it = local_cache.others.find(this->instance_id);
+    if (it != local_cache.others.end())
+    {
+      stats = it->second;
+    }
+    else
+    {
+      // the first call of the thread
+      std::lock_guard<std::mutex> lock(this->mtx);
+      this->thread_stats.push_back(std::make_unique<ThreadStats>());
+      stats = this->thread_stats.back().get();
+    }
+
+    // the evicted entry moves to the map
+    if (local_cache.instance_ids[slot] != 0)
+    {
+      local_cache.others[local_cache.instance_ids[slot]] =
+          local_cache.stats[slot];
+    }
+    local_cache.others.erase(this->instance_id);
+    local_cache.instance_ids[slot] = this->instance_id;
+    local_cache.stats[slot] = stats;
+    return *stats;
+  }
+
+  template <typename F>
+  auto StatsBlockManager::count(BlockOp op, usize blocks, u64 bytes, F &&f)
+      -> ChfsNullResult
+  {
+    auto &stats = this->local_stats().ops[static_cast<usize>(op)];
+
+    std::chrono::steady_clock::time_point start;
+    if (this->track_latency)
+    {
+      start = std::chrono::steady_clock::now();
+    }
+    auto res = f();
+    if (this->track_latency)
+    {
+      auto ns = static_cast<u64>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - start)
+              .count());
+      usize bucket = ns == 0 ? 0 : 63 - __builtin_clzll(ns);
+      bucket = std::min(bucket, KLatencyBuckets - 1);
+      bump(stats.total_ns, ns);
+      bump(stats.latency[bucket], 1);
+    }
+
+    bump(stats.calls, 1);
+    if (res.is_err())
+    {
+      bump(stats.errors, 1);
+    }
+    else
+    {
+      bump(stats.blocks, blocks);
+      bump(stats.bytes, bytes);
+    }
+    return res;
+  }
+
+  auto StatsBlockManager::merge() -> BlockIOStats
+  {
+    BlockIOStats res;
+    std::lock_guard<std::mutex> lock(this->mtx);
+    for (const auto &stats : this->thread_stats)
+    {
+      for (usize op = 0; op < KBlockOpCnt; ++op)
+      {
+        const auto &from = stats->ops[op];
+        auto &to = res.ops[op];
+        to.calls += from.calls.load(std::memory_order_relaxed);
+        to.errors += from.errors.load(std::memory_order_relaxed);
+        to.blocks += from.blocks.load(std::memory_order_relaxed);
+        to.bytes += from.bytes.load(std::memory_order_relaxed);
+        to.total_ns += from.total_ns.load(std::memory_order_relaxed);
+        for (usize i = 0; i < KLatencyBuckets; ++i)
+        {
+          to.latency[i] += from.latency[i].load(std::memory_order_relaxed);
+        }
+      }
+    }
+    return res;
+  }
+
+  auto StatsBlockManager::get_stats() -> BlockIOStats
+  {
+    auto res = this->merge();
+    std::lock_guard<std::mutex> lock(this->mtx);
+    for (usize op = 0; op < KBlockOpCnt; ++op)
+    {
+      const auto &base = this->baseline.ops[op];
+      auto &to = res.ops[op];
+      to.calls -= base.calls;
+      to.errors -= base.errors;
+      to.blocks -= base.blocks;
+      to.bytes -= base.bytes;
+      to.total_ns -= base.total_ns;
+      for (usize i = 0; i < KLatencyBuckets; ++i)
+      {
+        to.latency[i] -= base.latency[i];
+      }
+    }
+    return res;
+  }
+
+  auto StatsBlockManager::reset_stats() -> void
+  {
+    // the counters belong to their threads, so they are left alone
+    auto current = this->merge();
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->baseline = current;
+  }
+
+  auto StatsBlockManager::write_block(block_id_t block_id, const u8 *data)
+      -> ChfsNullResult
+  {
+    return this->count(BlockOp::Write, 1, this->block_sz, [&]()
+                       {
+                         if (block_id >= this->block_cnt)
+                         {
+                           return ChfsNullResult(ErrorType::INVALID_ARG);
+                         }
+                         return this->inner->write_block(block_id, data);
+                       });
+  }
+
+  auto StatsBlockManager::write_partial_block(block_id_t block_id,
+                                              const u8 *data, usize offset,
+                                              usize len) -> ChfsNullResult
+  {
+    return this->count(BlockOp::PartialWrite, 1, len, [&]()
+                       {
+                         if (block_id >= this->block_cnt)
+                         {
+                           return ChfsNullResult(ErrorType::INVALID_ARG);
+                         }
+                         return this->inner->write_partial_block(
+                             block_id, data, offset, len);
+                       });
+  }
+
+  auto StatsBlockManager::read_block(block_id_t block_id, u8 *data)
+      -> ChfsNullResult
+  {
+    return this->count(BlockOp::Read, 1, this->block_sz, [&]()
+                       {
+                         if (block_id >= this->block_cnt)
+                         {
+                           return ChfsNullResult(ErrorType::INVALID_ARG);
+                         }
+                         return this->inner->read_block(block_id, data);
+                       });
+  }
+
+  auto StatsBlockManager::zero_block(block_id_t block_id) -> ChfsNullResult
+  {
+    return this->count(BlockOp::Zero, 1, this->block_sz, [&]()
+                       {
+                         if (block_id >= this->block_cnt)
+                         {
+                           return ChfsNullResult(ErrorType::INVALID_ARG);
+                         }
+                         return this->inner->zero_block(block_id);
+                       });
+  }
+
+  auto StatsBlockManager::read_blocks(const std::vector<block_id_t> &block_ids,
+                                      u8 *data) -> ChfsNullResult
+  {
+    return this->count(
+        BlockOp::Read, block_ids.size(),
+        static_cast<u64>(block_ids.size()) * this->block_sz,
+        [&]() { return this->inner->read_blocks(block_ids, data); });
+  }
+
+  auto StatsBlockManager::write_blocks(const std::vector<block_id_t> &block_ids,
+                                       const u8 *data) -> ChfsNullResult
+  {
+    return this->count(
+        BlockOp::Write, block_ids.size(),
+        static_cast<u64>(block_ids.size()) * this->block_sz,
+        [&]() { return this->inner->write_blocks(block_ids, data); });
+  }
+
+  auto StatsBlockManager::discard_blocks(
+      const std::vector<block_id_t> &block_ids) -> ChfsNullResult
+  {
+    return this->count(
+        BlockOp::Discard, block_ids.size(),
+        static_cast<u64>(block_ids.size()) * this->block_sz,
+        [&]() { return this->inner->discard_blocks(block_ids); });
+  }
+
+  auto StatsBlockManager::sync_range(block_id_t start, usize cnt)
+      -> ChfsNullResult
+  {
+    return this->count(BlockOp::Sync, cnt,
+                       static_cast<u64>(cnt) * this->block_sz, [&]()
+                       { return this->inner->sync_range(start, cnt); });
+  }
+
+  auto StatsBlockManager::sync_all() -> ChfsNullResult
+  {
+    return this->count(BlockOp::Sync, this->block_cnt,
+                       static_cast<u64>(this->block_cnt) * this->block_sz,
+                       [&]() { return this->inner->sync_all(); });
+  }
+
+  auto StatsBlockManager::grow(usize new_block_cnt) -> ChfsNullResult
+  {
+    auto res = this->inner->grow(new_block_cnt);
+    if (res.is_ok())
+    {
+      this->block_cnt = this->inner->total_blocks();
+    }
+    return res;
+  }
+
+} // namespace chfs
@@ -0,0 +1,260 @@
+#include <algorithm>
+
+#include "block/striped_manager.h"
+
+namespace chfs
+{
+
+  /**
+   * Get the number of blocks of a striped device, i.e., the whole units
+   * the smallest device can hold, times the number of devices
+   */
+  static auto striped_block_cnt(
+      const std::vector<std::shared_ptr<BlockManager>> &devices,
+      usize stripe_unit) -> usize
+  {
+    CHFS_VERIFY(stripe_unit > 0, "The stripe unit must not be empty");
+    return min_device_block_cnt(devices) / stripe_unit * stripe_unit *
+           devices.size();
+  }
+
+  StripedBlockManager::StripedBlockManager(
+      std::vector<std::shared_ptr<BlockManager>> devices, usize stripe_unit)
+      : BlockManager("striped", -1, striped_block_cnt(devices, stripe_unit),
+                     devices[0]->block_size()),
+        devices(std::move(devices)), stripe_unit(stripe_unit),
+        workers(this->devices.size())
+  {
+    CHFS_VERIFY(this->block_cnt > 0, "The devices are too small");
+  }
+
+  StripedBlockManager::StripedBlockManager(const std::vector<std::string> &files,
+                                           usize block_cnt, usize stripe_unit,
+                                           BlockBackend backend)
+      : StripedBlockManager(open_devices(files, block_cnt, backend),
+                            stripe_unit) {}
+
+  auto StripedBlockManager::locate(block_id_t block_id) const
+      -> std::pair<usize, block_id_t>
+  {
+    const auto unit = block_id / this->stripe_unit;
+    const auto device = unit % this->devices.size();
+    const auto row = unit / this->devices.size();
+    return {device, row * this->stripe_unit + block_id % this->stripe_unit};
+  }
+
+  auto StripedBlockManager::split(const std::vector<block_id_t> &block_ids) const
+      -> Split
+  {
+    Split split(this->devices.size());
+    for (usize i = 0; i < block_ids.size(); ++i)
+    {
+      auto [device, inner_id] = this->locate(block_ids[i]);
+      auto &segments = split[device];
+      if (segments.empty() ||
+          segments.back().from + segments.back().ids.size() != i)
+      {
+        segments.push_back({i, {}});
+      }
+      segments.back().ids.push_back(inner_id);
+    }
+    return split;
+  }
+
+  auto StripedBlockManager::for_each_segment(
+      const Split &split,
+      const std::function<ChfsNullResult(BlockManager &, const Segment &)> &op)
+      -> ChfsNullResult
+  {
+    std::vector<ChfsNullResult> results(this->devices.size(), KNullOk);
+    std::vector<std::function<void()>> tasks(this->devices.size());
+    for (usize d = 0; d < this->devices.size(); ++d)
+    {
+      if (split[d].empty())
+      {
+        continue;
+      }
+      tasks[d] = [this, d, &split, &op, &results]()
+      {
+        for (const auto &segment : split[d])
+        {
+          auto res = op(*this->devices[d], segment);
+          if (res.is_err())
+          {
+            results[d] = res;
+            return;
+          }
+        }
+      };
+    }
+    this->workers.run(tasks);
+
+    for (const auto &res : results)
+    {
+      if (res.is_err())
+      {
+        return res;
+      }
+    }
+    return KNullOk;
+  }
+
+  auto StripedBlockManager::write_block(block_id_t block_id, const u8 *data)
+      -> ChfsNullResult
+  {
+    if (block_id >= this->block_cnt)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    auto [device, inner_id] = this->locate(block_id);
+    return this->devices[device]->write_block(inner_id, data);
+  }
+
+  auto StripedBlockManager::write_partial_block(block_id_t block_id,
+                                                const u8 *data, usize offset,
+                                                usize len) -> ChfsNullResult
+  {
+    if (block_id >= this->block_cnt)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    auto [device, inner_id] = this->locate(block_id);
+    return this->devices[device]->write_partial_block(inner_id, data, offset,
+                                                      len);
+  }
+
+  auto StripedBlockManager::read_block(block_id_t block_id, u8 *data)
+      -> ChfsNullResult
+  {
+    if (block_id >= this->block_cnt)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    auto [device, inner_id] = this->locate(block_id);
+    return this->devices[device]->read_block(inner_id, data);
+  }
+
+  auto StripedBlockManager::zero_block(block_id_t block_id) -> ChfsNullResult
+  {
+    if (block_id >= this->block_cnt)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    auto [device, inner_id] = this->locate(block_id);
+    return this->devices[device]->zero_block(inner_id);
+  }
+
+  auto StripedBlockManager::read_blocks(const std::vector<block_id_t> &block_ids,
+                                        u8 *data) -> ChfsNullResult
+  {
+    if (!this->check_batch(block_ids))
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    const auto block_sz = this->block_sz;
+    return this->for_each_segment(
+        this->split(block_ids),
+        [data, block_sz](BlockManager &device, const Segment &segment)
+        {
+          return device.read_blocks(
+              segment.ids, data + static_cast<u64>(segment.from) * block_sz);
+        });
+  }
+
+  auto StripedBlockManager::write_blocks(
+      const std::vector<block_id_t> &block_ids, const u8 *data)
+      -> ChfsNullResult
+  {
+    if (!this->check_batch(block_ids))
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    const auto block_sz = this->block_sz;
+    return this->for_each_segment(
+        this->split(block_ids),
+        [data, block_sz](BlockManager &device, const Segment &segment)
+        {
+          return device.write_blocks(
+              segment.ids, data + static_cast<u64>(segment.from) * block_sz);
+        });
+  }
+
+  auto StripedBlockManager::discard_blocks(
+      const std::vector<block_id_t> &block_ids) -> ChfsNullResult
+  {
+    if (!this->check_batch(block_ids))
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    return this->for_each_segment(
+        this->split(block_ids),
+        [](BlockManager &device, const Segment &segment)
+        { return device.discard_blocks(segment.ids); });
+  }
+
+  auto StripedBlockManager::sync_range(block_id_t start, usize cnt)
+      -> ChfsNullResult
+  {
+    if (start > this->block_cnt || cnt > this->block_cnt - start)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    if (cnt == 0)
+    {
+      return KNullOk;
+    }
+
+    // the range covers a contiguous range of every device it touches
+    const auto n = this->devices.size();
+    const auto first_unit = start / this->stripe_unit;
+    const auto last_unit = (start + cnt - 1) / this->stripe_unit;
+    std::vector<ChfsNullResult> results(n, KNullOk);
+    std::vector<std::function<void()>> tasks(n);
+    for (usize d = 0; d < n; ++d)
+    {
+      // the first and the last unit of the range on the device
+      auto lo_unit = first_unit + (d + n - first_unit % n) % n;
+      if (lo_unit > last_unit)
+      {
+        continue;
+      }
+      auto hi_unit = last_unit - (last_unit % n + n - d) % n;
+
+      auto lo = this->locate(std::max<block_id_t>(start, lo_unit * this->stripe_unit));
+      auto hi = this->locate(
+          std::min<block_id_t>(start + cnt, (hi_unit + 1) * this->stripe_unit) - 1);
+      tasks[d] = [this, d, lo, hi, &results]()
+      {
+        results[d] = this->devices[d]->sync_range(lo.second,
+                                                  hi.second - lo.second + 1);
+      };
+    }
+    this->workers.run(tasks);
+
+    for (const auto &res : results)
+    {
+      if (res.is_err())
+      {
+        return res;
+      }
+    }
+    return KNullOk;
+  }
+
+  auto StripedBlockManager::sync_all() -> ChfsNullResult
+  {
+    for (const auto &device : this->devices)
+    {
+      auto res = device->sync_all();
+      if (res.is_err())
+      {
+        return res;
+      }
+    }
+    return KNullOk;
+  }
+
+} // namespace chfs
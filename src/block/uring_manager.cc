@@ -0,0 +1,370 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "block/uring_manager.h"
+
+namespace chfs
+{
+
+  static auto io_uring_setup(u32 entries, io_uring_params *p) -> int
+  {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+  }
+
+  static auto io_uring_enter(int fd, u32 to_submit, u32 min_complete,
+                             u32 flags) -> int
+  {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit,
+                                    min_complete, flags, nullptr, 0));
+  }
+
+  auto UringBlockManager::is_supported() -> bool
+  {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    auto fd = io_uring_setup(1, &params);
+    if (fd < 0)
+    {
+      return false;
+    }
+    close(fd);
+    return true;
+  }
+
+  UringBlockManager::UringBlockManager(const std::string &file, usize block_cnt,
+                                       UringOptions options, usize block_size)
+      : UringBlockManager(file,
+                          open_block_file(file,
+                                          options.direct_io ? O_DIRECT : 0,
+                                          block_cnt, block_size),
+                          options, block_size) {}
+
+  UringBlockManager::UringBlockManager(const std::string &file,
+                                       std::pair<int, usize> opened,
+                                       UringOptions options, usize block_size)
+      : BlockManager(file, opened.first, opened.second, block_size),
+        options(options)
+  {
+    CHFS_VERIFY(this->fd != -1, "Failed to open the block manager file");
+    CHFS_VERIFY(is_valid_block_size(block_size), "Unsupported block size");
+    CHFS_VERIFY(this->options.queue_depth > 0, "Queue depth should be positive");
+    CHFS_VERIFY(this->setup_ring(), "Failed to setup io_uring");
+
+    auto res = posix_memalign(reinterpret_cast<void **>(&this->scratch),
+                              KDirectIOAlign, this->block_sz);
+    CHFS_VERIFY(res == 0, "Failed to allocate memory");
+  }
+
+  UringBlockManager::~UringBlockManager()
+  {
+    if (this->sqes != nullptr)
+    {
+      munmap(this->sqes, this->sqes_sz);
+    }
+    if (this->cq_ring != nullptr && this->cq_ring != this->sq_ring)
+    {
+      munmap(this->cq_ring, this->cq_ring_sz);
+    }
+    if (this->sq_ring != nullptr)
+    {
+      munmap(this->sq_ring, this->sq_ring_sz);
+    }
+    if (this->ring_fd != -1)
+    {
+      close(this->ring_fd);
+    }
+    free(this->scratch);
+  }
+
+  auto UringBlockManager::setup_ring() -> bool
+  {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    this->ring_fd = io_uring_setup(this->options.queue_depth, &params);
+    if (this->ring_fd < 0)
+    {
+      this->ring_fd = -1;
+      return false;
+    }
+    // the kernel may round the depth up to a power of two
+    this->options.queue_depth = params.sq_entries;
+
+    this->sq_ring_sz = params.sq_off.array + params.sq_entries * sizeof(u32);
+    this->cq_ring_sz =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    auto single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap)
+    {
+      this->sq_ring_sz = std::max(this->sq_ring_sz, this->cq_ring_sz);
+      this->cq_ring_sz = this->sq_ring_sz;
+    }
+
+    this->sq_ring = mmap(nullptr, this->sq_ring_sz, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, this->ring_fd,
+                         IORING_OFF_SQ_RING);
+    if (this->sq_ring == MAP_FAILED)
+    {
+      this->sq_ring = nullptr;
+      return false;
+    }
+
+    if (single_mmap)
+    {
+      this->cq_ring = this->sq_ring;
+    }
+    else
+    {
+      this->cq_ring = mmap(nullptr, this->cq_ring_sz, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, this->ring_fd,
+                           IORING_OFF_CQ_RING);
+      if (this->cq_ring == MAP_FAILED)
+      {
+        this->cq_ring = nullptr;
+        return false;
+      }
+    }
+
+    this->sqes_sz = params.sq_entries * sizeof(io_uring_sqe);
+    auto sqes = mmap(nullptr, this->sqes_sz, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, this->ring_fd,
+                     IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+      return false;
+    }
+    this->sqes = static_cast<io_uring_sqe *>(sqes);
+
+    auto sq_base = static_cast<u8 *>(this->sq_ring);
+    this->sq_head = reinterpret_cast<u32 *>(sq_base + params.sq_off.head);
+    this->sq_tail = reinterpret_cast<u32 *>(sq_base + params.sq_off.tail);
+    this->sq_mask = reinterpret_cast<u32 *>(sq_base + params.sq_off.ring_mask);
+    this->sq_array = reinterpret_cast<u32 *>(sq_base + params.sq_off.array);
+
+    auto cq_base = static_cast<u8 *>(this->cq_ring);
+    this->cq_head = reinterpret_cast<u32 *>(cq_base + params.cq_off.head);
+    this->cq_tail = reinterpret_cast<u32 *>(cq_base + params.cq_off.tail);
+    this->cq_mask = reinterpret_cast<u32 *>(cq_base + params.cq_off.ring_mask);
+    this->cqes = reinterpret_cast<io_uring_cqe *>(cq_base + params.cq_off.cqes);
+    return true;
+  }
+
+  auto UringBlockManager::submit_and_wait(std::vector<IoRequest> &reqs,
+                                          bool write) -> ChfsNullResult
+  {
+    auto error_code = ErrorType::DONE;
+
+    for (usize start = 0; start < reqs.size();
+         start += this->options.queue_depth)
+    {
+      auto n = std::min<usize>(this->options.queue_depth, reqs.size() - start);
+
+      // 1. fill the submission queue
+      auto tail = *this->sq_tail;
+      for (usize i = 0; i < n; ++i)
+      {
+        auto &req = reqs[start + i];
+        auto idx = tail & *this->sq_mask;
+        auto sqe = &this->sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+        sqe->fd = this->fd;
+        sqe->addr = reinterpret_cast<u64>(req.buf);
+        sqe->len = static_cast<u32>(req.len);
+        sqe->off = req.offset;
+        sqe->user_data = start + i;
+        this->sq_array[idx] = idx;
+        tail += 1;
+      }
+      __atomic_store_n(this->sq_tail, tail, __ATOMIC_RELEASE);
+
+      // 2. submit them and wait for the completions at once
+      usize to_submit = n;
+      usize reaped = 0;
+      while (reaped < n)
+      {
+        auto ret = io_uring_enter(this->ring_fd, to_submit, 1,
+                                  IORING_ENTER_GETEVENTS);
+        if (ret < 0)
+        {
+          if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+          {
+            // The requests not consumed by the kernel are taken back from
+            // the submission queue. The ones in flight still use the
+            // buffers, so they are waited for; if even waiting fails, they
+            // can never be reaped, which is fatal.
+            CHFS_VERIFY(to_submit > 0, "Cannot reap the io_uring requests");
+            error_code = ErrorType::IOError;
+            __atomic_store_n(this->sq_tail,
+                             __atomic_load_n(this->sq_head, __ATOMIC_ACQUIRE),
+                             __ATOMIC_RELEASE);
+            n -= to_submit;
+            to_submit = 0;
+            continue;
+          }
+          // retry, after reaping: EBUSY means the completion queue is full
+          ret = 0;
+        }
+        to_submit -= std::min<usize>(to_submit, ret);
+
+        // 3. reap the completions
+        auto head = *this->cq_head;
+        auto cq_tail = __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != cq_tail; ++head, ++reaped)
+        {
+          auto &cqe = this->cqes[head & *this->cq_mask];
+          if (cqe.res < 0 ||
+              static_cast<u64>(cqe.res) != reqs[cqe.user_data].len)
+          {
+            error_code = ErrorType::IOError;
+          }
+        }
+        __atomic_store_n(this->cq_head, head, __ATOMIC_RELEASE);
+      }
+
+      if (error_code != ErrorType::DONE)
+      {
+        break;
+      }
+    }
+
+    if (error_code != ErrorType::DONE)
+    {
+      return ChfsNullResult(error_code);
+    }
+    return KNullOk;
+  }
+
+  auto UringBlockManager::build_requests(
+      const std::vector<block_id_t> &block_ids, u8 *data)
+      -> std::vector<IoRequest>
+  {
+    // at least a block per request
+    const auto max_blocks = std::max<u64>(
+        this->options.max_request_bytes / this->block_sz, 1);
+
+    std::vector<IoRequest> reqs;
+    for (usize i = 0; i < block_ids.size();)
+    {
+      auto len = static_cast<usize>(
+          std::min<u64>(contiguous_run_len(block_ids, i), max_blocks));
+      reqs.push_back({data + static_cast<u64>(i) * this->block_sz,
+                      block_ids[i] * this->block_sz,
+                      static_cast<u64>(len) * this->block_sz});
+      i += len;
+    }
+    return reqs;
+  }
+
+  auto UringBlockManager::is_aligned(const void *ptr) const -> bool
+  {
+    return !this->options.direct_io ||
+           reinterpret_cast<uintptr_t>(ptr) % KDirectIOAlign == 0;
+  }
+
+  auto UringBlockManager::read_blocks(const std::vector<block_id_t> &block_ids,
+                                      u8 *data) -> ChfsNullResult
+  {
+    if (!this->check_batch(block_ids))
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    if (block_ids.empty())
+    {
+      return KNullOk;
+    }
+
+    const auto total_sz = static_cast<u64>(block_ids.size()) * this->block_sz;
+    u8 *staging = nullptr;
+    if (!this->is_aligned(data) &&
+        posix_memalign(reinterpret_cast<void **>(&staging), KDirectIOAlign,
+                       total_sz) != 0)
+    {
+      return ChfsNullResult(ErrorType::OUT_OF_RESOURCE);
+    }
+
+    auto reqs = this->build_requests(block_ids, staging ? staging : data);
+    auto res = this->submit_and_wait(reqs, false);
+    if (staging != nullptr)
+    {
+      memcpy(data, staging, total_sz);
+      free(staging);
+    }
+    return res;
+  }
+
+  auto UringBlockManager::write_blocks(const std::vector<block_id_t> &block_ids,
+                                       const u8 *data) -> ChfsNullResult
+  {
+    if (!this->check_batch(block_ids))
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+    if (block_ids.empty())
+    {
+      return KNullOk;
+    }
+
+    const auto total_sz = static_cast<u64>(block_ids.size()) * this->block_sz;
+    u8 *staging = nullptr;
+    if (!this->is_aligned(data))
+    {
+      if (posix_memalign(reinterpret_cast<void **>(&staging), KDirectIOAlign,
+                         total_sz) != 0)
+      {
+        return ChfsNullResult(ErrorType::OUT_OF_RESOURCE);
+      }
+      memcpy(staging, data, total_sz);
+    }
+
+    // the kernel only reads from the buffer of a write
+    auto reqs = this->build_requests(
+        block_ids, staging ? staging : const_cast<u8 *>(data));
+    auto res = this->submit_and_wait(reqs, true);
+    free(staging);
+    return res;
+  }
+
+  auto UringBlockManager::read_block(block_id_t block_id, u8 *data)
+      -> ChfsNullResult
+  {
+    return this->read_blocks({block_id}, data);
+  }
+
+  auto UringBlockManager::write_block(block_id_t block_id, const u8 *data)
+      -> ChfsNullResult
+  {
+    return this->write_blocks({block_id}, data);
+  }
+
+  auto UringBlockManager::write_partial_block(block_id_t block_id,
+                                              const u8 *data, usize offset,
+                                              usize len) -> ChfsNullResult
+  {
+    if (offset + len > this->block_sz)
+    {
+      return ChfsNullResult(ErrorType::INVALID_ARG);
+    }
+
+    // read-modify-write through the aligned scratch block
+    auto res = this->read_blocks({block_id}, this->scratch);
+    if (res.is_err())
+    {
+      return res;
+    }
+    memcpy(this->scratch + offset, data, len);
+    return this->write_blocks({block_id}, this->scratch);
+  }
+
+  auto UringBlockManager::zero_block(block_id_t block_id) -> ChfsNullResult
+  {
+    memset(this->scratch, 0, this->block_sz);
+    return this->write_blocks({block_id}, this->scratch);
+  }
+
+} // namespace chfs
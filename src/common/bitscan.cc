@@ -0,0 +1,81 @@
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "common/bitscan.h"
+
+namespace chfs
+{
+
+  auto skip_bytes_sw(const u8 *data, usize len, u8 value) -> usize
+  {
+    const u64 pattern = 0x0101010101010101ULL * value;
+    usize i = 0;
+    for (; i + sizeof(u64) <= len; i += sizeof(u64))
+    {
+      u64 word;
+      memcpy(&word, data + i, sizeof(u64));
+      if (word != pattern)
+      {
+        // the lowest differing bit is in the first differing byte
+        return i + __builtin_ctzll(word ^ pattern) / 8;
+      }
+    }
+    while (i < len && data[i] == value)
+    {
+      ++i;
+    }
+    return i;
+  }
+
+#if defined(__x86_64__)
+  __attribute__((target("avx2,bmi"))) static auto
+  skip_bytes_hw(const u8 *data, usize len, u8 value) -> usize
+  {
+    const auto pattern = _mm256_set1_epi8(static_cast<char>(value));
+    usize i = 0;
+    for (; i + 64 <= len; i += 64)
+    {
+      auto v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+      auto v1 =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i + 32));
+      // a bit per byte, set if the byte is equal to the value
+      u64 mask = static_cast<u32>(
+          _mm256_movemask_epi8(_mm256_cmpeq_epi8(v0, pattern)));
+      mask |= static_cast<u64>(static_cast<u32>(
+                  _mm256_movemask_epi8(_mm256_cmpeq_epi8(v1, pattern))))
+              << 32;
+      if (mask != ~u64(0))
+      {
+        return i + _tzcnt_u64(~mask);
+      }
+    }
+    return i + skip_bytes_sw(data + i, len - i, value);
+  }
+#endif
+
+  auto skip_bytes_hw_supported() -> bool
+  {
+#if defined(__x86_64__)
+    static const bool supported =
+        __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi");
+    return supported;
+#else
+    return false;
+#endif
+  }
+
+  auto skip_bytes(const u8 *data, usize len, u8 value) -> usize
+  {
+#if defined(__x86_64__)
+    if (skip_bytes_hw_supported())
+    {
+      return skip_bytes_hw(data, len, value);
+    }
+#endif
+    return skip_bytes_sw(data, len, value);
+  }
+
+} // namespace chfs
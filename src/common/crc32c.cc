@@ -0,0 +1,306 @@
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "common/crc32c.h"
+
+namespace chfs
+{
+
+  // the reversed Castagnoli polynomial
+  static const u32 KCrc32cPoly = 0x82f63b78;
+
+  // The hardware path runs three independent crc32 streams over lanes of
+  // these sizes, then merges them with carry-less multiplies. A 4KB block
+  // (or a 512-byte one) takes a single merge.
+  static const usize KLongLane = 1360;
+  static const usize KShortLane = 168;
+
+  // With VPCLMULQDQ, buffers of at least this size are folded 256 bytes at a
+  // time instead, which is not bound by the latency of the crc32 instruction.
+  static const usize KFoldMinBytes = 512;
+  static const usize KFoldDistances = 16;
+
+  /**
+   * Get x^n mod P, bit-reflected like the crcs
+   */
+  static auto crc32c_xpow(u64 n) -> u32
+  {
+    // x^0 is the top bit, multiplying by x shifts right
+    u32 p = 0x80000000;
+    for (; n > 0; --n)
+    {
+      p = (p & 1) ? (p >> 1) ^ KCrc32cPoly : p >> 1;
+    }
+    return p;
+  }
+
+  struct Crc32cTables
+  {
+    // byte-wise table of the software path
+    u32 table[256];
+    // The factors that shift a crc over one and over two lanes. A
+    // carry-less product of reflected operands carries an extra factor x,
+    // and reducing it with the crc32 instruction another x^32, so the
+    // factor for n bytes is x^(8n - 33).
+    u64 long_shift[2];
+    u64 short_shift[2];
+    // The factors that fold the two halves of a 16-byte chunk over
+    // 16 * (i + 1) bytes, see `crc32c_fold`. The first half is 64 bits
+    // further from the end than the second.
+    u64 fold[KFoldDistances][2];
+
+    Crc32cTables();
+  };
+
+  Crc32cTables::Crc32cTables()
+  {
+    for (u32 n = 0; n < 256; ++n)
+    {
+      u32 crc = n;
+      for (usize k = 0; k < 8; ++k)
+      {
+        crc = (crc & 1) ? (crc >> 1) ^ KCrc32cPoly : crc >> 1;
+      }
+      this->table[n] = crc;
+    }
+
+    this->long_shift[0] = crc32c_xpow(8 * KLongLane - 33);
+    this->long_shift[1] = crc32c_xpow(16 * KLongLane - 33);
+    this->short_shift[0] = crc32c_xpow(8 * KShortLane - 33);
+    this->short_shift[1] = crc32c_xpow(16 * KShortLane - 33);
+    for (usize i = 0; i < KFoldDistances; ++i)
+    {
+      const u64 bits = 8 * 16 * (i + 1);
+      this->fold[i][0] = crc32c_xpow(bits + 64 - 33);
+      this->fold[i][1] = crc32c_xpow(bits - 33);
+    }
+  }
+
+  static const Crc32cTables KTables;
+
+  auto crc32c_sw(const u8 *data, usize len, u32 crc) -> u32
+  {
+    crc = ~crc;
+    for (usize i = 0; i < len; ++i)
+    {
+      crc = KTables.table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+  }
+
+#if defined(__x86_64__)
+  /**
+   * Checksum three consecutive lanes of `lane` bytes as three streams and
+   * merge them. `crc` is the crc of the preceding data, not inverted.
+   */
+  __attribute__((target("sse4.2,pclmul"), always_inline)) static inline auto
+  crc32c_lanes(const u8 *data, usize lane, const u64 *shift, u64 crc) -> u64
+  {
+    u64 crc1 = 0;
+    u64 crc2 = 0;
+    for (usize i = 0; i < lane; i += 8)
+    {
+      u64 w0, w1, w2;
+      memcpy(&w0, data + i, 8);
+      memcpy(&w1, data + lane + i, 8);
+      memcpy(&w2, data + lane * 2 + i, 8);
+      crc = _mm_crc32_u64(crc, w0);
+      crc1 = _mm_crc32_u64(crc1, w1);
+      crc2 = _mm_crc32_u64(crc2, w2);
+    }
+
+    // shift the first crc over two lanes and the second over one, the
+    // products are reduced together since the reduction is linear
+    const auto crcs = _mm_set_epi64x(static_cast<long long>(crc),
+                                     static_cast<long long>(crc1));
+    const auto factors = _mm_set_epi64x(static_cast<long long>(shift[1]),
+                                        static_cast<long long>(shift[0]));
+    const auto prod = _mm_xor_si128(_mm_clmulepi64_si128(crcs, factors, 0x11),
+                                    _mm_clmulepi64_si128(crcs, factors, 0x00));
+    return _mm_crc32_u64(0, static_cast<u64>(_mm_cvtsi128_si64(prod))) ^ crc2;
+  }
+
+  /**
+   * Get the folding factors of a distance in bytes, a multiple of 16
+   */
+  static auto crc32c_fold_factors(usize bytes) -> __m128i
+  {
+    const auto *k = KTables.fold[bytes / 16 - 1];
+    return _mm_set_epi64x(static_cast<long long>(k[1]),
+                          static_cast<long long>(k[0]));
+  }
+
+  /**
+   * Move a 16-byte chunk forward by the distance of the factors, keeping the
+   * crc of the whole buffer
+   */
+  __attribute__((target("pclmul"), always_inline)) static inline auto
+  crc32c_fold_128(__m128i x, __m128i k) -> __m128i
+  {
+    return _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00),
+                         _mm_clmulepi64_si128(x, k, 0x11));
+  }
+
+  __attribute__((target("avx512f,vpclmulqdq"), always_inline)) static inline auto
+  crc32c_fold_512(__m512i x, __m512i k) -> __m512i
+  {
+    return _mm512_xor_si512(_mm512_clmulepi64_epi128(x, k, 0x00),
+                            _mm512_clmulepi64_epi128(x, k, 0x11));
+  }
+
+  /**
+   * Repeat 16 bytes over a vector. The masked form keeps GCC from warning
+   * about the undefined source of the unmasked one.
+   */
+  __attribute__((target("avx512f"), always_inline)) static inline auto
+  crc32c_broadcast(__m128i x) -> __m512i
+  {
+    return _mm512_maskz_broadcast_i32x4(0xffff, x);
+  }
+
+  /**
+   * Fold a buffer into 16 bytes of the same crc with VPCLMULQDQ, then reduce
+   * those with the crc32 instruction.
+   *
+   * @param len at least 256, a multiple of 16
+   * @param crc the crc of the preceding data, not inverted
+   */
+  __attribute__((target("avx512f,vpclmulqdq,pclmul,sse4.2"))) static auto
+  crc32c_fold(const u8 *data, usize len, u32 crc) -> u64
+  {
+    // 1. four accumulators of 64 bytes, the crc so far is part of the first
+    // four bytes of the message
+    auto x0 = _mm512_xor_si512(_mm512_loadu_si512(data),
+                               _mm512_zextsi128_si512(_mm_cvtsi32_si128(
+                                   static_cast<int>(crc))));
+    auto x1 = _mm512_loadu_si512(data + 64);
+    auto x2 = _mm512_loadu_si512(data + 128);
+    auto x3 = _mm512_loadu_si512(data + 192);
+    data += 256;
+    len -= 256;
+
+    const auto k256 = crc32c_broadcast(crc32c_fold_factors(256));
+    for (; len >= 256; data += 256, len -= 256)
+    {
+      x0 = _mm512_xor_si512(crc32c_fold_512(x0, k256),
+                            _mm512_loadu_si512(data));
+      x1 = _mm512_xor_si512(crc32c_fold_512(x1, k256),
+                            _mm512_loadu_si512(data + 64));
+      x2 = _mm512_xor_si512(crc32c_fold_512(x2, k256),
+                            _mm512_loadu_si512(data + 128));
+      x3 = _mm512_xor_si512(crc32c_fold_512(x3, k256),
+                            _mm512_loadu_si512(data + 192));
+    }
+
+    // 2. fold the accumulators into the last one, then its lanes into the
+    // last lane
+    x3 = _mm512_xor_si512(
+        x3, crc32c_fold_512(x0, crc32c_broadcast(crc32c_fold_factors(192))));
+    x3 = _mm512_xor_si512(
+        x3, crc32c_fold_512(x1, crc32c_broadcast(crc32c_fold_factors(128))));
+    x3 = _mm512_xor_si512(
+        x3, crc32c_fold_512(x2, crc32c_broadcast(crc32c_fold_factors(64))));
+    auto v = _mm512_maskz_extracti32x4_epi32(0xf, x3, 3);
+    v = _mm_xor_si128(
+        v, crc32c_fold_128(_mm512_maskz_extracti32x4_epi32(0xf, x3, 0),
+                           crc32c_fold_factors(48)));
+    v = _mm_xor_si128(
+        v, crc32c_fold_128(_mm512_maskz_extracti32x4_epi32(0xf, x3, 1),
+                           crc32c_fold_factors(32)));
+    v = _mm_xor_si128(
+        v, crc32c_fold_128(_mm512_maskz_extracti32x4_epi32(0xf, x3, 2),
+                           crc32c_fold_factors(16)));
+
+    // 3. the remaining chunks of 16 bytes
+    const auto k16 = crc32c_fold_factors(16);
+    for (; len >= 16; data += 16, len -= 16)
+    {
+      v = _mm_xor_si128(
+          crc32c_fold_128(v, k16),
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(data)));
+    }
+
+    // 4. the crc of the 16 bytes left is that of the whole buffer
+    u64 res = _mm_crc32_u64(0, static_cast<u64>(_mm_cvtsi128_si64(v)));
+    return _mm_crc32_u64(res, static_cast<u64>(_mm_extract_epi64(v, 1)));
+  }
+
+  static auto crc32c_fold_supported() -> bool
+  {
+    static const bool supported = __builtin_cpu_supports("avx512f") &&
+                                  __builtin_cpu_supports("vpclmulqdq");
+    return supported;
+  }
+
+  __attribute__((target("sse4.2,pclmul"))) static auto
+  crc32c_hw(const u8 *data, usize len, u32 crc) -> u32
+  {
+    u64 crc0 = ~crc;
+
+    // 1. bring the pointer to an eight-byte boundary
+    while (len > 0 && (reinterpret_cast<uintptr_t>(data) & 7) != 0)
+    {
+      crc0 = _mm_crc32_u8(static_cast<u32>(crc0), *data);
+      data += 1;
+      len -= 1;
+    }
+
+    // 2. fold the long buffers, run three streams in parallel over the
+    // others, hiding the latency of the instruction
+    if (len >= KFoldMinBytes && crc32c_fold_supported())
+    {
+      const auto folded = len & ~static_cast<usize>(15);
+      crc0 = crc32c_fold(data, folded, static_cast<u32>(crc0));
+      data += folded;
+      len -= folded;
+    }
+    for (; len >= KLongLane * 3; data += KLongLane * 3, len -= KLongLane * 3)
+    {
+      crc0 = crc32c_lanes(data, KLongLane, KTables.long_shift, crc0);
+    }
+    for (; len >= KShortLane * 3; data += KShortLane * 3, len -= KShortLane * 3)
+    {
+      crc0 = crc32c_lanes(data, KShortLane, KTables.short_shift, crc0);
+    }
+
+    // 3. the remaining words and bytes
+    for (; len >= 8; data += 8, len -= 8)
+    {
+      u64 w;
+      memcpy(&w, data, 8);
+      crc0 = _mm_crc32_u64(crc0, w);
+    }
+    for (; len > 0; data += 1, len -= 1)
+    {
+      crc0 = _mm_crc32_u8(static_cast<u32>(crc0), *data);
+    }
+    return ~static_cast<u32>(crc0);
+  }
+#endif
+
+  auto crc32c_hw_supported() -> bool
+  {
+#if defined(__x86_64__)
+    static const bool supported =
+        __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul");
+    return supported;
+#else
+    return false;
+#endif
+  }
+
+  auto crc32c(const u8 *data, usize len, u32 crc) -> u32
+  {
+#if defined(__x86_64__)
+    if (crc32c_hw_supported())
+    {
+      return crc32c_hw(data, len, crc);
+    }
+#endif
+    return crc32c_sw(data, len, crc);
+  }
+
+} // namespace chfs
@@ -0,0 +1,217 @@
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "common/galois.h"
+#include "common/macros.h"
+
+namespace chfs
+{
+
+  // x^8 + x^4 + x^3 + x^2 + 1, the polynomial of most Reed-Solomon codes
+  static const u32 KGfPoly = 0x11d;
+
+  struct GfTables
+  {
+    u8 exp[512];
+    u8 log[256];
+    // mul[a][b] = a * b
+    u8 mul[256][256];
+
+    GfTables();
+  };
+
+  GfTables::GfTables()
+  {
+    u32 x = 1;
+    for (usize i = 0; i < 255; ++i)
+    {
+      this->exp[i] = static_cast<u8>(x);
+      this->log[x] = static_cast<u8>(i);
+      x <<= 1;
+      if (x & 0x100)
+      {
+        x ^= KGfPoly;
+      }
+    }
+    // so that exp[log a + log b] needs no modulo
+    for (usize i = 255; i < 512; ++i)
+    {
+      this->exp[i] = this->exp[i - 255];
+    }
+    this->log[0] = 0;
+
+    for (usize a = 0; a < 256; ++a)
+    {
+      for (usize b = 0; b < 256; ++b)
+      {
+        this->mul[a][b] =
+            (a == 0 || b == 0)
+                ? 0
+                : this->exp[this->log[a] + this->log[b]];
+      }
+    }
+  }
+
+  static const GfTables KGfTables;
+
+  auto gf_mul(u8 a, u8 b) -> u8
+  {
+    return KGfTables.mul[a][b];
+  }
+
+  auto gf_inv(u8 a) -> u8
+  {
+    CHFS_ASSERT(a != 0, "zero has no inverse");
+    return KGfTables.exp[255 - KGfTables.log[a]];
+  }
+
+  static auto gf_mul_add_scalar(u8 c, const u8 *src, u8 *dst, usize len)
+      -> void
+  {
+    const u8 *row = KGfTables.mul[c];
+    for (usize i = 0; i < len; ++i)
+    {
+      dst[i] ^= row[src[i]];
+    }
+  }
+
+#if defined(__x86_64__)
+  /**
+   * Build the tables of c * x for the low and the high nibble of x,
+   * so that c * x = lo[x & 0xf] ^ hi[x >> 4]
+   */
+  static auto gf_nibble_tables(u8 c, u8 *lo, u8 *hi) -> void
+  {
+    const u8 *row = KGfTables.mul[c];
+    for (usize i = 0; i < 16; ++i)
+    {
+      lo[i] = row[i];
+      hi[i] = row[i << 4];
+    }
+  }
+
+  __attribute__((target("ssse3"))) static auto
+  gf_mul_add_ssse3(u8 c, const u8 *src, u8 *dst, usize len) -> void
+  {
+    alignas(16) u8 lo[16], hi[16];
+    gf_nibble_tables(c, lo, hi);
+    const __m128i lo_tbl = _mm_load_si128(reinterpret_cast<const __m128i *>(lo));
+    const __m128i hi_tbl = _mm_load_si128(reinterpret_cast<const __m128i *>(hi));
+    const __m128i mask = _mm_set1_epi8(0x0f);
+
+    usize i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+      __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+      __m128i l = _mm_shuffle_epi8(lo_tbl, _mm_and_si128(x, mask));
+      __m128i h = _mm_shuffle_epi8(hi_tbl,
+                                   _mm_and_si128(_mm_srli_epi64(x, 4), mask));
+      __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+      d = _mm_xor_si128(d, _mm_xor_si128(l, h));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), d);
+    }
+    gf_mul_add_scalar(c, src + i, dst + i, len - i);
+  }
+
+  __attribute__((target("avx2"))) static auto
+  gf_mul_add_avx2(u8 c, const u8 *src, u8 *dst, usize len) -> void
+  {
+    alignas(16) u8 lo[16], hi[16];
+    gf_nibble_tables(c, lo, hi);
+    const __m256i lo_tbl = _mm256_broadcastsi128_si256(
+        _mm_load_si128(reinterpret_cast<const __m128i *>(lo)));
+    const __m256i hi_tbl = _mm256_broadcastsi128_si256(
+        _mm_load_si128(reinterpret_cast<const __m128i *>(hi)));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+
+    usize i = 0;
+    // two vectors per iteration, which keeps both shuffle ports busy
+    for (; i + 64 <= len; i += 64)
+    {
+      __m256i x0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+      __m256i x1 =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i + 32));
+      __m256i p0 = _mm256_xor_si256(
+          _mm256_shuffle_epi8(lo_tbl, _mm256_and_si256(x0, mask)),
+          _mm256_shuffle_epi8(
+              hi_tbl, _mm256_and_si256(_mm256_srli_epi64(x0, 4), mask)));
+      __m256i p1 = _mm256_xor_si256(
+          _mm256_shuffle_epi8(lo_tbl, _mm256_and_si256(x1, mask)),
+          _mm256_shuffle_epi8(
+              hi_tbl, _mm256_and_si256(_mm256_srli_epi64(x1, 4), mask)));
+      __m256i d0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i));
+      __m256i d1 =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i + 32));
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i),
+                          _mm256_xor_si256(d0, p0));
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i + 32),
+                          _mm256_xor_si256(d1, p1));
+    }
+    gf_mul_add_ssse3(c, src + i, dst + i, len - i);
+  }
+#endif
+
+  auto gf_kernel_supported(GfKernel kernel) -> bool
+  {
+    switch (kernel)
+    {
+    case GfKernel::Scalar:
+      return true;
+#if defined(__x86_64__)
+    case GfKernel::Ssse3:
+    {
+      static const bool supported = __builtin_cpu_supports("ssse3");
+      return supported;
+    }
+    case GfKernel::Avx2:
+    {
+      static const bool supported = __builtin_cpu_supports("avx2");
+      return supported;
+    }
+#endif
+    default:
+      return false;
+    }
+  }
+
+  auto gf_best_kernel() -> GfKernel
+  {
+    static const GfKernel best = gf_kernel_supported(GfKernel::Avx2)
+                                     ? GfKernel::Avx2
+                                 : gf_kernel_supported(GfKernel::Ssse3)
+                                     ? GfKernel::Ssse3
+                                     : GfKernel::Scalar;
+    return best;
+  }
+
+  auto gf_mul_add_region(GfKernel kernel, u8 c, const u8 *src, u8 *dst,
+                         usize len) -> void
+  {
+    CHFS_ASSERT(gf_kernel_supported(kernel), "The kernel is not supported");
+
+    // a zero constant adds nothing
+    if (c == 0)
+    {
+      return;
+    }
+
+    switch (kernel)
+    {
+#if defined(__x86_64__)
+    case GfKernel::Avx2:
+      gf_mul_add_avx2(c, src, dst, len);
+      return;
+    case GfKernel::Ssse3:
+      gf_mul_add_ssse3(c, src, dst, len);
+      return;
+#endif
+    default:
+      gf_mul_add_scalar(c, src, dst, len);
+      return;
+    }
+  }
+
+} // namespace chfs
@@ -0,0 +1,185 @@
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "common/hash.h"
+
+namespace chfs
+{
+
+  static const usize KStripeLen = 64;
+  static const usize KLanes = KStripeLen / sizeof(u64);
+  // the accumulators are scrambled after this many stripes
+  static const usize KStripesPerScramble = 16;
+
+  static const u64 KPrime32 = 0x9e3779b1;
+  static const u64 KPrime64 = 0x9e3779b185ebca87;
+
+  // Stripe i is mixed with the keys starting at i % 16, the second half
+  // repeats the first so that eight keys can always be loaded at once.
+  static const u64 KSecret[32] = {
+      0xbe4ba423396cfeb8, 0x1cad21f72c81017c, 0xdb979083e96dd4de,
+      0x1f67b3b7a4a44072, 0x78e5c0cc4ee679cb, 0x2172ffcc7dd05a82,
+      0x8e2443f7744608b8, 0x4c263a81e69035e0, 0xcb00c391bb52283c,
+      0xa32e531b8b65d088, 0x4ef90da297486471, 0xd8acdea946ef1938,
+      0x3f349ce33f76faa8, 0x1d4f0bc7c7bbdcf9, 0x3159b4cd4be0518a,
+      0x647378d9c97e9fc8, 0xbe4ba423396cfeb8, 0x1cad21f72c81017c,
+      0xdb979083e96dd4de, 0x1f67b3b7a4a44072, 0x78e5c0cc4ee679cb,
+      0x2172ffcc7dd05a82, 0x8e2443f7744608b8, 0x4c263a81e69035e0,
+      0xcb00c391bb52283c, 0xa32e531b8b65d088, 0x4ef90da297486471,
+      0xd8acdea946ef1938, 0x3f349ce33f76faa8, 0x1d4f0bc7c7bbdcf9,
+      0x3159b4cd4be0518a, 0x647378d9c97e9fc8,
+  };
+
+  static auto mul128_fold64(u64 a, u64 b) -> u64
+  {
+    auto product = static_cast<unsigned __int128>(a) * b;
+    return static_cast<u64>(product) ^ static_cast<u64>(product >> 64);
+  }
+
+  /**
+   * Merge the accumulators into the hash
+   */
+  static auto hash64_finish(const u64 *acc, usize len) -> u64
+  {
+    u64 h = len * KPrime64;
+    for (usize i = 0; i < KLanes; i += 2)
+    {
+      h += mul128_fold64(acc[i] ^ KSecret[i + 3], acc[i + 1] ^ KSecret[i + 4]);
+    }
+    h ^= h >> 37;
+    h *= 0x165667919e3779f9;
+    h ^= h >> 32;
+    return h;
+  }
+
+  static auto accumulate_sw(u64 *acc, const u8 *stripe, usize idx) -> void
+  {
+    const u64 *keys = KSecret + idx % KStripesPerScramble;
+    for (usize i = 0; i < KLanes; ++i)
+    {
+      u64 value;
+      memcpy(&value, stripe + i * sizeof(u64), sizeof(u64));
+      auto key = value ^ keys[i];
+      acc[i ^ 1] += value;
+      acc[i] += (key & 0xffffffff) * (key >> 32);
+    }
+  }
+
+  static auto scramble_sw(u64 *acc) -> void
+  {
+    for (usize i = 0; i < KLanes; ++i)
+    {
+      acc[i] ^= acc[i] >> 47;
+      acc[i] ^= KSecret[i];
+      acc[i] *= KPrime32;
+    }
+  }
+
+  auto hash64_sw(const u8 *data, usize len) -> u64
+  {
+    u64 acc[KLanes] = {KPrime32, KPrime64, KPrime32, KPrime64,
+                       KPrime32, KPrime64, KPrime32, KPrime64};
+    usize idx = 0;
+    for (; (idx + 1) * KStripeLen <= len; ++idx)
+    {
+      accumulate_sw(acc, data + idx * KStripeLen, idx);
+      if (idx % KStripesPerScramble == KStripesPerScramble - 1)
+      {
+        scramble_sw(acc);
+      }
+    }
+
+    // the tail is padded with zeros to a stripe
+    if (len % KStripeLen != 0)
+    {
+      u8 tail[KStripeLen] = {};
+      memcpy(tail, data + idx * KStripeLen, len % KStripeLen);
+      accumulate_sw(acc, tail, idx);
+    }
+    return hash64_finish(acc, len);
+  }
+
+#if defined(__x86_64__)
+  __attribute__((target("avx2"))) static auto
+  accumulate_avx2(__m256i &acc, const u8 *stripe, const u64 *keys) -> void
+  {
+    auto value = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(stripe));
+    auto key = _mm256_xor_si256(
+        value, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys)));
+    // the value goes to the neighbouring lane
+    auto swapped = _mm256_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+    auto product = _mm256_mul_epu32(key, _mm256_srli_epi64(key, 32));
+    acc = _mm256_add_epi64(acc, _mm256_add_epi64(swapped, product));
+  }
+
+  __attribute__((target("avx2"))) static auto scramble_avx2(__m256i &acc,
+                                                            const u64 *keys)
+      -> void
+  {
+    const auto prime = _mm256_set1_epi64x(KPrime32);
+    acc = _mm256_xor_si256(acc, _mm256_srli_epi64(acc, 47));
+    acc = _mm256_xor_si256(
+        acc, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys)));
+    // a 64x32-bit multiplication from two 32x32-bit ones
+    auto lo = _mm256_mul_epu32(acc, prime);
+    auto hi = _mm256_mul_epu32(_mm256_srli_epi64(acc, 32), prime);
+    acc = _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32));
+  }
+
+  __attribute__((target("avx2"))) static auto hash64_hw(const u8 *data,
+                                                        usize len) -> u64
+  {
+    auto acc0 = _mm256_set_epi64x(KPrime64, KPrime32, KPrime64, KPrime32);
+    auto acc1 = acc0;
+    usize idx = 0;
+    for (; (idx + 1) * KStripeLen <= len; ++idx)
+    {
+      const u64 *keys = KSecret + idx % KStripesPerScramble;
+      const u8 *stripe = data + idx * KStripeLen;
+      accumulate_avx2(acc0, stripe, keys);
+      accumulate_avx2(acc1, stripe + KStripeLen / 2, keys + KLanes / 2);
+      if (idx % KStripesPerScramble == KStripesPerScramble - 1)
+      {
+        scramble_avx2(acc0, KSecret);
+        scramble_avx2(acc1, KSecret + KLanes / 2);
+      }
+    }
+
+    u64 acc[KLanes];
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(acc), acc0);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(acc + KLanes / 2), acc1);
+    if (len % KStripeLen != 0)
+    {
+      u8 tail[KStripeLen] = {};
+      memcpy(tail, data + idx * KStripeLen, len % KStripeLen);
+      accumulate_sw(acc, tail, idx);
+    }
+    return hash64_finish(acc, len);
+  }
+#endif
+
+  auto hash64_hw_supported() -> bool
+  {
+#if defined(__x86_64__)
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+#else
+    return false;
+#endif
+  }
+
+  auto hash64(const u8 *data, usize len) -> u64
+  {
+#if defined(__x86_64__)
+    if (hash64_hw_supported())
+    {
+      return hash64_hw(data, len);
+    }
+#endif
+    return hash64_sw(data, len);
+  }
+
+} // namespace chfs
@@ -0,0 +1,168 @@
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "common/macros.h"
+#include "common/popcount.h"
+
+namespace chfs
+{
+
+  /**
+   * Count the bits a word at a time, the trailing bytes are padded with
+   * zeros. It is inlined into the callers, so the builtin is lowered to
+   * POPCNT if the caller's target has it.
+   */
+  __attribute__((always_inline)) static inline auto
+  popcount_words(const u8 *data, usize len) -> usize
+  {
+    usize cnt = 0;
+    usize i = 0;
+    for (; i + sizeof(u64) <= len; i += sizeof(u64))
+    {
+      u64 word;
+      memcpy(&word, data + i, sizeof(u64));
+      cnt += __builtin_popcountll(word);
+    }
+    if (i < len)
+    {
+      u64 word = 0;
+      memcpy(&word, data + i, len - i);
+      cnt += __builtin_popcountll(word);
+    }
+    return cnt;
+  }
+
+#if defined(__x86_64__)
+  __attribute__((target("popcnt"))) static auto
+  popcount_popcnt(const u8 *data, usize len) -> usize
+  {
+    return popcount_words(data, len);
+  }
+
+  __attribute__((target("avx2,popcnt"))) static auto
+  popcount_avx2(const u8 *data, usize len) -> usize
+  {
+    // the number of bits of each nibble
+    const auto table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2,
+                                        3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3, 1, 2,
+                                        2, 3, 2, 3, 3, 4);
+    const auto low_mask = _mm256_set1_epi8(0x0f);
+    auto acc = _mm256_setzero_si256();
+
+    usize i = 0;
+    while (i + 32 <= len)
+    {
+      // the byte counters hold up to 255 / 8 = 31 iterations
+      auto bytes = _mm256_setzero_si256();
+      for (usize n = 0; n < 31 && i + 32 <= len; ++n, i += 32)
+      {
+        auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        auto lo = _mm256_shuffle_epi8(table, _mm256_and_si256(v, low_mask));
+        auto hi = _mm256_shuffle_epi8(
+            table, _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask));
+        bytes = _mm256_add_epi8(bytes, _mm256_add_epi8(lo, hi));
+      }
+      acc = _mm256_add_epi64(acc,
+                             _mm256_sad_epu8(bytes, _mm256_setzero_si256()));
+    }
+
+    u64 lanes[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+           popcount_words(data + i, len - i);
+  }
+
+  __attribute__((target("avx512f,avx512bw,avx512vpopcntdq,bmi2"))) static auto
+  popcount_avx512(const u8 *data, usize len) -> usize
+  {
+    auto acc = _mm512_setzero_si512();
+    usize i = 0;
+    for (; i + 64 <= len; i += 64)
+    {
+      auto v = _mm512_loadu_si512(data + i);
+      acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(v));
+    }
+    if (i < len)
+    {
+      // the bytes past the end are neither loaded nor counted
+      auto mask = _bzhi_u64(~u64(0), len - i);
+      auto v = _mm512_maskz_loadu_epi8(mask, data + i);
+      acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(v));
+    }
+    u64 lanes[8];
+    _mm512_storeu_si512(lanes, acc);
+    usize cnt = 0;
+    for (auto lane : lanes)
+    {
+      cnt += lane;
+    }
+    return cnt;
+  }
+#endif
+
+  auto popcount_kernel_supported(PopcountKernel kernel) -> bool
+  {
+    switch (kernel)
+    {
+    case PopcountKernel::Scalar:
+      return true;
+#if defined(__x86_64__)
+    case PopcountKernel::Popcnt:
+    {
+      static const bool supported = __builtin_cpu_supports("popcnt");
+      return supported;
+    }
+    case PopcountKernel::Avx2:
+    {
+      static const bool supported =
+          __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+      return supported;
+    }
+    case PopcountKernel::Avx512:
+    {
+      static const bool supported =
+          __builtin_cpu_supports("avx512bw") &&
+          __builtin_cpu_supports("avx512vpopcntdq") &&
+          __builtin_cpu_supports("bmi2");
+      return supported;
+    }
+#endif
+    default:
+      return false;
+    }
+  }
+
+  auto popcount_best_kernel() -> PopcountKernel
+  {
+    static const PopcountKernel best =
+        popcount_kernel_supported(PopcountKernel::Avx512) ? PopcountKernel::Avx512
+        : popcount_kernel_supported(PopcountKernel::Avx2) ? PopcountKernel::Avx2
+        : popcount_kernel_supported(PopcountKernel::Popcnt)
+            ? PopcountKernel::Popcnt
+            : PopcountKernel::Scalar;
+    return best;
+  }
+
+  auto popcount(PopcountKernel kernel, const u8 *data, usize len) -> usize
+  {
+    CHFS_ASSERT(popcount_kernel_supported(kernel),
+                "The kernel is not supported");
+    switch (kernel)
+    {
+#if defined(__x86_64__)
+    case PopcountKernel::Popcnt:
+      return popcount_popcnt(data, len);
+    case PopcountKernel::Avx2:
+      return popcount_avx2(data, len);
+    case PopcountKernel::Avx512:
+      return popcount_avx512(data, len);
+#endif
+    default:
+      return popcount_words(data, len);
+    }
+  }
+
+} // namespace chfs
@@ -0,0 +1,188 @@
+#include <cstring>
+
+#include "common/macros.h"
+#include "common/reed_solomon.h"
+
+namespace chfs
+{
+
+  /**
+   * Invert a n x n matrix over GF(2^8) with Gauss-Jordan elimination
+   *
+   * @return false if the matrix is singular
+   */
+  static auto gf_invert_matrix(std::vector<u8> mat, std::vector<u8> &inv,
+                               usize n) -> bool
+  {
+    inv.assign(n * n, 0);
+    for (usize i = 0; i < n; ++i)
+    {
+      inv[i * n + i] = 1;
+    }
+
+    for (usize col = 0; col < n; ++col)
+    {
+      // find a pivot
+      usize pivot = col;
+      while (pivot < n && mat[pivot * n + col] == 0)
+      {
+        pivot += 1;
+      }
+      if (pivot == n)
+      {
+        return false;
+      }
+      if (pivot != col)
+      {
+        for (usize j = 0; j < n; ++j)
+        {
+          std::swap(mat[pivot * n + j], mat[col * n + j]);
+          std::swap(inv[pivot * n + j], inv[col * n + j]);
+        }
+      }
+
+      // scale the pivot row to 1
+      const u8 scale = gf_inv(mat[col * n + col]);
+      for (usize j = 0; j < n; ++j)
+      {
+        mat[col * n + j] = gf_mul(mat[col * n + j], scale);
+        inv[col * n + j] = gf_mul(inv[col * n + j], scale);
+      }
+
+      // eliminate the column from the other rows
+      for (usize i = 0; i < n; ++i)
+      {
+        const u8 factor = mat[i * n + col];
+        if (i == col || factor == 0)
+        {
+          continue;
+        }
+        for (usize j = 0; j < n; ++j)
+        {
+          mat[i * n + j] ^= gf_mul(factor, mat[col * n + j]);
+          inv[i * n + j] ^= gf_mul(factor, inv[col * n + j]);
+        }
+      }
+    }
+    return true;
+  }
+
+  ReedSolomon::ReedSolomon(usize data_cnt, usize parity_cnt, GfKernel kernel)
+      : k(data_cnt), m(parity_cnt), matrix((data_cnt + parity_cnt) * data_cnt),
+        kernel(kernel)
+  {
+    CHFS_VERIFY(data_cnt > 0, "Need at least one data shard");
+    CHFS_VERIFY(data_cnt + parity_cnt <= 256, "Too many shards for GF(2^8)");
+    CHFS_VERIFY(gf_kernel_supported(kernel), "The kernel is not supported");
+
+    for (usize i = 0; i < this->k; ++i)
+    {
+      this->matrix[i * this->k + i] = 1;
+    }
+    // Cauchy rows 1 / (x_i + y_j) with x_i = k + i and y_j = j,
+    // which are all distinct
+    for (usize i = 0; i < this->m; ++i)
+    {
+      for (usize j = 0; j < this->k; ++j)
+      {
+        this->matrix[(this->k + i) * this->k + j] =
+            gf_inv(static_cast<u8>((this->k + i) ^ j));
+      }
+    }
+  }
+
+  auto ReedSolomon::encode(const u8 *const *data, u8 *const *parity,
+                           usize len) const -> void
+  {
+    for (usize i = 0; i < this->m; ++i)
+    {
+      memset(parity[i], 0, len);
+      for (usize j = 0; j < this->k; ++j)
+      {
+        gf_mul_add_region(this->kernel, this->coef(i, j), data[j], parity[i],
+                          len);
+      }
+    }
+  }
+
+  auto ReedSolomon::update(usize parity_idx, usize data_idx, const u8 *delta,
+                           u8 *parity, usize len) const -> void
+  {
+    gf_mul_add_region(this->kernel, this->coef(parity_idx, data_idx), delta,
+                      parity, len);
+  }
+
+  auto ReedSolomon::reconstruct(u8 *const *shards,
+                                const std::vector<bool> &present,
+                                usize len) const -> bool
+  {
+    const auto n = this->k + this->m;
+    CHFS_ASSERT(present.size() == n, "Need the state of every shard");
+
+    // 1. the first k present shards and their rows of the generator
+    std::vector<usize> rows;
+    for (usize i = 0; i < n && rows.size() < this->k; ++i)
+    {
+      if (present[i])
+      {
+        rows.push_back(i);
+      }
+    }
+    if (rows.size() < this->k)
+    {
+      return false;
+    }
+
+    bool data_missing = false;
+    for (usize j = 0; j < this->k; ++j)
+    {
+      data_missing = data_missing || !present[j];
+    }
+
+    // 2. data = inverse(sub) * the present shards
+    if (data_missing)
+    {
+      std::vector<u8> sub(this->k * this->k);
+      for (usize r = 0; r < this->k; ++r)
+      {
+        memcpy(sub.data() + r * this->k,
+               this->matrix.data() + rows[r] * this->k, this->k);
+      }
+      std::vector<u8> inv;
+      auto ok = gf_invert_matrix(std::move(sub), inv, this->k);
+      CHFS_VERIFY(ok, "A Cauchy submatrix must be invertible");
+
+      for (usize j = 0; j < this->k; ++j)
+      {
+        if (present[j])
+        {
+          continue;
+        }
+        memset(shards[j], 0, len);
+        for (usize r = 0; r < this->k; ++r)
+        {
+          gf_mul_add_region(this->kernel, inv[j * this->k + r],
+                            shards[rows[r]], shards[j], len);
+        }
+      }
+    }
+
+    // 3. the missing parity is encoded again from the data
+    for (usize i = 0; i < this->m; ++i)
+    {
+      if (present[this->k + i])
+      {
+        continue;
+      }
+      auto parity = shards[this->k + i];
+      memset(parity, 0, len);
+      for (usize j = 0; j < this->k; ++j)
+      {
+        gf_mul_add_region(this->kernel, this->coef(i, j), shards[j], parity,
+                          len);
+      }
+    }
+    return true;
+  }
+
+} // namespace chfs
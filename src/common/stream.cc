@@ -0,0 +1,195 @@
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "common/stream.h"
+#include "common/macros.h"
+
+namespace chfs
+{
+
+#if defined(__x86_64__)
+  /**
+   * The bytes before the first aligned store of the destination
+   */
+  static auto head_len(const u8 *dst, usize align, u64 len) -> u64
+  {
+    auto head = (align - reinterpret_cast<uintptr_t>(dst) % align) % align;
+    return head < len ? head : len;
+  }
+
+  __attribute__((target("sse2"))) static auto
+  stream_copy_sse2(u8 *dst, const u8 *src, u64 len) -> void
+  {
+    auto head = head_len(dst, 16, len);
+    memcpy(dst, src, head);
+    dst += head;
+    src += head;
+    len -= head;
+
+    for (; len >= 64; dst += 64, src += 64, len -= 64)
+    {
+      auto v0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+      auto v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 16));
+      auto v2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 32));
+      auto v3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 48));
+      _mm_stream_si128(reinterpret_cast<__m128i *>(dst), v0);
+      _mm_stream_si128(reinterpret_cast<__m128i *>(dst + 16), v1);
+      _mm_stream_si128(reinterpret_cast<__m128i *>(dst + 32), v2);
+      _mm_stream_si128(reinterpret_cast<__m128i *>(dst + 48), v3);
+    }
+    for (; len >= 16; dst += 16, src += 16, len -= 16)
+    {
+      _mm_stream_si128(
+          reinterpret_cast<__m128i *>(dst),
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(src)));
+    }
+    memcpy(dst, src, len);
+    _mm_sfence();
+  }
+
+  __attribute__((target("sse2"))) static auto stream_zero_sse2(u8 *dst,
+                                                               u64 len)
+      -> void
+  {
+    auto head = head_len(dst, 16, len);
+    memset(dst, 0, head);
+    dst += head;
+    len -= head;
+
+    const auto zero = _mm_setzero_si128();
+    for (; len >= 16; dst += 16, len -= 16)
+    {
+      _mm_stream_si128(reinterpret_cast<__m128i *>(dst), zero);
+    }
+    memset(dst, 0, len);
+    _mm_sfence();
+  }
+
+  __attribute__((target("avx2"))) static auto
+  stream_copy_avx2(u8 *dst, const u8 *src, u64 len) -> void
+  {
+    auto head = head_len(dst, 32, len);
+    memcpy(dst, src, head);
+    dst += head;
+    src += head;
+    len -= head;
+
+    // a cache line of loads in flight before the stores
+    for (; len >= 128; dst += 128, src += 128, len -= 128)
+    {
+      auto v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+      auto v1 =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 32));
+      auto v2 =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 64));
+      auto v3 =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 96));
+      _mm256_stream_si256(reinterpret_cast<__m256i *>(dst), v0);
+      _mm256_stream_si256(reinterpret_cast<__m256i *>(dst + 32), v1);
+      _mm256_stream_si256(reinterpret_cast<__m256i *>(dst + 64), v2);
+      _mm256_stream_si256(reinterpret_cast<__m256i *>(dst + 96), v3);
+    }
+    for (; len >= 32; dst += 32, src += 32, len -= 32)
+    {
+      _mm256_stream_si256(
+          reinterpret_cast<__m256i *>(dst),
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src)));
+    }
+    memcpy(dst, src, len);
+    _mm_sfence();
+  }
+
+  __attribute__((target("avx2"))) static auto stream_zero_avx2(u8 *dst,
+                                                               u64 len)
+      -> void
+  {
+    auto head = head_len(dst, 32, len);
+    memset(dst, 0, head);
+    dst += head;
+    len -= head;
+
+    const auto zero = _mm256_setzero_si256();
+    for (; len >= 32; dst += 32, len -= 32)
+    {
+      _mm256_stream_si256(reinterpret_cast<__m256i *>(dst), zero);
+    }
+    memset(dst, 0, len);
+    _mm_sfence();
+  }
+#endif
+
+  auto stream_kernel_supported(StreamKernel kernel) -> bool
+  {
+    switch (kernel)
+    {
+    case StreamKernel::Plain:
+      return true;
+#if defined(__x86_64__)
+    case StreamKernel::Sse2:
+    {
+      static const bool supported = __builtin_cpu_supports("sse2");
+      return supported;
+    }
+    case StreamKernel::Avx2:
+    {
+      static const bool supported = __builtin_cpu_supports("avx2");
+      return supported;
+    }
+#endif
+    default:
+      return false;
+    }
+  }
+
+  auto stream_best_kernel() -> StreamKernel
+  {
+    static const StreamKernel best =
+        stream_kernel_supported(StreamKernel::Avx2)   ? StreamKernel::Avx2
+        : stream_kernel_supported(StreamKernel::Sse2) ? StreamKernel::Sse2
+                                                      : StreamKernel::Plain;
+    return best;
+  }
+
+  auto stream_copy(StreamKernel kernel, u8 *dst, const u8 *src, u64 len)
+      -> void
+  {
+    CHFS_ASSERT(stream_kernel_supported(kernel), "The kernel is not supported");
+    switch (kernel)
+    {
+#if defined(__x86_64__)
+    case StreamKernel::Sse2:
+      stream_copy_sse2(dst, src, len);
+      return;
+    case StreamKernel::Avx2:
+      stream_copy_avx2(dst, src, len);
+      return;
+#endif
+    default:
+      memcpy(dst, src, len);
+      return;
+    }
+  }
+
+  auto stream_zero(StreamKernel kernel, u8 *dst, u64 len) -> void
+  {
+    CHFS_ASSERT(stream_kernel_supported(kernel), "The kernel is not supported");
+    switch (kernel)
+    {
+#if defined(__x86_64__)
+    case StreamKernel::Sse2:
+      stream_zero_sse2(dst, len);
+      return;
+    case StreamKernel::Avx2:
+      stream_zero_avx2(dst, len);
+      return;
+#endif
+    default:
+      memset(dst, 0, len);
+      return;
+    }
+  }
+
+} // namespace chfs
@@ -0,0 +1,95 @@
+#include "common/worker_pool.h"
+
+namespace chfs
+{
+
+  WorkerPool::WorkerPool(usize worker_cnt) : workers(worker_cnt)
+  {
+    for (usize i = 0; i < worker_cnt; ++i)
+    {
+      this->workers[i].thread = std::thread(&WorkerPool::worker_loop, this, i);
+    }
+  }
+
+  WorkerPool::~WorkerPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(this->mtx);
+      this->stop = true;
+    }
+    this->task_cv.notify_all();
+    for (auto &worker : this->workers)
+    {
+      worker.thread.join();
+    }
+  }
+
+  auto WorkerPool::run(const std::vector<std::function<void()>> &tasks) -> void
+  {
+    CHFS_ASSERT(tasks.size() <= this->workers.size(), "Too many tasks");
+
+    usize task_cnt = 0;
+    usize last = 0;
+    for (usize i = 0; i < tasks.size(); ++i)
+    {
+      if (tasks[i])
+      {
+        task_cnt += 1;
+        last = i;
+      }
+    }
+    if (task_cnt == 0)
+    {
+      return;
+    }
+    if (task_cnt == 1)
+    {
+      // not worth a round trip to the worker
+      tasks[last]();
+      return;
+    }
+
+    // the batch is tracked on its own, so that concurrent callers do not
+    // wait for each other
+    usize remaining = task_cnt;
+    std::unique_lock<std::mutex> lock(this->mtx);
+    for (usize i = 0; i < tasks.size(); ++i)
+    {
+      if (tasks[i])
+      {
+        this->workers[i].tasks.push_back({tasks[i], &remaining});
+      }
+    }
+    this->task_cv.notify_all();
+    this->done_cv.wait(lock, [&remaining]() { return remaining == 0; });
+  }
+
+  auto WorkerPool::worker_loop(usize idx) -> void
+  {
+    auto &worker = this->workers[idx];
+    std::unique_lock<std::mutex> lock(this->mtx);
+    while (true)
+    {
+      this->task_cv.wait(lock, [this, &worker]()
+                         { return this->stop || !worker.tasks.empty(); });
+      if (worker.tasks.empty())
+      {
+        // stopped
+        return;
+      }
+
+      auto task = std::move(worker.tasks.front());
+      worker.tasks.pop_front();
+      lock.unlock();
+      task.func();
+      lock.lock();
+
+      *task.remaining -= 1;
+      if (*task.remaining == 0)
+      {
+        this->done_cv.notify_all();
+      }
+    }
+  }
+
+} // namespace chfs
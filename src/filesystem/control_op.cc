@@ -5,14 +5,26 @@ namespace chfs
 {
 
   FileOperation::FileOperation(std::shared_ptr<BlockManager> bm,
-                               u64 max_inode_supported)
+                               u64 max_inode_supported, bool dedup)
       : block_manager_(bm), inode_manager_(std::shared_ptr<InodeManager>(
                                 new InodeManager(bm, max_inode_supported))),
         block_allocator_(std::shared_ptr<BlockAllocator>(
             new BlockAllocator(bm, inode_manager_->get_reserved_blocks())))
   {
+    // the bitmap is flushed at the end of each operation
+    block_allocator_->set_flush_batch(0);
+
     // now initialize the superblock
-    SuperBlock(bm, inode_manager_->get_max_inode_supported()).flush(0).unwrap();
+    auto superblock = SuperBlock(bm, inode_manager_->get_max_inode_supported());
+    if (dedup)
+    {
+      // the table follows the bitmap
+      dedup_allocator_ = DedupAllocator::create(bm, block_allocator_).unwrap();
+      superblock.set_dedup_table(dedup_allocator_->get_table_block_id(),
+                                 dedup_allocator_->get_table_block_cnt());
+      block_allocator_->flush().unwrap();
+    }
+    superblock.flush(0).unwrap();
   }
 
   auto FileOperation::create_from_raw(std::shared_ptr<BlockManager> bm)
@@ -26,6 +38,11 @@ namespace chfs
           superblock_res.unwrap_error());
     }
 
+    if (superblock_res.unwrap()->get_block_size() != bm->block_size())
+    {
+      return ChfsResult<std::shared_ptr<FileOperation>>(ErrorType::INVALID);
+    }
+
     // 2. create the innode manager
     auto inode_manager_res = InodeManager::create_from_block_manager(
         bm, superblock_res.unwrap()->get_ninodes());
@@ -35,12 +52,54 @@ namespace chfs
           inode_manager_res.unwrap_error());
     }
 
+    // 3. the filesystem may have grown, the bitmap follows the super block
+    auto superblock = superblock_res.unwrap();
+    if (superblock->get_nblocks() > bm->total_blocks())
+    {
+      return ChfsResult<std::shared_ptr<FileOperation>>(ErrorType::INVALID);
+    }
+
     auto reserved_block_num = inode_manager_res.unwrap().get_reserved_blocks();
+    auto allocator = std::shared_ptr<BlockAllocator>(
+        new BlockAllocator(bm, reserved_block_num, superblock->get_nblocks(),
+                           superblock->get_bitmap_extents()));
+    allocator->set_flush_batch(0);
+
+    // 4. the fingerprints are indexed again from the table
+    std::shared_ptr<DedupAllocator> dedup_allocator = nullptr;
+    if (superblock->get_dedup_table_cnt() > 0)
+    {
+      dedup_allocator = std::make_shared<DedupAllocator>(
+          bm, allocator, superblock->get_dedup_table_block(),
+          superblock->get_dedup_table_cnt());
+    }
     return ChfsResult<std::shared_ptr<FileOperation>>(
         std::shared_ptr<FileOperation>(new FileOperation(
             bm, InodeManager::to_shared_ptr(inode_manager_res.unwrap()),
-            std::shared_ptr<BlockAllocator>(
-                new BlockAllocator(bm, reserved_block_num, false)))));
+            allocator, dedup_allocator)));
+  }
+
+  auto FileOperation::open(const std::string &file, BlockBackend backend)
+      -> ChfsResult<std::shared_ptr<FileOperation>>
+  {
+    auto block_size_res = SuperBlock::probe_block_size(file);
+    if (block_size_res.is_err())
+    {
+      return ChfsResult<std::shared_ptr<FileOperation>>(
+          block_size_res.unwrap_error());
+    }
+    // the block cnt is taken from the size of the existing file
+    return create_from_raw(create_block_manager(file, 1, backend, false,
+                                                block_size_res.unwrap()));
+  }
+
+  auto FileOperation::free_block(block_id_t block_id) -> ChfsNullResult
+  {
+    if (dedup_allocator_ != nullptr)
+    {
+      return dedup_allocator_->deallocate(block_id);
+    }
+    return block_allocator_->deallocate(block_id);
   }
 
   auto FileOperation::get_free_inode_num() const -> ChfsResult<u64>
@@ -53,6 +112,50 @@ namespace chfs
     return ChfsResult<u64>(block_allocator_->free_block_cnt());
   }
 
+  auto FileOperation::grow(usize new_block_cnt) -> ChfsNullResult
+  {
+    auto superblock_res = SuperBlock::create_from_existing(block_manager_, 0);
+    if (superblock_res.is_err())
+    {
+      return ChfsNullResult(superblock_res.unwrap_error());
+    }
+    auto superblock = superblock_res.unwrap();
+
+    // 0. nothing is changed unless the super block can record the new
+    // bitmap blocks
+    if (block_allocator_->grow_bitmap_block_cnt(new_block_cnt) > 0 &&
+        superblock->get_bitmap_extents().size() == KMaxBitmapExtents)
+    {
+      return ChfsNullResult(ErrorType::OUT_OF_RESOURCE);
+    }
+
+    // 1. grow the device
+    if (new_block_cnt > block_manager_->total_blocks())
+    {
+      auto res = block_manager_->grow(new_block_cnt);
+      if (res.is_err())
+      {
+        return res;
+      }
+    }
+
+    // 2. cover the new blocks with the bitmap
+    auto extent_res = block_allocator_->grow(new_block_cnt);
+    if (extent_res.is_err())
+    {
+      return ChfsNullResult(extent_res.unwrap_error());
+    }
+
+    // 3. the super block is written last, so that a crash before it leaves
+    // the filesystem at the old size
+    auto res = superblock->grow(new_block_cnt, extent_res.unwrap());
+    if (res.is_err())
+    {
+      return res;
+    }
+    return superblock->flush(0);
+  }
+
   auto FileOperation::remove_file(inode_id_t id) -> ChfsNullResult
   {
     auto error_code = ErrorType::DONE;
@@ -83,7 +186,7 @@ namespace chfs
     if (inode_p->blocks[inode_p->get_direct_block_num()] != KInvalidBlockID)
     {
       // we still need to release the indirect block
-      std::vector<u8> indirect_block;
+      std::vector<u8> indirect_block(block_size);
       auto read_res = this->block_manager_->read_block(
           inode_p->blocks[inode_p->get_direct_block_num()],
           indirect_block.data());
@@ -122,13 +225,13 @@ namespace chfs
     //  now free the blocks
     for (auto bid : free_set)
     {
-      auto res = this->block_allocator_->deallocate(bid);
+      auto res = this->free_block(bid);
       if (res.is_err())
       {
         return res;
       }
     }
-    return KNullOk;
+    return this->block_allocator_->flush();
   err_ret:
     // std::cout << "error code: " << (int)error_code << std::endl;
     return ChfsNullResult(error_code);
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <ctime>
 
 #include "filesystem/operations.h"
@@ -30,6 +31,11 @@ namespace chfs
     auto bid = alloc_res.unwrap();
 
     inode_res = this->inode_manager_->allocate_inode(type, bid);
+    auto flush_res = this->block_allocator_->flush();
+    if (flush_res.is_err())
+    {
+      return ChfsResult<inode_id_t>(flush_res.unwrap_error());
+    }
     // unfinished: 3
     return inode_res;
     // TODO:
@@ -131,6 +137,37 @@ namespace chfs
     // std::cout << "old_block_num: " << old_block_num << "\n new_block_numL " << new_block_num << std::endl;
     if (new_block_num > old_block_num)
     {
+      // The new blocks are placed right after the last block of the file,
+      // or after its inode if it is empty, so that the file stays physically
+      // sequential and its blocks are read and written in merged runs.
+      std::optional<block_id_t> goal = std::nullopt;
+      if (old_block_num == 0)
+      {
+        auto inode_block_res = this->inode_manager_->get(id);
+        if (inode_block_res.is_ok())
+        {
+          goal = inode_block_res.unwrap();
+        }
+      }
+      else if (inode_p->is_direct_block(old_block_num - 1))
+      {
+        goal = (*inode_p)[old_block_num - 1];
+      }
+      else
+      {
+        // the loaded indirect block is also the one updated below
+        indirect_block.resize(block_size);
+        auto read_res = this->block_manager_->read_block(
+            inode_p->get_indirect_block_id(), indirect_block.data());
+        if (read_res.is_err())
+        {
+          error_code = read_res.unwrap_error();
+          goto err_ret;
+        }
+        goal = reinterpret_cast<block_id_t *>(
+            indirect_block.data())[old_block_num - 1 - inlined_blocks_num];
+      }
+
       // If we need to allocate more blocks.
       for (usize idx = old_block_num; idx < new_block_num; ++idx)
       {
@@ -141,12 +178,16 @@ namespace chfs
         //     You should pay attention to the case of indirect block.
         //     You may use function `get_or_insert_indirect_block`
         //     in the case of indirect block.
-        auto alloc_res = this->block_allocator_->allocate();
+        // With the deduplication, the block is only chosen with its content.
+        auto alloc_res = this->dedup_allocator_ != nullptr
+                             ? ChfsResult<block_id_t>(KInvalidBlockID)
+                             : this->block_allocator_->allocate(goal);
         if (alloc_res.is_err())
         {
           error_code = alloc_res.unwrap_error();
           goto err_ret;
         }
+        goal = alloc_res.unwrap();
 
         if (inode_p->is_direct_block(idx))
         {
@@ -184,7 +225,7 @@ namespace chfs
 
           // TODO: Free the direct extra block.
           block_id_t block_id = (*inode_p)[idx];
-          this->block_allocator_->deallocate(block_id);
+          this->free_block(block_id);
           // UNIMPLEMENTED();
         }
         else
@@ -202,7 +243,7 @@ namespace chfs
             // indirect_block.resize(block_size);
           }
           block_id_t block_id = reinterpret_cast<block_id_t *>(indirect_block.data())[idx - inlined_blocks_num];
-          this->block_allocator_->deallocate(block_id);
+          this->free_block(block_id);
           // TODO: Free the indirect extra block.
           // UNIMPLEMENTED();
         }
@@ -230,30 +271,19 @@ namespace chfs
     inode_p->inner_attr.mtime = time(0);
 
     {
-      auto block_idx = 0;
-      u64 write_sz = 0;
+      // collect the blocks first, so that the full blocks are written in a
+      // single batch and physically contiguous blocks are merged
+      std::vector<block_id_t> block_ids;
+      block_ids.reserve(new_block_num);
 
-      while (write_sz < content.size())
+      for (usize block_idx = 0; block_idx < new_block_num; ++block_idx)
       {
-        auto sz = ((content.size() - write_sz) > block_size)
-                      ? block_size
-                      : (content.size() - write_sz);
-        std::vector<u8> buffer(block_size);
-        memcpy(buffer.data(), content.data() + write_sz, sz);
-
-        block_id_t block_id;
-        // std::cout << "block idx: " << block_idx << std::endl;
         if (inode_p->is_direct_block(block_idx))
         {
-
-          // std::cout << "direct id" << std::endl;
-          block_id = (*inode_p)[block_idx];
-          // TODO: Implement getting block id of current direct block.
-          // UNIMPLEMENTED();
+          block_ids.push_back((*inode_p)[block_idx]);
         }
         else
         {
-          // std::cout << "indirect id " << block_idx << inlined_blocks_num << std::endl;
           if (indirect_block.size() == 0)
           {
             auto indirect_res = inode_p->get_or_insert_indirect_block(this->block_allocator_);
@@ -265,27 +295,61 @@ namespace chfs
             }
             this->block_manager_->read_block(indirect_res.unwrap(), indirect_block.data());
           }
-          block_id = reinterpret_cast<block_id_t *>(indirect_block.data())[block_idx - inlined_blocks_num];
-          // TODO: Implement getting block id of current indirect block.
-          // UNIMPLEMENTED();
+          block_ids.push_back(reinterpret_cast<block_id_t *>(indirect_block.data())[block_idx - inlined_blocks_num]);
         }
-        // std::cout << "write to block" << block_id << std::endl;
-        //   for (auto it = content.begin() + write_sz; it < content.begin() + write_sz + sz; it++)
-        //   {
-        //     std::cout << (int)(*it) << " ";
-        //   }
-        if (sz == block_size)
+      }
+
+      const auto full_block_num = content.size() / block_size;
+      const auto tail_sz = content.size() % block_size;
+
+      if (this->dedup_allocator_ != nullptr)
+      {
+        // the tail is padded with zeros, so that it can be shared as well
+        const u8 *data = content.data();
+        std::vector<u8> padded;
+        if (tail_sz != 0)
         {
-          this->block_manager_->write_block(block_id, content.data() + write_sz);
+          padded.resize(new_block_num * block_size);
+          memcpy(padded.data(), content.data(), content.size());
+          data = padded.data();
+        }
+        auto store_res = this->dedup_allocator_->store(block_ids, data);
+        if (store_res.is_err())
+        {
+          error_code = store_res.unwrap_error();
+          goto err_ret;
         }
-        else
-          this->block_manager_->write_partial_block(block_id, content.data() + write_sz, 0, sz);
 
-        // TODO: Write to current block.
-        // UNIMPLEMENTED();
+        // the blocks may have moved
+        for (usize block_idx = 0; block_idx < new_block_num; ++block_idx)
+        {
+          if (inode_p->is_direct_block(block_idx))
+          {
+            (*inode_p)[block_idx] = block_ids[block_idx];
+          }
+          else
+          {
+            reinterpret_cast<block_id_t *>(indirect_block.data())[block_idx - inlined_blocks_num] = block_ids[block_idx];
+          }
+        }
+      }
+      else
+      {
+        auto tail_id = tail_sz != 0 ? block_ids.back() : KInvalidBlockID;
+        block_ids.resize(full_block_num);
 
-        write_sz += sz;
-        block_idx += 1;
+        auto write_res =
+            this->block_manager_->write_blocks(block_ids, content.data());
+        if (write_res.is_ok() && tail_sz != 0)
+        {
+          write_res = this->block_manager_->write_partial_block(
+              tail_id, content.data() + full_block_num * block_size, 0, tail_sz);
+        }
+        if (write_res.is_err())
+        {
+          error_code = write_res.unwrap_error();
+          goto err_ret;
+        }
       }
     }
 
@@ -312,10 +376,16 @@ namespace chfs
       }
     }
 
-    return KNullOk;
+    // the bitmap blocks changed by the write reach the device at once
+    return this->block_allocator_->flush();
 
   err_ret:
     // std::cerr << "write file return error: " << (int)error_code << std::endl;
+    {
+      // the blocks allocated before the error are still recorded, the
+      // original error is reported rather than the one of the flush
+      [[maybe_unused]] auto flush_res = this->block_allocator_->flush();
+    }
     return ChfsNullResult(error_code);
   }
 
@@ -334,7 +404,6 @@ namespace chfs
 
     auto inode_p = reinterpret_cast<Inode *>(inode.data());
     u64 file_sz = 0;
-    u64 read_sz = 0;
 
     auto inode_res = this->inode_manager_->read_inode(id, inode);
     if (inode_res.is_err())
@@ -345,55 +414,41 @@ namespace chfs
     }
 
     file_sz = inode_p->get_size();
-    content.reserve(file_sz);
 
-    // std::cout << "read inode ok" << std::endl;
-    //  Now read the file
-    while (read_sz < file_sz)
+    // Now read the file
     {
-      auto sz = ((inode_p->get_size() - read_sz) > block_size)
-                    ? block_size
-                    : (inode_p->get_size() - read_sz);
-      std::vector<u8> buffer(block_size);
-
-      // Get current block id.
-      block_id_t current_block_id;
-      if (inode_p->is_direct_block(read_sz / block_size))
-      {
-        // TODO: Implement the case of direct block.
-        current_block_id = (*inode_p)[read_sz / block_size];
-        // UNIMPLEMENTED();
-      }
-      else
+      const auto block_num = calculate_block_sz(file_sz, block_size);
+      std::vector<block_id_t> block_ids;
+      block_ids.reserve(block_num);
+
+      for (u64 block_idx = 0; block_idx < block_num; ++block_idx)
       {
-        // TODO: Implement the case of indirect block.
-        if (indirect_block.size() == 0)
+        if (inode_p->is_direct_block(block_idx))
         {
-          indirect_block.resize(block_size);
-          auto indirect_id = inode_p->get_indirect_block_id();
-          // std::cout << "get indirect block id:" << indirect_id << std::endl;
-          this->block_manager_->read_block(indirect_id, indirect_block.data());
-          // indirect_block.resize(block_size);
-          // std::cout << reinterpret_cast<block_id_t *>(indirect_block.data())[0] << std::endl;
+          block_ids.push_back((*inode_p)[block_idx]);
+        }
+        else
+        {
+          if (indirect_block.size() == 0)
+          {
+            indirect_block.resize(block_size);
+            auto indirect_id = inode_p->get_indirect_block_id();
+            this->block_manager_->read_block(indirect_id, indirect_block.data());
+          }
+          block_ids.push_back(reinterpret_cast<block_id_t *>(indirect_block.data())[block_idx - inode_p->get_direct_block_num()]);
         }
-        current_block_id = reinterpret_cast<block_id_t *>(indirect_block.data())[read_sz / block_size - inode_p->get_direct_block_num()];
-
-        // std::cout << "indirect block id:" << current_block_id << std::endl;
-        //   UNIMPLEMENTED();
       }
 
-      // TODO: Read from current block and store to `content`.
-
-      this->block_manager_->read_block(current_block_id, buffer.data());
-
-      // std::cout << "read from block " << current_block_id << std::endl;
-      //  std::cout << buffer << std::endl;
-      content.resize(read_sz + sz);
-      std::move(buffer.begin(), buffer.begin() + sz, content.begin() + read_sz);
-      // std::cout << "read a block " << std::endl;
-      //  UNIMPLEMENTED();
-      // std::cout << "read_sz: " << read_sz << "\ncurrent_sz: " << sz << std::endl;
-      read_sz += sz;
+      // read all blocks in a single batch, then drop the tail padding
+      content.resize(block_num * block_size);
+      auto read_res =
+          this->block_manager_->read_blocks(block_ids, content.data());
+      if (read_res.is_err())
+      {
+        error_code = read_res.unwrap_error();
+        goto err_ret;
+      }
+      content.resize(file_sz);
     }
     return ChfsResult<std::vector<u8>>(std::move(content));
 
@@ -415,6 +470,89 @@ namespace chfs
         std::vector<u8>(content.begin() + offset, content.begin() + offset + sz));
   }
 
+  auto FileOperation::sync_file(inode_id_t id) -> ChfsNullResult
+  {
+    const auto block_size = this->block_manager_->block_size();
+
+    std::vector<u8> inode(block_size);
+    auto inode_p = reinterpret_cast<Inode *>(inode.data());
+    auto inode_res = this->inode_manager_->read_inode(id, inode);
+    if (inode_res.is_err())
+    {
+      return ChfsNullResult(inode_res.unwrap_error());
+    }
+
+    // 1. collect the blocks of the file, including the inode itself
+    std::vector<block_id_t> block_ids = {inode_res.unwrap()};
+    const auto block_num = calculate_block_sz(inode_p->get_size(), block_size);
+    for (u64 block_idx = 0; block_idx < block_num; ++block_idx)
+    {
+      if (inode_p->is_direct_block(block_idx))
+      {
+        block_ids.push_back((*inode_p)[block_idx]);
+        continue;
+      }
+
+      auto indirect_id = inode_p->get_indirect_block_id();
+      std::vector<u8> indirect_block(block_size);
+      auto read_res =
+          this->block_manager_->read_block(indirect_id, indirect_block.data());
+      if (read_res.is_err())
+      {
+        return read_res;
+      }
+      block_ids.push_back(indirect_id);
+
+      auto entries = reinterpret_cast<block_id_t *>(indirect_block.data());
+      for (; block_idx < block_num; ++block_idx)
+      {
+        block_ids.push_back(
+            entries[block_idx - inode_p->get_direct_block_num()]);
+      }
+    }
+
+    // 2. sync them run by run
+    std::sort(block_ids.begin(), block_ids.end());
+    for (usize i = 0; i < block_ids.size();)
+    {
+      usize len = 1;
+      while (i + len < block_ids.size() &&
+             block_ids[i + len] <= block_ids[i] + len)
+      {
+        len += 1;
+      }
+      // duplicated ids are folded into the run
+      auto cnt = block_ids[i + len - 1] - block_ids[i] + 1;
+      auto res = this->block_manager_->sync_range(block_ids[i], cnt);
+      if (res.is_err())
+      {
+        return res;
+      }
+      i += len;
+    }
+
+    // 3. the metadata that locates the file: inode table and bitmaps
+    auto flush_res = this->block_allocator_->flush();
+    if (flush_res.is_err())
+    {
+      return flush_res;
+    }
+    const auto &grown_extents = this->block_allocator_->get_grown_extents();
+    usize grown_cnt = 0;
+    for (const auto &extent : grown_extents)
+    {
+      auto res = this->block_manager_->sync_range(extent.start, extent.cnt);
+      if (res.is_err())
+      {
+        return res;
+      }
+      grown_cnt += extent.cnt;
+    }
+    return this->block_manager_->sync_range(
+        0, this->inode_manager_->get_reserved_blocks() +
+               this->block_allocator_->total_bitmap_block() - grown_cnt);
+  }
+
   auto FileOperation::resize(inode_id_t id, u64 sz) -> ChfsResult<FileAttr>
   {
     auto attr_res = this->getattr(id);
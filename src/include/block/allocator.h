@@ -12,6 +12,10 @@
 #pragma once
 
 #include <memory>
+#include <optional>
+#include <set>
+#include <unordered_set>
+#include <vector>
 
 #include "block/manager.h"
 
@@ -20,9 +24,19 @@ namespace chfs {
 class SuperBlock;
 class InodeManager;
 
+/**
+ * A run of bitmap blocks added when the allocator grows
+ */
+struct BitmapExtent {
+  block_id_t start;
+  u64 cnt;
+};
+
 /**
  * BlockManager implements a block allocator to manage blocks of the manager
  * It internally uses bitmap for the management.
+ * The bitmap is kept in memory, the changed bitmap blocks are written back
+ * in batches (see `set_flush_batch`) or on `flush`.
  * Note that the block allocator is **not** thread-safe.
  *
  * # Example
@@ -37,14 +51,49 @@ public:
   std::shared_ptr<BlockManager> bm;
 
 protected:
-  // The bitmap block is stored at [bitmap_block_id, bitmap_block_id +
-  // bitmap_block_cnt - 1]
+  // The initial bitmap blocks are stored at [bitmap_block_id,
+  // bitmap_block_id + initial count - 1], the ones added by `grow` at the
+  // start of each grown region, see `grown_extents`.
+  // bitmap_block_cnt counts both of them.
   block_id_t bitmap_block_id;
   block_id_t bitmap_block_cnt;
 
+  // number of blocks covered by the bitmap
+  usize block_cnt;
+  std::vector<BitmapExtent> grown_extents;
+  // the location of each bitmap block
+  std::vector<block_id_t> bitmap_blocks;
+
   // number of bits needed in the last bitmap block
   usize last_block_num;
 
+  // Freed blocks are discarded on the device once this many are pending,
+  // 0 disables the discard
+  usize discard_batch = 0;
+  std::unordered_set<block_id_t> pending_discards;
+
+  // The whole bitmap, the bit of a block is at its id. The bitmap blocks
+  // changed since the last flush are in `dirty_blocks`, by their index in
+  // `bitmap_blocks`.
+  std::vector<u8> bitmap;
+  std::set<usize> dirty_blocks;
+
+  // The dirty bitmap blocks are flushed once this many allocations and
+  // deallocations are pending, 0 only flushes on `flush`
+  usize flush_batch = 1;
+  usize pending_updates = 0;
+
+  // An in-memory index over the bitmap, so a free block is found by
+  // descending it instead of scanning the bitmap from the start.
+  // summary[0] has a bit per 64-bit word of the bitmap, set if the word has
+  // a free bit. summary[k] has a bit per word of summary[k - 1], set if the
+  // word is not zero. The last level is a single word.
+  std::vector<std::vector<u64>> summary;
+
+  // where `allocate(std::nullopt)` starts, right after the last allocated
+  // block
+  block_id_t next_fit_cursor = 0;
+
 public:
   /**
    * Creates a new block allocator with a block manager.
@@ -68,8 +117,91 @@ public:
   BlockAllocator(std::shared_ptr<BlockManager> bm, usize bitmap_block_id,
                  bool will_initialize = true);
 
+  /**
+   * Creates a block allocator over an existing bitmap that has been grown.
+   *
+   * @param bm the block manager
+   * @param bitmap_block_id the block id of the initial bitmap
+   * @param block_cnt the number of blocks covered by the bitmap
+   * @param grown_extents the bitmap blocks added by `grow`, in order
+   */
+  BlockAllocator(std::shared_ptr<BlockManager> bm, usize bitmap_block_id,
+                 usize block_cnt, std::vector<BitmapExtent> grown_extents);
+
+  /**
+   * Flush the bitmap and discard the pending blocks before the allocator
+   * goes away
+   */
+  ~BlockAllocator();
+
   auto total_bitmap_block() -> usize { return this->bitmap_block_cnt; }
 
+  /**
+   * Get the number of blocks covered by the bitmap
+   */
+  auto total_blocks() const -> usize { return this->block_cnt; }
+
+  auto get_grown_extents() const -> const std::vector<BitmapExtent> & {
+    return this->grown_extents;
+  }
+
+  /**
+   * Cover the blocks up to `new_block_cnt` of the block manager, which must
+   * have been grown already. The extra bitmap blocks are placed at the start
+   * of the new region and marked as allocated.
+   *
+   * @return the bitmap blocks added, whose `cnt` may be 0.
+   *         INVALID_ARG if the allocator would shrink or the block manager
+   *         is too small.
+   */
+  auto grow(usize new_block_cnt) -> ChfsResult<BitmapExtent>;
+
+  /**
+   * Get the number of bitmap blocks `grow(new_block_cnt)` would add, so
+   * that the caller can check it has room to record them beforehand
+   */
+  auto grow_bitmap_block_cnt(usize new_block_cnt) const -> usize;
+
+  /**
+   * Release the storage of freed blocks with `BlockManager::discard_blocks`.
+   *
+   * @param batch the number of freed blocks to discard at once.
+   *        1 discards a block on every deallocation, 0 disables the discard.
+   * @return the error of discarding the blocks already pending, if the new
+   *         batch is reached
+   */
+  auto set_discard_batch(usize batch) -> ChfsNullResult;
+
+  /**
+   * Discard the freed blocks that are still pending
+   */
+  auto flush_discards() -> ChfsNullResult;
+
+  /**
+   * Write the bitmap back in batches instead of on every allocation and
+   * deallocation. The bitmap on the device is only consistent after a
+   * flush.
+   *
+   * @param batch the number of pending allocations and deallocations that
+   *        trigger a flush. 1 (the default) writes through, 0 only flushes
+   *        on `flush`.
+   * @return the error of flushing the updates already pending, if the new
+   *         batch is reached
+   */
+  auto set_flush_batch(usize batch) -> ChfsNullResult;
+
+  /**
+   * Write the changed bitmap blocks back to the block manager
+   */
+  auto flush() -> ChfsNullResult;
+
+  /**
+   * Get the number of bitmap blocks not flushed yet
+   */
+  auto dirty_bitmap_block_cnt() const -> usize {
+    return this->dirty_blocks.size();
+  }
+
   /**
    * Count the number of free blocks.
    *
@@ -86,6 +218,20 @@ public:
    */
   auto allocate() -> ChfsResult<block_id_t>;
 
+  /**
+   * Allocate a block near a goal, e.g., right after the previous block of a
+   * file, so that the blocks of a file are physically sequential.
+   * The search starts at the goal and wraps around to the start.
+   *
+   * @param hint the goal block. std::nullopt starts after the last
+   *        allocated block (next-fit), which spreads the allocations over
+   *        the device instead of crowding its front.
+   *
+   * @return the block id of the allocated block if succeed.
+   *         OUT_OF_RESOURCE if there is no free block.
+   */
+  auto allocate(std::optional<block_id_t> hint) -> ChfsResult<block_id_t>;
+
   /**
    * Deallocate a block.
    * @param block_id the block id to be deallocated.
@@ -94,6 +240,66 @@ public:
    *         other error code if there is other error.
    */
   auto deallocate(block_id_t block_id) -> ChfsNullResult;
+private:
+  auto bits_per_block() const -> usize;
+
+  /**
+   * Compute the bounds and the location of each bitmap block from
+   * `bitmap_block_id`, `block_cnt` and `grown_extents`
+   */
+  auto locate_bitmap_blocks() -> void;
+
+  /**
+   * Read the bitmap from the device and build its summary
+   */
+  auto load_bitmap() -> ChfsNullResult;
+
+  /**
+   * Build `summary` from the resident bitmap
+   */
+  auto rebuild_summary() -> void;
+
+  /**
+   * Record a change of the bit of a block, and flush if the batch is full
+   */
+  auto mark_dirty(block_id_t block_id) -> ChfsNullResult;
+
+  /**
+   * Update the summary after a word of the bitmap changed
+   *
+   * @param word the index of the word in the whole bitmap
+   * @param has_free whether the word has a free bit now
+   */
+  auto update_summary(usize word, bool has_free) -> void;
+
+  /**
+   * Find a word of the bitmap with a free bit in the summary
+   */
+  auto find_free_word() const -> std::optional<usize>;
+
+  /**
+   * Find the first word of the bitmap with a free bit starting at a word,
+   * it wraps around to the start
+   */
+  auto find_free_word_from(usize word) const -> std::optional<usize>;
+
+  /**
+   * Allocate the first free block at or after `goal`, see `allocate`
+   */
+  auto allocate_from(block_id_t goal) -> ChfsResult<block_id_t>;
+
+  /**
+   * Get the free bits of a word of the bitmap, the bits past `block_cnt`
+   * are never free
+   *
+   * @param word the index of the word in the whole bitmap
+   */
+  auto free_bits_of(usize word) const -> u64;
+
+  /**
+   * Update `bitmap_block_cnt` and `last_block_num` from `block_cnt`
+   */
+  auto update_bounds() -> void;
 };
 
 } // namespace chfs
\ No newline at end of file
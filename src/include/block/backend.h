@@ -0,0 +1,74 @@
+//===----------------------------------------------------------------------===//
+//
+//                         Chfs
+//
+// backend.h
+//
+// Identification: src/include/block/backend.h
+//
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "block/manager.h"
+
+namespace chfs {
+
+/**
+ * The I/O backends of a file-backed block device
+ */
+enum class BlockBackend {
+  // a shared mmap of the file, see `BlockManager`
+  Mmap,
+  // pread(2)/pwrite(2), see `PreadBlockManager`
+  Pread,
+  // io_uring, see `UringBlockManager`
+  IoUring,
+};
+
+/**
+ * Creates a file-backed block manager with the given backend.
+ *
+ * @param file the file name of the file to write to
+ * @param block_cnt the number of expected blocks in the device
+ * @param backend which I/O backend to use
+ * @param direct_io whether to bypass the page cache with O_DIRECT. It is
+ * ignored by the mmap backend.
+ * @param block_size the size of each block
+ */
+auto create_block_manager(const std::string &file, usize block_cnt,
+                          BlockBackend backend, bool direct_io = false,
+                          usize block_size = KDefaultBlockSize)
+    -> std::shared_ptr<BlockManager>;
+
+/**
+ * Creates a file-backed block manager for each file, e.g., the devices of a
+ * striped array
+ *
+ * @param files the file of each device
+ * @param block_cnt the number of expected blocks in each device
+ * @param backend which I/O backend to use
+ */
+auto open_devices(const std::vector<std::string> &files, usize block_cnt,
+                  BlockBackend backend)
+    -> std::vector<std::shared_ptr<BlockManager>>;
+
+/**
+ * Get the number of blocks all devices of an array can hold, i.e., that of
+ * the smallest one. The devices must share a block size.
+ */
+auto min_device_block_cnt(
+    const std::vector<std::shared_ptr<BlockManager>> &devices) -> usize;
+
+/**
+ * Parse the name of a backend ("mmap", "pread" or "uring")
+ */
+auto parse_block_backend(const std::string &name)
+    -> std::optional<BlockBackend>;
+
+} // namespace chfs
@@ -0,0 +1,265 @@
+//===----------------------------------------------------------------------===//
+//
+//                         Chfs
+//
+// cached_manager.h
+//
+// Identification: src/include/block/cached_manager.h
+//
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "block/manager.h"
+
+namespace chfs {
+
+// The default number of blocks kept by the block cache
+const usize KDefaultCacheBlockCnt = 256;
+
+/**
+ * Counters exported by the block cache
+ */
+struct BlockCacheStats {
+  u64 hits = 0;
+  u64 misses = 0;
+  u64 evictions = 0;
+  // number of dirty blocks written back to the device
+  u64 writebacks = 0;
+  // number of dirty blocks written back by the writeback thread
+  u64 background_writebacks = 0;
+};
+
+/**
+ * Options of the background writeback of the block cache
+ */
+struct WritebackOptions {
+  // whether to start the writeback thread
+  bool enabled = false;
+  // a dirty block older than this is written back
+  std::chrono::milliseconds dirty_expire{3000};
+  // once more dirty bytes than this are cached, all of them are written back
+  usize dirty_bytes_threshold = 64 * KDefaultBlockSize;
+  // how often the thread looks for expired blocks
+  std::chrono::milliseconds interval{500};
+};
+
+/**
+ * CachedBlockManager puts a fixed-size write-back block cache in front of the
+ * block device. Blocks are evicted with the CLOCK (second chance) algorithm,
+ * and dirty blocks are only written to the device upon eviction or `flush()`.
+ *
+ * Block views point into the cache frames, which stay pinned until the views
+ * are released.
+ *
+ * With `WritebackOptions::enabled`, a background thread writes back the
+ * blocks that have been dirty for too long, or all of them once too many
+ * bytes are dirty, so that `sync_range()` only pays for recent writes.
+ * The cache is guarded by a lock for the sake of the thread, but block
+ * views are **not** thread-safe.
+ */
+class CachedBlockManager : public BlockManager {
+  struct Frame {
+    block_id_t block_id = 0;
+    bool valid = false;
+    bool dirty = false;
+    // the reference bit of CLOCK
+    bool referenced = false;
+    // number of block views using the frame, a pinned frame is never evicted
+    usize pin_cnt = 0;
+    // when the frame turned from clean into dirty
+    std::chrono::steady_clock::time_point dirtied_at;
+  };
+
+  usize cache_block_cnt;
+  std::vector<u8> frame_data;
+  std::vector<Frame> frames;
+  // block id -> frame index
+  std::unordered_map<block_id_t, usize> frame_table;
+  usize clock_hand = 0;
+  usize dirty_cnt = 0;
+
+  BlockCacheStats stats;
+
+  // the batch calls re-enter the per-block calls, hence recursive
+  mutable std::recursive_mutex mtx;
+  WritebackOptions writeback_options;
+  std::thread writeback_thread;
+  std::condition_variable_any writeback_cv;
+  bool writeback_stop = false;
+  // the first error of the writeback thread, reported by the next sync
+  ErrorType writeback_error = ErrorType::DONE;
+
+public:
+  /**
+   * Creates a cached block manager over a file-backed block device.
+   * @param file the file name of the file to write to
+   * @param block_cnt the number of expected blocks in the device
+   * @param cache_block_cnt the number of blocks the cache can hold
+   * @param writeback the options of the background writeback
+   * @param block_size the size of each block
+   */
+  CachedBlockManager(const std::string &file, usize block_cnt,
+                     usize cache_block_cnt = KDefaultCacheBlockCnt,
+                     WritebackOptions writeback = WritebackOptions(),
+                     usize block_size = KDefaultBlockSize);
+
+  /**
+   * Creates a cached block manager over a memory-backed block device.
+   * @param block_count the number of blocks in the device
+   * @param block_size the size of each block
+   * @param cache_block_cnt the number of blocks the cache can hold
+   * @param writeback the options of the background writeback
+   */
+  CachedBlockManager(usize block_count, usize block_size,
+                     usize cache_block_cnt,
+                     WritebackOptions writeback = WritebackOptions());
+
+  /**
+   * Stop the writeback thread and flush all dirty blocks before the device
+   * is released
+   */
+  ~CachedBlockManager() override;
+
+  auto write_block(block_id_t block_id, const u8 *block_data)
+      -> ChfsNullResult override;
+
+  auto write_partial_block(block_id_t block_id, const u8 *block_data,
+                           usize offset, usize len) -> ChfsNullResult override;
+
+  auto read_block(block_id_t block_id, u8 *block_data)
+      -> ChfsNullResult override;
+
+  auto zero_block(block_id_t block_id) -> ChfsNullResult override;
+
+  /**
+   * The range goes through the cache block by block
+   */
+  auto zero_blocks(block_id_t start, usize cnt) -> ChfsNullResult override;
+
+  /**
+   * The batch goes through the cache block by block
+   */
+  auto read_blocks(const std::vector<block_id_t> &block_ids, u8 *block_data)
+      -> ChfsNullResult override;
+
+  auto write_blocks(const std::vector<block_id_t> &block_ids,
+                    const u8 *block_data) -> ChfsNullResult override;
+
+  /**
+   * Cached copies of the blocks are zeroed and marked clean,
+   * then the blocks are discarded on the device
+   */
+  auto discard_blocks(const std::vector<block_id_t> &block_ids)
+      -> ChfsNullResult override;
+
+  /**
+   * Write all dirty blocks back to the device.
+   * The blocks remain cached (and clean) after the flush.
+   */
+  auto flush() -> ChfsNullResult;
+
+  auto grow(usize new_block_cnt) -> ChfsNullResult override;
+
+  /**
+   * Write back the dirty blocks of the range, then sync the device range
+   */
+  auto sync_range(block_id_t start, usize cnt) -> ChfsNullResult override;
+
+  auto sync_all() -> ChfsNullResult override;
+
+  /**
+   * Get the number of bytes cached but not written back
+   */
+  auto dirty_bytes() const -> usize {
+    std::lock_guard<std::recursive_mutex> lock(this->mtx);
+    return this->dirty_cnt * this->block_sz;
+  }
+
+  /**
+   * Get the number of blocks the cache can hold
+   */
+  auto cache_capacity() const -> usize { return this->cache_block_cnt; }
+
+  /**
+   * Get a copy of the cache counters
+   */
+  auto get_stats() const -> BlockCacheStats {
+    std::lock_guard<std::recursive_mutex> lock(this->mtx);
+    return this->stats;
+  }
+
+  auto reset_stats() {
+    std::lock_guard<std::recursive_mutex> lock(this->mtx);
+    this->stats = BlockCacheStats();
+  }
+
+protected:
+  auto map_block(block_id_t block_id) -> u8 * override;
+
+  auto unmap_block(block_id_t block_id, bool dirty) -> void override;
+
+  /**
+   * An iterator must go through the cache, it reads the blocks
+   */
+  auto map_blocks(block_id_t start, usize cnt) -> u8 * override {
+    return nullptr;
+  }
+
+private:
+  auto init_frames() -> void;
+
+  auto frame_ptr(usize idx) -> u8 * {
+    return this->frame_data.data() + static_cast<u64>(idx) * this->block_sz;
+  }
+
+  /**
+   * Find the frame caching the block.
+   * On a miss, a frame is evicted and (optionally) filled from the device.
+   *
+   * @param block_id the block to look up
+   * @param fill whether to read the block content into the frame on a miss
+   */
+  auto lookup(block_id_t block_id, bool fill) -> ChfsResult<usize>;
+
+  /**
+   * Pick a victim frame with CLOCK and write it back if it is dirty
+   *
+   * @return OUT_OF_RESOURCE if all frames are pinned
+   */
+  auto evict() -> ChfsResult<usize>;
+
+  auto write_back(usize idx) -> ChfsNullResult;
+
+  /**
+   * Mark a frame dirty and wake up the writeback thread if the cache holds
+   * too many dirty bytes
+   */
+  auto mark_dirty(usize idx) -> void;
+
+  /**
+   * The loop of the writeback thread
+   */
+  auto writeback_loop() -> void;
+
+  /**
+   * Write back the expired dirty blocks, or all of them if the cache holds
+   * too many dirty bytes. Pinned blocks are skipped.
+   */
+  auto writeback_once() -> void;
+
+  /**
+   * Take the error of the writeback thread, if any
+   */
+  auto take_writeback_error() -> ChfsNullResult;
+};
+
+} // namespace chfs
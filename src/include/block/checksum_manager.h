@@ -0,0 +1,113 @@
+//===----------------------------------------------------------------------===//
+//
+//                         Chfs
+//
+// checksum_manager.h
+//
+// Identification: src/include/block/checksum_manager.h
+//
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "block/manager.h"
+
+namespace chfs {
+
+/**
+ * ChecksumBlockManager protects every block of an underlying block device
+ * with a CRC32C.
+ *
+ * The checksums are stored in a reserved region at the tail of the underlying
+ * device, so the device it exposes is a bit smaller:
+ * | block 0 ... block N - 1 | checksum region |
+ * The filesystem layout (super block, inode table, bitmaps, data blocks) is
+ * built on top of the first N blocks, hence both data and metadata blocks
+ * are covered.
+ *
+ * Reads are verified and return `ErrorType::Corrupted` on a mismatch.
+ * Block views cannot point into the device, they fall back to a private
+ * buffer which is verified on creation and checksummed on release.
+ *
+ * Note that the block manager is **not** thread-safe.
+ */
+class ChecksumBlockManager : public BlockManager {
+  std::shared_ptr<BlockManager> inner;
+  // the checksum region is [csum_block_id, inner->total_blocks())
+  block_id_t csum_block_id;
+  // the checksums of all blocks, kept in memory
+  std::vector<u32> csums;
+  // the checksum of an all-zero block
+  u32 zero_csum;
+
+public:
+  /**
+   * Creates a checksummed block device over another block device.
+   *
+   * @param inner the underlying block device
+   * @param will_initialize whether to compute the checksums from the current
+   * content of the device. It reads the whole device once. Otherwise the
+   * checksums are loaded from the checksum region.
+   */
+  explicit ChecksumBlockManager(std::shared_ptr<BlockManager> inner,
+                                bool will_initialize = true);
+
+  /**
+   * Get the number of blocks reserved for the checksums of a device
+   *
+   * @param block_cnt the number of blocks of the underlying device
+   * @param block_size the block size of the underlying device
+   */
+  static auto csum_block_cnt(usize block_cnt, usize block_size) -> usize;
+
+  auto write_block(block_id_t block_id, const u8 *block_data)
+      -> ChfsNullResult override;
+
+  /**
+   * It reads, verifies and rewrites the whole block
+   */
+  auto write_partial_block(block_id_t block_id, const u8 *block_data,
+                           usize offset, usize len) -> ChfsNullResult override;
+
+  auto read_block(block_id_t block_id, u8 *block_data)
+      -> ChfsNullResult override;
+
+  auto zero_block(block_id_t block_id) -> ChfsNullResult override;
+
+  auto read_blocks(const std::vector<block_id_t> &block_ids, u8 *block_data)
+      -> ChfsNullResult override;
+
+  auto write_blocks(const std::vector<block_id_t> &block_ids,
+                    const u8 *block_data) -> ChfsNullResult override;
+
+  auto discard_blocks(const std::vector<block_id_t> &block_ids)
+      -> ChfsNullResult override;
+
+  auto sync_range(block_id_t start, usize cnt) -> ChfsNullResult override;
+
+  auto sync_all() -> ChfsNullResult override;
+
+  auto get_inner() const -> std::shared_ptr<BlockManager> {
+    return this->inner;
+  }
+
+private:
+  auto entries_per_block() const -> usize { return this->block_sz / 4; }
+
+  /**
+   * Verify a block read from the device
+   */
+  auto verify(block_id_t block_id, const u8 *block_data) const
+      -> ChfsNullResult;
+
+  /**
+   * Persist the checksums of the blocks in the region
+   *
+   * @param block_ids the blocks whose checksums have changed
+   */
+  auto store_csums(const std::vector<block_id_t> &block_ids)
+      -> ChfsNullResult;
+};
+
+} // namespace chfs
@@ -0,0 +1,135 @@
+//===----------------------------------------------------------------------===//
+//
+//                         Chfs
+//
+// concurrent_manager.h
+//
+// Identification: src/include/block/concurrent_manager.h
+//
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <functional>
+#include <shared_mutex>
+
+#include "block/manager.h"
+
+namespace chfs {
+
+// the default number of lock stripes of a ConcurrentBlockManager
+const usize KDefaultLockStripes = 256;
+
+/**
+ * ConcurrentBlockManager makes a block device safe to use from several
+ * threads.
+ *
+ * Each block is guarded by one of a fixed number of reader/writer locks,
+ * picked by hashing the block id. Reads take the locks shared and writes
+ * take them exclusive, so readers never wait for each other, and writers
+ * only wait for the users of blocks that hash to the same lock. A batched
+ * call takes the locks of all its blocks, in a fixed order.
+ *
+ * A partial write is atomic, i.e., concurrent partial writes to the same
+ * block are not lost even if the underlying device implements them as a
+ * read-modify-write. `update_block` runs an arbitrary read-modify-write
+ * atomically.
+ *
+ * Block views fall back to a private buffer, a writable view is **not** an
+ * atomic update. The underlying device must allow concurrent calls on
+ * different blocks, e.g., the mmap backend or a `CachedBlockManager`.
+ */
+class ConcurrentBlockManager : public BlockManager {
+  // a lock on its own cache line, so that the readers of different stripes
+  // do not bounce a line between the cores
+  struct alignas(64) Stripe {
+    std::shared_mutex mtx;
+  };
+
+  std::shared_ptr<BlockManager> inner;
+  std::vector<Stripe> stripes;
+
+public:
+  /**
+   * Creates a thread-safe block device over another block device.
+   *
+   * @param inner the underlying block device
+   * @param stripe_cnt the number of locks
+   */
+  explicit ConcurrentBlockManager(std::shared_ptr<BlockManager> inner,
+                                  usize stripe_cnt = KDefaultLockStripes);
+
+  auto write_block(block_id_t block_id, const u8 *block_data)
+      -> ChfsNullResult override;
+
+  auto write_partial_block(block_id_t block_id, const u8 *block_data,
+                           usize offset, usize len) -> ChfsNullResult override;
+
+  auto read_block(block_id_t block_id, u8 *block_data)
+      -> ChfsNullResult override;
+
+  auto zero_block(block_id_t block_id) -> ChfsNullResult override;
+
+  auto read_blocks(const std::vector<block_id_t> &block_ids, u8 *block_data)
+      -> ChfsNullResult override;
+
+  auto write_blocks(const std::vector<block_id_t> &block_ids,
+                    const u8 *block_data) -> ChfsNullResult override;
+
+  auto discard_blocks(const std::vector<block_id_t> &block_ids)
+      -> ChfsNullResult override;
+
+  auto sync_range(block_id_t start, usize cnt) -> ChfsNullResult override;
+
+  auto sync_all() -> ChfsNullResult override;
+
+  /**
+   * It waits for all other calls, since the underlying mapping may move
+   */
+  auto grow(usize new_block_cnt) -> ChfsNullResult override;
+
+  /**
+   * Read, modify and write back a block atomically
+   *
+   * @param update modifies the content of the block in place
+   */
+  auto update_block(block_id_t block_id,
+                    const std::function<void(u8 *)> &update)
+      -> ChfsNullResult;
+
+  auto get_inner() const -> std::shared_ptr<BlockManager> {
+    return this->inner;
+  }
+
+private:
+  auto stripe_of(block_id_t block_id) const -> usize;
+
+  /**
+   * Get the stripes of a batch, sorted and without duplicates
+   */
+  auto stripes_of(const std::vector<block_id_t> &block_ids) const
+      -> std::vector<usize>;
+
+  /**
+   * Holds the locks of several stripes until it goes out of scope
+   */
+  class BatchLock {
+    ConcurrentBlockManager *bm;
+    std::vector<usize> stripes;
+    bool exclusive;
+
+  public:
+    /**
+     * @param stripes the stripes, sorted and without duplicates
+     */
+    BatchLock(ConcurrentBlockManager *bm, std::vector<usize> stripes,
+              bool exclusive);
+
+    ~BatchLock();
+
+    DISALLOW_COPY_AND_MOVE(BatchLock);
+  };
+};
+
+} // namespace chfs
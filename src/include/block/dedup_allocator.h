@@ -0,0 +1,144 @@
+//===----------------------------------------------------------------------===//
+//
+//                         Chfs
+//
+// dedup_allocator.h
+//
+// Identification: src/include/block/dedup_allocator.h
+//
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <unordered_map>
+
+#include "block/allocator.h"
+
+namespace chfs {
+
+/**
+ * An entry of the reference count table
+ */
+struct DedupEntry {
+  // the hash of the content, see `hash64`
+  u64 fingerprint;
+  // 0 if the block is not deduplicated
+  u32 ref_cnt;
+  u32 reserved;
+};
+
+/**
+ * DedupAllocator shares the file blocks with identical content.
+ * It sits between the filesystem and the block allocator: the data blocks
+ * are stored through it, the other blocks are allocated as usual.
+ *
+ * A table of `DedupEntry`, indexed by the block id, records the fingerprint
+ * and the reference count of every deduplicated block. It is stored in
+ * contiguous blocks taken from the allocator when the filesystem is created.
+ * The fingerprint index is rebuilt from it when the filesystem is mounted.
+ *
+ * Blocks past the table, e.g., added by growing the filesystem, are stored
+ * without deduplication.
+ *
+ * Note that the allocator is **not** thread-safe.
+ */
+class DedupAllocator {
+  std::shared_ptr<BlockManager> bm;
+  std::shared_ptr<BlockAllocator> allocator;
+  block_id_t table_block_id;
+  usize table_block_cnt;
+
+  // a copy of the table
+  std::vector<DedupEntry> entries;
+  // fingerprint -> block id
+  std::unordered_map<u64, block_id_t> index;
+
+  // the number of blocks whose write was saved
+  u64 dedup_hit_cnt = 0;
+
+public:
+  /**
+   * Get the number of table blocks for `block_cnt` blocks
+   */
+  static auto table_block_cnt_for(usize block_cnt, usize block_size) -> usize;
+
+  /**
+   * Take the table from the allocator and initialize it
+   *
+   * @return OUT_OF_RESOURCE if the allocator has no contiguous blocks for it
+   */
+  static auto create(std::shared_ptr<BlockManager> bm,
+                     std::shared_ptr<BlockAllocator> allocator)
+      -> ChfsResult<std::shared_ptr<DedupAllocator>>;
+
+  /**
+   * Load an existing table, see `create`
+   */
+  DedupAllocator(std::shared_ptr<BlockManager> bm,
+                 std::shared_ptr<BlockAllocator> allocator,
+                 block_id_t table_block_id, usize table_block_cnt);
+
+  /**
+   * Store the content of file blocks.
+   * A block with the same content as a stored one shares it, otherwise it
+   * is written in place if the old block is not shared, or to a new block.
+   *
+   * @param block_ids the old blocks of the content, 0 (`KInvalidBlockID`)
+   * for new ones. They are updated to the blocks that hold the content.
+   * @param data the content, `block_ids.size()` blocks
+   */
+  auto store(std::vector<block_id_t> &block_ids, const u8 *data)
+      -> ChfsNullResult;
+
+  /**
+   * Allocate a block that is not deduplicated, e.g., for the metadata
+   */
+  auto allocate() -> ChfsResult<block_id_t> {
+    return this->allocator->allocate();
+  }
+
+  /**
+   * Drop a reference to a block.
+   * It is freed once no file refers to it.
+   *
+   * @return INVALID_ARG if the block is freed
+   */
+  auto deallocate(block_id_t block_id) -> ChfsNullResult;
+
+  /**
+   * Get the number of references to a block, 0 if it is not deduplicated
+   */
+  auto ref_cnt(block_id_t block_id) const -> u32;
+
+  /**
+   * Get the number of block writes saved by sharing blocks
+   */
+  auto hit_cnt() const -> u64 { return this->dedup_hit_cnt; }
+
+  auto get_table_block_id() const -> block_id_t {
+    return this->table_block_id;
+  }
+
+  auto get_table_block_cnt() const -> usize { return this->table_block_cnt; }
+
+private:
+  auto entries_per_block() const -> usize;
+
+  auto covered(block_id_t block_id) const -> bool {
+    return block_id < this->entries.size();
+  }
+
+  /**
+   * Drop a reference, without writing the table
+   */
+  auto release(block_id_t block_id, std::vector<block_id_t> &dirty)
+      -> ChfsNullResult;
+
+  /**
+   * Write the table blocks holding the entries of the blocks
+   */
+  auto store_entries(std::vector<block_id_t> &block_ids) -> ChfsNullResult;
+};
+
+} // namespace chfs
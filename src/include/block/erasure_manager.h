@@ -0,0 +1,159 @@
+//===----------------------------------------------------------------------===//
+//
+//                         Chfs
+//
+// erasure_manager.h
+//
+// Identification: src/include/block/erasure_manager.h
+//
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "block/backend.h"
+#include "common/reed_solomon.h"
+#include "common/worker_pool.h"
+
+namespace chfs {
+
+/**
+ * ErasureBlockManager spreads blocks over k + m block devices with a
+ * Reed-Solomon code, so that it survives the loss of any m devices while
+ * only spending m / k of the capacity on redundancy.
+ *
+ * The blocks are grouped into rows of k blocks. Row r is stored in block r
+ * of every device: its k data shards and m parity shards are placed on the
+ * devices starting from device r % (k + m), so that the parity rotates over
+ * the devices like RAID-5/6.
+ *
+ * A write updates the parity of its rows, either by encoding the whole row
+ * (reading the unchanged blocks first) or, for a few blocks of a wide row,
+ * by applying the change of each block to the old parity, whichever reads
+ * fewer blocks. A device that fails an I/O is marked as failed and left
+ * alone, the blocks on it are then reconstructed on the fly by the reads.
+ *
+ * A row is not updated atomically, a crash during a write may leave the
+ * parity of the row stale.
+ * Block views fall back to a private buffer.
+ * Note that the block manager is **not** thread-safe.
+ */
+class ErasureBlockManager : public BlockManager {
+  std::vector<std::shared_ptr<BlockManager>> devices;
+  std::vector<bool> failed;
+  ReedSolomon codec;
+  WorkerPool workers;
+
+public:
+  /**
+   * Creates an erasure-coded block device over other block devices.
+   *
+   * @param devices the k + m underlying block devices, they must share a
+   * block size
+   * @param data_cnt the number of data shards of a row (k)
+   */
+  ErasureBlockManager(std::vector<std::shared_ptr<BlockManager>> devices,
+                      usize data_cnt);
+
+  /**
+   * Creates an erasure-coded block device over files, one device per file.
+   *
+   * @param files the file names of the k + m files
+   * @param block_cnt the number of expected blocks of each file
+   * @param data_cnt the number of data shards of a row (k)
+   * @param backend how the files are accessed
+   */
+  ErasureBlockManager(const std::vector<std::string> &files, usize block_cnt,
+                      usize data_cnt,
+                      BlockBackend backend = BlockBackend::Pread);
+
+  auto write_block(block_id_t block_id, const u8 *block_data)
+      -> ChfsNullResult override;
+
+  auto write_partial_block(block_id_t block_id, const u8 *block_data,
+                           usize offset, usize len) -> ChfsNullResult override;
+
+  auto read_block(block_id_t block_id, u8 *block_data)
+      -> ChfsNullResult override;
+
+  auto zero_block(block_id_t block_id) -> ChfsNullResult override;
+
+  auto read_blocks(const std::vector<block_id_t> &block_ids, u8 *block_data)
+      -> ChfsNullResult override;
+
+  auto write_blocks(const std::vector<block_id_t> &block_ids,
+                    const u8 *block_data) -> ChfsNullResult override;
+
+  /**
+   * The whole rows are discarded on the devices, the other blocks are
+   * zeroed.
+   */
+  auto discard_blocks(const std::vector<block_id_t> &block_ids)
+      -> ChfsNullResult override;
+
+  auto sync_range(block_id_t start, usize cnt) -> ChfsNullResult override;
+
+  auto sync_all() -> ChfsNullResult override;
+
+  auto get_codec() const -> const ReedSolomon & { return this->codec; }
+
+  auto device_failed(usize idx) const -> bool { return this->failed[idx]; }
+
+  /**
+   * Take a device out of service, the blocks on it are reconstructed from
+   * then on.
+   *
+   * @return INVALID_ARG if it would leave fewer than k devices
+   */
+  auto fail_device(usize idx) -> ChfsNullResult;
+
+  /**
+   * Get the device holding a shard of a row
+   */
+  auto device_of(block_id_t row, usize shard) const -> usize {
+    return (row + shard) % this->devices.size();
+  }
+
+private:
+  /**
+   * A shard of a row to read or write
+   */
+  struct ShardIo {
+    block_id_t row;
+    usize shard;
+    // the destination of a read, or the source of a write
+    u8 *data;
+  };
+
+  auto failed_cnt() const -> usize;
+
+  /**
+   * Read shards from the devices in parallel.
+   * The shards on failed devices are reconstructed from their rows.
+   */
+  auto read_shards(const std::vector<ShardIo> &shards) -> ChfsNullResult;
+
+  /**
+   * Reconstruct a whole row from the devices that have not failed
+   *
+   * @param row_data the buffer of the k + m shards
+   */
+  auto reconstruct_row(block_id_t row, u8 *row_data) -> ChfsNullResult;
+
+  /**
+   * Write shards to the devices in parallel, the failed devices are
+   * skipped. It fails once more than m devices have failed.
+   */
+  auto write_shards(const std::vector<ShardIo> &shards) -> ChfsNullResult;
+
+  /**
+   * Run `op(d)` on the devices that have not failed, in parallel.
+   * A device that fails the operation is marked as failed.
+   *
+   * @return IOError once more than m devices have failed
+   */
+  auto for_each_device(const std::function<ChfsNullResult(usize)> &op)
+      -> ChfsNullResult;
+};
+
+} // namespace chfs
@@ -11,6 +11,8 @@
 
 #pragma once
 
+#include <memory>
+#include <type_traits>
 #include <vector>
 
 #include "common/config.h"
@@ -21,22 +23,131 @@ namespace chfs {
 // TODO
 
 class BlockIterator;
+class BlockManager;
+
+/**
+ * How the in-memory block device uses huge pages
+ */
+enum class HugePageMode {
+  // regular pages
+  None,
+  // ask for transparent huge pages with madvise(MADV_HUGEPAGE)
+  Transparent,
+  // reserve pages from the hugetlb pool with MAP_HUGETLB. It falls back to
+  // transparent huge pages if the pool cannot satisfy the mapping.
+  Explicit,
+};
+
+// O_DIRECT requires the buffers, offsets and lengths to be aligned
+const usize KDirectIOAlign = 4096;
+
+/**
+ * An RAII view of a single block of a block manager.
+ *
+ * If the device can be addressed directly (e.g., it is mmap'd), the view
+ * points into the device and no copy is made. Otherwise, the view reads the
+ * block into a private buffer and a writable view writes the buffer back
+ * when it is released.
+ *
+ * A view must not outlive the block manager that creates it.
+ *
+ * @tparam T `const u8` for a read-only view, `u8` for a writable one
+ */
+template <typename T> class BlockView {
+  friend class BlockManager;
+
+  BlockManager *bm = nullptr;
+  block_id_t block_id = 0;
+  T *ptr = nullptr;
+  usize sz = 0;
+  // the private buffer used if the device cannot be addressed directly
+  std::unique_ptr<u8[]> bounce;
+
+public:
+  static constexpr bool KWritable = !std::is_const<T>::value;
+
+  BlockView() = default;
+  BlockView(BlockView &&other) noexcept { *this = std::move(other); }
+
+  auto operator=(BlockView &&other) noexcept -> BlockView & {
+    if (this != &other) {
+      this->release();
+      this->bm = other.bm;
+      this->block_id = other.block_id;
+      this->ptr = other.ptr;
+      this->sz = other.sz;
+      this->bounce = std::move(other.bounce);
+      other.bm = nullptr;
+      other.ptr = nullptr;
+      other.sz = 0;
+    }
+    return *this;
+  }
+
+  ~BlockView() { this->release(); }
+
+  auto id() const -> block_id_t { return this->block_id; }
+
+  auto data() const -> T * { return this->ptr; }
+
+  auto size() const -> usize { return this->sz; }
+
+  auto operator[](usize idx) const -> T & {
+    CHFS_ASSERT(idx < this->sz, "block view index out of range");
+    return this->ptr[idx];
+  }
+
+  /**
+   * Interpret the bytes at the offset as a value of type V.
+   * The value is const for a read-only view.
+   */
+  template <typename V>
+  auto as(usize offset = 0) const
+      -> std::conditional_t<KWritable, V, const V> * {
+    CHFS_ASSERT(offset + sizeof(V) <= this->sz,
+                "block view offset out of range");
+    return reinterpret_cast<std::conditional_t<KWritable, V, const V> *>(
+        this->ptr + offset);
+  }
+
+  /**
+   * Release the view before it is destructed.
+   * A writable view reports whether its content reaches the device.
+   */
+  auto release() -> ChfsNullResult;
+
+private:
+  BlockView(BlockManager *bm, block_id_t block_id, T *ptr, usize sz,
+            std::unique_ptr<u8[]> bounce)
+      : bm(bm), block_id(block_id), ptr(ptr), sz(sz),
+        bounce(std::move(bounce)) {}
+
+  DISALLOW_COPY(BlockView);
+};
+
+using ReadBlockView = BlockView<const u8>;
+using WriteBlockView = BlockView<u8>;
 
 /**
  * BlockManager implements a block device to read/write block devices
- * Note that the block manager is **not** thread-safe.
+ * Note that the block manager is **not** thread-safe, wrap it in a
+ * `ConcurrentBlockManager` to share it between threads.
  */
 class BlockManager {
   friend class BlockIterator;
+  friend class BlockView<const u8>;
+  friend class BlockView<u8>;
 
 protected:
-  const usize block_sz = 4096;
+  const usize block_sz = KDefaultBlockSize;
 
   std::string file_name_;
   int fd;
   u8 *block_data;
   usize block_cnt;
   bool in_memory; // whether we use in-memory to emulate the block manager
+  u64 map_sz = 0;  // the length of the anonymous mapping of an in-memory device
+  bool hugetlb = false; // whether the anonymous mapping uses hugetlb pages
 
 public:
   /**
@@ -51,18 +162,27 @@ public:
    * @param block_cnt the number of expected blocks in the device. If the
    * device's blocks are more or less than it, the manager should adjust the
    * actual block cnt.
+   * @param block_size the size of each block, see `is_valid_block_size`.
+   * An existing file must be opened with the size it was created with,
+   * which the filesystem records in its super block.
    */
-  BlockManager(const std::string &file, usize block_cnt);
+  BlockManager(const std::string &file, usize block_cnt,
+               usize block_size = KDefaultBlockSize);
 
   /**
    * Creates a memory-backed block manager that writes to a memory block device.
    * Note that this is commonly used for testing.
    * Maybe it can be used for non-volatile memory, but who knows.
    *
+   * The device is an anonymous mapping, so it reads as zeros and a page is
+   * only allocated when it is first written.
+   *
    * @param block_count the number of blocks in the device
    * @param block_size the size of each block
+   * @param huge_page whether to back the device with huge pages
    */
-  BlockManager(usize block_count, usize block_size);
+  BlockManager(usize block_count, usize block_size,
+               HugePageMode huge_page = HugePageMode::None);
 
   virtual ~BlockManager();
 
@@ -95,6 +215,122 @@ public:
    */
   virtual auto zero_block(block_id_t block_id) -> ChfsNullResult;
 
+  /**
+   * Clear a range of blocks, e.g., when a volume is initialized.
+   * A mapped device zeroes large ranges with non-temporal stores, so the
+   * zeros do not evict the cached data, see `bulk_zero`.
+   *
+   * @param start the first block of the range
+   * @param cnt the number of blocks in the range
+   * @return INVALID_ARG if the range is out of the device
+   */
+  virtual auto zero_blocks(block_id_t start, usize cnt) -> ChfsNullResult;
+
+  /**
+   * Read a batch of blocks into a contiguous buffer.
+   * Runs of physically contiguous blocks are transferred at once.
+   *
+   * @param block_ids ids of the blocks to read
+   * @param block_data the buffer to store the result, the i-th block is
+   * stored at `block_data + i * block_size()`
+   * @return INVALID_ARG if any block id is out of range, nothing is read then
+   */
+  virtual auto read_blocks(const std::vector<block_id_t> &block_ids,
+                           u8 *block_data) -> ChfsNullResult;
+
+  /**
+   * Write a batch of blocks from a contiguous buffer.
+   * Runs of physically contiguous blocks are transferred at once, large
+   * runs of a mapped device with non-temporal stores, see `bulk_copy`.
+   *
+   * @param block_ids ids of the blocks to write
+   * @param block_data the raw data, the i-th block is stored at
+   * `block_data + i * block_size()`
+   * @return INVALID_ARG if any block id is out of range, nothing is written
+   * then
+   */
+  virtual auto write_blocks(const std::vector<block_id_t> &block_ids,
+                            const u8 *block_data) -> ChfsNullResult;
+
+  /**
+   * Release the storage of a batch of blocks, which read as zeros afterwards.
+   * A file-backed device punches holes in the file with fallocate(2), an
+   * in-memory device drops its pages with madvise(MADV_DONTNEED). Parts of a
+   * block smaller than the host page (or file system block) are only zeroed.
+   *
+   * @param block_ids ids of the blocks, runs of contiguous blocks are
+   * released at once
+   * @return INVALID_ARG if any block id is out of range
+   */
+  virtual auto discard_blocks(const std::vector<block_id_t> &block_ids)
+      -> ChfsNullResult;
+
+  /**
+   * Grow the device to `new_block_cnt` blocks. A file-backed device extends
+   * the file and remaps it, the new blocks read as zeros.
+   *
+   * The device may be moved in memory, so no block view (or pointer from
+   * `unsafe_get_block_ptr`) may be alive during the call.
+   *
+   * @return INVALID_ARG if the device would shrink,
+   *         INVALID if the device cannot grow (e.g., it has no storage),
+   *         OUT_OF_RESOURCE or IOError if the remap or the resize fails
+   */
+  virtual auto grow(usize new_block_cnt) -> ChfsNullResult;
+
+  /**
+   * Force a block to the stable storage.
+   * @param block_id id of the block
+   */
+  auto sync_block(block_id_t block_id) -> ChfsNullResult {
+    return this->sync_range(block_id, 1);
+  }
+
+  /**
+   * Force a range of blocks to the stable storage.
+   * A mapped device uses msync(2) on the pages of the range, others fall back
+   * to fdatasync(2). It is a no-op for an in-memory device.
+   *
+   * @param start the first block of the range
+   * @param cnt the number of blocks in the range
+   * @return INVALID_ARG if the range is out of the device,
+   *         IOError if the device fails to sync
+   */
+  virtual auto sync_range(block_id_t start, usize cnt) -> ChfsNullResult;
+
+  /**
+   * Force all blocks to the stable storage.
+   */
+  virtual auto sync_all() -> ChfsNullResult;
+
+  /**
+   * Hint that a range of blocks will be read soon, so that the device can
+   * start fetching them. A mapped file is prefetched with madvise(2), a file
+   * accessed with read(2) with posix_fadvise(2).
+   *
+   * @param start the first block of the range
+   * @param cnt the number of blocks in the range
+   */
+  virtual auto readahead(block_id_t start, usize cnt) -> void;
+
+  /**
+   * Get a read-only view of a block.
+   * If possible, the view points into the device directly without a copy.
+   *
+   * @param block_id id of the block
+   * @return INVALID_ARG if the block id is out of range
+   */
+  auto read_view(block_id_t block_id) -> ChfsResult<ReadBlockView>;
+
+  /**
+   * Get a writable view of a block.
+   * The modification is committed to the device when the view is released.
+   *
+   * @param block_id id of the block
+   * @return INVALID_ARG if the block id is out of range
+   */
+  auto write_view(block_id_t block_id) -> ChfsResult<WriteBlockView>;
+
   auto total_storage_sz() const -> usize {
     return this->block_cnt * this->block_sz;
   }
@@ -113,11 +349,155 @@ public:
    * Get the block data pointer of the manager
    */
   auto unsafe_get_block_ptr() const -> u8 * { return this->block_data; }
+
+  /**
+   * Whether a file-backed device supports the block size, i.e., a power of
+   * two from `KMinBlockSize` to `KMaxBlockSize`
+   */
+  static auto is_valid_block_size(usize block_size) -> bool {
+    return block_size >= KMinBlockSize && block_size <= KMaxBlockSize &&
+           (block_size & (block_size - 1)) == 0;
+  }
+
+protected:
+  /**
+   * Creates a block manager whose device is **not** mapped into memory,
+   * i.e., `block_data` is nullptr. Subclasses perform the I/O on their own.
+   *
+   * @param file the name of the device
+   * @param fd the opened device file, or -1 if there is none.
+   * The manager takes the ownership of it.
+   * @param block_cnt the number of blocks in the device
+   * @param block_size the size of each block
+   */
+  BlockManager(const std::string &file, int fd, usize block_cnt,
+               usize block_size);
+
+  /**
+   * Open (or create) the file backing a block device.
+   * An empty file is initialized to `block_cnt` blocks.
+   *
+   * @param file the file name
+   * @param flags extra flags passed to open(2), e.g., O_DIRECT
+   * @param block_cnt the number of blocks for a new file
+   * @param block_size the size of each block
+   * @return the opened fd (-1 on failure) and the number of blocks in the file
+   */
+  static auto open_block_file(const std::string &file, int flags,
+                              usize block_cnt, usize block_size)
+      -> std::pair<int, usize>;
+
+  /**
+   * Get the length of the run of consecutive block ids starting at `from`
+   */
+  static auto contiguous_run_len(const std::vector<block_id_t> &block_ids,
+                                 usize from) -> usize;
+
+  /**
+   * Check that all block ids of a batch are in range
+   */
+  auto check_batch(const std::vector<block_id_t> &block_ids) const -> bool;
+
+  /**
+   * Get the address of a block for a block view.
+   * Subclasses that keep their own copy of the blocks (e.g., a cache)
+   * should return the address of that copy instead.
+   *
+   * @return nullptr if the block cannot be addressed directly,
+   *         then the view falls back to `read_block`/`write_block`
+   */
+  virtual auto map_block(block_id_t block_id) -> u8 *;
+
+  /**
+   * Called when a directly addressed block view is released.
+   * This is the hook for subclasses that need to intercept writes.
+   *
+   * @param dirty whether the view was writable
+   */
+  virtual auto unmap_block(block_id_t block_id, bool dirty) -> void {}
+
+  /**
+   * Get the address of a run of blocks for a block iterator.
+   * Unlike `map_block`, there is no hook when the run is no longer used,
+   * so subclasses that need to intercept the accesses return nullptr.
+   *
+   * @return nullptr if the run cannot be addressed directly,
+   *         then the iterator reads the run into its own buffer
+   */
+  virtual auto map_blocks(block_id_t start, usize cnt) -> u8 *;
+
+private:
+  template <typename T> auto make_view(block_id_t block_id)
+      -> ChfsResult<BlockView<T>>;
 };
 
+template <typename T> auto BlockView<T>::release() -> ChfsNullResult {
+  if (this->bm == nullptr) {
+    return KNullOk;
+  }
+  auto bm = this->bm;
+  this->bm = nullptr;
+  this->ptr = nullptr;
+  this->sz = 0;
+
+  if (this->bounce == nullptr) {
+    bm->unmap_block(this->block_id, KWritable);
+    return KNullOk;
+  }
+
+  auto bounce = std::move(this->bounce);
+  if (KWritable) {
+    return bm->write_block(this->block_id, bounce.get());
+  }
+  return KNullOk;
+}
+
+template <typename T>
+auto BlockManager::make_view(block_id_t block_id) -> ChfsResult<BlockView<T>> {
+  if (block_id >= this->block_cnt) {
+    return ChfsResult<BlockView<T>>(ErrorType::INVALID_ARG);
+  }
+
+  auto ptr = this->map_block(block_id);
+  if (ptr != nullptr) {
+    return ChfsResult<BlockView<T>>(
+        BlockView<T>(this, block_id, ptr, this->block_sz, nullptr));
+  }
+
+  auto bounce = std::unique_ptr<u8[]>(new u8[this->block_sz]);
+  auto res = this->read_block(block_id, bounce.get());
+  if (res.is_err()) {
+    return ChfsResult<BlockView<T>>(res.unwrap_error());
+  }
+  ptr = bounce.get();
+  return ChfsResult<BlockView<T>>(
+      BlockView<T>(this, block_id, ptr, this->block_sz, std::move(bounce)));
+}
+
+inline auto BlockManager::read_view(block_id_t block_id)
+    -> ChfsResult<ReadBlockView> {
+  return this->make_view<const u8>(block_id);
+}
+
+inline auto BlockManager::write_view(block_id_t block_id)
+    -> ChfsResult<WriteBlockView> {
+  return this->make_view<u8>(block_id);
+}
+
+// the default number of blocks an iterator holds at once
+const usize KDefaultIterWindow = 32;
+
 /**
  * A class to simplify iterating blocks in the block manager.
  *
+ * The iterator holds a window of several consecutive blocks. If the device
+ * can be addressed directly (e.g., it is mmap'd), the window points into the
+ * device and no copy is made, otherwise the window is read with a single
+ * `read_blocks`. Whenever a window is loaded, the device is asked to read
+ * the next one ahead.
+ *
+ * A window pointing into the device must not be used across a `grow`.
+ *
  * Note that we don't provide a conventional iterator interface, because
  * each block read/write may return error due to failed reading/writing blocks.
  */
@@ -127,6 +507,14 @@ class BlockIterator {
   block_id_t start_block_id;
   block_id_t end_block_id;
 
+  // the maximal number of blocks of a window
+  usize window;
+  // the window is [win_start, win_start + win_len), relative to start_block_id
+  block_id_t win_start = 0;
+  usize win_len = 0;
+  // the window in the device, or nullptr if it is in the buffer
+  u8 *mapped = nullptr;
+
   std::vector<u8> buffer;
 
 public:
@@ -136,9 +524,12 @@ public:
    * @param bm the block manager to iterate
    * @param start_block_id the start block id of the iterator
    * @param end_block_id the end block id of the iterator
+   * @param window the number of blocks loaded at once
    */
   static auto create(BlockManager *bm, block_id_t start_block_id,
-                     block_id_t end_block_id) -> ChfsResult<BlockIterator>;
+                     block_id_t end_block_id,
+                     usize window = KDefaultIterWindow)
+      -> ChfsResult<BlockIterator>;
 
   /**
    * Iterate to the cur_block_off to an offset
@@ -162,19 +553,54 @@ public:
    *  Assumption: a prior call of has_next() must return true
    */
   auto flush_cur_block() -> ChfsNullResult {
+    if (this->mapped != nullptr) {
+      // the changes are already in the device
+      return KNullOk;
+    }
     auto target_block_id =
         this->start_block_id + this->cur_block_off / bm->block_sz;
-    return this->bm->write_block(target_block_id, this->buffer.data());
+    return this->bm->write_block(target_block_id, this->cur_block_ptr());
   }
 
   auto get_cur_byte() const -> u8 {
-    return this->buffer[this->cur_block_off % bm->block_sz];
+    return this->window_data()[this->cur_block_off -
+                               this->win_start * bm->block_sz];
   }
 
   template <typename T> auto unsafe_get_value_ptr() -> T * {
-    return reinterpret_cast<T *>(this->buffer.data() +
-                                 this->cur_block_off % bm->block_sz);
+    return reinterpret_cast<T *>(this->window_data() + this->cur_block_off -
+                                 this->win_start * bm->block_sz);
+  }
+
+  /**
+   * Get the blocks of the current window from the current block on,
+   * so that a scan can go through them at once.
+   *
+   * **Assumption**: a prior call of has_next() must return true
+   *
+   * @return the address of the current block and the number of blocks
+   */
+  auto cur_window() -> std::pair<u8 *, usize> {
+    auto cur_block = this->cur_block_off / bm->block_sz;
+    return {this->cur_block_ptr(),
+            static_cast<usize>(this->win_start + this->win_len - cur_block)};
   }
+
+private:
+  auto window_data() const -> u8 * {
+    return this->mapped != nullptr ? this->mapped
+                                   : const_cast<u8 *>(this->buffer.data());
+  }
+
+  auto cur_block_ptr() const -> u8 * {
+    auto cur_block = this->cur_block_off / bm->block_sz;
+    return this->window_data() + (cur_block - this->win_start) * bm->block_sz;
+  }
+
+  /**
+   * Load the window starting from a block, relative to start_block_id
+   */
+  auto load_window(block_id_t from) -> ChfsNullResult;
 };
 
 } // namespace chfs
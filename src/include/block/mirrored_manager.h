@@ -0,0 +1,196 @@
+//===----------------------------------------------------------------------===//
+//
+//                         Chfs
+//
+// mirrored_manager.h
+//
+// Identification: src/include/block/mirrored_manager.h
+//
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <atomic>
+#include <shared_mutex>
+
+#include "block/manager.h"
+#include "common/worker_pool.h"
+
+namespace chfs {
+
+/**
+ * How the reads of a mirror choose a replica
+ */
+enum class ReadPolicy {
+  // take the healthy replicas in turn
+  RoundRobin,
+  // take the healthy replica with the fewest blocks being read
+  QueueDepth,
+};
+
+enum class ReplicaState {
+  // in sync, it serves reads and writes
+  Healthy,
+  // being copied from a healthy replica, it only receives writes
+  Rebuilding,
+  // out of sync, it is left alone until it is rebuilt
+  Failed,
+};
+
+/**
+ * MirroredBlockManager keeps the same blocks on two or more block devices
+ * (RAID-1).
+ *
+ * Every write goes to all replicas that are not failed, and a read goes to a
+ * single healthy replica chosen by the `ReadPolicy`. A large batched read is
+ * split among the healthy replicas, which serve their parts in parallel.
+ *
+ * A replica which fails an I/O is marked `ReplicaState::Failed` and the
+ * request is retried on the others (this also covers a replica that reports
+ * `ErrorType::Corrupted`, e.g., a `ChecksumBlockManager`). The request only
+ * fails when no healthy replica is left. A failed replica can be replaced
+ * (or retried) with `rebuild_replica()`, which copies the device from a
+ * healthy replica in the background, while it keeps receiving the writes.
+ *
+ * Reads may be issued from several threads at once, as long as the replicas
+ * allow concurrent reads. Writes are serialized with reads and with the
+ * rebuild. Block views fall back to a private buffer and are **not**
+ * thread-safe.
+ */
+class MirroredBlockManager : public BlockManager {
+  struct Replica {
+    std::shared_ptr<BlockManager> bm;
+    std::atomic<ReplicaState> state{ReplicaState::Healthy};
+    // the number of blocks being read from the replica
+    std::atomic<usize> inflight{0};
+  };
+
+  std::vector<std::unique_ptr<Replica>> replicas;
+  ReadPolicy read_policy;
+  std::atomic<usize> next_replica{0};
+
+  // reads share it, writes and the rebuild batches take it exclusively
+  mutable std::shared_mutex mtx;
+  WorkerPool workers;
+
+  std::thread rebuild_thread;
+  std::atomic<bool> rebuild_stop{false};
+  // the number of blocks copied by the current rebuild
+  std::atomic<usize> rebuild_done{0};
+
+public:
+  /**
+   * Creates a mirror over block devices with the same content,
+   * e.g., the devices just created.
+   *
+   * @param replicas the underlying block devices, they must share a block
+   * size. The mirror is as large as the smallest one.
+   * @param read_policy how the reads choose a replica
+   */
+  explicit MirroredBlockManager(
+      std::vector<std::shared_ptr<BlockManager>> replicas,
+      ReadPolicy read_policy = ReadPolicy::QueueDepth);
+
+  /**
+   * Stop the rebuild, if any
+   */
+  ~MirroredBlockManager() override;
+
+  auto write_block(block_id_t block_id, const u8 *block_data)
+      -> ChfsNullResult override;
+
+  auto write_partial_block(block_id_t block_id, const u8 *block_data,
+                           usize offset, usize len) -> ChfsNullResult override;
+
+  auto read_block(block_id_t block_id, u8 *block_data)
+      -> ChfsNullResult override;
+
+  auto zero_block(block_id_t block_id) -> ChfsNullResult override;
+
+  /**
+   * A large batch is split among the healthy replicas
+   */
+  auto read_blocks(const std::vector<block_id_t> &block_ids, u8 *block_data)
+      -> ChfsNullResult override;
+
+  /**
+   * The replicas are written in parallel
+   */
+  auto write_blocks(const std::vector<block_id_t> &block_ids,
+                    const u8 *block_data) -> ChfsNullResult override;
+
+  auto discard_blocks(const std::vector<block_id_t> &block_ids)
+      -> ChfsNullResult override;
+
+  auto sync_range(block_id_t start, usize cnt) -> ChfsNullResult override;
+
+  auto sync_all() -> ChfsNullResult override;
+
+  auto replica_cnt() const -> usize { return this->replicas.size(); }
+
+  auto get_replica(usize idx) const -> std::shared_ptr<BlockManager>;
+
+  auto replica_state(usize idx) const -> ReplicaState;
+
+  /**
+   * Take a replica out of service, e.g., before it is replaced.
+   *
+   * @return INVALID_ARG if it is the last healthy replica
+   */
+  auto fail_replica(usize idx) -> ChfsNullResult;
+
+  /**
+   * Rebuild a failed replica in the background.
+   *
+   * @param idx the index of the replica
+   * @param replacement the device that replaces the replica, or nullptr
+   * to rebuild the replica in place
+   * @return INVALID_ARG if the replica is not failed, the replacement is too
+   * small, or another rebuild is running
+   */
+  auto rebuild_replica(usize idx,
+                       std::shared_ptr<BlockManager> replacement = nullptr)
+      -> ChfsNullResult;
+
+  /**
+   * Wait for the running rebuild, if any
+   *
+   * @return whether all replicas are healthy
+   */
+  auto wait_rebuild() -> bool;
+
+  /**
+   * Get the number of blocks copied by the running (or last) rebuild
+   */
+  auto rebuild_progress() const -> usize { return this->rebuild_done; }
+
+private:
+  /**
+   * Choose a healthy replica for a read
+   *
+   * @return the index of the replica, or `replica_cnt()` if there is none
+   */
+  auto pick_replica() -> usize;
+
+  auto healthy_cnt() const -> usize;
+
+  /**
+   * Read a batch from a healthy replica, trying the others on failure
+   */
+  auto read_from_any(const std::vector<block_id_t> &block_ids, u8 *block_data)
+      -> ChfsNullResult;
+
+  /**
+   * Apply a write to all replicas that are not failed.
+   * A replica that fails the write is marked as failed.
+   *
+   * @param parallel whether to write the replicas in parallel
+   */
+  auto write_all(const std::function<ChfsNullResult(BlockManager &)> &op,
+                 bool parallel) -> ChfsNullResult;
+
+  auto rebuild(usize idx) -> void;
+};
+
+} // namespace chfs
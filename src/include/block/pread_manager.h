@@ -0,0 +1,81 @@
+//===----------------------------------------------------------------------===//
+//
+//                         Chfs
+//
+// pread_manager.h
+//
+// Identification: src/include/block/pread_manager.h
+//
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "block/manager.h"
+
+namespace chfs {
+
+/**
+ * PreadBlockManager implements a file-backed block device with plain
+ * pread(2)/pwrite(2) calls instead of a shared mmap.
+ *
+ * Compared with the mmap backend, the data reaches the file when the call
+ * returns, I/O errors are reported as `ErrorType::IOError` instead of a
+ * SIGBUS, and the memory used is bounded by a single aligned scratch block.
+ *
+ * Note that the block manager is **not** thread-safe.
+ */
+class PreadBlockManager : public BlockManager {
+  bool direct_io;
+  // an aligned buffer of one block for partial writes and O_DIRECT staging
+  u8 *scratch = nullptr;
+
+public:
+  /**
+   * Creates a new block manager over a file with pread/pwrite.
+   * @param file the file name of the file to write to
+   * @param block_cnt the number of expected blocks in the device. If the file
+   * already exists, the block cnt is taken from the file size.
+   * @param direct_io whether to bypass the page cache with O_DIRECT
+   * @param block_size the size of each block
+   */
+  PreadBlockManager(const std::string &file, usize block_cnt,
+                    bool direct_io = false,
+                    usize block_size = KDefaultBlockSize);
+
+  ~PreadBlockManager() override;
+
+  auto write_block(block_id_t block_id, const u8 *block_data)
+      -> ChfsNullResult override;
+
+  auto write_partial_block(block_id_t block_id, const u8 *block_data,
+                           usize offset, usize len) -> ChfsNullResult override;
+
+  auto read_block(block_id_t block_id, u8 *block_data)
+      -> ChfsNullResult override;
+
+  auto zero_block(block_id_t block_id) -> ChfsNullResult override;
+
+  auto read_blocks(const std::vector<block_id_t> &block_ids, u8 *block_data)
+      -> ChfsNullResult override;
+
+  auto write_blocks(const std::vector<block_id_t> &block_ids,
+                    const u8 *block_data) -> ChfsNullResult override;
+
+private:
+  /**
+   * @param opened the fd and block cnt from `open_block_file`
+   */
+  PreadBlockManager(const std::string &file, std::pair<int, usize> opened,
+                    bool direct_io, usize block_size);
+
+  /**
+   * Transfer a contiguous range of the device, retrying short transfers
+   */
+  auto read_range(u8 *buf, u64 offset, u64 len) -> ChfsNullResult;
+  auto write_range(const u8 *buf, u64 offset, u64 len) -> ChfsNullResult;
+
+  auto is_aligned(const void *ptr) const -> bool;
+};
+
+} // namespace chfs
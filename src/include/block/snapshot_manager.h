@@ -0,0 +1,222 @@
+//===----------------------------------------------------------------------===//
+//
+//                         Chfs
+//
+// snapshot_manager.h
+//
+// Identification: src/include/block/snapshot_manager.h
+//
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <unordered_map>
+
+#include "block/manager.h"
+
+namespace chfs {
+
+// the maximal number of snapshots kept at once
+const usize KMaxSnapshots = 64;
+
+/**
+ * SnapshotBlockManager takes copy-on-write snapshots of a block device.
+ *
+ * The underlying device is split into the live volume, the snapshot
+ * metadata and a store of preserved blocks:
+ * | volume | header | remap log | store |
+ * Taking a snapshot only records it in the header. When a block of the
+ * volume is written for the first time after the latest snapshot, its old
+ * content is first copied to the store, and the remap entry
+ * (snapshot, block) -> store block is appended to the log.
+ *
+ * A snapshot sees a block as the first preserved copy among itself and the
+ * later snapshots, or as the live block if no snapshot has preserved it.
+ * `open_snapshot` exposes a snapshot as a read-only block device.
+ *
+ * Deleting a snapshot hands its copies to the previous snapshot, which
+ * still needs them, and frees the others.
+ *
+ * Note that the block manager is **not** thread-safe.
+ */
+class SnapshotBlockManager : public BlockManager {
+  struct Snapshot {
+    u32 id;
+    // block id -> store block id
+    std::unordered_map<block_id_t, block_id_t> remap;
+  };
+
+  std::shared_ptr<BlockManager> inner;
+  block_id_t header_block_id;
+  block_id_t log_block_id;
+  block_id_t store_block_id;
+  usize store_block_cnt;
+
+  // ordered by id, the last one is the latest
+  std::vector<Snapshot> snapshots;
+  u32 next_id = 1;
+  // the number of entries in the log
+  usize log_entry_cnt = 0;
+  // the store blocks below it have been used, the free ones are in the list
+  usize store_cursor = 0;
+  std::vector<block_id_t> free_store_blocks;
+
+public:
+  /**
+   * Creates a snapshot-capable block device over another block device.
+   *
+   * @param inner the underlying block device
+   * @param store_block_cnt the number of blocks reserved for the preserved
+   * copies, it bounds how much can be written while snapshots are kept
+   * @param will_initialize whether to start without snapshots. Otherwise the
+   * snapshots are loaded from the device.
+   */
+  SnapshotBlockManager(std::shared_ptr<BlockManager> inner,
+                       usize store_block_cnt, bool will_initialize = true);
+
+  /**
+   * Get the number of blocks of the underlying device used for the
+   * snapshots, besides the volume
+   */
+  static auto reserved_block_cnt(usize store_block_cnt, usize block_size)
+      -> usize;
+
+  auto write_block(block_id_t block_id, const u8 *block_data)
+      -> ChfsNullResult override;
+
+  auto write_partial_block(block_id_t block_id, const u8 *block_data,
+                           usize offset, usize len) -> ChfsNullResult override;
+
+  auto read_block(block_id_t block_id, u8 *block_data)
+      -> ChfsNullResult override;
+
+  auto zero_block(block_id_t block_id) -> ChfsNullResult override;
+
+  auto read_blocks(const std::vector<block_id_t> &block_ids, u8 *block_data)
+      -> ChfsNullResult override;
+
+  auto write_blocks(const std::vector<block_id_t> &block_ids,
+                    const u8 *block_data) -> ChfsNullResult override;
+
+  auto discard_blocks(const std::vector<block_id_t> &block_ids)
+      -> ChfsNullResult override;
+
+  auto sync_range(block_id_t start, usize cnt) -> ChfsNullResult override;
+
+  auto sync_all() -> ChfsNullResult override;
+
+  /**
+   * Take a snapshot of the volume in O(1)
+   *
+   * @return the id of the snapshot, or OUT_OF_RESOURCE if there are
+   * `KMaxSnapshots` snapshots already
+   */
+  auto create_snapshot() -> ChfsResult<u32>;
+
+  /**
+   * Delete a snapshot
+   *
+   * @return NotExist if there is no such snapshot
+   */
+  auto delete_snapshot(u32 id) -> ChfsNullResult;
+
+  /**
+   * Get the ids of the snapshots, from the oldest to the latest
+   */
+  auto list_snapshots() const -> std::vector<u32>;
+
+  /**
+   * Get a read-only block device of a snapshot.
+   * It must not outlive this block manager.
+   *
+   * @return NotExist if there is no such snapshot
+   */
+  auto open_snapshot(u32 id) -> ChfsResult<std::shared_ptr<BlockManager>>;
+
+  /**
+   * Read a block as it was when a snapshot was taken
+   */
+  auto read_snapshot_block(u32 id, block_id_t block_id, u8 *block_data)
+      -> ChfsNullResult;
+
+  /**
+   * Get the number of store blocks left for the preserved copies
+   */
+  auto free_store_block_cnt() const -> usize {
+    return this->store_block_cnt - this->store_cursor +
+           this->free_store_blocks.size();
+  }
+
+  auto get_inner() const -> std::shared_ptr<BlockManager> {
+    return this->inner;
+  }
+
+private:
+  auto entries_per_block() const -> usize;
+
+  auto find_snapshot(u32 id) -> Snapshot *;
+
+  /**
+   * Copy the blocks to the store before they are overwritten,
+   * unless the latest snapshot has copied them already
+   */
+  auto preserve(const std::vector<block_id_t> &block_ids) -> ChfsNullResult;
+
+  auto alloc_store_block() -> ChfsResult<block_id_t>;
+
+  auto store_header() -> ChfsNullResult;
+
+  /**
+   * Append an entry to the remap log
+   */
+  auto append_log(u32 id, block_id_t block_id, block_id_t store_id)
+      -> ChfsNullResult;
+
+  /**
+   * Write the whole remap log again from the snapshots
+   */
+  auto rewrite_log() -> ChfsNullResult;
+
+  auto load() -> void;
+};
+
+/**
+ * A read-only block device of a snapshot, see
+ * `SnapshotBlockManager::open_snapshot`. Writes return INVALID.
+ */
+class SnapshotView : public BlockManager {
+  SnapshotBlockManager *origin;
+  u32 id;
+
+public:
+  SnapshotView(SnapshotBlockManager *origin, u32 id);
+
+  auto write_block(block_id_t block_id, const u8 *block_data)
+      -> ChfsNullResult override;
+
+  auto write_partial_block(block_id_t block_id, const u8 *block_data,
+                           usize offset, usize len) -> ChfsNullResult override;
+
+  auto read_block(block_id_t block_id, u8 *block_data)
+      -> ChfsNullResult override;
+
+  auto zero_block(block_id_t block_id) -> ChfsNullResult override;
+
+  auto read_blocks(const std::vector<block_id_t> &block_ids, u8 *block_data)
+      -> ChfsNullResult override;
+
+  auto write_blocks(const std::vector<block_id_t> &block_ids,
+                    const u8 *block_data) -> ChfsNullResult override;
+
+  auto discard_blocks(const std::vector<block_id_t> &block_ids)
+      -> ChfsNullResult override;
+
+  auto sync_range(block_id_t start, usize cnt) -> ChfsNullResult override;
+
+  auto sync_all() -> ChfsNullResult override;
+
+  auto snapshot_id() const -> u32 { return this->id; }
+};
+
+} // namespace chfs
@@ -0,0 +1,224 @@
+//===----------------------------------------------------------------------===//
+//
+//                         Chfs
+//
+// stats_manager.h
+//
+// Identification: src/include/block/stats_manager.h
+//
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <mutex>
+
+#include "block/manager.h"
+
+namespace chfs {
+
+/**
+ * The kinds of block operations counted by a StatsBlockManager
+ */
+enum class BlockOp {
+  // read_block, read_blocks
+  Read,
+  // write_block, write_blocks
+  Write,
+  // write_partial_block
+  PartialWrite,
+  // zero_block
+  Zero,
+  // discard_blocks
+  Discard,
+  // sync_range, sync_all
+  Sync,
+};
+
+const usize KBlockOpCnt = 6;
+
+/**
+ * Get the name of a kind of block operation, e.g., for reports
+ */
+inline auto block_op_name(BlockOp op) -> const char * {
+  switch (op) {
+  case BlockOp::Read:
+    return "read";
+  case BlockOp::Write:
+    return "write";
+  case BlockOp::PartialWrite:
+    return "partial_write";
+  case BlockOp::Zero:
+    return "zero";
+  case BlockOp::Discard:
+    return "discard";
+  case BlockOp::Sync:
+    return "sync";
+  default:
+    return "unknown";
+  }
+}
+
+// Bucket i of a latency histogram counts the latencies in [2^i, 2^(i+1)) ns,
+// the last one also counts the longer ones (> 4s).
+const usize KLatencyBuckets = 32;
+
+/**
+ * The counters of one kind of operation
+ */
+struct BlockOpStats {
+  u64 calls = 0;
+  u64 errors = 0;
+  // the blocks and the bytes the calls cover
+  u64 blocks = 0;
+  u64 bytes = 0;
+  u64 total_ns = 0;
+  std::array<u64, KLatencyBuckets> latency{};
+
+  auto mean_ns() const -> u64 {
+    return this->calls == 0 ? 0 : this->total_ns / this->calls;
+  }
+
+  /**
+   * Get an upper bound of a latency percentile
+   *
+   * @param p the percentile in [0, 100]
+   */
+  auto percentile_ns(double p) const -> u64;
+};
+
+/**
+ * A snapshot of the counters of a StatsBlockManager
+ */
+struct BlockIOStats {
+  std::array<BlockOpStats, KBlockOpCnt> ops;
+
+  auto operator[](BlockOp op) -> BlockOpStats & {
+    return this->ops[static_cast<usize>(op)];
+  }
+
+  auto operator[](BlockOp op) const -> const BlockOpStats & {
+    return this->ops[static_cast<usize>(op)];
+  }
+};
+
+/**
+ * StatsBlockManager counts the operations on a block device and the
+ * latencies of them.
+ *
+ * Each thread counts into its own set of counters, so counting needs neither
+ * locks nor atomic read-modify-writes, and the threads do not share cache
+ * lines. The sets are only merged by `get_stats()`.
+ *
+ * The block manager is as thread-safe as the underlying device, the
+ * statistics can be read from any thread at any time.
+ *
+ * Every access has to go through the counted operations, so the blocks are
+ * never mapped: block views and iterators over this manager copy the blocks
+ * instead of pointing into the device. Wrap a device only when its I/O is
+ * being measured.
+ */
+class StatsBlockManager : public BlockManager {
+public:
+  /**
+   * The counters of a thread. They are only written by the thread, the
+   * atomics make the concurrent reads of `get_stats()` well-defined.
+   */
+  struct alignas(64) ThreadStats {
+    struct Op {
+      std::atomic<u64> calls{0};
+      std::atomic<u64> errors{0};
+      std::atomic<u64> blocks{0};
+      std::atomic<u64> bytes{0};
+      std::atomic<u64> total_ns{0};
+      std::array<std::atomic<u64>, KLatencyBuckets> latency{};
+    };
+    std::array<Op, KBlockOpCnt> ops;
+  };
+
+private:
+  std::shared_ptr<BlockManager> inner;
+  bool track_latency;
+  // tells the thread-local caches of different managers apart
+  u64 instance_id;
+
+  std::mutex mtx;
+  std::vector<std::unique_ptr<ThreadStats>> thread_stats;
+  // what `reset_stats()` has seen, it is subtracted from the counters
+  BlockIOStats baseline;
+
+public:
+  /**
+   * Creates a block device that counts the operations on another one.
+   *
+   * @param inner the underlying block device
+   * @param track_latency whether to measure the latencies, which costs two
+   * clock reads per operation
+   */
+  explicit StatsBlockManager(std::shared_ptr<BlockManager> inner,
+                             bool track_latency = true);
+
+  auto write_block(block_id_t block_id, const u8 *block_data)
+      -> ChfsNullResult override;
+
+  auto write_partial_block(block_id_t block_id, const u8 *block_data,
+                           usize offset, usize len) -> ChfsNullResult override;
+
+  auto read_block(block_id_t block_id, u8 *block_data)
+      -> ChfsNullResult override;
+
+  auto zero_block(block_id_t block_id) -> ChfsNullResult override;
+
+  auto read_blocks(const std::vector<block_id_t> &block_ids, u8 *block_data)
+      -> ChfsNullResult override;
+
+  auto write_blocks(const std::vector<block_id_t> &block_ids,
+                    const u8 *block_data) -> ChfsNullResult override;
+
+  auto discard_blocks(const std::vector<block_id_t> &block_ids)
+      -> ChfsNullResult override;
+
+  auto sync_range(block_id_t start, usize cnt) -> ChfsNullResult override;
+
+  auto sync_all() -> ChfsNullResult override;
+
+  auto grow(usize new_block_cnt) -> ChfsNullResult override;
+
+  auto readahead(block_id_t start, usize cnt) -> void override {
+    this->inner->readahead(start, cnt);
+  }
+
+  /**
+   * Merge the counters of all threads since the last reset
+   */
+  auto get_stats() -> BlockIOStats;
+
+  /**
+   * Start counting from zero again
+   */
+  auto reset_stats() -> void;
+
+  auto get_inner() const -> std::shared_ptr<BlockManager> {
+    return this->inner;
+  }
+
+private:
+  /**
+   * Get the counters of the calling thread, creating them on its first call
+   */
+  auto local_stats() -> ThreadStats &;
+
+  /**
+   * Run an operation and count it
+   *
+   * @param bytes the bytes moved by the operation
+   */
+  template <typename F>
+  auto count(BlockOp op, usize blocks, u64 bytes, F &&f) -> ChfsNullResult;
+
+  auto merge() -> BlockIOStats;
+};
+
+} // namespace chfs
@@ -0,0 +1,133 @@
+//===----------------------------------------------------------------------===//
+//
+//                         Chfs
+//
+// striped_manager.h
+//
+// Identification: src/include/block/striped_manager.h
+//
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "block/backend.h"
+#include "common/worker_pool.h"
+
+namespace chfs {
+
+/**
+ * StripedBlockManager spreads the block address space over several block
+ * devices (RAID-0), so a large request is served by all of them at once.
+ *
+ * The address space is cut into stripe units of `stripe_unit` blocks, which
+ * are placed on the devices round-robin:
+ * | unit 0 -> dev 0 | unit 1 -> dev 1 | ... | unit N -> dev 0 | ...
+ * Each device only contributes whole units, and all devices contribute the
+ * same number of units, so the tail of a larger device is unused.
+ *
+ * A batched request is split by device, and the per-device parts are issued
+ * in parallel, each device being driven by its own worker thread.
+ * Block views cannot point into the devices, they fall back to a private
+ * buffer.
+ *
+ * Note that the block manager is **not** thread-safe.
+ */
+class StripedBlockManager : public BlockManager {
+  std::vector<std::shared_ptr<BlockManager>> devices;
+  usize stripe_unit;
+  WorkerPool workers;
+
+public:
+  /**
+   * Creates a striped block device over other block devices.
+   *
+   * @param devices the underlying block devices, they must share a block size
+   * @param stripe_unit the number of consecutive blocks placed on a device
+   */
+  StripedBlockManager(std::vector<std::shared_ptr<BlockManager>> devices,
+                      usize stripe_unit);
+
+  /**
+   * Creates a striped block device over files, one device per file.
+   *
+   * @param files the file names of the files to write to
+   * @param block_cnt the number of expected blocks of each file
+   * @param stripe_unit the number of consecutive blocks placed on a device
+   * @param backend how the files are accessed
+   */
+  StripedBlockManager(const std::vector<std::string> &files, usize block_cnt,
+                      usize stripe_unit,
+                      BlockBackend backend = BlockBackend::Pread);
+
+  auto write_block(block_id_t block_id, const u8 *block_data)
+      -> ChfsNullResult override;
+
+  auto write_partial_block(block_id_t block_id, const u8 *block_data,
+                           usize offset, usize len) -> ChfsNullResult override;
+
+  auto read_block(block_id_t block_id, u8 *block_data)
+      -> ChfsNullResult override;
+
+  auto zero_block(block_id_t block_id) -> ChfsNullResult override;
+
+  /**
+   * The blocks of each device are read in parallel
+   */
+  auto read_blocks(const std::vector<block_id_t> &block_ids, u8 *block_data)
+      -> ChfsNullResult override;
+
+  /**
+   * The blocks of each device are written in parallel
+   */
+  auto write_blocks(const std::vector<block_id_t> &block_ids,
+                    const u8 *block_data) -> ChfsNullResult override;
+
+  auto discard_blocks(const std::vector<block_id_t> &block_ids)
+      -> ChfsNullResult override;
+
+  auto sync_range(block_id_t start, usize cnt) -> ChfsNullResult override;
+
+  auto sync_all() -> ChfsNullResult override;
+
+  auto get_devices() const
+      -> const std::vector<std::shared_ptr<BlockManager>> & {
+    return this->devices;
+  }
+
+  auto get_stripe_unit() const -> usize { return this->stripe_unit; }
+
+  /**
+   * Locate a block on the devices
+   *
+   * @return the device index and the block id inside the device
+   */
+  auto locate(block_id_t block_id) const -> std::pair<usize, block_id_t>;
+
+private:
+  /**
+   * A part of a batch that goes to a single device.
+   * Its blocks are adjacent in the batch buffer, starting from the
+   * `from`-th block, so the device can work on the buffer in place.
+   */
+  struct Segment {
+    usize from;
+    std::vector<block_id_t> ids;
+  };
+
+  // the segments of each device
+  using Split = std::vector<std::vector<Segment>>;
+
+  auto split(const std::vector<block_id_t> &block_ids) const -> Split;
+
+  /**
+   * Run `op(device, segment)` on every segment, the devices in parallel.
+   * The first error is returned.
+   */
+  auto for_each_segment(
+      const Split &split,
+      const std::function<ChfsNullResult(BlockManager &, const Segment &)>
+          &op) -> ChfsNullResult;
+};
+
+} // namespace chfs
@@ -0,0 +1,146 @@
+//===----------------------------------------------------------------------===//
+//
+//                         Chfs
+//
+// uring_manager.h
+//
+// Identification: src/include/block/uring_manager.h
+//
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <linux/io_uring.h>
+
+#include "block/manager.h"
+
+namespace chfs {
+
+/**
+ * Options of the io_uring block device
+ */
+struct UringOptions {
+  // the number of requests that can be in flight at once
+  usize queue_depth = 64;
+  // whether to bypass the page cache with O_DIRECT
+  bool direct_io = false;
+  // the longest read or write of a single request, longer runs are split.
+  // The kernel transfers at most about 2GB per request.
+  u64 max_request_bytes = 1ULL << 30;
+};
+
+/**
+ * UringBlockManager implements a file-backed block device whose reads and
+ * writes are submitted through io_uring instead of a shared mmap.
+ *
+ * A batch (`read_blocks`/`write_blocks`) is split into one request per
+ * contiguous run (of at most `max_request_bytes`), and up to `queue_depth` requests are submitted and reaped
+ * with a single io_uring_enter(2) call.
+ *
+ * With `direct_io`, buffers that are not aligned for O_DIRECT are staged
+ * through an aligned buffer.
+ * Note that the block manager is **not** thread-safe.
+ */
+class UringBlockManager : public BlockManager {
+  UringOptions options;
+
+  int ring_fd = -1;
+  void *sq_ring = nullptr;
+  usize sq_ring_sz = 0;
+  void *cq_ring = nullptr;
+  usize cq_ring_sz = 0;
+  io_uring_sqe *sqes = nullptr;
+  usize sqes_sz = 0;
+
+  // pointers into the mapped rings
+  u32 *sq_head = nullptr;
+  u32 *sq_tail = nullptr;
+  u32 *sq_mask = nullptr;
+  u32 *sq_array = nullptr;
+  u32 *cq_head = nullptr;
+  u32 *cq_tail = nullptr;
+  u32 *cq_mask = nullptr;
+  io_uring_cqe *cqes = nullptr;
+
+  // an aligned buffer of one block for partial writes and O_DIRECT staging
+  u8 *scratch = nullptr;
+
+public:
+  /**
+   * Creates a new block manager over a file through io_uring.
+   * @param file the file name of the file to write to
+   * @param block_cnt the number of expected blocks in the device. If the file
+   * already exists, the block cnt is taken from the file size.
+   * @param options the io_uring options
+   * @param block_size the size of each block
+   */
+  UringBlockManager(const std::string &file, usize block_cnt,
+                    UringOptions options = UringOptions(),
+                    usize block_size = KDefaultBlockSize);
+
+  ~UringBlockManager() override;
+
+  /**
+   * Whether the running kernel allows creating an io_uring instance
+   */
+  static auto is_supported() -> bool;
+
+  auto write_block(block_id_t block_id, const u8 *block_data)
+      -> ChfsNullResult override;
+
+  auto write_partial_block(block_id_t block_id, const u8 *block_data,
+                           usize offset, usize len) -> ChfsNullResult override;
+
+  auto read_block(block_id_t block_id, u8 *block_data)
+      -> ChfsNullResult override;
+
+  auto zero_block(block_id_t block_id) -> ChfsNullResult override;
+
+  auto read_blocks(const std::vector<block_id_t> &block_ids, u8 *block_data)
+      -> ChfsNullResult override;
+
+  auto write_blocks(const std::vector<block_id_t> &block_ids,
+                    const u8 *block_data) -> ChfsNullResult override;
+
+  auto get_options() const -> const UringOptions & { return this->options; }
+
+private:
+  /**
+   * @param opened the fd and block cnt from `open_block_file`
+   */
+  UringBlockManager(const std::string &file, std::pair<int, usize> opened,
+                    UringOptions options, usize block_size);
+
+  /**
+   * A single read/write of a contiguous range of the device
+   */
+  struct IoRequest {
+    u8 *buf;
+    u64 offset;
+    u64 len;
+  };
+
+  auto setup_ring() -> bool;
+
+  /**
+   * Submit the requests in batches of `queue_depth` and wait for all of them
+   *
+   * @param write whether the requests are writes
+   * @return IOError if a request fails or the ring rejects the submission,
+   *         the requests after the failed batch are not submitted
+   */
+  auto submit_and_wait(std::vector<IoRequest> &reqs, bool write)
+      -> ChfsNullResult;
+
+  /**
+   * Build one request per contiguous run of the batch, a run longer than
+   * `max_request_bytes` takes several
+   */
+  auto build_requests(const std::vector<block_id_t> &block_ids, u8 *data)
+      -> std::vector<IoRequest>;
+
+  auto is_aligned(const void *ptr) const -> bool;
+};
+
+} // namespace chfs
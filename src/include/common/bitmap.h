@@ -14,8 +14,10 @@
 #include <optional>
 #include <string.h>
 
+#include "./bitscan.h"
 #include "./config.h"
 #include "./macros.h"
+#include "./popcount.h"
 
 namespace chfs {
 
@@ -75,15 +77,7 @@ public:
    *
    * @return the number of ones in the bitmap
    */
-  auto count_ones() -> usize {
-    usize num_ones = 0;
-    for (usize i = 0; i < payload * KBitsPerByte; ++i) {
-      if (this->check(i)) {
-        ++num_ones;
-      }
-    }
-    return num_ones;
-  }
+  auto count_ones() -> usize { return popcount(data, payload); }
 
   /**
    * Count the number of zeros in the bitmap
@@ -101,13 +95,15 @@ public:
    * @param upbound the upper bound of the count
    */
   auto count_zeros_to_bound(usize upbound) -> usize {
-    usize num_zeros = 0;
-    for (usize i = 0; i < upbound; ++i) {
-      if (!this->check(i)) {
-        ++num_zeros;
-      }
+    CHFS_ASSERT(upbound <= payload * KBitsPerByte, "bound out of range");
+    auto full_bytes = upbound / KBitsPerByte;
+    auto num_ones = popcount(data, full_bytes);
+    if (upbound % KBitsPerByte != 0) {
+      // only the bits below the bound of the last byte
+      u8 mask = (1 << (upbound % KBitsPerByte)) - 1;
+      num_ones += __builtin_popcount(data[full_bytes] & mask);
     }
-    return num_zeros;
+    return upbound - num_ones;
   }
 
   /**
@@ -128,32 +124,94 @@ public:
    */
   auto find_first_free_w_bound(usize bits) -> std::optional<usize> {
     auto refined_bits = std::min(this->payload * KBitsPerByte, bits);
-    size_t num_words = refined_bits / (KBytesPerWord * KBitsPerByte);
-    u64 *words = reinterpret_cast<u64 *>(data);
-
-    // Check the words first
-    for (usize i = 0; i < num_words; ++i) {
-      if (words[i] !=
-          ~u64(0)) { // if word is not all ones, at least one bit is free
-        for (size_t j = 0; j < KBitsPerByte * KBytesPerWord; ++j) {
-          size_t bit_index = i * KBytesPerWord * KBitsPerByte + j;
-          if (!this->check(bit_index)) {
-            return bit_index;
-          }
-        }
-      }
+    auto res = this->next_with(0, refined_bits, false);
+    if (res == refined_bits) {
+      return std::nullopt; // No free bit found
     }
+    return res;
+  }
 
-    // Check remaining bits
-    size_t num_remaining_bits = bits % (KBytesPerWord * KBitsPerByte);
-    for (size_t i = 0; i < num_remaining_bits; ++i) {
-      auto bit_index = i + num_words * KBytesPerWord * KBitsPerByte;
-      if (!this->check(bit_index)) {
-        return bit_index;
+  /**
+   * Find a run of contiguous free bits, e.g., for an extent
+   * @param len the length of the run
+   * @param hint where to start the search, it wraps around to the start of
+   * the bitmap
+   *
+   * @return the index of the first bit of the run, or std::nullopt if no
+   * run is found
+   */
+  auto find_free_run(usize len, usize hint = 0) -> std::optional<usize> {
+    return find_free_run_w_bound(len, hint, payload * KBitsPerByte);
+  }
+
+  /**
+   * Find a run of contiguous free bits with an up bound, see
+   * `find_free_run`
+   * @param bits the upper bound of the search, runs end before it
+   */
+  auto find_free_run_w_bound(usize len, usize hint, usize bits)
+      -> std::optional<usize> {
+    auto refined_bits = std::min(this->payload * KBitsPerByte, bits);
+    if (len == 0 || len > refined_bits) {
+      return std::nullopt;
+    }
+    hint = hint < refined_bits ? hint : 0;
+
+    auto res = this->find_run_in(len, hint, refined_bits);
+    if (!res && hint > 0) {
+      // the runs ending after the hint were not searched yet
+      res = this->find_run_in(len, 0, std::min(refined_bits, hint + len - 1));
+    }
+    return res;
+  }
+
+private:
+  /**
+   * Find the first bit in [from, to) with the given value
+   *
+   * @return the index of the bit, or `to` if there is none
+   */
+  auto next_with(usize from, usize to, bool value) -> usize {
+    if (from >= to) {
+      return to;
+    }
+    // a free bit is a zero, flip the bytes to look for a one
+    const u8 flip = value ? 0 : 0xff;
+    auto byte = from / KBitsPerByte;
+    u8 bits = (data[byte] ^ flip) & (0xff << (from % KBitsPerByte));
+    if (bits == 0) {
+      auto end_byte = (to + KBitsPerByte - 1) / KBitsPerByte;
+      byte += 1;
+      // whole bytes without the value are skipped, 0xff bytes when looking
+      // for a zero and 0x00 ones when looking for a one
+      byte += skip_bytes(data + byte, end_byte - byte, flip);
+      if (byte == end_byte) {
+        return to;
       }
+      bits = data[byte] ^ flip;
     }
+    auto res = byte * KBitsPerByte + __builtin_ctz(bits);
+    return res < to ? res : to;
+  }
 
-    return std::nullopt; // No free bit found
+  /**
+   * Find a run of `len` free bits in [from, to)
+   */
+  auto find_run_in(usize len, usize from, usize to) -> std::optional<usize> {
+    auto pos = from;
+    while (pos + len <= to) {
+      auto start = this->next_with(pos, to, false);
+      if (start + len > to) {
+        return std::nullopt;
+      }
+      // the run ends at the next used bit
+      auto end = this->next_with(start, start + len, true);
+      if (end == start + len) {
+        return start;
+      }
+      pos = end + 1;
+    }
+    return std::nullopt;
   }
 };
 
@@ -0,0 +1,41 @@
+//===----------------------------------------------------------------------===//
+//
+//                         Chfs
+//
+// bitscan.h
+//
+// Identification: src/include/common/bitscan.h
+//
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "common/config.h"
+
+namespace chfs {
+
+/**
+ * Skip the leading bytes of a buffer that are equal to a value, e.g., the
+ * full (0xff) or empty (0x00) regions of a bitmap.
+ *
+ * @param data the buffer, it need not be aligned
+ * @param len the length of the buffer in bytes
+ * @param value the byte to skip
+ * @return the index of the first byte other than `value`, or `len` if
+ * there is none
+ */
+auto skip_bytes(const u8 *data, usize len, u8 value) -> usize;
+
+/**
+ * The portable implementation of `skip_bytes`, exposed for tests and
+ * benchmarks
+ */
+auto skip_bytes_sw(const u8 *data, usize len, u8 value) -> usize;
+
+/**
+ * Whether `skip_bytes` runs on AVX2
+ */
+auto skip_bytes_hw_supported() -> bool;
+
+} // namespace chfs
@@ -16,5 +16,9 @@ using block_id_t = u64; // page id type
 using inode_id_t = u64;
 
 const usize KDefaultBlockCnt = 4096; // use a default 8MB file size
+const usize KDefaultBlockSize = 4096;
+// the block sizes of a file-backed device are powers of two in between
+const usize KMinBlockSize = 512;
+const usize KMaxBlockSize = 64 * 1024;
 
 } // namespace chfs
@@ -0,0 +1,42 @@
+//===----------------------------------------------------------------------===//
+//
+//                         Chfs
+//
+// crc32c.h
+//
+// Identification: src/include/common/crc32c.h
+//
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "common/config.h"
+
+namespace chfs {
+
+/**
+ * Compute the CRC32C (Castagnoli) of a buffer.
+ *
+ * The SSE4.2 crc32 instruction is used on three interleaved streams, merged
+ * with PCLMULQDQ, if the CPU supports both, otherwise it falls back to a
+ * table-driven implementation. With VPCLMULQDQ, long buffers are folded
+ * 256 bytes at a time instead.
+ *
+ * @param data the buffer
+ * @param len the length of the buffer
+ * @param crc the crc of the preceding data, to checksum a buffer piecewise
+ */
+auto crc32c(const u8 *data, usize len, u32 crc = 0) -> u32;
+
+/**
+ * The portable implementation of `crc32c`, exposed for tests and benchmarks
+ */
+auto crc32c_sw(const u8 *data, usize len, u32 crc = 0) -> u32;
+
+/**
+ * Whether `crc32c` runs on the SSE4.2 and PCLMULQDQ instructions
+ */
+auto crc32c_hw_supported() -> bool;
+
+} // namespace chfs
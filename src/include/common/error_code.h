@@ -22,6 +22,12 @@ enum class ErrorType {
   AlreadyExist = 5,
 
   NotEmpty = 6,
+
+  /** The underlying device fails to read or write */
+  IOError = 7,
+
+  /** The data read fails the integrity check */
+  Corrupted = 8,
 };
 
 } // namespace chfs
\ No newline at end of file
@@ -0,0 +1,67 @@
+//===----------------------------------------------------------------------===//
+//
+//                         Chfs
+//
+// galois.h
+//
+// Identification: src/include/common/galois.h
+//
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "common/config.h"
+
+namespace chfs {
+
+/**
+ * The implementations of the GF(2^8) region operations
+ */
+enum class GfKernel {
+  // a 64KB multiplication table
+  Scalar,
+  // 16-byte nibble lookups with pshufb
+  Ssse3,
+  // 32-byte nibble lookups with vpshufb
+  Avx2,
+};
+
+/**
+ * Multiply two elements of GF(2^8), modulo x^8 + x^4 + x^3 + x^2 + 1
+ */
+auto gf_mul(u8 a, u8 b) -> u8;
+
+/**
+ * Get the multiplicative inverse of a non-zero element
+ */
+auto gf_inv(u8 a) -> u8;
+
+/**
+ * Whether the CPU can run a kernel
+ */
+auto gf_kernel_supported(GfKernel kernel) -> bool;
+
+/**
+ * Get the fastest kernel the CPU can run
+ */
+auto gf_best_kernel() -> GfKernel;
+
+/**
+ * Multiply a region by a constant and add it to another one,
+ * i.e., dst[i] ^= c * src[i].
+ *
+ * @param kernel the kernel to use, it must be supported
+ */
+auto gf_mul_add_region(GfKernel kernel, u8 c, const u8 *src, u8 *dst,
+                       usize len) -> void;
+
+/**
+ * `gf_mul_add_region` with the fastest kernel
+ */
+inline auto gf_mul_add_region(u8 c, const u8 *src, u8 *dst, usize len)
+    -> void {
+  gf_mul_add_region(gf_best_kernel(), c, src, dst, len);
+}
+
+} // namespace chfs
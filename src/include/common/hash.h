@@ -0,0 +1,44 @@
+//===----------------------------------------------------------------------===//
+//
+//                         Chfs
+//
+// hash.h
+//
+// Identification: src/include/common/hash.h
+//
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "common/config.h"
+
+namespace chfs {
+
+/**
+ * Compute a 64-bit hash of a buffer, used to fingerprint block contents.
+ *
+ * It follows the stripe loop of XXH3: eight 64-bit lanes accumulate
+ * 32x32-bit products of the input mixed with a secret, and are scrambled
+ * every 1 KiB. The AVX2 path processes a 64-byte stripe with two vectors
+ * and gives the same result as the portable one, so the hashes can be
+ * persisted.
+ *
+ * It is not cryptographic, equal hashes must be confirmed by the content.
+ *
+ * @param data the buffer
+ * @param len the length of the buffer
+ */
+auto hash64(const u8 *data, usize len) -> u64;
+
+/**
+ * The portable implementation of `hash64`, exposed for tests and benchmarks
+ */
+auto hash64_sw(const u8 *data, usize len) -> u64;
+
+/**
+ * Whether `hash64` runs on AVX2
+ */
+auto hash64_hw_supported() -> bool;
+
+} // namespace chfs
@@ -0,0 +1,58 @@
+//===----------------------------------------------------------------------===//
+//
+//                         Chfs
+//
+// popcount.h
+//
+// Identification: src/include/common/popcount.h
+//
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "common/config.h"
+
+namespace chfs {
+
+/**
+ * The implementations of the bit counting
+ */
+enum class PopcountKernel {
+  // a word at a time, with the compiler's generic popcount
+  Scalar,
+  // a word at a time, with the POPCNT instruction
+  Popcnt,
+  // 32 bytes at a time, with nibble lookups in a shuffle table
+  Avx2,
+  // 64 bytes at a time, with VPOPCNTQ, the tail is a masked load
+  Avx512,
+};
+
+/**
+ * Whether the CPU can run a kernel
+ */
+auto popcount_kernel_supported(PopcountKernel kernel) -> bool;
+
+/**
+ * Get the fastest kernel the CPU can run
+ */
+auto popcount_best_kernel() -> PopcountKernel;
+
+/**
+ * Count the set bits of a buffer
+ *
+ * @param kernel the kernel to use, it must be supported
+ * @param data the buffer, it need not be aligned
+ * @param len the length of the buffer in bytes
+ */
+auto popcount(PopcountKernel kernel, const u8 *data, usize len) -> usize;
+
+/**
+ * Count the set bits of a buffer with the fastest kernel
+ */
+inline auto popcount(const u8 *data, usize len) -> usize {
+  return popcount(popcount_best_kernel(), data, len);
+}
+
+} // namespace chfs
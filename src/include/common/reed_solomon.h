@@ -0,0 +1,87 @@
+//===----------------------------------------------------------------------===//
+//
+//                         Chfs
+//
+// reed_solomon.h
+//
+// Identification: src/include/common/reed_solomon.h
+//
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <vector>
+
+#include "common/galois.h"
+
+namespace chfs {
+
+/**
+ * A systematic Reed-Solomon code over GF(2^8) with k data shards and
+ * m parity shards. Any k of the k + m shards recover the others.
+ *
+ * The parity rows of the generator form a Cauchy matrix, so that every
+ * k x k submatrix of the generator is invertible.
+ */
+class ReedSolomon {
+  usize k;
+  usize m;
+  // the (k + m) x k generator, row-major, the first k rows are the identity
+  std::vector<u8> matrix;
+  GfKernel kernel;
+
+public:
+  /**
+   * @param data_cnt the number of data shards (k)
+   * @param parity_cnt the number of parity shards (m)
+   * @param kernel the kernel of the region operations
+   */
+  ReedSolomon(usize data_cnt, usize parity_cnt,
+              GfKernel kernel = gf_best_kernel());
+
+  auto data_cnt() const -> usize { return this->k; }
+
+  auto parity_cnt() const -> usize { return this->m; }
+
+  auto get_kernel() const -> GfKernel { return this->kernel; }
+
+  /**
+   * Get the coefficient of a data shard in a parity shard
+   */
+  auto coef(usize parity, usize data) const -> u8 {
+    return this->matrix[(this->k + parity) * this->k + data];
+  }
+
+  /**
+   * Compute the parity shards from the data shards
+   *
+   * @param data the k data shards
+   * @param parity the m parity shards, overwritten
+   * @param len the length of each shard
+   */
+  auto encode(const u8 *const *data, u8 *const *parity, usize len) const
+      -> void;
+
+  /**
+   * Apply the change of a data shard to a parity shard,
+   * i.e., parity ^= coef * (old_data ^ new_data)
+   *
+   * @param delta the xor of the old and the new data shard
+   */
+  auto update(usize parity_idx, usize data_idx, const u8 *delta, u8 *parity,
+              usize len) const -> void;
+
+  /**
+   * Recover the missing shards from the present ones
+   *
+   * @param shards the k + m shards, the missing ones are overwritten
+   * @param present which shards are present
+   * @param len the length of each shard
+   * @return false if fewer than k shards are present
+   */
+  auto reconstruct(u8 *const *shards, const std::vector<bool> &present,
+                   usize len) const -> bool;
+};
+
+} // namespace chfs
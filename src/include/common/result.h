@@ -2,6 +2,7 @@
 
 #include <iostream>
 #include <stdexcept>
+#include <utility>
 #include <variant>
 
 #include "./error_code.h"
@@ -18,13 +19,15 @@ template <typename T, typename E> class Result {
 public:
   Result(const T &value) : data(value), hasValue(true) {}
 
+  Result(T &&value) : data(std::move(value)), hasValue(true) {}
+
   Result(const E &error) : data(error), hasValue(false) {}
 
   auto is_ok() const -> bool { return hasValue; }
 
   auto is_err() const -> bool { return !hasValue; }
 
-  auto unwrap() const -> T {
+  auto unwrap() const & -> T {
     if (hasValue) {
       return std::get<T>(data);
     } else {
@@ -32,6 +35,15 @@ public:
     }
   }
 
+  // Move the value out, so that move-only values can be unwrapped
+  auto unwrap() && -> T {
+    if (hasValue) {
+      return std::move(std::get<T>(data));
+    } else {
+      throw std::runtime_error("Tried to unwrap error");
+    }
+  }
+
   auto unwrap_error() const -> E {
     if (!hasValue) {
       return std::get<E>(data);
@@ -0,0 +1,77 @@
+//===----------------------------------------------------------------------===//
+//
+//                         Chfs
+//
+// stream.h
+//
+// Identification: src/include/common/stream.h
+//
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "common/config.h"
+
+namespace chfs {
+
+/**
+ * The implementations of the bulk copy and zeroing
+ */
+enum class StreamKernel {
+  // memcpy/memset, the destination goes through the cache
+  Plain,
+  // 16-byte non-temporal stores
+  Sse2,
+  // 32-byte non-temporal stores
+  Avx2,
+};
+
+// Transfers at least this large bypass the cache. Below it the data likely
+// fits in the cache anyway, and may be read again soon.
+const usize KStreamMinBytes = 64 * 1024;
+
+/**
+ * Whether the CPU can run a kernel
+ */
+auto stream_kernel_supported(StreamKernel kernel) -> bool;
+
+/**
+ * Get the fastest kernel the CPU can run
+ */
+auto stream_best_kernel() -> StreamKernel;
+
+/**
+ * Copy a buffer with non-temporal stores, so the destination does not
+ * evict the data in the cache. The stores are fenced before it returns.
+ *
+ * @param kernel the kernel to use, it must be supported
+ */
+auto stream_copy(StreamKernel kernel, u8 *dst, const u8 *src, u64 len)
+    -> void;
+
+/**
+ * Zero a buffer with non-temporal stores, see `stream_copy`
+ */
+auto stream_zero(StreamKernel kernel, u8 *dst, u64 len) -> void;
+
+/**
+ * Copy a buffer, bypassing the cache with the fastest kernel if it is at
+ * least `KStreamMinBytes`
+ */
+inline auto bulk_copy(u8 *dst, const u8 *src, u64 len) -> void {
+  stream_copy(len >= KStreamMinBytes ? stream_best_kernel()
+                                     : StreamKernel::Plain,
+              dst, src, len);
+}
+
+/**
+ * Zero a buffer, see `bulk_copy`
+ */
+inline auto bulk_zero(u8 *dst, u64 len) -> void {
+  stream_zero(len >= KStreamMinBytes ? stream_best_kernel()
+                                     : StreamKernel::Plain,
+              dst, len);
+}
+
+} // namespace chfs
@@ -0,0 +1,78 @@
+//===----------------------------------------------------------------------===//
+//
+//                         Chfs
+//
+// worker_pool.h
+//
+// Identification: src/include/common/worker_pool.h
+//
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "common/config.h"
+#include "common/macros.h"
+
+namespace chfs {
+
+/**
+ * A fixed set of worker threads, each with its own queue.
+ *
+ * The i-th task of a `run` always goes to the i-th worker, so a worker can
+ * own a resource (e.g., a backing device). As long as `run` is called from
+ * one thread at a time, that resource is never touched by two threads at
+ * once.
+ */
+class WorkerPool {
+  struct Task {
+    std::function<void()> func;
+    // the unfinished tasks of the batch
+    usize *remaining;
+  };
+
+  struct Worker {
+    std::thread thread;
+    std::deque<Task> tasks;
+  };
+
+  std::mutex mtx;
+  std::condition_variable task_cv;
+  std::condition_variable done_cv;
+  std::vector<Worker> workers;
+  bool stop = false;
+
+public:
+  /**
+   * @param worker_cnt the number of worker threads
+   */
+  explicit WorkerPool(usize worker_cnt);
+
+  ~WorkerPool();
+
+  DISALLOW_COPY_AND_MOVE(WorkerPool);
+
+  auto size() const -> usize { return this->workers.size(); }
+
+  /**
+   * Run a batch of tasks and wait for all of them.
+   * A single task runs on the calling thread instead.
+   * It can be called from several threads at once, then the tasks of a
+   * worker run one after another.
+   *
+   * @param tasks the task of each worker, an empty function means no task
+   */
+  auto run(const std::vector<std::function<void()>> &tasks) -> void;
+
+private:
+  auto worker_loop(usize idx) -> void;
+};
+
+} // namespace chfs
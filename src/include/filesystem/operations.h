@@ -11,6 +11,8 @@
 
 #pragma once
 
+#include "block/backend.h"
+#include "block/dedup_allocator.h"
 #include "metadata/manager.h"
 #include <sys/stat.h>
 
@@ -26,6 +28,8 @@ protected:
   [[maybe_unused]] std::shared_ptr<BlockManager> block_manager_;
   [[maybe_unused]] std::shared_ptr<InodeManager> inode_manager_;
   [[maybe_unused]] std::shared_ptr<BlockAllocator> block_allocator_;
+  // stores the file blocks if the deduplication is enabled, otherwise null
+  std::shared_ptr<DedupAllocator> dedup_allocator_;
 
 public:
   /**
@@ -33,17 +37,41 @@ public:
    * @param bm the block manager to manage the block device
    * @param max_inode_supported the maximum number of inodes supported by the
    * filesystem
+   * @param dedup whether the file blocks with identical content are shared,
+   * see `DedupAllocator`
    */
-  FileOperation(std::shared_ptr<BlockManager> bm, u64 max_inode_supported);
+  FileOperation(std::shared_ptr<BlockManager> bm, u64 max_inode_supported,
+                bool dedup = false);
 
   /**
    * Create a filesystem handler from an initialized filesystem
    *
    * Note that this function will consider the filesystem as not corrupted
+   *
+   * @return INVALID if the block size of the block manager is not the one
+   * the filesystem was created with
    */
   static auto create_from_raw(std::shared_ptr<BlockManager> bm)
       -> ChfsResult<std::shared_ptr<FileOperation>>;
 
+  /**
+   * Open a filesystem stored in a file, with the block size recorded in its
+   * super block
+   *
+   * @param file the file of the volume
+   * @param backend the I/O backend of the block manager
+   */
+  static auto open(const std::string &file,
+                   BlockBackend backend = BlockBackend::Mmap)
+      -> ChfsResult<std::shared_ptr<FileOperation>>;
+
+  /**
+   * Get the deduplication layer, null if it is disabled
+   */
+  auto get_dedup_allocator() const -> std::shared_ptr<DedupAllocator> {
+    return dedup_allocator_;
+  }
+
   /**
    * Get the free inodes of the filesystem.
    * Will read the inode bitmap of the underlying filesystem
@@ -120,6 +148,15 @@ public:
   auto read_file_w_off(inode_id_t id, u64 sz, u64 offset)
       -> ChfsResult<std::vector<u8>>;
 
+  /**
+   * Force the content and the metadata of a file to the stable storage.
+   * Only the blocks of the file, its inode and the metadata region (inode
+   * table and bitmaps) are synced, other dirty blocks are left alone.
+   *
+   * @param id the id of the inode
+   */
+  auto sync_file(inode_id_t id) -> ChfsNullResult;
+
   /**
    * Remove the file corresponding to an inode.
    * It is defined in contorl_op.cc
@@ -135,6 +172,14 @@ public:
    */
   auto get_free_blocks_num() const -> ChfsResult<u64>;
 
+  /**
+   * Grow the filesystem to `new_block_cnt` blocks without reformatting.
+   * The block manager is grown first if it is smaller.
+   *
+   * No block view may be alive during the call, see `BlockManager::grow`.
+   */
+  auto grow(usize new_block_cnt) -> ChfsNullResult;
+
   /**
    * Lookup the directory
    */
@@ -188,8 +233,15 @@ public:
 private:
   FileOperation(std::shared_ptr<BlockManager> bm,
                 std::shared_ptr<InodeManager> im,
-                std::shared_ptr<BlockAllocator> ba)
-      : block_manager_(bm), inode_manager_(im), block_allocator_(ba) {}
+                std::shared_ptr<BlockAllocator> ba,
+                std::shared_ptr<DedupAllocator> da = nullptr)
+      : block_manager_(bm), inode_manager_(im), block_allocator_(ba),
+        dedup_allocator_(da) {}
+
+  /**
+   * Free a block of a file, through the deduplication layer if enabled
+   */
+  auto free_block(block_id_t block_id) -> ChfsNullResult;
 };
 
 } // namespace chfs
\ No newline at end of file
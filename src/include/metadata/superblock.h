@@ -16,6 +16,9 @@
 
 namespace chfs {
 
+// The maximum number of times a filesystem can grow with new bitmap blocks
+const usize KMaxBitmapExtents = 16;
+
 typedef struct SuperBlockInternal {
   // Blocksize of the file system. It should be equal to the block size of the
   // block device.
@@ -28,6 +31,14 @@ typedef struct SuperBlockInternal {
   u64 ninodes;
   // The current filesystem size.
   u64 file_system_size;
+  // The bitmap blocks added by growing the filesystem,
+  // see `BlockAllocator::grow`
+  u32 n_bitmap_extents;
+  BitmapExtent bitmap_extents[KMaxBitmapExtents];
+  // The reference count table of the deduplicated blocks,
+  // see `DedupAllocator`. No blocks if the deduplication is disabled.
+  u64 dedup_table_block;
+  u64 dedup_table_cnt;
 } SuperblockInternal;
 
 /**
@@ -66,11 +77,46 @@ public:
                                    block_id_t id)
       -> ChfsResult<std::shared_ptr<SuperBlock>>;
 
+  /**
+   * Read the block size recorded in the super block at the start of a
+   * file-backed volume, so that the volume can be opened without knowing it
+   *
+   * @param file the file of the volume
+   * @return IOError if the file cannot be read,
+   *         INVALID if it does not record a supported block size
+   */
+  static auto probe_block_size(const std::string &file) -> ChfsResult<usize>;
+
   auto flush(block_id_t id) const -> ChfsNullResult {
     return bm->write_partial_block(id, (u8 *)&inner, 0,
                                    sizeof(SuperBlockInternal));
   }
 
+  /**
+   * Record that the filesystem has grown to `nblocks` blocks.
+   * The super block should be flushed afterwards.
+   *
+   * @param nblocks the new number of blocks
+   * @param extent the bitmap blocks added, if any
+   * @return OUT_OF_RESOURCE if there are too many bitmap extents
+   */
+  auto grow(u64 nblocks, const BitmapExtent &extent) -> ChfsNullResult;
+
+  auto get_bitmap_extents() const -> std::vector<BitmapExtent> {
+    return std::vector<BitmapExtent>(inner.bitmap_extents,
+                                     inner.bitmap_extents +
+                                         inner.n_bitmap_extents);
+  }
+
+  /**
+   * Record the table of the deduplicated blocks.
+   * The super block should be flushed afterwards.
+   */
+  auto set_dedup_table(block_id_t start, u64 cnt) -> void {
+    inner.dedup_table_block = start;
+    inner.dedup_table_cnt = cnt;
+  }
+
   /**
    * Getters
    */
@@ -78,6 +124,8 @@ public:
   u32 get_block_size() const { return inner.block_size; }
   u64 get_nblocks() const { return inner.nblocks; }
   u64 get_ninodes() const { return inner.ninodes; }
+  block_id_t get_dedup_table_block() const { return inner.dedup_table_block; }
+  u64 get_dedup_table_cnt() const { return inner.dedup_table_cnt; }
 
 private:
   explicit SuperBlock(std::shared_ptr<BlockManager> bm) : bm(bm) {}
@@ -41,16 +41,8 @@ namespace chfs
     }
     this->n_table_blocks = table_blocks;
 
-    // 3. clear the bitmap blocks and table blocks
-    for (u64 i = 0; i < this->n_table_blocks; ++i)
-    {
-      bm->zero_block(i + 1); // 1: the super block
-    }
-
-    for (u64 i = 0; i < this->n_bitmap_blocks; ++i)
-    {
-      bm->zero_block(i + 1 + this->n_table_blocks);
-    }
+    // 3. clear the table blocks and bitmap blocks, 1: the super block
+    bm->zero_blocks(1, this->n_table_blocks + this->n_bitmap_blocks);
   }
 
   auto InodeManager::create_from_block_manager(std::shared_ptr<BlockManager> bm,
@@ -171,7 +163,6 @@ namespace chfs
     // auto inode_blocks = raw_inode_id / total_bits_per_blocks;
     // auto inode_index = raw_inode_id % total_bits_per_blocks;
 
-    std::vector<u8> buffer(bm->block_size());
     // bm->read_block(1 + n_table_blocks + inode_blocks, buffer.data());
     // Bitmap inode_bitmap(buffer.data(), bm->block_size());
     // if (!inode_bitmap.check(inode_index))
@@ -179,12 +170,18 @@ namespace chfs
     //   return ChfsResult<block_id_t>(ErrorType::INVALID_ARG);
     // }
 
-    block_id_t bid;
     auto inode_per_blocks = bm->block_size() / sizeof(inode_id_t);
     auto inode_table_blocks = raw_inode_id / inode_per_blocks;
     auto inode_table_index = raw_inode_id % inode_per_blocks;
-    bm->read_block(1 + inode_table_blocks, buffer.data());
-    bid = *reinterpret_cast<block_id_t *>(buffer.data() + inode_table_index * sizeof(block_id_t));
+
+    // read the table entry in place, without copying the table block
+    auto view_res = bm->read_view(1 + inode_table_blocks);
+    if (view_res.is_err())
+    {
+      return ChfsResult<block_id_t>(view_res.unwrap_error());
+    }
+    auto view = std::move(view_res).unwrap();
+    block_id_t bid = *view.as<block_id_t>(inode_table_index * sizeof(block_id_t));
     // std::cout << "get inode table blocks: " << inode_table_blocks << "\n get inode table index: " << inode_table_index << std::endl;
     //  TODO: Implement this function.
     //  Get the block id of inode whose id is `id`
@@ -209,12 +206,13 @@ namespace chfs
     u64 count = 0;
     for (auto iter = iter_res.unwrap(); iter.has_next();)
     {
-      auto data = iter.unsafe_get_value_ptr<u8>();
-      auto bitmap = Bitmap(data, bm->block_size());
+      // the bitmap blocks of a window are scanned at once
+      auto [data, block_cnt] = iter.cur_window();
+      auto bitmap = Bitmap(data, block_cnt * bm->block_size());
 
       count += bitmap.count_zeros();
 
-      auto iter_res = iter.next(bm->block_size());
+      auto iter_res = iter.next(block_cnt * bm->block_size());
       if (iter_res.is_err())
       {
         return ChfsResult<u64>(iter_res.unwrap_error());
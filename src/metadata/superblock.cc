@@ -1,12 +1,17 @@
+#include <fcntl.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "metadata/superblock.h"
 
 namespace chfs {
 
 SuperBlock::SuperBlock(std::shared_ptr<BlockManager> bm, u64 ninodes) : bm(bm) {
+  memset(&this->inner, 0, sizeof(SuperBlockInternal));
   this->inner.block_size = bm->block_size();
   this->inner.nblocks = bm->total_blocks();
+  this->inner.file_system_size =
+      this->inner.nblocks * static_cast<u64>(this->inner.block_size);
   this->inner.ninodes = ninodes;
 
   CHFS_VERIFY(this->inner.block_size >= sizeof(SuperBlockInternal),
@@ -26,4 +31,42 @@ auto SuperBlock::create_from_existing(std::shared_ptr<BlockManager> bm,
   return ChfsResult<std::shared_ptr<SuperBlock>>(res);
 }
 
+auto SuperBlock::probe_block_size(const std::string &file)
+    -> ChfsResult<usize> {
+  auto fd = open(file.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return ChfsResult<usize>(ErrorType::IOError);
+  }
+
+  // the block size is the first field of the first block
+  u32 block_size = 0;
+  auto n = pread(fd, &block_size, sizeof(block_size),
+                 offsetof(SuperBlockInternal, block_size));
+  close(fd);
+  if (n != static_cast<ssize_t>(sizeof(block_size))) {
+    return ChfsResult<usize>(ErrorType::IOError);
+  }
+  if (!BlockManager::is_valid_block_size(block_size)) {
+    return ChfsResult<usize>(ErrorType::INVALID);
+  }
+  return ChfsResult<usize>(block_size);
+}
+
+auto SuperBlock::grow(u64 nblocks, const BitmapExtent &extent)
+    -> ChfsNullResult {
+  if (nblocks < this->inner.nblocks) {
+    return ChfsNullResult(ErrorType::INVALID_ARG);
+  }
+  if (extent.cnt > 0) {
+    if (this->inner.n_bitmap_extents == KMaxBitmapExtents) {
+      return ChfsNullResult(ErrorType::OUT_OF_RESOURCE);
+    }
+    this->inner.bitmap_extents[this->inner.n_bitmap_extents++] = extent;
+  }
+  this->inner.nblocks = nblocks;
+  this->inner.file_system_size =
+      nblocks * static_cast<u64>(this->inner.block_size);
+  return KNullOk;
+}
+
 } // namespace chfs
\ No newline at end of file
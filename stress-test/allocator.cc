@@ -1,8 +1,11 @@
+#include <chrono>
+#include <algorithm>
 #include <gtest/gtest.h>
 #include <random>
 #include <unordered_set>
 
 #include "block/allocator.h"
+#include "common/popcount.h"
 
 namespace chfs {
 
@@ -62,6 +65,94 @@ TEST(BlockAllocatorTest, StressTest1) {
             << std::endl;
 }
 
+TEST(BlockAllocatorTest, FreeBlockCount) {
+  // a 16GB volume, only its bitmap is touched
+  const usize block_sz = 4096;
+  const usize block_cnt = 4 * 1024 * 1024;
+  auto bm =
+      std::shared_ptr<BlockManager>(new BlockManager(block_cnt, block_sz));
+  auto allocator = BlockAllocator(bm);
+  for (usize i = 0; i < 100000; ++i) {
+    allocator.allocate().unwrap();
+  }
+
+  const usize rounds = 100;
+  auto start = std::chrono::steady_clock::now();
+  usize free_cnt = 0;
+  for (usize i = 0; i < rounds; ++i) {
+    free_cnt = allocator.free_block_cnt();
+  }
+  auto end = std::chrono::steady_clock::now();
+  auto us =
+      std::chrono::duration<double, std::micro>(end - start).count() / rounds;
+  std::cout << "free_block_cnt over " << allocator.total_bitmap_block()
+            << " bitmap blocks: " << us << " us" << std::endl;
+  ASSERT_EQ(free_cnt + 100000 + allocator.total_bitmap_block(), block_cnt);
+
+  std::vector<u8> bitmap(allocator.total_bitmap_block() * block_sz, 0x5a);
+  const char *names[] = {"scalar", "popcnt", "avx2", "avx512"};
+  for (auto kernel : {PopcountKernel::Scalar, PopcountKernel::Popcnt,
+                      PopcountKernel::Avx2, PopcountKernel::Avx512}) {
+    if (!popcount_kernel_supported(kernel)) {
+      continue;
+    }
+    start = std::chrono::steady_clock::now();
+    usize ones = 0;
+    for (usize i = 0; i < rounds; ++i) {
+      ones += popcount(kernel, bitmap.data(), bitmap.size());
+    }
+    end = std::chrono::steady_clock::now();
+    ASSERT_EQ(ones, rounds * bitmap.size() * 4);
+    std::cout << "popcount " << names[static_cast<int>(kernel)] << ": "
+              << std::chrono::duration<double, std::micro>(end - start)
+                         .count() /
+                     rounds
+              << " us" << std::endl;
+  }
+}
+
+TEST(BlockAllocatorTest, AllocateWhenFull) {
+  // a 16GB volume, the cost of an allocation should not grow as it fills
+  const usize block_sz = 4096;
+  const usize block_cnt = 4 * 1024 * 1024;
+  auto bm =
+      std::shared_ptr<BlockManager>(new BlockManager(block_cnt, block_sz));
+  auto allocator = BlockAllocator(bm);
+  // the bitmap stays in memory, it is only written back at the end
+  allocator.set_flush_batch(0);
+
+  const usize batch = 10000;
+  std::mt19937 gen(0xdeadbeaf);
+  for (auto fill : {0.0, 0.5, 0.9, 0.99}) {
+    while (allocator.free_block_cnt() > block_cnt * (1 - fill) + batch) {
+      for (usize i = 0; i < batch; ++i) {
+        allocator.allocate().unwrap();
+      }
+    }
+
+    // free scattered blocks, then allocate them again
+    std::vector<block_id_t> block_ids;
+    for (usize i = 0; i < batch; ++i) {
+      auto block_id = allocator.allocate().unwrap();
+      block_ids.push_back(block_id);
+    }
+    std::shuffle(block_ids.begin(), block_ids.end(), gen);
+    for (auto block_id : block_ids) {
+      allocator.deallocate(block_id).unwrap();
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (usize i = 0; i < batch; ++i) {
+      allocator.allocate().unwrap();
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::cout << "allocate at " << fill * 100 << "% full: "
+              << std::chrono::duration<double, std::nano>(end - start).count() /
+                     batch
+              << " ns" << std::endl;
+  }
+  allocator.flush().unwrap();
+}
+
 } // namespace chfs
 
 int main(int argc, char **argv) {
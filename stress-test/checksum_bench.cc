@@ -0,0 +1,149 @@
+#include <chrono>
+#include <functional>
+#include <gtest/gtest.h>
+#include <iostream>
+
+#include "block/backend.h"
+#include "block/checksum_manager.h"
+#include "block/uring_manager.h"
+#include "common/crc32c.h"
+
+namespace chfs {
+
+// 64MB device
+const usize KBenchBlockCnt = 16 * 1024;
+const usize KBenchRounds = 8;
+// blocks read by each read_blocks call
+const usize KBenchBatch = 32;
+
+template <typename F> auto time_ms(F &&f) -> double {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+/**
+ * Read the whole device sequentially in batches
+ *
+ * @return the throughput in MB/s
+ */
+auto sequential_read(BlockManager &bm) -> double {
+  std::vector<u8> buf(KBenchBatch * bm.block_size());
+  std::vector<block_id_t> block_ids(KBenchBatch);
+  usize blocks = 0;
+
+  auto ms = time_ms([&]() {
+    for (usize round = 0; round < KBenchRounds; ++round) {
+      for (block_id_t start = 0; start + KBenchBatch <= bm.total_blocks();
+           start += KBenchBatch) {
+        for (usize i = 0; i < KBenchBatch; ++i) {
+          block_ids[i] = start + i;
+        }
+        bm.read_blocks(block_ids, buf.data()).unwrap();
+        blocks += KBenchBatch;
+      }
+    }
+  });
+  return static_cast<double>(blocks) * bm.block_size() / 1024 / 1024 / ms *
+         1000;
+}
+
+TEST(ChecksumBenchmark, Crc32c) {
+  std::vector<u8> data(KBenchBlockCnt * KDefaultBlockSize, 0x5a);
+  u32 hw = 0, sw = 0;
+  auto hw_ms = time_ms([&]() { hw = crc32c(data.data(), data.size()); });
+  auto sw_ms = time_ms([&]() { sw = crc32c_sw(data.data(), data.size()); });
+  ASSERT_EQ(hw, sw);
+
+  // the checksums of a device are computed a block at a time
+  u32 sum = 0;
+  auto block_ms = time_ms([&]() {
+    for (usize i = 0; i < KBenchBlockCnt; ++i) {
+      sum ^= crc32c(data.data() + i * KDefaultBlockSize, KDefaultBlockSize);
+    }
+  });
+
+  auto mb = data.size() / 1024.0 / 1024.0;
+  std::cout << "crc32c (" << (crc32c_hw_supported() ? "hardware" : "software")
+            << "): " << mb / hw_ms * 1000 << " MB/s, per block "
+            << mb / block_ms * 1000 << " MB/s, "
+            << "software: " << mb / sw_ms * 1000 << " MB/s" << std::endl;
+  // keep the checksums alive
+  EXPECT_NE(sum, 1);
+}
+
+/**
+ * Compare the sequential reads of a device with and without the checksums.
+ * The checksummed mode targets the file-backed backends, whose reads cost a
+ * system call per batch and, with O_DIRECT, the device itself. Against the
+ * in-memory device the reads are a bare memcpy, so the checksums are the
+ * bulk of the cost there.
+ */
+TEST(ChecksumBenchmark, SequentialRead) {
+  struct Device {
+    const char *name;
+    std::function<std::shared_ptr<BlockManager>()> create;
+  };
+  const std::string file = "checksum_bench.db";
+  std::vector<Device> devices = {
+      {"memory",
+       [&]() {
+         return std::make_shared<BlockManager>(KBenchBlockCnt,
+                                               KDefaultBlockSize);
+       }},
+      {"pread",
+       [&]() {
+         return create_block_manager(file, KBenchBlockCnt, BlockBackend::Pread);
+       }},
+      {"pread, O_DIRECT",
+       [&]() {
+         return create_block_manager(file, KBenchBlockCnt, BlockBackend::Pread,
+                                     true);
+       }},
+  };
+  if (UringBlockManager::is_supported()) {
+    devices.push_back({"io_uring", [&]() {
+                         return create_block_manager(file, KBenchBlockCnt,
+                                                     BlockBackend::IoUring);
+                       }});
+    devices.push_back({"io_uring, O_DIRECT", [&]() {
+                         return create_block_manager(
+                             file, KBenchBlockCnt, BlockBackend::IoUring, true);
+                       }});
+  }
+
+  for (const auto &device : devices) {
+    remove(file.c_str());
+    auto inner = device.create();
+    auto csum_bm = ChecksumBlockManager(inner);
+
+    // fill the device, so that neither reads holes
+    std::vector<u8> data(KBenchBatch * inner->block_size(), 0x5a);
+    std::vector<block_id_t> block_ids(KBenchBatch);
+    for (block_id_t start = 0; start + KBenchBatch <= csum_bm.total_blocks();
+         start += KBenchBatch) {
+      for (usize i = 0; i < KBenchBatch; ++i) {
+        block_ids[i] = start + i;
+      }
+      csum_bm.write_blocks(block_ids, data.data()).unwrap();
+    }
+    csum_bm.sync_all().unwrap();
+
+    // warm up both, then take the best of a few runs of each
+    sequential_read(*inner);
+    sequential_read(csum_bm);
+    double plain = 0, csum = 0;
+    for (usize i = 0; i < 3; ++i) {
+      plain = std::max(plain, sequential_read(*inner));
+      csum = std::max(csum, sequential_read(csum_bm));
+    }
+
+    std::cout << "sequential read (" << device.name << "): plain " << plain
+              << " MB/s, checksummed " << csum << " MB/s, overhead "
+              << (plain / csum - 1) * 100 << "%" << std::endl;
+  }
+  remove(file.c_str());
+}
+
+} // namespace chfs
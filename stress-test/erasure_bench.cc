@@ -0,0 +1,121 @@
+#include <chrono>
+#include <gtest/gtest.h>
+#include <iostream>
+
+#include "block/erasure_manager.h"
+#include "common/galois.h"
+#include "common/reed_solomon.h"
+
+namespace chfs {
+
+// 64MB of data per measurement
+const usize KBenchDataBytes = 64 * 1024 * 1024;
+const usize KBenchShardBytes = KDefaultBlockSize;
+
+template <typename F> auto time_ms(F &&f) -> double {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+auto kernel_name(GfKernel kernel) -> const char * {
+  switch (kernel) {
+  case GfKernel::Avx2:
+    return "avx2";
+  case GfKernel::Ssse3:
+    return "ssse3";
+  default:
+    return "scalar";
+  }
+}
+
+/**
+ * Measure the encoding and the decoding (with m data shards lost) of
+ * stripes of 4K shards, in MB/s of data
+ */
+auto bench_codec(usize k, usize m, GfKernel kernel) -> void {
+  auto codec = ReedSolomon(k, m, kernel);
+  const usize stripes = KBenchDataBytes / (k * KBenchShardBytes);
+
+  std::vector<u8> buffer((k + m) * KBenchShardBytes);
+  for (usize i = 0; i < k * KBenchShardBytes; ++i) {
+    buffer[i] = static_cast<u8>(i * 131);
+  }
+  std::vector<u8 *> ptrs(k + m);
+  for (usize i = 0; i < k + m; ++i) {
+    ptrs[i] = buffer.data() + i * KBenchShardBytes;
+  }
+
+  auto encode_ms = time_ms([&]() {
+    for (usize s = 0; s < stripes; ++s) {
+      codec.encode(ptrs.data(), ptrs.data() + k, KBenchShardBytes);
+    }
+  });
+
+  std::vector<bool> present(k + m, true);
+  for (usize i = 0; i < m; ++i) {
+    present[i] = false;
+  }
+  auto decode_ms = time_ms([&]() {
+    for (usize s = 0; s < stripes; ++s) {
+      codec.reconstruct(ptrs.data(), present, KBenchShardBytes);
+    }
+  });
+
+  auto mb = stripes * k * KBenchShardBytes / 1024.0 / 1024.0;
+  std::cout << "RS(" << k << "+" << m << ") " << kernel_name(kernel)
+            << ": encode " << mb / encode_ms * 1000 << " MB/s, decode "
+            << mb / decode_ms * 1000 << " MB/s" << std::endl;
+}
+
+TEST(ErasureBenchmark, Codec) {
+  for (auto kernel : {GfKernel::Scalar, GfKernel::Ssse3, GfKernel::Avx2}) {
+    if (!gf_kernel_supported(kernel)) {
+      continue;
+    }
+    bench_codec(4, 2, kernel);
+    bench_codec(8, 3, kernel);
+  }
+}
+
+TEST(ErasureBenchmark, DegradedRead) {
+  const usize k = 4, m = 2, rows = 4096;
+  std::vector<std::shared_ptr<BlockManager>> devices;
+  for (usize i = 0; i < k + m; ++i) {
+    devices.push_back(
+        std::make_shared<BlockManager>(rows, KDefaultBlockSize));
+  }
+  auto bm = ErasureBlockManager(devices, k);
+
+  const usize batch = 64;
+  std::vector<u8> buf(batch * bm.block_size(), 0x5a);
+  std::vector<block_id_t> block_ids(batch);
+  auto sweep = [&](bool write) {
+    for (block_id_t start = 0; start + batch <= bm.total_blocks();
+         start += batch) {
+      for (usize i = 0; i < batch; ++i) {
+        block_ids[i] = start + i;
+      }
+      if (write) {
+        bm.write_blocks(block_ids, buf.data()).unwrap();
+      } else {
+        bm.read_blocks(block_ids, buf.data()).unwrap();
+      }
+    }
+  };
+
+  auto write_ms = time_ms([&]() { sweep(true); });
+  auto read_ms = time_ms([&]() { sweep(false); });
+  bm.fail_device(0).unwrap();
+  bm.fail_device(1).unwrap();
+  auto degraded_ms = time_ms([&]() { sweep(false); });
+
+  auto mb = bm.total_blocks() * bm.block_size() / 1024.0 / 1024.0;
+  std::cout << "RS(4+2) device: write " << mb / write_ms * 1000
+            << " MB/s, read " << mb / read_ms * 1000
+            << " MB/s, degraded read " << mb / degraded_ms * 1000 << " MB/s"
+            << std::endl;
+}
+
+} // namespace chfs
@@ -0,0 +1,115 @@
+#include <chrono>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <iostream>
+#include <random>
+
+#include "block/manager.h"
+#include "common/stream.h"
+
+namespace chfs {
+
+// 256MB of data per measurement
+const usize KBenchDataBytes = 256 * 1024 * 1024;
+
+template <typename F> auto time_ms(F &&f) -> double {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+auto kernel_name(StreamKernel kernel) -> const char * {
+  switch (kernel) {
+  case StreamKernel::Avx2:
+    return "avx2";
+  case StreamKernel::Sse2:
+    return "sse2";
+  default:
+    return "plain";
+  }
+}
+
+const StreamKernel KBenchKernels[] = {StreamKernel::Plain, StreamKernel::Sse2,
+                                      StreamKernel::Avx2};
+
+TEST(StreamBenchmark, Bandwidth) {
+  const usize chunk = 16 * 1024 * 1024;
+  std::vector<u8> src(chunk, 0x5a), dst(chunk);
+
+  for (auto kernel : KBenchKernels) {
+    if (!stream_kernel_supported(kernel)) {
+      continue;
+    }
+    auto copy_ms = time_ms([&]() {
+      for (usize i = 0; i < KBenchDataBytes / chunk; ++i) {
+        stream_copy(kernel, dst.data(), src.data(), chunk);
+      }
+    });
+    auto zero_ms = time_ms([&]() {
+      for (usize i = 0; i < KBenchDataBytes / chunk; ++i) {
+        stream_zero(kernel, dst.data(), chunk);
+      }
+    });
+
+    auto mb = KBenchDataBytes / 1024.0 / 1024.0;
+    std::cout << kernel_name(kernel) << ": copy " << mb / copy_ms * 1000
+              << " MB/s, zero " << mb / zero_ms * 1000 << " MB/s"
+              << std::endl;
+  }
+}
+
+/**
+ * Interleave bulk writes to the data region of a device with random lookups
+ * in its metadata region (e.g., the inode table), and measure the latency
+ * of the lookups. Cached stores evict the metadata, non-temporal ones
+ * should not.
+ */
+TEST(StreamBenchmark, CoRunningLookups) {
+  const usize meta_blocks = 256; // 1MB, fits in the L2/L3
+  const usize run_blocks = 64;   // 256KB bulk writes
+  const usize data_blocks = 64 * 1024;
+  auto bm = BlockManager(meta_blocks + data_blocks, KDefaultBlockSize);
+  auto base = bm.unsafe_get_block_ptr();
+  auto bs = bm.block_size();
+
+  // fault the pages in, so the first kernel is not penalized
+  memset(base, 0, static_cast<u64>(bm.total_blocks()) * bs);
+
+  std::vector<u8> run(run_blocks * bs, 0x5a);
+  const usize lookups = 1024;
+
+  for (auto kernel : KBenchKernels) {
+    if (!stream_kernel_supported(kernel)) {
+      continue;
+    }
+    std::mt19937 rng(73);
+    u64 sum = 0;
+    double lookup_ms = 0;
+    auto rounds = data_blocks / run_blocks;
+
+    auto write_ms = time_ms([&]() {
+      for (usize r = 0; r < rounds; ++r) {
+        auto start = meta_blocks + r * run_blocks;
+        stream_copy(kernel, base + static_cast<u64>(start) * bs, run.data(),
+                    run.size());
+
+        lookup_ms += time_ms([&]() {
+          for (usize i = 0; i < lookups; ++i) {
+            auto off = rng() % (meta_blocks * bs / sizeof(u64));
+            sum += reinterpret_cast<const u64 *>(base)[off];
+          }
+        });
+      }
+    });
+
+    auto mb = static_cast<u64>(data_blocks) * bs / 1024.0 / 1024.0;
+    std::cout << kernel_name(kernel) << ": bulk write "
+              << mb / (write_ms - lookup_ms) * 1000 << " MB/s, lookup "
+              << lookup_ms * 1e6 / (rounds * lookups) << " ns" << std::endl;
+    // keep the lookups alive
+    EXPECT_EQ(sum, 0);
+  }
+}
+
+} // namespace chfs
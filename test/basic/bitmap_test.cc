@@ -1,7 +1,10 @@
 #include "gtest/gtest.h"
 
 #include "common/bitmap.h"
+#include "common/bitscan.h"
 #include "common/macros.h"
+#include "common/popcount.h"
+#include <random>
 
 namespace chfs {
 
@@ -60,4 +63,142 @@ TEST(BasicTest, BitmapFree) {
   delete[] data;
 }
 
-} // namespace chfs
\ No newline at end of file
+TEST(BasicTest, BitmapCount) {
+  usize data_sz = 4096;
+  std::vector<u8> data(data_sz + 1);
+  // an unaligned bitmap
+  auto bm = Bitmap(data.data() + 1, data_sz);
+  bm.zeroed();
+
+  std::mt19937 gen(73);
+  std::vector<bool> bits(data_sz * KBitsPerByte);
+  for (usize i = 0; i < data_sz * KBitsPerByte / 3; i++) {
+    auto idx = gen() % bits.size();
+    bits[idx] = true;
+    bm.set(idx);
+  }
+
+  usize ones = 0;
+  std::vector<usize> prefix_zeros(bits.size() + 1);
+  for (usize i = 0; i < bits.size(); i++) {
+    prefix_zeros[i] = i - ones;
+    ones += bits[i];
+  }
+  prefix_zeros[bits.size()] = bits.size() - ones;
+
+  EXPECT_EQ(bm.count_ones(), ones);
+  EXPECT_EQ(bm.count_zeros(), bits.size() - ones);
+  for (usize bound : {0u, 1u, 7u, 8u, 63u, 64u, 1000u, 32767u, 32768u}) {
+    EXPECT_EQ(bm.count_zeros_to_bound(bound), prefix_zeros[bound]);
+  }
+
+  // every kernel agrees on every length, including the tails
+  for (auto kernel : {PopcountKernel::Scalar, PopcountKernel::Popcnt,
+                      PopcountKernel::Avx2, PopcountKernel::Avx512}) {
+    if (!popcount_kernel_supported(kernel)) {
+      continue;
+    }
+    for (usize len : {0u, 1u, 7u, 8u, 31u, 32u, 33u, 63u, 65u, 999u, 4096u}) {
+      usize expected = 0;
+      for (usize i = 0; i < len * KBitsPerByte; i++) {
+        expected += bits[i];
+      }
+      EXPECT_EQ(popcount(kernel, data.data() + 1, len), expected);
+    }
+  }
+}
+
+TEST(BasicTest, BitmapFindRun) {
+  usize data_sz = 512;
+  std::vector<u8> data(data_sz);
+  auto bm = Bitmap(data.data(), data_sz);
+  bm.zeroed();
+
+  // used: [0, 1000), 1003, [1010, 2000), 2100
+  for (usize i = 0; i < 2000; i++) {
+    if (i < 1000 || i >= 1010 || i == 1003) {
+      bm.set(i);
+    }
+  }
+  bm.set(2100);
+  EXPECT_EQ(bm.find_first_free().value(), 1000);
+  EXPECT_EQ(bm.find_first_free_w_bound(1000), std::nullopt);
+  EXPECT_EQ(bm.find_first_free_w_bound(1001).value(), 1000);
+
+  EXPECT_EQ(bm.find_free_run(3).value(), 1000);
+  EXPECT_EQ(bm.find_free_run(4).value(), 1004);
+  EXPECT_EQ(bm.find_free_run(6).value(), 1004);
+  EXPECT_EQ(bm.find_free_run(7).value(), 2000);
+  EXPECT_EQ(bm.find_free_run(100).value(), 2000);
+  EXPECT_EQ(bm.find_free_run(101).value(), 2101);
+  EXPECT_EQ(bm.find_free_run(data_sz * KBitsPerByte - 2101).value(), 2101);
+  EXPECT_EQ(bm.find_free_run(data_sz * KBitsPerByte - 2100), std::nullopt);
+
+  // the search starts at the hint and wraps around
+  EXPECT_EQ(bm.find_free_run(3, 1001).value(), 1004);
+  EXPECT_EQ(bm.find_free_run(3, 3000).value(), 3000);
+  EXPECT_EQ(bm.find_free_run(90, 4000).value(), 4000);
+  EXPECT_EQ(bm.find_free_run(200, 4000).value(), 2101);
+  EXPECT_EQ(bm.find_free_run(1995, 3000).value(), 2101);
+  EXPECT_EQ(bm.find_free_run(5, 1005).value(), 1005);
+  EXPECT_EQ(bm.find_free_run(6, 1005).value(), 2000);
+  // a run crossing the hint is found after the wrap
+  EXPECT_EQ(bm.find_free_run(6, 2050).value(), 2050);
+  EXPECT_EQ(bm.find_free_run(60, 2050).value(), 2101);
+  EXPECT_EQ(bm.find_free_run(60, 2099).value(), 2101);
+  bm.set(data_sz * KBitsPerByte - 1);
+  EXPECT_EQ(bm.find_free_run(95, 4000).value(), 4000);
+  EXPECT_EQ(bm.find_free_run(96, 4000).value(), 2000);
+  EXPECT_EQ(bm.find_free_run(101, 4000).value(), 2101);
+
+  // the bound cuts the runs
+  EXPECT_EQ(bm.find_free_run_w_bound(7, 0, 2006), std::nullopt);
+  EXPECT_EQ(bm.find_free_run_w_bound(7, 0, 2007).value(), 2000);
+
+  // against a brute force search on random bitmaps
+  std::mt19937 gen(73);
+  auto total = data_sz * KBitsPerByte;
+  for (int round = 0; round < 50; round++) {
+    bm.zeroed();
+    for (usize i = 0; i < total * 9 / 10; i++) {
+      bm.set(gen() % total);
+    }
+    auto len = gen() % 8 + 1;
+    auto hint = gen() % total;
+    std::optional<usize> expected;
+    for (usize k = 0; k < total && !expected; k++) {
+      auto start = (hint + k) % total;
+      if (start + len > total) {
+        continue;
+      }
+      usize j = 0;
+      while (j < len && !bm.check(start + j)) {
+        j++;
+      }
+      if (j == len) {
+        expected = start;
+      }
+    }
+    EXPECT_EQ(bm.find_free_run(len, hint), expected);
+  }
+}
+
+TEST(BasicTest, BitmapSkipBytes) {
+  std::vector<u8> data(300);
+  for (usize len : {0u, 1u, 7u, 8u, 33u, 64u, 65u, 130u, 299u}) {
+    for (usize pos = 0; pos <= len; pos++) {
+      // an unaligned buffer, the first differing byte wins
+      std::fill(data.begin(), data.end(), 0xff);
+      if (pos < len) {
+        data[1 + pos] = 0xfe;
+        data[len] = 0;
+      }
+      EXPECT_EQ(skip_bytes_sw(data.data() + 1, len, 0xff), pos);
+      EXPECT_EQ(skip_bytes(data.data() + 1, len, 0xff), pos);
+    }
+  }
+  std::vector<u8> zeros(100);
+  EXPECT_EQ(skip_bytes(zeros.data(), zeros.size(), 0), zeros.size());
+}
+
+} // namespace chfs
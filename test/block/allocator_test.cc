@@ -1,4 +1,5 @@
 #include "block/allocator.h"
+#include "common/bitmap.h"
 #include "common/macros.h"
 #include "gtest/gtest.h"
 
@@ -66,4 +67,261 @@ TEST_F(BlockAllocatorTest, Allocation) {
   }
 }
 
-} // namespace chfs
\ No newline at end of file
+TEST_F(BlockAllocatorTest, Discard) {
+  auto bm = std::shared_ptr<BlockManager>(new BlockManager(1024, 4096));
+  auto allocator = BlockAllocator(bm);
+  allocator.set_discard_batch(4);
+
+  std::vector<u8> data(bm->block_size(), 0x5a);
+  std::vector<block_id_t> block_ids;
+  for (int i = 0; i < 4; ++i) {
+    auto block_id = allocator.allocate().unwrap();
+    bm->write_block(block_id, data.data()).unwrap();
+    block_ids.push_back(block_id);
+  }
+
+  // 1. pending discards are dropped once the block is reused
+  allocator.deallocate(block_ids[0]).unwrap();
+  EXPECT_EQ(allocator.allocate().unwrap(), block_ids[0]);
+  allocator.flush_discards().unwrap();
+  std::vector<u8> buf(bm->block_size());
+  bm->read_block(block_ids[0], buf.data()).unwrap();
+  EXPECT_EQ(buf, data);
+
+  // 2. the batch is discarded when it is full
+  for (int i = 0; i < 3; ++i) {
+    allocator.deallocate(block_ids[i]).unwrap();
+  }
+  bm->read_block(block_ids[0], buf.data()).unwrap();
+  EXPECT_EQ(buf, data);
+  allocator.deallocate(block_ids[3]).unwrap();
+  for (auto block_id : block_ids) {
+    bm->read_block(block_id, buf.data()).unwrap();
+    EXPECT_EQ(buf, std::vector<u8>(bm->block_size()));
+  }
+}
+
+TEST_F(BlockAllocatorTest, Grow) {
+  // a bitmap block covers 4096 * 8 blocks
+  auto bm = std::shared_ptr<BlockManager>(new BlockManager(1024, 4096));
+  auto allocator = BlockAllocator(bm, 1);
+  auto free_before = allocator.free_block_cnt();
+
+  bm->grow(100000).unwrap();
+  // the first bitmap block still has room
+  auto extent = allocator.grow(30000).unwrap();
+  EXPECT_EQ(extent.cnt, 0);
+  EXPECT_EQ(allocator.free_block_cnt(), free_before + 30000 - 1024);
+
+  // 100000 blocks need 4 bitmap blocks, 3 of them are new
+  extent = allocator.grow(100000).unwrap();
+  EXPECT_EQ(extent.start, 30000);
+  EXPECT_EQ(extent.cnt, 3);
+  EXPECT_EQ(allocator.total_bitmap_block(), 4);
+  EXPECT_EQ(allocator.free_block_cnt(), free_before + 100000 - 1024 - 3);
+  EXPECT_TRUE(allocator.grow(100001).is_err());
+
+  // the allocator can be rebuilt from the extents
+  auto allocator1 =
+      BlockAllocator(bm, 1, 100000, allocator.get_grown_extents());
+  EXPECT_EQ(allocator1.free_block_cnt(), allocator.free_block_cnt());
+  EXPECT_TRUE(allocator1.deallocate(30001).is_ok());
+  EXPECT_TRUE(allocator1.deallocate(99999).is_err());
+}
+
+/**
+ * An in-memory device whose batched reads and writes can be made to fail
+ */
+class FaultyBlockManager : public BlockManager {
+public:
+  bool broken_reads = false;
+  bool broken_writes = false;
+
+  FaultyBlockManager(usize block_cnt, usize block_size)
+      : BlockManager(block_cnt, block_size) {}
+
+  auto read_blocks(const std::vector<block_id_t> &block_ids, u8 *data)
+      -> ChfsNullResult override {
+    if (broken_reads) {
+      return ChfsNullResult(ErrorType::IOError);
+    }
+    return BlockManager::read_blocks(block_ids, data);
+  }
+
+  auto write_blocks(const std::vector<block_id_t> &block_ids, const u8 *data)
+      -> ChfsNullResult override {
+    if (broken_writes) {
+      return ChfsNullResult(ErrorType::IOError);
+    }
+    return BlockManager::write_blocks(block_ids, data);
+  }
+};
+
+TEST_F(BlockAllocatorTest, GrowFlushFailure) {
+  auto faulty = std::make_shared<FaultyBlockManager>(1024, 4096);
+  auto bm = std::shared_ptr<BlockManager>(faulty);
+  auto allocator = BlockAllocator(bm, 1);
+  auto free_before = allocator.free_block_cnt();
+  bm->grow(100000).unwrap();
+
+  // the allocator is left at its old size
+  faulty->broken_writes = true;
+  EXPECT_TRUE(allocator.grow(100000).is_err());
+  EXPECT_EQ(allocator.total_blocks(), 1024);
+  EXPECT_EQ(allocator.total_bitmap_block(), 1);
+  EXPECT_TRUE(allocator.get_grown_extents().empty());
+  EXPECT_EQ(allocator.free_block_cnt(), free_before);
+  EXPECT_TRUE(allocator.deallocate(1024).is_err());
+
+  // and can grow again once the device recovers
+  faulty->broken_writes = false;
+  auto extent = allocator.grow(100000).unwrap();
+  EXPECT_EQ(extent.start, 1024);
+  EXPECT_EQ(extent.cnt, 3);
+  EXPECT_EQ(allocator.free_block_cnt(), free_before + 100000 - 1024 - 3);
+  auto allocator1 =
+      BlockAllocator(bm, 1, 100000, allocator.get_grown_extents());
+  EXPECT_EQ(allocator1.free_block_cnt(), allocator.free_block_cnt());
+}
+
+TEST_F(BlockAllocatorTest, InitWithoutRead) {
+  // a new bitmap does not read the old one it overwrites
+  auto faulty = std::make_shared<FaultyBlockManager>(1024, 4096);
+  faulty->broken_reads = true;
+  auto allocator = BlockAllocator(faulty, 1);
+  EXPECT_EQ(allocator.free_block_cnt(), 1024 - 2);
+  EXPECT_EQ(allocator.allocate().unwrap(), 2);
+}
+
+TEST_F(BlockAllocatorTest, PartialLastByte) {
+  // the last byte of the bitmap has only 3 valid bits
+  const usize block_cnt = 1027;
+  auto bm = std::shared_ptr<BlockManager>(new BlockManager(block_cnt, 4096));
+  auto allocator = BlockAllocator(bm);
+  auto free_cnt = allocator.free_block_cnt();
+  EXPECT_EQ(free_cnt, block_cnt - allocator.total_bitmap_block());
+
+  block_id_t last = 0;
+  for (usize i = 0; i < free_cnt; ++i) {
+    last = allocator.allocate().unwrap();
+  }
+  EXPECT_EQ(last, block_cnt - 1);
+  EXPECT_EQ(allocator.free_block_cnt(), 0);
+  EXPECT_TRUE(allocator.allocate().is_err());
+}
+
+TEST_F(BlockAllocatorTest, Summary) {
+  // 4M blocks, the summary has three levels
+  const usize block_cnt = 4 * 1024 * 1024;
+  auto bm = std::shared_ptr<BlockManager>(new BlockManager(block_cnt, 4096));
+  auto allocator = BlockAllocator(bm, 1);
+  auto first = allocator.allocate().unwrap();
+  EXPECT_EQ(first, 1 + allocator.total_bitmap_block());
+
+  // mark everything but a few scattered blocks as used on the device
+  std::vector<block_id_t> holes = {1000, 70000, 3000000, block_cnt - 1};
+  for (usize i = 0; i < allocator.total_bitmap_block(); ++i) {
+    std::vector<u8> buffer(bm->block_size(), 0xff);
+    auto bitmap = Bitmap(buffer.data(), bm->block_size());
+    for (auto hole : holes) {
+      if (hole / (bm->block_size() * KBitsPerByte) == i) {
+        bitmap.clear(hole % (bm->block_size() * KBitsPerByte));
+      }
+    }
+    bm->write_block(1 + i, buffer.data()).unwrap();
+  }
+
+  // the summary is rebuilt when the bitmap is loaded
+  auto allocator1 = BlockAllocator(bm, 1, false);
+  EXPECT_EQ(allocator1.free_block_cnt(), holes.size());
+  for (auto hole : holes) {
+    EXPECT_EQ(allocator1.allocate().unwrap(), hole);
+  }
+  EXPECT_TRUE(allocator1.allocate().is_err());
+
+  // freed blocks are found again, the lowest first
+  allocator1.deallocate(3000000).unwrap();
+  allocator1.deallocate(70001).unwrap();
+  EXPECT_EQ(allocator1.allocate().unwrap(), 70001);
+  EXPECT_EQ(allocator1.allocate().unwrap(), 3000000);
+}
+
+TEST_F(BlockAllocatorTest, Hint) {
+  auto bm = std::shared_ptr<BlockManager>(new BlockManager(1024, 4096));
+  auto allocator = BlockAllocator(bm);
+  // block 0 holds the bitmap
+  EXPECT_EQ(allocator.allocate(std::nullopt).unwrap(), 1);
+
+  // the search starts at the goal
+  EXPECT_EQ(allocator.allocate(500).unwrap(), 500);
+  EXPECT_EQ(allocator.allocate(500).unwrap(), 501);
+  EXPECT_EQ(allocator.allocate(130).unwrap(), 130);
+
+  // next-fit goes on after the last allocated block
+  EXPECT_EQ(allocator.allocate(std::nullopt).unwrap(), 131);
+  EXPECT_EQ(allocator.allocate(std::nullopt).unwrap(), 132);
+
+  // the first-fit allocation is unchanged
+  EXPECT_EQ(allocator.allocate().unwrap(), 2);
+
+  // the search wraps around, the free bits before the goal in its word
+  // are found last
+  for (block_id_t i = 1000; i < 1024; ++i) {
+    allocator.allocate(i).unwrap();
+  }
+  EXPECT_EQ(allocator.allocate(1010).unwrap(), 3);
+  allocator.deallocate(1001).unwrap();
+  EXPECT_EQ(allocator.allocate(1020).unwrap(), 4);
+  EXPECT_EQ(allocator.allocate(1000).unwrap(), 1001);
+  EXPECT_EQ(allocator.allocate(5000).unwrap(), 5);
+
+  // the cursor wraps around as well
+  EXPECT_EQ(allocator.allocate(1023).unwrap(), 6);
+  EXPECT_EQ(allocator.allocate(std::nullopt).unwrap(), 7);
+
+  while (allocator.allocate(std::nullopt).is_ok()) {
+  }
+  EXPECT_EQ(allocator.free_block_cnt(), 0);
+}
+
+TEST_F(BlockAllocatorTest, FlushBatch) {
+  auto bm = std::shared_ptr<BlockManager>(new BlockManager(100000, 4096));
+  std::vector<block_id_t> block_ids;
+  {
+    auto allocator = BlockAllocator(bm, 1);
+    auto free_cnt = allocator.free_block_cnt();
+    allocator.set_flush_batch(0);
+    for (usize i = 0; i < 40000; ++i) {
+      block_ids.push_back(allocator.allocate().unwrap());
+    }
+    EXPECT_EQ(allocator.dirty_bitmap_block_cnt(), 2);
+    EXPECT_EQ(allocator.free_block_cnt(), free_cnt - 40000);
+
+    // the device has the bitmap of the last flush
+    EXPECT_EQ(BlockAllocator(bm, 1, false).free_block_cnt(), free_cnt);
+    allocator.flush().unwrap();
+    EXPECT_EQ(allocator.dirty_bitmap_block_cnt(), 0);
+    EXPECT_EQ(BlockAllocator(bm, 1, false).free_block_cnt(), free_cnt - 40000);
+
+    // a batch is flushed once it is full
+    allocator.set_flush_batch(10);
+    for (usize i = 0; i < 9; ++i) {
+      allocator.deallocate(block_ids.back()).unwrap();
+      block_ids.pop_back();
+    }
+    EXPECT_EQ(allocator.dirty_bitmap_block_cnt(), 1);
+    allocator.deallocate(block_ids.back()).unwrap();
+    block_ids.pop_back();
+    EXPECT_EQ(allocator.dirty_bitmap_block_cnt(), 0);
+
+    // the rest is flushed when the allocator goes away
+    allocator.deallocate(block_ids.front()).unwrap();
+    EXPECT_EQ(allocator.dirty_bitmap_block_cnt(), 1);
+  }
+  auto allocator = BlockAllocator(bm, 1, false);
+  EXPECT_EQ(allocator.free_block_cnt(),
+            100000 - 1 - allocator.total_bitmap_block() - block_ids.size() + 1);
+  EXPECT_EQ(allocator.allocate().unwrap(), block_ids.front());
+}
+
+} // namespace chfs
@@ -0,0 +1,196 @@
+#include "block/cached_manager.h"
+#include "common/macros.h"
+#include "filesystem/operations.h"
+#include "gtest/gtest.h"
+#include <cstring>
+
+namespace chfs {
+
+TEST(CachedBlockManagerTest, ReadWrite) {
+  auto bm = CachedBlockManager(1024, 4096, 16);
+
+  std::vector<u8> data(bm.block_size());
+  std::vector<u8> buf(bm.block_size());
+  std::strncpy((char *)data.data(), "A test string.", bm.block_size());
+
+  bm.write_block(3, data.data()).unwrap();
+  bm.read_block(3, buf.data()).unwrap();
+  EXPECT_EQ(std::memcmp(buf.data(), data.data(), bm.block_size()), 0);
+
+  // the write is not visible on the device until a flush
+  EXPECT_NE(std::memcmp(bm.unsafe_get_block_ptr() + 3 * bm.block_size(),
+                        data.data(), bm.block_size()),
+            0);
+  bm.flush().unwrap();
+  EXPECT_EQ(std::memcmp(bm.unsafe_get_block_ptr() + 3 * bm.block_size(),
+                        data.data(), bm.block_size()),
+            0);
+
+  bm.write_partial_block(3, data.data(), 100, 4).unwrap();
+  bm.read_block(3, buf.data()).unwrap();
+  EXPECT_EQ(std::memcmp(buf.data() + 100, data.data(), 4), 0);
+
+  bm.zero_block(3).unwrap();
+  bm.read_block(3, buf.data()).unwrap();
+  for (usize i = 0; i < bm.block_size(); i++) {
+    EXPECT_EQ(buf[i], 0);
+  }
+}
+
+TEST(CachedBlockManagerTest, Eviction) {
+  const usize cache_block_cnt = 8;
+  auto bm = CachedBlockManager(1024, 4096, cache_block_cnt);
+  std::vector<u8> buf(bm.block_size());
+
+  // write more blocks than the cache can hold
+  for (u64 i = 0; i < 64; ++i) {
+    *reinterpret_cast<u64 *>(buf.data()) = i + 73;
+    bm.write_block(i, buf.data()).unwrap();
+  }
+  auto stats = bm.get_stats();
+  EXPECT_EQ(stats.misses, 64);
+  EXPECT_EQ(stats.evictions, 64 - cache_block_cnt);
+  EXPECT_EQ(stats.writebacks, 64 - cache_block_cnt);
+
+  // evicted blocks must come back with their latest content
+  for (u64 i = 0; i < 64; ++i) {
+    bm.read_block(i, buf.data()).unwrap();
+    ASSERT_EQ(*reinterpret_cast<u64 *>(buf.data()), i + 73);
+  }
+
+  // a hot block stays in the cache
+  bm.reset_stats();
+  for (usize i = 0; i < 16; ++i) {
+    bm.read_block(63, buf.data()).unwrap();
+  }
+  EXPECT_EQ(bm.get_stats().hits, 16);
+  EXPECT_EQ(bm.get_stats().misses, 0);
+
+  EXPECT_TRUE(bm.read_block(1024, buf.data()).is_err());
+}
+
+TEST(CachedBlockManagerTest, BlockView) {
+  auto bm = CachedBlockManager(1024, 4096, 2);
+
+  {
+    auto view = bm.write_view(5).unwrap();
+    *view.as<u64>() = 73;
+
+    // the pinned frame survives the pressure of other blocks
+    std::vector<u8> buf(bm.block_size());
+    for (block_id_t i = 10; i < 20; ++i) {
+      bm.read_block(i, buf.data()).unwrap();
+    }
+    ASSERT_EQ(*view.as<u64>(), 73);
+  }
+
+  std::vector<u8> buf(bm.block_size());
+  bm.read_block(5, buf.data()).unwrap();
+  ASSERT_EQ(*reinterpret_cast<u64 *>(buf.data()), 73);
+
+  bm.flush().unwrap();
+  ASSERT_EQ(*reinterpret_cast<u64 *>(bm.unsafe_get_block_ptr() +
+                                     5 * bm.block_size()),
+            73);
+}
+
+TEST(CachedBlockManagerTest, Iterator) {
+  auto bm = CachedBlockManager(64, 512, 8);
+  std::vector<u8> data(bm.block_size(), 0x42);
+  bm.write_block(20, data.data()).unwrap();
+
+  // the iterator reads through the cache, not from the device beneath
+  auto iter = BlockIterator::create(&bm, 16, 48, 8).unwrap();
+  EXPECT_NE(iter.cur_window().first,
+            bm.unsafe_get_block_ptr() + 16 * bm.block_size());
+  usize count = 0;
+  for (; iter.has_next(); iter.next(bm.block_size()).unwrap()) {
+    EXPECT_EQ(iter.get_cur_byte(), count == 4 ? 0x42 : 0);
+    if (count == 30) {
+      *iter.unsafe_get_value_ptr<u8>() = 0x24;
+      iter.flush_cur_block().unwrap();
+    }
+    count += 1;
+  }
+  EXPECT_EQ(count, 32);
+
+  std::vector<u8> buf(bm.block_size());
+  bm.read_block(46, buf.data()).unwrap();
+  EXPECT_EQ(buf[0], 0x24);
+}
+
+TEST(CachedBlockManagerTest, FileSystem) {
+  auto bm = std::shared_ptr<BlockManager>(
+      new CachedBlockManager(16 * 1024, 512, 64));
+  auto fs = FileOperation(bm, 1024);
+
+  auto id = fs.alloc_inode(InodeType::FILE).unwrap();
+  std::vector<u8> content(512 * 40);
+  for (usize i = 0; i < content.size(); ++i) {
+    content[i] = i % 251;
+  }
+  fs.write_file(id, content).unwrap();
+  ASSERT_EQ(fs.read_file(id).unwrap(), content);
+
+  auto cache = std::dynamic_pointer_cast<CachedBlockManager>(bm);
+  EXPECT_GT(cache->get_stats().hits, 0);
+
+  // fsync only writes back the blocks of the file
+  EXPECT_GT(cache->dirty_bytes(), 0);
+  fs.sync_file(id).unwrap();
+  EXPECT_EQ(fs.read_file(id).unwrap(), content);
+  EXPECT_TRUE(fs.sync_file(1023).is_err());
+}
+
+TEST(CachedBlockManagerTest, SyncRange) {
+  auto bm = CachedBlockManager(1024, 4096, 16);
+  std::vector<u8> data(bm.block_size(), 0x5a);
+
+  bm.write_block(3, data.data()).unwrap();
+  bm.write_block(9, data.data()).unwrap();
+  EXPECT_EQ(bm.dirty_bytes(), 2 * bm.block_size());
+
+  bm.sync_block(3).unwrap();
+  EXPECT_EQ(bm.unsafe_get_block_ptr()[3 * bm.block_size()], 0x5a);
+  EXPECT_EQ(bm.unsafe_get_block_ptr()[9 * bm.block_size()], 0);
+  EXPECT_EQ(bm.dirty_bytes(), bm.block_size());
+
+  bm.sync_all().unwrap();
+  EXPECT_EQ(bm.unsafe_get_block_ptr()[9 * bm.block_size()], 0x5a);
+  EXPECT_EQ(bm.dirty_bytes(), 0);
+
+  EXPECT_TRUE(bm.sync_range(1000, 25).is_err());
+}
+
+TEST(CachedBlockManagerTest, BackgroundWriteback) {
+  WritebackOptions options;
+  options.enabled = true;
+  options.dirty_expire = std::chrono::milliseconds(20);
+  options.interval = std::chrono::milliseconds(5);
+  options.dirty_bytes_threshold = 8 * 4096;
+  auto bm = CachedBlockManager(1024, 4096, 64, options);
+  std::vector<u8> data(bm.block_size(), 0x5a);
+
+  // 1. an expired block is written back
+  bm.write_block(3, data.data()).unwrap();
+  for (int i = 0; i < 200 && bm.dirty_bytes() > 0; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  EXPECT_EQ(bm.dirty_bytes(), 0);
+  EXPECT_EQ(bm.get_stats().background_writebacks, 1);
+
+  // 2. crossing the threshold writes back everything
+  options.dirty_expire = std::chrono::hours(1);
+  options.interval = std::chrono::hours(1);
+  auto bm2 = CachedBlockManager(1024, 4096, 64, options);
+  for (block_id_t i = 0; i < 9; ++i) {
+    bm2.write_block(i, data.data()).unwrap();
+  }
+  for (int i = 0; i < 200 && bm2.dirty_bytes() > 0; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  EXPECT_EQ(bm2.dirty_bytes(), 0);
+  EXPECT_EQ(bm2.get_stats().background_writebacks, 9);
+}
+
+} // namespace chfs
@@ -0,0 +1,119 @@
+#include "block/checksum_manager.h"
+#include "common/crc32c.h"
+#include "common/macros.h"
+#include "filesystem/operations.h"
+#include "gtest/gtest.h"
+#include <cstring>
+#include <random>
+
+namespace chfs {
+
+TEST(ChecksumBlockManagerTest, Crc32c) {
+  const char *check = "123456789";
+  EXPECT_EQ(crc32c(reinterpret_cast<const u8 *>(check), 9), 0xe3069283);
+  EXPECT_EQ(crc32c_sw(reinterpret_cast<const u8 *>(check), 9), 0xe3069283);
+
+  // the hardware path agrees with the portable one on every alignment
+  std::vector<u8> data(3 * 4096 + 17);
+  std::mt19937 gen(0xdeadbeaf);
+  for (auto &c : data) {
+    c = static_cast<u8>(gen());
+  }
+  for (usize off : {0, 1, 7}) {
+    // the lengths around the lanes of 3 * 168 and 3 * 1360 bytes, and
+    // around the folding of 512 bytes and more
+    for (usize len :
+         {0, 5, 64, 503, 504, 511, 512, 767, 4080, 4096, 4111, 3 * 4096}) {
+      EXPECT_EQ(crc32c(data.data() + off, len),
+                crc32c_sw(data.data() + off, len));
+    }
+  }
+
+  // piecewise checksums
+  auto crc = crc32c(data.data(), 1000);
+  EXPECT_EQ(crc32c(data.data() + 1000, 3000, crc),
+            crc32c(data.data(), 4000));
+}
+
+TEST(ChecksumBlockManagerTest, ReadWrite) {
+  auto inner = std::shared_ptr<BlockManager>(new BlockManager(4096, 512));
+  auto bm = ChecksumBlockManager(inner);
+  // 4096 blocks, each checksum block covers 128 blocks
+  EXPECT_EQ(ChecksumBlockManager::csum_block_cnt(4096, 512), 32);
+  ASSERT_EQ(bm.total_blocks(), 4096 - 32);
+
+  std::vector<u8> data(bm.block_size());
+  std::vector<u8> buf(bm.block_size());
+  std::strncpy((char *)data.data(), "A test string.", bm.block_size());
+
+  bm.write_block(3, data.data()).unwrap();
+  bm.read_block(3, buf.data()).unwrap();
+  EXPECT_EQ(buf, data);
+
+  bm.write_partial_block(3, data.data(), 100, 4).unwrap();
+  bm.read_block(3, buf.data()).unwrap();
+  EXPECT_EQ(std::memcmp(buf.data() + 100, data.data(), 4), 0);
+
+  {
+    auto view = bm.write_view(7).unwrap();
+    *view.as<u64>() = 73;
+  }
+  EXPECT_EQ(*bm.read_view(7).unwrap().as<u64>(), 73);
+
+  std::vector<block_id_t> block_ids = {200, 201, 202, 9};
+  std::vector<u8> batch(block_ids.size() * bm.block_size(), 0x3c);
+  bm.write_blocks(block_ids, batch.data()).unwrap();
+  std::vector<u8> batch_buf(batch.size());
+  bm.read_blocks(block_ids, batch_buf.data()).unwrap();
+  EXPECT_EQ(batch_buf, batch);
+
+  bm.zero_block(3).unwrap();
+  bm.read_block(3, buf.data()).unwrap();
+  EXPECT_EQ(buf, std::vector<u8>(bm.block_size()));
+
+  // corrupt a block behind the checksum
+  inner->write_partial_block(201, data.data(), 0, 1).unwrap();
+  auto res = bm.read_block(201, buf.data());
+  ASSERT_TRUE(res.is_err());
+  EXPECT_EQ(res.unwrap_error(), ErrorType::Corrupted);
+  EXPECT_TRUE(bm.read_blocks(block_ids, batch_buf.data()).is_err());
+  EXPECT_TRUE(bm.read_view(201).is_err());
+}
+
+TEST(ChecksumBlockManagerTest, Reopen) {
+  remove("checksum_test.db");
+  std::vector<u8> data(KDefaultBlockSize, 0x5a);
+  {
+    auto bm = ChecksumBlockManager(
+        std::make_shared<BlockManager>("checksum_test.db", 4096));
+    bm.write_block(100, data.data()).unwrap();
+    bm.sync_all().unwrap();
+  }
+
+  auto inner = std::make_shared<BlockManager>("checksum_test.db", 4096);
+  auto bm = ChecksumBlockManager(inner, false);
+  std::vector<u8> buf(bm.block_size());
+  bm.read_block(100, buf.data()).unwrap();
+  EXPECT_EQ(buf, data);
+
+  inner->zero_block(100).unwrap();
+  EXPECT_TRUE(bm.read_block(100, buf.data()).is_err());
+  remove("checksum_test.db");
+}
+
+TEST(ChecksumBlockManagerTest, FileSystem) {
+  auto bm = std::shared_ptr<BlockManager>(new ChecksumBlockManager(
+      std::shared_ptr<BlockManager>(new BlockManager(16 * 1024, 512))));
+  auto fs = FileOperation(bm, 1024);
+
+  auto id = fs.alloc_inode(InodeType::FILE).unwrap();
+  std::vector<u8> content(512 * 40 + 100);
+  for (usize i = 0; i < content.size(); ++i) {
+    content[i] = i % 251;
+  }
+  fs.write_file(id, content).unwrap();
+  ASSERT_EQ(fs.read_file(id).unwrap(), content);
+  fs.sync_file(id).unwrap();
+}
+
+} // namespace chfs
@@ -0,0 +1,36 @@
+//===----------------------------------------------------------------------===//
+//
+//                         Chfs
+//
+// common.h
+//
+// Common fixtures of the block device tests
+//
+// Identification: test/block/common.h
+//
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "block/manager.h"
+
+namespace chfs {
+
+/**
+ * Creates `n` in-memory devices of 512-byte blocks, e.g., for an array
+ */
+inline auto make_devices(usize n, usize block_cnt)
+    -> std::vector<std::shared_ptr<BlockManager>> {
+  std::vector<std::shared_ptr<BlockManager>> devices;
+  for (usize i = 0; i < n; ++i) {
+    devices.push_back(
+        std::shared_ptr<BlockManager>(new BlockManager(block_cnt, 512)));
+  }
+  return devices;
+}
+
+} // namespace chfs
@@ -0,0 +1,88 @@
+#include "block/checksum_manager.h"
+#include "block/concurrent_manager.h"
+#include "common/macros.h"
+#include "gtest/gtest.h"
+#include <cstring>
+#include <thread>
+
+namespace chfs {
+
+const usize KTestThreads = 4;
+
+TEST(ConcurrentBlockManagerTest, ReadWrite) {
+  auto bm = ConcurrentBlockManager(
+      std::shared_ptr<BlockManager>(new BlockManager(1024, 512)), 16);
+  ASSERT_EQ(bm.total_blocks(), 1024);
+
+  std::vector<u8> data(bm.block_size(), 0x42);
+  std::vector<u8> buf(bm.block_size());
+  bm.write_block(3, data.data()).unwrap();
+  bm.read_block(3, buf.data()).unwrap();
+  EXPECT_EQ(buf, data);
+
+  std::vector<block_id_t> block_ids = {5, 21, 37, 5};
+  std::vector<u8> batch(block_ids.size() * bm.block_size(), 0x3c);
+  bm.write_blocks(block_ids, batch.data()).unwrap();
+  std::vector<u8> batch_buf(batch.size());
+  bm.read_blocks(block_ids, batch_buf.data()).unwrap();
+  EXPECT_EQ(batch_buf, batch);
+
+  bm.update_block(3, [](u8 *block) { block[0] = 7; }).unwrap();
+  bm.read_block(3, buf.data()).unwrap();
+  EXPECT_EQ(buf[0], 7);
+  EXPECT_EQ(buf[1], 0x42);
+
+  bm.discard_blocks({3}).unwrap();
+  bm.read_block(3, buf.data()).unwrap();
+  EXPECT_EQ(buf, std::vector<u8>(bm.block_size()));
+  bm.sync_all().unwrap();
+
+  bm.grow(2048).unwrap();
+  EXPECT_EQ(bm.total_blocks(), 2048);
+  bm.write_block(2000, data.data()).unwrap();
+  EXPECT_TRUE(bm.write_block(2048, data.data()).is_err());
+}
+
+TEST(ConcurrentBlockManagerTest, AtomicPartialWrite) {
+  // the checksummed device writes a partial block as a read-modify-write,
+  // which loses updates without the locks
+  auto bm = ConcurrentBlockManager(std::shared_ptr<BlockManager>(
+      new ChecksumBlockManager(std::make_shared<BlockManager>(256, 512))));
+
+  const usize rounds = 200;
+  std::vector<std::thread> threads;
+  for (usize t = 0; t < KTestThreads; ++t) {
+    threads.emplace_back([&bm, t]() {
+      for (usize i = 0; i < rounds; ++i) {
+        // each thread owns a byte of every block
+        for (block_id_t block_id = 0; block_id < 8; ++block_id) {
+          u8 value = static_cast<u8>(i + 1);
+          bm.write_partial_block(block_id, &value, t, 1).unwrap();
+        }
+        // and they all bump a shared counter
+        bm.update_block(100, [](u8 *block) {
+            *reinterpret_cast<u32 *>(block) += 1;
+          }).unwrap();
+      }
+    });
+  }
+  // readers of other blocks go on meanwhile
+  std::vector<u8> buf(bm.block_size());
+  for (usize i = 0; i < rounds; ++i) {
+    bm.read_block(50, buf.data()).unwrap();
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  for (block_id_t block_id = 0; block_id < 8; ++block_id) {
+    bm.read_block(block_id, buf.data()).unwrap();
+    for (usize t = 0; t < KTestThreads; ++t) {
+      EXPECT_EQ(buf[t], static_cast<u8>(rounds));
+    }
+  }
+  bm.read_block(100, buf.data()).unwrap();
+  EXPECT_EQ(*reinterpret_cast<u32 *>(buf.data()), rounds * KTestThreads);
+}
+
+} // namespace chfs
@@ -0,0 +1,114 @@
+#include "block/dedup_allocator.h"
+#include "common/hash.h"
+#include "filesystem/operations.h"
+#include "gtest/gtest.h"
+#include <random>
+
+namespace chfs {
+
+TEST(DedupAllocatorTest, Hash) {
+  std::vector<u8> data(3 * 4096 + 17);
+  std::mt19937 gen(0xdeadbeaf);
+  for (auto &c : data) {
+    c = static_cast<u8>(gen());
+  }
+
+  // the AVX2 path agrees with the portable one, the hashes are persisted
+  for (usize off : {0, 1, 7}) {
+    for (usize len : {0, 5, 64, 767, 1024, 1088, 4096, 3 * 4096}) {
+      EXPECT_EQ(hash64(data.data() + off, len),
+                hash64_sw(data.data() + off, len));
+    }
+  }
+
+  // a flipped bit or a different length changes the hash
+  auto h = hash64(data.data(), 4096);
+  data[4095] ^= 1;
+  EXPECT_NE(hash64(data.data(), 4096), h);
+  EXPECT_NE(hash64(data.data(), 4095), hash64(data.data(), 4096));
+  std::vector<u8> zeros(4096);
+  EXPECT_NE(hash64(zeros.data(), 4096), hash64(zeros.data(), 2048));
+}
+
+static auto make_content(usize size, u8 seed) -> std::vector<u8> {
+  std::vector<u8> content(size);
+  for (usize i = 0; i < size; ++i) {
+    content[i] = static_cast<u8>(i % 251 + seed);
+  }
+  return content;
+}
+
+TEST(DedupAllocatorTest, SharedBlocks) {
+  auto bm = std::shared_ptr<BlockManager>(new BlockManager(16 * 1024, 512));
+  auto fs = FileOperation(bm, 1024, true);
+  auto dedup = fs.get_dedup_allocator();
+  ASSERT_NE(dedup, nullptr);
+  EXPECT_EQ(dedup->get_table_block_cnt(),
+            DedupAllocator::table_block_cnt_for(16 * 1024, 512));
+
+  // 80 blocks and a tail, more than the direct blocks
+  auto content = make_content(512 * 80 + 100, 0);
+  auto a = fs.alloc_inode(InodeType::FILE).unwrap();
+  fs.write_file(a, content).unwrap();
+  auto free_cnt = fs.get_free_blocks_num().unwrap();
+
+  // the second copy only takes an inode and an indirect block
+  auto b = fs.alloc_inode(InodeType::FILE).unwrap();
+  fs.write_file(b, content).unwrap();
+  EXPECT_EQ(fs.get_free_blocks_num().unwrap(), free_cnt - 2);
+  EXPECT_EQ(dedup->hit_cnt(), 81);
+  ASSERT_EQ(fs.read_file(b).unwrap(), content);
+
+  // rewriting the first file does not touch the second one
+  auto modified = content;
+  modified[0] ^= 0xff;
+  fs.write_file(a, modified).unwrap();
+  ASSERT_EQ(fs.read_file(a).unwrap(), modified);
+  ASSERT_EQ(fs.read_file(b).unwrap(), content);
+
+  // identical blocks within a file are shared as well
+  auto c = fs.alloc_inode(InodeType::FILE).unwrap();
+  free_cnt = fs.get_free_blocks_num().unwrap();
+  fs.write_file(c, std::vector<u8>(512 * 8, 0x5a)).unwrap();
+  EXPECT_EQ(fs.get_free_blocks_num().unwrap(), free_cnt - 1);
+
+  // a block is freed with its last reference
+  free_cnt = fs.get_free_blocks_num().unwrap();
+  fs.remove_file(c).unwrap();
+  EXPECT_EQ(fs.get_free_blocks_num().unwrap(), free_cnt + 2);
+  fs.remove_file(a).unwrap();
+  ASSERT_EQ(fs.read_file(b).unwrap(), content);
+  fs.write_file(b, std::vector<u8>(100, 1)).unwrap();
+  ASSERT_EQ(fs.read_file(b).unwrap(), std::vector<u8>(100, 1));
+}
+
+TEST(DedupAllocatorTest, Reopen) {
+  auto bm = std::shared_ptr<BlockManager>(new BlockManager(16 * 1024, 512));
+  auto content = make_content(512 * 10, 7);
+  {
+    auto fs = FileOperation(bm, 1024, true);
+    auto id = fs.alloc_inode(InodeType::FILE).unwrap();
+    fs.write_file(id, content).unwrap();
+  }
+
+  // the fingerprints are indexed from the table
+  auto fs = FileOperation::create_from_raw(bm).unwrap();
+  auto dedup = fs->get_dedup_allocator();
+  ASSERT_NE(dedup, nullptr);
+  auto free_cnt = fs->get_free_blocks_num().unwrap();
+  auto id = fs->alloc_inode(InodeType::FILE).unwrap();
+  fs->write_file(id, content).unwrap();
+  EXPECT_EQ(fs->get_free_blocks_num().unwrap(), free_cnt - 1);
+  EXPECT_EQ(dedup->hit_cnt(), 10);
+  ASSERT_EQ(fs->read_file(id).unwrap(), content);
+
+  // the filesystems without deduplication are left alone
+  auto plain_bm = std::shared_ptr<BlockManager>(new BlockManager(1024, 512));
+  FileOperation(plain_bm, 64);
+  EXPECT_EQ(FileOperation::create_from_raw(plain_bm)
+                .unwrap()
+                ->get_dedup_allocator(),
+            nullptr);
+}
+
+} // namespace chfs
@@ -0,0 +1,189 @@
+#include "./common.h"
+#include "block/erasure_manager.h"
+#include "common/galois.h"
+#include "common/macros.h"
+#include "common/reed_solomon.h"
+#include "filesystem/operations.h"
+#include "gtest/gtest.h"
+#include <cstring>
+#include <random>
+
+namespace chfs {
+
+TEST(ErasureBlockManagerTest, Galois) {
+  EXPECT_EQ(gf_mul(0, 0x53), 0);
+  EXPECT_EQ(gf_mul(1, 0x53), 0x53);
+  EXPECT_EQ(gf_mul(2, 0x80), 0x1d);
+  for (u32 a = 1; a < 256; ++a) {
+    EXPECT_EQ(gf_mul(static_cast<u8>(a), gf_inv(static_cast<u8>(a))), 1);
+  }
+
+  // every kernel agrees with the scalar one, including the tails
+  std::vector<u8> src(4096 + 77);
+  std::mt19937 gen(0xdeadbeaf);
+  for (auto &c : src) {
+    c = static_cast<u8>(gen());
+  }
+  for (auto kernel : {GfKernel::Ssse3, GfKernel::Avx2}) {
+    if (!gf_kernel_supported(kernel)) {
+      continue;
+    }
+    for (u32 c : {0u, 1u, 2u, 0x8eu, 0xffu}) {
+      for (usize len : {0, 15, 33, 100, 4096 + 77}) {
+        std::vector<u8> expected(src.size(), 0x5a);
+        std::vector<u8> actual(src.size(), 0x5a);
+        gf_mul_add_region(GfKernel::Scalar, static_cast<u8>(c), src.data(),
+                          expected.data(), len);
+        gf_mul_add_region(kernel, static_cast<u8>(c), src.data(),
+                          actual.data(), len);
+        EXPECT_EQ(actual, expected);
+      }
+    }
+  }
+}
+
+TEST(ErasureBlockManagerTest, ReedSolomon) {
+  const usize k = 5, m = 3, len = 1000;
+  auto codec = ReedSolomon(k, m);
+  std::mt19937 gen(42);
+
+  std::vector<std::vector<u8>> shards(k + m, std::vector<u8>(len));
+  for (usize j = 0; j < k; ++j) {
+    for (auto &c : shards[j]) {
+      c = static_cast<u8>(gen());
+    }
+  }
+  std::vector<u8 *> ptrs;
+  for (auto &shard : shards) {
+    ptrs.push_back(shard.data());
+  }
+  codec.encode(ptrs.data(), ptrs.data() + k, len);
+  auto expected = shards;
+
+  // any m shards can be lost
+  for (usize a = 0; a < k + m; ++a) {
+    for (usize b = a + 1; b < k + m; ++b) {
+      for (usize c = b + 1; c < k + m; ++c) {
+        std::vector<bool> present(k + m, true);
+        present[a] = present[b] = present[c] = false;
+        std::fill(shards[a].begin(), shards[a].end(), 0xee);
+        std::fill(shards[b].begin(), shards[b].end(), 0xee);
+        std::fill(shards[c].begin(), shards[c].end(), 0xee);
+        ASSERT_TRUE(codec.reconstruct(ptrs.data(), present, len));
+        ASSERT_EQ(shards, expected);
+      }
+    }
+  }
+
+  std::vector<bool> present(k + m, false);
+  present[0] = present[1] = true;
+  EXPECT_FALSE(codec.reconstruct(ptrs.data(), present, len));
+}
+
+TEST(ErasureBlockManagerTest, ReadWrite) {
+  auto devices = make_devices(6, 256);
+  auto bm = ErasureBlockManager(devices, 4);
+  ASSERT_EQ(bm.total_blocks(), 4 * 256);
+
+  // single blocks, partial rows, and whole rows
+  std::vector<block_id_t> block_ids = {5, 17, 16, 18, 19, 20, 100, 3};
+  std::vector<u8> batch(block_ids.size() * bm.block_size());
+  for (usize i = 0; i < batch.size(); ++i) {
+    batch[i] = i % 251;
+  }
+  bm.write_blocks(block_ids, batch.data()).unwrap();
+
+  std::vector<u8> batch_buf(batch.size());
+  bm.read_blocks(block_ids, batch_buf.data()).unwrap();
+  EXPECT_EQ(batch_buf, batch);
+
+  std::vector<u8> data(bm.block_size(), 0x42);
+  std::vector<u8> buf(bm.block_size());
+  bm.write_block(6, data.data()).unwrap();
+  bm.write_partial_block(6, batch.data(), 10, 20).unwrap();
+  bm.read_block(6, buf.data()).unwrap();
+  EXPECT_EQ(std::memcmp(buf.data() + 10, batch.data(), 20), 0);
+  EXPECT_EQ(buf[0], 0x42);
+
+  {
+    auto view = bm.write_view(7).unwrap();
+    *view.as<u64>() = 73;
+  }
+  EXPECT_EQ(*bm.read_view(7).unwrap().as<u64>(), 73);
+
+  bm.discard_blocks({16, 17, 18, 19, 100}).unwrap();
+  bm.read_block(17, buf.data()).unwrap();
+  EXPECT_EQ(buf, std::vector<u8>(bm.block_size()));
+  bm.read_block(20, buf.data()).unwrap();
+  EXPECT_EQ(std::memcmp(buf.data(), batch.data() + 5 * bm.block_size(),
+                        bm.block_size()),
+            0);
+  bm.sync_range(3, 20).unwrap();
+  bm.sync_all().unwrap();
+
+  EXPECT_TRUE(bm.read_block(bm.total_blocks(), buf.data()).is_err());
+}
+
+TEST(ErasureBlockManagerTest, Degraded) {
+  // a wide row, so that small writes update the parity in place
+  auto devices = make_devices(10, 128);
+  auto bm = ErasureBlockManager(devices, 8);
+
+  std::vector<u8> content(bm.total_blocks() * bm.block_size());
+  std::mt19937 gen(7);
+  for (auto &c : content) {
+    c = static_cast<u8>(gen());
+  }
+  std::vector<block_id_t> all(bm.total_blocks());
+  for (usize i = 0; i < all.size(); ++i) {
+    all[i] = i;
+  }
+  bm.write_blocks(all, content.data()).unwrap();
+
+  // small writes with all devices
+  std::vector<u8> data(bm.block_size(), 0x42);
+  for (block_id_t id : {3, 9, 700}) {
+    bm.write_block(id, data.data()).unwrap();
+    std::memcpy(content.data() + id * bm.block_size(), data.data(),
+                bm.block_size());
+  }
+
+  // lose two devices, everything is still there
+  bm.fail_device(2).unwrap();
+  bm.fail_device(5).unwrap();
+  EXPECT_TRUE(bm.fail_device(7).is_err());
+  std::vector<u8> buf(content.size());
+  bm.read_blocks(all, buf.data()).unwrap();
+  EXPECT_EQ(buf, content);
+
+  // and it can still be written
+  for (block_id_t id : {0, 1, 2, 10, 511}) {
+    bm.write_block(id, content.data()).unwrap();
+    std::memcpy(content.data() + id * bm.block_size(), content.data(),
+                bm.block_size());
+  }
+  bm.read_blocks(all, buf.data()).unwrap();
+  EXPECT_EQ(buf, content);
+  for (block_id_t id : {0, 1, 2, 10, 511}) {
+    std::vector<u8> block(bm.block_size());
+    bm.read_block(id, block.data()).unwrap();
+    EXPECT_EQ(std::memcmp(block.data(), content.data(), bm.block_size()), 0);
+  }
+}
+
+TEST(ErasureBlockManagerTest, FileSystem) {
+  auto bm = std::shared_ptr<BlockManager>(
+      new ErasureBlockManager(make_devices(6, 2048), 4));
+  auto fs = FileOperation(bm, 1024);
+
+  auto id = fs.alloc_inode(InodeType::FILE).unwrap();
+  std::vector<u8> content(512 * 40 + 100);
+  for (usize i = 0; i < content.size(); ++i) {
+    content[i] = i % 251;
+  }
+  fs.write_file(id, content).unwrap();
+  ASSERT_EQ(fs.read_file(id).unwrap(), content);
+  fs.sync_file(id).unwrap();
+}
+
+} // namespace chfs
@@ -1,7 +1,9 @@
 #include "block/manager.h"
 #include "common/macros.h"
+#include "common/stream.h"
 #include "gtest/gtest.h"
 #include <cstring>
+#include <sys/stat.h>
 
 namespace chfs {
 
@@ -86,6 +88,136 @@ TEST_F(BlockManagerTest, InMemoryTest) {
   delete[] data;
 }
 
+TEST_F(BlockManagerTest, InMemoryHugePageTest) {
+  for (auto mode : {HugePageMode::None, HugePageMode::Transparent,
+                    HugePageMode::Explicit}) {
+    // 4GB: the device is mapped lazily, so only the touched pages are used
+    auto bm = BlockManager(1024 * 1024, 4096, mode);
+    std::vector<u8> buf(bm.block_size());
+    std::vector<u8> data(bm.block_size(), 0xab);
+
+    // untouched blocks read as zeros
+    bm.read_block(1024 * 1024 - 1, buf.data());
+    EXPECT_EQ(buf, std::vector<u8>(bm.block_size()));
+
+    bm.write_block(1024 * 1024 - 1, data.data());
+    bm.read_block(1024 * 1024 - 1, buf.data());
+    EXPECT_EQ(buf, data);
+  }
+}
+
+TEST_F(BlockManagerTest, Sync) {
+  auto bm = BlockManager("sync_test.db", 1024);
+  std::vector<u8> data(bm.block_size(), 0x5a);
+
+  bm.write_block(5, data.data()).unwrap();
+  EXPECT_TRUE(bm.sync_block(5).is_ok());
+  EXPECT_TRUE(bm.sync_range(0, 1024).is_ok());
+  EXPECT_TRUE(bm.sync_all().is_ok());
+  EXPECT_TRUE(bm.sync_range(1000, 25).is_err());
+
+  auto mem_bm = BlockManager(1024, 4096);
+  EXPECT_TRUE(mem_bm.sync_all().is_ok());
+  remove("sync_test.db");
+}
+
+TEST_F(BlockManagerTest, Discard) {
+  remove("discard_test.db");
+  auto bm = BlockManager("discard_test.db", 1024);
+  std::vector<u8> data(bm.block_size(), 0x5a);
+  std::vector<u8> buf(bm.block_size());
+  for (block_id_t i = 0; i < 64; ++i) {
+    bm.write_block(i, data.data()).unwrap();
+  }
+  bm.sync_all().unwrap();
+
+  struct stat before, after;
+  stat("discard_test.db", &before);
+  bm.discard_blocks({3, 1, 2, 10, 40, 41}).unwrap();
+  stat("discard_test.db", &after);
+  // the file keeps its size, the host blocks are released
+  EXPECT_EQ(after.st_size, before.st_size);
+  EXPECT_LE(after.st_blocks, before.st_blocks);
+
+  for (block_id_t i : {1, 2, 3, 10, 40, 41}) {
+    bm.read_block(i, buf.data()).unwrap();
+    EXPECT_EQ(buf, std::vector<u8>(bm.block_size()));
+  }
+  bm.read_block(4, buf.data()).unwrap();
+  EXPECT_EQ(buf, data);
+  EXPECT_TRUE(bm.discard_blocks({1024}).is_err());
+  remove("discard_test.db");
+
+  // in-memory devices with blocks smaller than a page
+  auto mem_bm = BlockManager(1024, 512);
+  std::vector<u8> small(mem_bm.block_size(), 0x5a);
+  for (block_id_t i = 0; i < 32; ++i) {
+    mem_bm.write_block(i, small.data()).unwrap();
+  }
+  mem_bm.discard_blocks({7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17}).unwrap();
+  for (block_id_t i = 0; i < 32; ++i) {
+    mem_bm.read_block(i, buf.data()).unwrap();
+    auto discarded = i >= 7 && i <= 17;
+    EXPECT_EQ(buf[0], discarded ? 0 : 0x5a);
+    EXPECT_EQ(buf[511], discarded ? 0 : 0x5a);
+  }
+}
+
+TEST_F(BlockManagerTest, Grow) {
+  remove("grow_test.db");
+  std::vector<u8> data(4096, 0x5a);
+  std::vector<u8> buf(4096);
+  {
+    auto bm = BlockManager("grow_test.db", 16);
+    bm.write_block(15, data.data()).unwrap();
+    EXPECT_TRUE(bm.grow(8).is_err());
+    bm.grow(1024).unwrap();
+    EXPECT_EQ(bm.total_blocks(), 1024);
+    bm.write_block(1000, data.data()).unwrap();
+    bm.read_block(15, buf.data()).unwrap();
+    EXPECT_EQ(buf, data);
+  }
+
+  // the device is reopened at the new size
+  auto bm = BlockManager("grow_test.db", 16);
+  EXPECT_EQ(bm.total_blocks(), 1024);
+  bm.read_block(1000, buf.data()).unwrap();
+  EXPECT_EQ(buf, data);
+  remove("grow_test.db");
+
+  for (auto mode : {HugePageMode::None, HugePageMode::Explicit}) {
+    auto mem_bm = BlockManager(16, 4096, mode);
+    mem_bm.write_block(15, data.data()).unwrap();
+    mem_bm.grow(4096).unwrap();
+    mem_bm.read_block(15, buf.data()).unwrap();
+    EXPECT_EQ(buf, data);
+    mem_bm.read_block(4095, buf.data()).unwrap();
+    EXPECT_EQ(buf, std::vector<u8>(4096));
+  }
+}
+
+TEST_F(BlockManagerTest, FileBlockSize) {
+  for (usize block_size : {512, 16 * 1024, 64 * 1024}) {
+    remove("block_size_test.db");
+    std::vector<u8> data(block_size, 0x5a);
+    std::vector<u8> buf(block_size);
+    {
+      auto bm = BlockManager("block_size_test.db", 64, block_size);
+      ASSERT_EQ(bm.block_size(), block_size);
+      bm.write_block(63, data.data()).unwrap();
+    }
+
+    struct stat st;
+    stat("block_size_test.db", &st);
+    EXPECT_EQ(st.st_size, 64 * block_size);
+    auto bm = BlockManager("block_size_test.db", 16, block_size);
+    EXPECT_EQ(bm.total_blocks(), 64);
+    bm.read_block(63, buf.data()).unwrap();
+    EXPECT_EQ(buf, data);
+  }
+  remove("block_size_test.db");
+}
+
 TEST_F(BlockManagerTest, Iterator) {
   // 1024: block cnt
   // 4096: block size
@@ -109,4 +241,162 @@ TEST_F(BlockManagerTest, Iterator) {
   }
 }
 
+TEST_F(BlockManagerTest, IteratorWindow) {
+  auto bm = BlockManager(256, 512);
+  for (block_id_t i = 0; i < 256; ++i) {
+    std::vector<u8> buffer(512, static_cast<u8>(i));
+    bm.write_block(i, buffer.data()).unwrap();
+  }
+
+  // the window of a mapped device points into it
+  auto iter = BlockIterator::create(&bm, 10, 110, 16).unwrap();
+  auto [window, window_cnt] = iter.cur_window();
+  ASSERT_EQ(window, bm.unsafe_get_block_ptr() + 10 * 512);
+  ASSERT_EQ(window_cnt, 16);
+
+  // by blocks, through several windows and a partial one at the end
+  usize count = 0;
+  for (; iter.has_next(); iter.next(512).unwrap()) {
+    ASSERT_EQ(iter.get_cur_byte(), static_cast<u8>(10 + count));
+    *iter.unsafe_get_value_ptr<u8>() = 0xee;
+    iter.flush_cur_block().unwrap();
+    count += 1;
+  }
+  ASSERT_EQ(count, 100);
+  std::vector<u8> buffer(512);
+  bm.read_block(109, buffer.data()).unwrap();
+  ASSERT_EQ(buffer[0], 0xee);
+  ASSERT_EQ(buffer[1], 109);
+
+  // by bytes across a window boundary
+  iter = BlockIterator::create(&bm, 0, 4, 2).unwrap();
+  iter.next(2 * 512 - 1).unwrap();
+  ASSERT_EQ(iter.get_cur_byte(), 1);
+  iter.next(1).unwrap();
+  ASSERT_EQ(iter.get_cur_byte(), 2);
+  auto window_cnt2 = iter.cur_window().second;
+  ASSERT_EQ(window_cnt2, 2);
+  iter.next(2 * 512).unwrap();
+  ASSERT_FALSE(iter.has_next());
+  ASSERT_TRUE(iter.next(512).is_err());
+}
+
+TEST_F(BlockManagerTest, BlockView) {
+  auto bm = BlockManager(1024, 4096);
+
+  {
+    auto view = bm.write_view(7).unwrap();
+    ASSERT_EQ(view.size(), bm.block_size());
+    *view.as<u64>(8) = 73;
+    view[0] = 42;
+  }
+
+  std::vector<u8> buffer(4096);
+  bm.read_block(7, buffer.data()).unwrap();
+  ASSERT_EQ(buffer[0], 42);
+  ASSERT_EQ(*reinterpret_cast<u64 *>(buffer.data() + 8), 73);
+
+  // the view points into the device without a copy
+  auto view = bm.read_view(7).unwrap();
+  ASSERT_EQ(view.data(), bm.unsafe_get_block_ptr() + 7 * bm.block_size());
+  ASSERT_EQ(*view.as<u64>(8), 73);
+
+  ASSERT_TRUE(bm.read_view(1024).is_err());
+  ASSERT_TRUE(bm.write_view(1024).is_err());
+}
+
+TEST_F(BlockManagerTest, BatchReadWrite) {
+  auto bm = BlockManager(1024, 4096);
+
+  // two contiguous runs and a single block
+  std::vector<block_id_t> block_ids = {10, 11, 12, 40, 41, 7};
+  std::vector<u8> data(block_ids.size() * bm.block_size());
+  for (usize i = 0; i < block_ids.size(); ++i) {
+    *reinterpret_cast<u64 *>(data.data() + i * bm.block_size()) = i + 73;
+  }
+  bm.write_blocks(block_ids, data.data()).unwrap();
+
+  std::vector<u8> buffer(4096);
+  for (usize i = 0; i < block_ids.size(); ++i) {
+    bm.read_block(block_ids[i], buffer.data()).unwrap();
+    ASSERT_EQ(*reinterpret_cast<u64 *>(buffer.data()), i + 73);
+  }
+
+  std::vector<u8> res(data.size());
+  bm.read_blocks(block_ids, res.data()).unwrap();
+  ASSERT_EQ(res, data);
+
+  // out of range batches are rejected as a whole
+  ASSERT_TRUE(bm.read_blocks({1, 1024}, res.data()).is_err());
+  ASSERT_TRUE(bm.write_blocks({1, 1024}, data.data()).is_err());
+}
+
+TEST_F(BlockManagerTest, StreamKernels) {
+  std::vector<u8> src(KStreamMinBytes + 300);
+  for (usize i = 0; i < src.size(); ++i) {
+    src[i] = static_cast<u8>(i * 131 + 7);
+  }
+
+  for (auto kernel :
+       {StreamKernel::Plain, StreamKernel::Sse2, StreamKernel::Avx2}) {
+    if (!stream_kernel_supported(kernel)) {
+      continue;
+    }
+    // unaligned heads and tails on both sides
+    for (usize off : {0u, 1u, 15u, 33u}) {
+      for (usize len : {0u, 7u, 64u, 100u, 4096u, KStreamMinBytes + 5}) {
+        std::vector<u8> dst(src.size() + 64, 0xff);
+        stream_copy(kernel, dst.data() + off, src.data() + 3, len);
+        ASSERT_EQ(memcmp(dst.data() + off, src.data() + 3, len), 0);
+        ASSERT_EQ(dst[off + len], 0xff);
+        if (off > 0) {
+          ASSERT_EQ(dst[off - 1], 0xff);
+        }
+
+        stream_zero(kernel, dst.data() + off, len);
+        for (usize i = off; i < off + len; ++i) {
+          ASSERT_EQ(dst[i], 0);
+        }
+        ASSERT_EQ(dst[off + len], 0xff);
+        if (off > 0) {
+          ASSERT_EQ(dst[off - 1], 0xff);
+        }
+      }
+    }
+  }
+}
+
+TEST_F(BlockManagerTest, BulkTransfer) {
+  auto bm = BlockManager(1024, 4096);
+
+  // a run large enough to be streamed
+  std::vector<block_id_t> block_ids;
+  for (block_id_t i = 100; i < 200; ++i) {
+    block_ids.push_back(i);
+  }
+  std::vector<u8> data(block_ids.size() * bm.block_size());
+  for (usize i = 0; i < data.size(); ++i) {
+    data[i] = static_cast<u8>(i * 17 + 1);
+  }
+  bm.write_blocks(block_ids, data.data()).unwrap();
+
+  std::vector<u8> res(data.size());
+  bm.read_blocks(block_ids, res.data()).unwrap();
+  ASSERT_EQ(res, data);
+
+  // clear all but the first and the last block of the run
+  bm.zero_blocks(101, 98).unwrap();
+  bm.read_blocks(block_ids, res.data()).unwrap();
+  ASSERT_EQ(memcmp(res.data(), data.data(), bm.block_size()), 0);
+  ASSERT_EQ(memcmp(res.data() + 99 * bm.block_size(),
+                   data.data() + 99 * bm.block_size(), bm.block_size()),
+            0);
+  for (usize i = bm.block_size(); i < 99 * bm.block_size(); ++i) {
+    ASSERT_EQ(res[i], 0);
+  }
+
+  bm.zero_blocks(1024, 0).unwrap();
+  ASSERT_TRUE(bm.zero_blocks(1000, 25).is_err());
+}
+
 } // namespace chfs
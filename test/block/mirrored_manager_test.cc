@@ -0,0 +1,176 @@
+#include "block/mirrored_manager.h"
+#include "common/macros.h"
+#include "filesystem/operations.h"
+#include "gtest/gtest.h"
+#include <cstring>
+
+namespace chfs {
+
+/**
+ * An in-memory device whose I/O can be made to fail
+ */
+class FaultyBlockManager : public BlockManager {
+public:
+  bool broken = false;
+  usize reads = 0;
+
+  FaultyBlockManager(usize block_cnt, usize block_size)
+      : BlockManager(block_cnt, block_size) {}
+
+  auto write_block(block_id_t block_id, const u8 *data)
+      -> ChfsNullResult override {
+    if (broken) {
+      return ChfsNullResult(ErrorType::IOError);
+    }
+    return BlockManager::write_block(block_id, data);
+  }
+
+  auto read_block(block_id_t block_id, u8 *data) -> ChfsNullResult override {
+    reads += 1;
+    if (broken) {
+      return ChfsNullResult(ErrorType::IOError);
+    }
+    return BlockManager::read_block(block_id, data);
+  }
+
+  auto read_blocks(const std::vector<block_id_t> &block_ids, u8 *data)
+      -> ChfsNullResult override {
+    reads += block_ids.size();
+    if (broken) {
+      return ChfsNullResult(ErrorType::IOError);
+    }
+    return BlockManager::read_blocks(block_ids, data);
+  }
+
+  auto write_blocks(const std::vector<block_id_t> &block_ids, const u8 *data)
+      -> ChfsNullResult override {
+    if (broken) {
+      return ChfsNullResult(ErrorType::IOError);
+    }
+    return BlockManager::write_blocks(block_ids, data);
+  }
+};
+
+TEST(MirroredBlockManagerTest, ReadWrite) {
+  auto r0 = std::make_shared<FaultyBlockManager>(1024, 512);
+  auto r1 = std::make_shared<FaultyBlockManager>(1024, 512);
+  auto bm = MirroredBlockManager({r0, r1}, ReadPolicy::RoundRobin);
+  ASSERT_EQ(bm.total_blocks(), 1024);
+
+  std::vector<u8> data(bm.block_size(), 0x42);
+  std::vector<u8> buf(bm.block_size());
+  bm.write_block(3, data.data()).unwrap();
+  r0->read_block(3, buf.data()).unwrap();
+  EXPECT_EQ(buf, data);
+  r1->read_block(3, buf.data()).unwrap();
+  EXPECT_EQ(buf, data);
+
+  // the reads alternate between the replicas
+  r0->reads = r1->reads = 0;
+  for (int i = 0; i < 10; ++i) {
+    bm.read_block(3, buf.data()).unwrap();
+    EXPECT_EQ(buf, data);
+  }
+  EXPECT_EQ(r0->reads, 5);
+  EXPECT_EQ(r1->reads, 5);
+
+  // a large batch is split among the replicas
+  std::vector<block_id_t> block_ids;
+  for (block_id_t i = 100; i < 200; ++i) {
+    block_ids.push_back(i);
+  }
+  std::vector<u8> batch(block_ids.size() * bm.block_size());
+  for (usize i = 0; i < batch.size(); ++i) {
+    batch[i] = i % 251;
+  }
+  bm.write_blocks(block_ids, batch.data()).unwrap();
+  r0->reads = r1->reads = 0;
+  std::vector<u8> batch_buf(batch.size());
+  bm.read_blocks(block_ids, batch_buf.data()).unwrap();
+  EXPECT_EQ(batch_buf, batch);
+  EXPECT_EQ(r0->reads, 50);
+  EXPECT_EQ(r1->reads, 50);
+
+  bm.write_partial_block(3, data.data(), 0, 1).unwrap();
+  bm.zero_block(4).unwrap();
+  bm.discard_blocks({100}).unwrap();
+  r1->read_block(100, buf.data()).unwrap();
+  EXPECT_EQ(buf, std::vector<u8>(bm.block_size()));
+  bm.sync_all().unwrap();
+
+  EXPECT_TRUE(bm.read_block(1024, buf.data()).is_err());
+}
+
+TEST(MirroredBlockManagerTest, Degraded) {
+  auto r0 = std::make_shared<FaultyBlockManager>(1024, 512);
+  auto r1 = std::make_shared<FaultyBlockManager>(1024, 512);
+  auto bm = MirroredBlockManager({r0, r1});
+
+  std::vector<u8> data(bm.block_size(), 0x42);
+  std::vector<u8> buf(bm.block_size());
+  bm.write_block(3, data.data()).unwrap();
+
+  // the reads move on to the healthy replica
+  r0->broken = true;
+  for (int i = 0; i < 4; ++i) {
+    bm.read_block(3, buf.data()).unwrap();
+    EXPECT_EQ(buf, data);
+  }
+  EXPECT_EQ(bm.replica_state(0), ReplicaState::Failed);
+  EXPECT_EQ(bm.replica_state(1), ReplicaState::Healthy);
+
+  // the last healthy replica cannot be taken out
+  EXPECT_TRUE(bm.fail_replica(1).is_err());
+
+  // writes keep going to the healthy replica only
+  std::vector<u8> data2(bm.block_size(), 0x24);
+  bm.write_block(5, data2.data()).unwrap();
+
+  // rebuild the replica in place
+  r0->broken = false;
+  bm.rebuild_replica(0).unwrap();
+  EXPECT_TRUE(bm.wait_rebuild());
+  EXPECT_EQ(bm.rebuild_progress(), 1024);
+  r0->read_block(5, buf.data()).unwrap();
+  EXPECT_EQ(buf, data2);
+
+  // replace a replica with a new device
+  bm.fail_replica(1).unwrap();
+  auto r2 = std::make_shared<FaultyBlockManager>(2048, 512);
+  EXPECT_TRUE(
+      bm.rebuild_replica(1, std::make_shared<BlockManager>(16, 512)).is_err());
+  bm.rebuild_replica(1, r2).unwrap();
+  // the writes during the rebuild reach the new replica as well
+  bm.write_block(7, data.data()).unwrap();
+  EXPECT_TRUE(bm.wait_rebuild());
+  EXPECT_EQ(bm.get_replica(1), r2);
+  r2->read_block(3, buf.data()).unwrap();
+  EXPECT_EQ(buf, data);
+  r2->read_block(7, buf.data()).unwrap();
+  EXPECT_EQ(buf, data);
+
+  // the error is reported once all replicas are gone
+  r0->broken = true;
+  r2->broken = true;
+  EXPECT_TRUE(bm.read_block(3, buf.data()).is_err());
+  EXPECT_TRUE(bm.write_block(3, data.data()).is_err());
+}
+
+TEST(MirroredBlockManagerTest, FileSystem) {
+  auto bm = std::shared_ptr<BlockManager>(new MirroredBlockManager(
+      {std::make_shared<BlockManager>(4096, 512),
+       std::make_shared<BlockManager>(4096, 512),
+       std::make_shared<BlockManager>(4096, 512)}));
+  auto fs = FileOperation(bm, 1024);
+
+  auto id = fs.alloc_inode(InodeType::FILE).unwrap();
+  std::vector<u8> content(512 * 40 + 100);
+  for (usize i = 0; i < content.size(); ++i) {
+    content[i] = i % 251;
+  }
+  fs.write_file(id, content).unwrap();
+  ASSERT_EQ(fs.read_file(id).unwrap(), content);
+  fs.sync_file(id).unwrap();
+}
+
+} // namespace chfs
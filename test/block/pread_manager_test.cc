@@ -0,0 +1,79 @@
+#include "block/backend.h"
+#include "block/pread_manager.h"
+#include "block/uring_manager.h"
+#include "common/macros.h"
+#include "gtest/gtest.h"
+#include <cstring>
+
+namespace chfs {
+
+class PreadBlockManagerTest : public ::testing::Test {
+protected:
+  // This function is called before every test.
+  void SetUp() override { remove("pread_test.db"); }
+
+  // This function is called after every test.
+  void TearDown() override { remove("pread_test.db"); };
+};
+
+// NOLINTNEXTLINE
+TEST_F(PreadBlockManagerTest, ReadWrite) {
+  for (auto direct_io : {false, true}) {
+    remove("pread_test.db");
+    auto bm = PreadBlockManager("pread_test.db", 1024, direct_io);
+    ASSERT_EQ(bm.total_blocks(), 1024);
+
+    std::vector<u8> data(bm.block_size());
+    std::vector<u8> buf(bm.block_size());
+    std::strncpy((char *)data.data(), "A test string.", bm.block_size());
+
+    bm.write_block(3, data.data()).unwrap();
+    bm.read_block(3, buf.data()).unwrap();
+    EXPECT_EQ(buf, data);
+
+    bm.write_partial_block(3, data.data(), 1000, 4).unwrap();
+    bm.read_block(3, buf.data()).unwrap();
+    EXPECT_EQ(std::memcmp(buf.data() + 1000, data.data(), 4), 0);
+
+    bm.zero_block(3).unwrap();
+    bm.read_block(3, buf.data()).unwrap();
+    EXPECT_EQ(buf, std::vector<u8>(bm.block_size()));
+
+    EXPECT_TRUE(bm.read_block(1024, buf.data()).is_err());
+    EXPECT_TRUE(bm.write_partial_block(3, data.data(), 4095, 2).is_err());
+  }
+}
+
+// NOLINTNEXTLINE
+TEST_F(PreadBlockManagerTest, Backends) {
+  std::vector<BlockBackend> backends = {BlockBackend::Mmap,
+                                        BlockBackend::Pread};
+  if (UringBlockManager::is_supported()) {
+    backends.push_back(BlockBackend::IoUring);
+  }
+
+  for (auto backend : backends) {
+    remove("pread_test.db");
+    std::vector<block_id_t> block_ids = {7, 8, 9, 2, 100};
+    std::vector<u8> data(block_ids.size() * KDefaultBlockSize);
+    for (usize i = 0; i < data.size(); ++i) {
+      data[i] = static_cast<u8>(i * 13 + 1);
+    }
+
+    {
+      auto bm = create_block_manager("pread_test.db", 1024, backend);
+      bm->write_blocks(block_ids, data.data()).unwrap();
+    }
+
+    // every backend reads what the others wrote
+    auto bm = create_block_manager("pread_test.db", 1024, BlockBackend::Pread);
+    std::vector<u8> buf(data.size());
+    bm->read_blocks(block_ids, buf.data()).unwrap();
+    EXPECT_EQ(buf, data);
+  }
+
+  EXPECT_EQ(parse_block_backend("pread"), BlockBackend::Pread);
+  EXPECT_FALSE(parse_block_backend("unknown").has_value());
+}
+
+} // namespace chfs
@@ -0,0 +1,164 @@
+#include "block/snapshot_manager.h"
+#include "common/macros.h"
+#include "filesystem/operations.h"
+#include "gtest/gtest.h"
+#include <cstring>
+
+namespace chfs {
+
+static auto fill(usize size, u8 c) -> std::vector<u8> {
+  return std::vector<u8>(size, c);
+}
+
+TEST(SnapshotBlockManagerTest, CopyOnWrite) {
+  auto inner = std::shared_ptr<BlockManager>(new BlockManager(1024, 512));
+  auto bm = SnapshotBlockManager(inner, 64);
+  // a header, 2 log blocks of 32 entries and the store
+  EXPECT_EQ(SnapshotBlockManager::reserved_block_cnt(64, 512), 1 + 2 + 64);
+  ASSERT_EQ(bm.total_blocks(), 1024 - 67);
+
+  std::vector<u8> buf(bm.block_size());
+  bm.write_block(3, fill(512, 1).data()).unwrap();
+  bm.write_block(4, fill(512, 1).data()).unwrap();
+  // nothing is copied without snapshots
+  EXPECT_EQ(bm.free_store_block_cnt(), 64);
+
+  auto id = bm.create_snapshot().unwrap();
+  EXPECT_EQ(bm.free_store_block_cnt(), 64);
+  bm.write_block(3, fill(512, 2).data()).unwrap();
+  bm.write_partial_block(3, fill(4, 3).data(), 0, 4).unwrap();
+  bm.write_blocks({4, 5, 4}, fill(3 * 512, 4).data()).unwrap();
+  // only the first write of a block after the snapshot copies it
+  EXPECT_EQ(bm.free_store_block_cnt(), 64 - 3);
+
+  bm.read_block(3, buf.data()).unwrap();
+  EXPECT_EQ(buf[0], 3);
+  EXPECT_EQ(buf[4], 2);
+  bm.read_snapshot_block(id, 3, buf.data()).unwrap();
+  EXPECT_EQ(buf, fill(512, 1));
+  bm.read_snapshot_block(id, 5, buf.data()).unwrap();
+  EXPECT_EQ(buf, fill(512, 0));
+
+  // the view is read-only
+  auto view = bm.open_snapshot(id).unwrap();
+  ASSERT_EQ(view->total_blocks(), bm.total_blocks());
+  std::vector<u8> bufs(2 * 512);
+  view->read_blocks({4, 6}, bufs.data()).unwrap();
+  EXPECT_EQ(bufs[0], 1);
+  EXPECT_EQ(bufs[512], 0);
+  EXPECT_TRUE(view->write_block(4, buf.data()).is_err());
+  EXPECT_TRUE(view->zero_block(4).is_err());
+  EXPECT_TRUE(view->read_block(bm.total_blocks(), buf.data()).is_err());
+  EXPECT_TRUE(bm.open_snapshot(id + 1).is_err());
+}
+
+TEST(SnapshotBlockManagerTest, MultipleSnapshots) {
+  auto inner = std::shared_ptr<BlockManager>(new BlockManager(1024, 512));
+  auto bm = SnapshotBlockManager(inner, 8);
+  std::vector<u8> buf(bm.block_size());
+
+  bm.write_block(0, fill(512, 1).data()).unwrap();
+  auto first = bm.create_snapshot().unwrap();
+  bm.write_block(1, fill(512, 2).data()).unwrap();
+  auto second = bm.create_snapshot().unwrap();
+  bm.write_block(0, fill(512, 3).data()).unwrap();
+  auto third = bm.create_snapshot().unwrap();
+  bm.discard_blocks({0, 1}).unwrap();
+  ASSERT_EQ(bm.list_snapshots(), std::vector<u32>({first, second, third}));
+
+  auto expect = [&](u32 id, block_id_t block_id, u8 c) {
+    bm.read_snapshot_block(id, block_id, buf.data()).unwrap();
+    EXPECT_EQ(buf, fill(512, c)) << id << " " << block_id;
+  };
+  expect(first, 0, 1);
+  expect(first, 1, 0);
+  expect(second, 0, 1);
+  expect(second, 1, 2);
+  expect(third, 0, 3);
+  expect(third, 1, 2);
+
+  // the first snapshot still needs the copies of the second one
+  auto before = bm.free_store_block_cnt();
+  bm.delete_snapshot(second).unwrap();
+  EXPECT_TRUE(bm.delete_snapshot(second).is_err());
+  expect(first, 0, 1);
+  expect(first, 1, 0);
+  expect(third, 0, 3);
+  EXPECT_EQ(bm.free_store_block_cnt(), before);
+
+  // the third snapshot has its own copies
+  bm.delete_snapshot(first).unwrap();
+  EXPECT_EQ(bm.free_store_block_cnt(), before + 2);
+  expect(third, 1, 2);
+  bm.delete_snapshot(third).unwrap();
+  EXPECT_EQ(bm.free_store_block_cnt(), 8);
+
+  // the store bounds the writes while a snapshot is kept
+  bm.create_snapshot().unwrap();
+  std::vector<block_id_t> block_ids;
+  for (block_id_t i = 0; i < 9; ++i) {
+    block_ids.push_back(i);
+  }
+  std::vector<u8> data(9 * 512);
+  EXPECT_TRUE(bm.write_blocks(block_ids, data.data()).is_err());
+  block_ids.pop_back();
+  bm.write_blocks(block_ids, data.data()).unwrap();
+}
+
+TEST(SnapshotBlockManagerTest, Reopen) {
+  auto inner = std::shared_ptr<BlockManager>(new BlockManager(1024, 512));
+  u32 first, second;
+  {
+    auto bm = SnapshotBlockManager(inner, 128);
+    bm.write_block(7, fill(512, 1).data()).unwrap();
+    first = bm.create_snapshot().unwrap();
+    // more entries than a log block holds
+    for (block_id_t i = 0; i < 40; ++i) {
+      bm.write_block(i, fill(512, 2).data()).unwrap();
+    }
+    second = bm.create_snapshot().unwrap();
+    auto dropped = bm.create_snapshot().unwrap();
+    bm.write_block(7, fill(512, 3).data()).unwrap();
+    bm.delete_snapshot(dropped).unwrap();
+  }
+
+  auto bm = SnapshotBlockManager(inner, 128, false);
+  ASSERT_EQ(bm.list_snapshots(), std::vector<u32>({first, second}));
+  EXPECT_EQ(bm.free_store_block_cnt(), 128 - 41);
+  std::vector<u8> buf(bm.block_size());
+  bm.read_snapshot_block(first, 7, buf.data()).unwrap();
+  EXPECT_EQ(buf, fill(512, 1));
+  bm.read_snapshot_block(first, 39, buf.data()).unwrap();
+  EXPECT_EQ(buf, fill(512, 0));
+  bm.read_snapshot_block(second, 7, buf.data()).unwrap();
+  EXPECT_EQ(buf, fill(512, 2));
+  bm.read_block(7, buf.data()).unwrap();
+  EXPECT_EQ(buf, fill(512, 3));
+
+  // new snapshots keep the ids unique
+  EXPECT_GT(bm.create_snapshot().unwrap(), second + 1);
+}
+
+TEST(SnapshotBlockManagerTest, FileSystem) {
+  auto bm = std::make_shared<SnapshotBlockManager>(
+      std::shared_ptr<BlockManager>(new BlockManager(16 * 1024, 512)), 1024);
+  auto fs = FileOperation(bm, 1024);
+
+  auto id = fs.alloc_inode(InodeType::FILE).unwrap();
+  std::vector<u8> content(512 * 40 + 100);
+  for (usize i = 0; i < content.size(); ++i) {
+    content[i] = i % 251;
+  }
+  fs.write_file(id, content).unwrap();
+  auto snapshot = bm->create_snapshot().unwrap();
+  fs.write_file(id, std::vector<u8>(100, 0xee)).unwrap();
+
+  // the snapshot mounts as the file system it was
+  auto snapshot_fs =
+      FileOperation::create_from_raw(bm->open_snapshot(snapshot).unwrap())
+          .unwrap();
+  ASSERT_EQ(snapshot_fs->read_file(id).unwrap(), content);
+  ASSERT_EQ(fs.read_file(id).unwrap(), std::vector<u8>(100, 0xee));
+}
+
+} // namespace chfs
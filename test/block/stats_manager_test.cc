@@ -0,0 +1,88 @@
+#include "block/stats_manager.h"
+#include "common/macros.h"
+#include "gtest/gtest.h"
+#include <thread>
+
+namespace chfs {
+
+TEST(StatsBlockManagerTest, Counters) {
+  auto bm = StatsBlockManager(
+      std::shared_ptr<BlockManager>(new BlockManager(1024, 512)));
+
+  std::vector<u8> buf(4 * bm.block_size());
+  bm.write_block(1, buf.data()).unwrap();
+  bm.write_blocks({2, 3, 4}, buf.data()).unwrap();
+  bm.read_block(1, buf.data()).unwrap();
+  bm.read_blocks({1, 2, 3, 4}, buf.data()).unwrap();
+  bm.write_partial_block(1, buf.data(), 10, 20).unwrap();
+  bm.zero_block(5).unwrap();
+  bm.discard_blocks({5, 6}).unwrap();
+  bm.sync_all().unwrap();
+  EXPECT_TRUE(bm.read_block(1024, buf.data()).is_err());
+
+  auto stats = bm.get_stats();
+  EXPECT_EQ(stats[BlockOp::Write].calls, 2);
+  EXPECT_EQ(stats[BlockOp::Write].blocks, 4);
+  EXPECT_EQ(stats[BlockOp::Write].bytes, 4 * 512);
+  EXPECT_EQ(stats[BlockOp::Read].calls, 3);
+  EXPECT_EQ(stats[BlockOp::Read].errors, 1);
+  EXPECT_EQ(stats[BlockOp::Read].blocks, 5);
+  EXPECT_EQ(stats[BlockOp::PartialWrite].bytes, 20);
+  EXPECT_EQ(stats[BlockOp::Zero].calls, 1);
+  EXPECT_EQ(stats[BlockOp::Discard].blocks, 2);
+  EXPECT_EQ(stats[BlockOp::Sync].calls, 1);
+
+  // every call lands in a latency bucket
+  u64 samples = 0;
+  for (auto cnt : stats[BlockOp::Read].latency) {
+    samples += cnt;
+  }
+  EXPECT_EQ(samples, 3);
+  EXPECT_GT(stats[BlockOp::Read].percentile_ns(50), 0);
+  EXPECT_LE(stats[BlockOp::Read].percentile_ns(50),
+            stats[BlockOp::Read].percentile_ns(100));
+
+  bm.reset_stats();
+  stats = bm.get_stats();
+  EXPECT_EQ(stats[BlockOp::Write].calls, 0);
+  EXPECT_EQ(stats[BlockOp::Read].percentile_ns(99), 0);
+  bm.read_block(1, buf.data()).unwrap();
+  EXPECT_EQ(bm.get_stats()[BlockOp::Read].calls, 1);
+
+  EXPECT_STREQ(block_op_name(BlockOp::Read), "read");
+  EXPECT_STREQ(block_op_name(BlockOp::PartialWrite), "partial_write");
+  EXPECT_STREQ(block_op_name(static_cast<BlockOp>(KBlockOpCnt - 1)), "sync");
+}
+
+TEST(StatsBlockManagerTest, Threads) {
+  auto bm = StatsBlockManager(
+      std::shared_ptr<BlockManager>(new BlockManager(1024, 512)), false);
+  // another manager, so that the threads switch between their counters
+  auto other = StatsBlockManager(
+      std::shared_ptr<BlockManager>(new BlockManager(16, 512)), false);
+
+  const usize threads_cnt = 4, rounds = 1000;
+  std::vector<std::thread> threads;
+  for (usize t = 0; t < threads_cnt; ++t) {
+    threads.emplace_back([&, t]() {
+      std::vector<u8> buf(bm.block_size());
+      for (usize i = 0; i < rounds; ++i) {
+        bm.read_block(t * 100 + i % 100, buf.data()).unwrap();
+        other.read_block(0, buf.data()).unwrap();
+        // the statistics can be read meanwhile
+        if (i % 100 == 0) {
+          bm.get_stats();
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(bm.get_stats()[BlockOp::Read].calls, threads_cnt * rounds);
+  EXPECT_EQ(other.get_stats()[BlockOp::Read].calls, threads_cnt * rounds);
+  EXPECT_EQ(bm.get_stats()[BlockOp::Read].total_ns, 0);
+}
+
+} // namespace chfs
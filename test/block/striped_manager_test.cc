@@ -0,0 +1,123 @@
+#include "./common.h"
+#include "block/striped_manager.h"
+#include "common/macros.h"
+#include "filesystem/operations.h"
+#include "gtest/gtest.h"
+#include <cstring>
+
+namespace chfs {
+
+TEST(StripedBlockManagerTest, Layout) {
+  auto devices = make_devices(3, 100);
+  // the largest device only contributes as much as the others
+  devices.push_back(
+      std::shared_ptr<BlockManager>(new BlockManager(200, 512)));
+  auto bm = StripedBlockManager(devices, 8);
+  // 100 blocks hold 12 whole units
+  ASSERT_EQ(bm.total_blocks(), 4 * 12 * 8);
+
+  using Loc = std::pair<usize, block_id_t>;
+
+  EXPECT_EQ(bm.locate(0), Loc(0, 0));
+  EXPECT_EQ(bm.locate(7), Loc(0, 7));
+  EXPECT_EQ(bm.locate(8), Loc(1, 0));
+  EXPECT_EQ(bm.locate(33), Loc(0, 9));
+
+  std::vector<u8> data(bm.block_size(), 0x42);
+  std::vector<u8> buf(bm.block_size());
+  bm.write_block(33, data.data()).unwrap();
+  devices[0]->read_block(9, buf.data()).unwrap();
+  EXPECT_EQ(buf, data);
+
+  EXPECT_TRUE(bm.write_block(bm.total_blocks(), data.data()).is_err());
+}
+
+TEST(StripedBlockManagerTest, ReadWrite) {
+  auto devices = make_devices(4, 256);
+  auto bm = StripedBlockManager(devices, 4);
+
+  // a batch across every device, with holes and out of order
+  std::vector<block_id_t> block_ids;
+  for (block_id_t i = 3; i < 70; ++i) {
+    block_ids.push_back(i);
+  }
+  block_ids.push_back(500);
+  block_ids.push_back(1);
+  block_ids.push_back(501);
+
+  std::vector<u8> batch(block_ids.size() * bm.block_size());
+  for (usize i = 0; i < block_ids.size(); ++i) {
+    std::memset(batch.data() + i * bm.block_size(), static_cast<int>(i),
+                bm.block_size());
+  }
+  bm.write_blocks(block_ids, batch.data()).unwrap();
+
+  std::vector<u8> batch_buf(batch.size());
+  bm.read_blocks(block_ids, batch_buf.data()).unwrap();
+  EXPECT_EQ(batch_buf, batch);
+
+  std::vector<u8> buf(bm.block_size());
+  for (usize i = 0; i < block_ids.size(); ++i) {
+    bm.read_block(block_ids[i], buf.data()).unwrap();
+    EXPECT_EQ(buf[0], static_cast<u8>(i));
+  }
+
+  {
+    auto view = bm.write_view(42).unwrap();
+    *view.as<u64>() = 73;
+  }
+  EXPECT_EQ(*bm.read_view(42).unwrap().as<u64>(), 73);
+
+  bm.discard_blocks({42, 43, 44}).unwrap();
+  bm.read_block(43, buf.data()).unwrap();
+  EXPECT_EQ(buf, std::vector<u8>(bm.block_size()));
+  bm.sync_range(2, 100).unwrap();
+  bm.sync_all().unwrap();
+
+  block_ids.push_back(bm.total_blocks());
+  EXPECT_TRUE(bm.read_blocks(block_ids, batch_buf.data()).is_err());
+}
+
+TEST(StripedBlockManagerTest, Reopen) {
+  std::vector<std::string> files = {"striped_test_0.db", "striped_test_1.db"};
+  for (const auto &file : files) {
+    remove(file.c_str());
+  }
+
+  std::vector<u8> data(4 * KDefaultBlockSize);
+  for (usize i = 0; i < data.size(); ++i) {
+    data[i] = i % 251;
+  }
+  {
+    auto bm = StripedBlockManager(files, 1024, 16);
+    ASSERT_EQ(bm.total_blocks(), 2048);
+    bm.write_blocks({14, 15, 16, 17}, data.data()).unwrap();
+    bm.sync_range(14, 4).unwrap();
+  }
+
+  auto bm = StripedBlockManager(files, 1024, 16, BlockBackend::Mmap);
+  std::vector<u8> buf(data.size());
+  bm.read_blocks({14, 15, 16, 17}, buf.data()).unwrap();
+  EXPECT_EQ(buf, data);
+
+  for (const auto &file : files) {
+    remove(file.c_str());
+  }
+}
+
+TEST(StripedBlockManagerTest, FileSystem) {
+  auto bm = std::shared_ptr<BlockManager>(
+      new StripedBlockManager(make_devices(4, 4096), 8));
+  auto fs = FileOperation(bm, 1024);
+
+  auto id = fs.alloc_inode(InodeType::FILE).unwrap();
+  std::vector<u8> content(512 * 40 + 100);
+  for (usize i = 0; i < content.size(); ++i) {
+    content[i] = i % 251;
+  }
+  fs.write_file(id, content).unwrap();
+  ASSERT_EQ(fs.read_file(id).unwrap(), content);
+  fs.sync_file(id).unwrap();
+}
+
+} // namespace chfs
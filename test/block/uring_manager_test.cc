@@ -0,0 +1,117 @@
+#include "block/uring_manager.h"
+#include "common/macros.h"
+#include "gtest/gtest.h"
+#include <cstring>
+
+namespace chfs {
+
+class UringBlockManagerTest : public ::testing::Test {
+protected:
+  // This function is called before every test.
+  void SetUp() override {
+    if (!UringBlockManager::is_supported()) {
+      GTEST_SKIP() << "io_uring is not supported by the kernel";
+    }
+    remove("uring_test.db");
+  }
+
+  // This function is called after every test.
+  void TearDown() override { remove("uring_test.db"); };
+};
+
+// NOLINTNEXTLINE
+TEST_F(UringBlockManagerTest, ReadWrite) {
+  auto bm = UringBlockManager("uring_test.db", 1024);
+  ASSERT_EQ(bm.total_blocks(), 1024);
+
+  std::vector<u8> data(bm.block_size());
+  std::vector<u8> buf(bm.block_size());
+  std::strncpy((char *)data.data(), "A test string.", bm.block_size());
+
+  bm.write_block(3, data.data()).unwrap();
+  bm.read_block(3, buf.data()).unwrap();
+  EXPECT_EQ(buf, data);
+
+  bm.write_partial_block(3, data.data(), 1000, 4).unwrap();
+  bm.read_block(3, buf.data()).unwrap();
+  EXPECT_EQ(std::memcmp(buf.data() + 1000, data.data(), 4), 0);
+
+  bm.zero_block(3).unwrap();
+  bm.read_block(3, buf.data()).unwrap();
+  EXPECT_EQ(buf, std::vector<u8>(bm.block_size()));
+
+  EXPECT_TRUE(bm.read_block(1024, buf.data()).is_err());
+
+  // views fall back to a private buffer
+  {
+    auto view = bm.write_view(5).unwrap();
+    *view.as<u64>() = 73;
+  }
+  EXPECT_EQ(*bm.read_view(5).unwrap().as<u64>(), 73);
+}
+
+TEST_F(UringBlockManagerTest, Batch) {
+  UringOptions options;
+  // a small queue forces the batch to be split
+  options.queue_depth = 4;
+  options.direct_io = true;
+  auto bm = UringBlockManager("uring_test.db", 1024, options);
+
+  std::vector<block_id_t> block_ids;
+  for (block_id_t i = 0; i < 32; ++i) {
+    // runs of 2 contiguous blocks
+    block_ids.push_back((i / 2) * 7 + i % 2);
+  }
+
+  // an unaligned buffer has to be staged for O_DIRECT
+  std::vector<u8> data(block_ids.size() * bm.block_size() + 1);
+  for (usize i = 0; i < block_ids.size(); ++i) {
+    data[1 + i * bm.block_size()] = i + 73;
+  }
+  bm.write_blocks(block_ids, data.data() + 1).unwrap();
+
+  std::vector<u8> res(data.size());
+  bm.read_blocks(block_ids, res.data() + 1).unwrap();
+  EXPECT_EQ(std::memcmp(res.data() + 1, data.data() + 1, data.size() - 1), 0);
+
+  std::vector<u8> buf(bm.block_size());
+  bm.read_block(7, buf.data()).unwrap();
+  EXPECT_EQ(buf[0], 75);
+}
+
+TEST_F(UringBlockManagerTest, LongRun) {
+  UringOptions options;
+  // a run of 32 blocks takes 11 requests of at most 3 blocks
+  options.queue_depth = 4;
+  options.max_request_bytes = 3 * KDefaultBlockSize;
+  auto bm = UringBlockManager("uring_test.db", 1024, options);
+
+  std::vector<block_id_t> block_ids;
+  for (block_id_t i = 0; i < 32; ++i) {
+    block_ids.push_back(100 + i);
+  }
+  std::vector<u8> data(block_ids.size() * bm.block_size());
+  for (usize i = 0; i < data.size(); ++i) {
+    data[i] = static_cast<u8>(i * 7);
+  }
+  bm.write_blocks(block_ids, data.data()).unwrap();
+
+  std::vector<u8> res(data.size());
+  bm.read_blocks(block_ids, res.data()).unwrap();
+  EXPECT_EQ(res, data);
+}
+
+TEST_F(UringBlockManagerTest, Reopen) {
+  {
+    auto bm = UringBlockManager("uring_test.db", 64);
+    std::vector<u8> data(bm.block_size(), 42);
+    bm.write_block(63, data.data()).unwrap();
+  }
+  auto bm = UringBlockManager("uring_test.db", 1024);
+  ASSERT_EQ(bm.total_blocks(), 64);
+  std::vector<u8> buf(bm.block_size());
+  bm.read_block(63, buf.data()).unwrap();
+  EXPECT_EQ(buf, std::vector<u8>(bm.block_size(), 42));
+}
+
+} // namespace chfs
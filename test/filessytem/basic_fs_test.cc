@@ -1,5 +1,6 @@
 #include "./common.h"
 #include "filesystem/operations.h"
+#include "metadata/superblock.h"
 #include "gtest/gtest.h"
 
 namespace chfs {
@@ -29,4 +30,188 @@ TEST(BasicFileSystemTest, Init) {
   std::cout << "Basic FS test done" << std::endl;
 }
 
-} // namespace chfs
\ No newline at end of file
+TEST(BasicFileSystemTest, Grow) {
+  remove("grow_test.db");
+  // 512 blocks of 4KB, the bitmap has a single block
+  auto bm = std::shared_ptr<BlockManager>(new BlockManager("grow_test.db", 512));
+  auto fs = FileOperation(bm, 64);
+  auto free_before = fs.get_free_blocks_num().unwrap();
+
+  auto id = fs.alloc_inode(InodeType::FILE).unwrap();
+  std::vector<u8> content(4096 * 10 + 7, 'x');
+  fs.write_file(id, content).unwrap();
+
+  // 40000 blocks need 2 bitmap blocks, the extra one is taken from the
+  // grown region. 12: the inode and the 11 blocks of the file
+  fs.grow(40000).unwrap();
+  EXPECT_EQ(bm->total_blocks(), 40000);
+  EXPECT_EQ(fs.get_free_blocks_num().unwrap(),
+            free_before - 12 + (40000 - 512) - 1);
+  fs.sync_file(id).unwrap();
+
+  // the grown filesystem is reopened at its new size
+  bm.reset();
+  auto bm1 = std::shared_ptr<BlockManager>(new BlockManager("grow_test.db", 512));
+  EXPECT_EQ(bm1->total_blocks(), 40000);
+  auto fs1 = FileOperation::create_from_raw(bm1).unwrap();
+  EXPECT_EQ(fs1->read_file(id).unwrap(), content);
+  EXPECT_EQ(fs1->get_free_blocks_num().unwrap(),
+            free_before - 12 + (40000 - 512) - 1);
+
+  // the new blocks are usable
+  std::vector<u8> large(4096 * 1000, 'y');
+  auto id1 = fs1->alloc_inode(InodeType::FILE).unwrap();
+  fs1->write_file(id1, large).unwrap();
+  EXPECT_EQ(fs1->read_file(id1).unwrap(), large);
+  remove("grow_test.db");
+}
+
+TEST(BasicFileSystemTest, GrowExtentLimit) {
+  // a bitmap block of 512 bytes covers 4096 blocks
+  const usize bits = kBlockSize * 8;
+  auto bm = std::shared_ptr<BlockManager>(new BlockManager(bits, kBlockSize));
+  auto fs = FileOperation(bm, 64);
+
+  // each grow adds a bitmap block, until the super block cannot record more
+  for (usize i = 0; i < KMaxBitmapExtents; ++i) {
+    fs.grow(bits * (i + 2)).unwrap();
+  }
+  const usize full_cnt = bits * (KMaxBitmapExtents + 1);
+  auto free_before = fs.get_free_blocks_num().unwrap();
+
+  auto res = fs.grow(full_cnt + 1);
+  ASSERT_TRUE(res.is_err());
+  EXPECT_EQ(res.unwrap_error(), ErrorType::OUT_OF_RESOURCE);
+  // neither the device nor the allocator has changed
+  EXPECT_EQ(bm->total_blocks(), full_cnt);
+  EXPECT_EQ(fs.get_free_blocks_num().unwrap(), free_before);
+
+  auto superblock = SuperBlock::create_from_existing(bm, 0).unwrap();
+  EXPECT_EQ(superblock->get_nblocks(), full_cnt);
+  EXPECT_EQ(superblock->get_file_system_size(),
+            static_cast<u64>(full_cnt) * kBlockSize);
+}
+
+TEST(BasicFileSystemTest, BlockSize) {
+  for (usize block_size : {16 * 1024, 64 * 1024}) {
+    remove("block_size_test.db");
+    std::vector<u8> content(block_size * 3 + 100, 'x');
+    inode_id_t id;
+    {
+      auto bm = std::shared_ptr<BlockManager>(
+          new BlockManager("block_size_test.db", 256, block_size));
+      auto fs = FileOperation(bm, 64);
+      id = fs.alloc_inode(InodeType::FILE).unwrap();
+      fs.write_file(id, content).unwrap();
+      bm->sync_all().unwrap();
+    }
+
+    // the volume is reopened with the block size of its super block
+    EXPECT_EQ(SuperBlock::probe_block_size("block_size_test.db").unwrap(),
+              block_size);
+    for (auto backend : {BlockBackend::Mmap, BlockBackend::Pread}) {
+      auto fs = FileOperation::open("block_size_test.db", backend).unwrap();
+      EXPECT_EQ(fs->read_file(id).unwrap(), content);
+    }
+
+    // a block manager with another block size is rejected
+    auto bm = std::shared_ptr<BlockManager>(
+        new BlockManager("block_size_test.db", 256));
+    EXPECT_TRUE(FileOperation::create_from_raw(bm).is_err());
+  }
+  remove("block_size_test.db");
+
+  EXPECT_FALSE(BlockManager::is_valid_block_size(128 * 1024));
+  EXPECT_FALSE(BlockManager::is_valid_block_size(3000));
+  EXPECT_TRUE(SuperBlock::probe_block_size("no_such_file.db").is_err());
+}
+
+// Records the blocks of the batch writes
+class RecordingBlockManager : public BlockManager {
+public:
+  using BlockManager::BlockManager;
+  std::vector<std::vector<block_id_t>> batches;
+
+  auto write_blocks(const std::vector<block_id_t> &block_ids,
+                    const u8 *block_data) -> ChfsNullResult override {
+    this->batches.push_back(block_ids);
+    return BlockManager::write_blocks(block_ids, block_data);
+  }
+
+  // the data blocks of a write, the bitmap is written as a batch as well
+  auto last_batch_of(usize cnt) -> std::vector<block_id_t> {
+    for (auto it = batches.rbegin(); it != batches.rend(); ++it) {
+      if (it->size() == cnt) {
+        return *it;
+      }
+    }
+    return {};
+  }
+};
+
+TEST(BasicFileSystemTest, SequentialBlocks) {
+  auto bm = std::make_shared<RecordingBlockManager>(1024, 4096);
+  auto fs = FileOperation(bm, 64);
+
+  auto id = fs.alloc_inode(InodeType::FILE).unwrap();
+  fs.write_file(id, std::vector<u8>(4096 * 8, 'x')).unwrap();
+  auto id1 = fs.alloc_inode(InodeType::FILE).unwrap();
+  fs.write_file(id1, std::vector<u8>(4096 * 8, 'y')).unwrap();
+
+  // the first file leaves a hole before the second one, which still grows
+  // right after its last block
+  fs.remove_file(id).unwrap();
+  std::vector<u8> content(4096 * 20, 'z');
+  fs.write_file(id1, content).unwrap();
+  auto batch = bm->last_batch_of(20);
+  ASSERT_EQ(batch.size(), 20);
+  for (usize i = 1; i < batch.size(); ++i) {
+    EXPECT_EQ(batch[i], batch[i - 1] + 1);
+  }
+  EXPECT_EQ(fs.read_file(id1).unwrap(), content);
+
+  // a new file takes the hole
+  auto id2 = fs.alloc_inode(InodeType::FILE).unwrap();
+  fs.write_file(id2, std::vector<u8>(4096 * 4, 'w')).unwrap();
+  EXPECT_LT(bm->last_batch_of(4).back(), batch.front());
+}
+
+/**
+ * A device whose single-block reads fail after a number of them
+ */
+class FailingReadBlockManager : public BlockManager {
+public:
+  using BlockManager::BlockManager;
+  // the reads left before they fail, negative never fails
+  int reads_left = -1;
+
+  auto read_block(block_id_t block_id, u8 *block_data)
+      -> ChfsNullResult override {
+    if (this->reads_left == 0) {
+      return ChfsNullResult(ErrorType::IOError);
+    }
+    if (this->reads_left > 0) {
+      this->reads_left -= 1;
+    }
+    return BlockManager::read_block(block_id, block_data);
+  }
+};
+
+TEST(BasicFileSystemTest, IndirectReadFailure) {
+  auto bm = std::make_shared<FailingReadBlockManager>(4096, kBlockSize);
+  auto fs = FileOperation(bm, 64);
+
+  // the file has an indirect block
+  auto id = fs.alloc_inode(InodeType::FILE).unwrap();
+  std::vector<u8> content(kBlockSize * 100, 'x');
+  fs.write_file(id, content).unwrap();
+
+  // the inode is read, then the indirect block fails
+  bm->reads_left = 1;
+  EXPECT_TRUE(fs.write_file(id, std::vector<u8>(kBlockSize * 110, 'y'))
+                  .is_err());
+  bm->reads_left = -1;
+  EXPECT_EQ(fs.read_file(id).unwrap(), content);
+}
+
+} // namespace chfs